@@ -0,0 +1,90 @@
+#include "util-math.h"
+#include <algorithm>
+
+namespace util
+{
+	// Box transform implementations
+
+	void boxTransformBatch(
+			box3_arg a,
+			const float4x4 * pMatrices,
+			int count,
+			float * const pMinsOut[3],
+			float * const pMaxsOut[3])
+	{
+		ASSERT_ERR(count >= 0);
+		ASSERT_ERR(pMatrices || count == 0);
+		ASSERT_ERR(pMinsOut && pMaxsOut);
+
+		if (a.isempty())
+		{
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				std::fill(pMinsOut[axis], pMinsOut[axis] + count, a.m_mins[axis]);
+				std::fill(pMaxsOut[axis], pMaxsOut[axis] + count, a.m_maxs[axis]);
+			}
+			return;
+		}
+
+		// The same box goes through every matrix, so its center and half-diagonal are splatted once
+		__m128 center[3], half[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			center[axis] = _mm_set1_ps(0.5f * (a.m_mins[axis] + a.m_maxs[axis]));
+			half[axis] = _mm_set1_ps(0.5f * (a.m_maxs[axis] - a.m_mins[axis]));
+		}
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+		float4x4 matricesTail[4];
+		for (int i = 0; i < count; i += 4)
+		{
+			// The last few matrices are padded out to four by repeating the last one, so they take the same path
+			const float4x4 * pM = pMatrices + i;
+			int n = std::min(count - i, 4);
+			if (n < 4)
+			{
+				for (int j = 0; j < 4; ++j)
+					matricesTail[j] = pM[std::min(j, n - 1)];
+				pM = matricesTail;
+			}
+
+			// rows[row][axis] holds that element of each of the four matrices
+			__m128 rows[4][4];
+			for (int row = 0; row < 4; ++row)
+			{
+				rows[row][0] = _mm_loadu_ps(&pM[0][row].x);
+				rows[row][1] = _mm_loadu_ps(&pM[1][row].x);
+				rows[row][2] = _mm_loadu_ps(&pM[2][row].x);
+				rows[row][3] = _mm_loadu_ps(&pM[3][row].x);
+				_MM_TRANSPOSE4_PS(rows[row][0], rows[row][1], rows[row][2], rows[row][3]);
+			}
+
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				__m128 c = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(center[0], rows[0][axis]), _mm_mul_ps(center[1], rows[1][axis])),
+					_mm_add_ps(_mm_mul_ps(center[2], rows[2][axis]), rows[3][axis]));
+				__m128 e = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(half[0], _mm_and_ps(rows[0][axis], absMask)), _mm_mul_ps(half[1], _mm_and_ps(rows[1][axis], absMask))),
+					_mm_mul_ps(half[2], _mm_and_ps(rows[2][axis], absMask)));
+
+				if (n == 4)
+				{
+					_mm_storeu_ps(pMinsOut[axis] + i, _mm_sub_ps(c, e));
+					_mm_storeu_ps(pMaxsOut[axis] + i, _mm_add_ps(c, e));
+				}
+				else
+				{
+					float mins[4], maxs[4];
+					_mm_storeu_ps(mins, _mm_sub_ps(c, e));
+					_mm_storeu_ps(maxs, _mm_add_ps(c, e));
+					for (int j = 0; j < n; ++j)
+					{
+						pMinsOut[axis][i + j] = mins[j];
+						pMaxsOut[axis][i + j] = maxs[j];
+					}
+				}
+			}
+		}
+	}
+}
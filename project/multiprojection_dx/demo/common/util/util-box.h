@@ -221,6 +221,19 @@ namespace util
 		return result;
 	}
 
+	// Transforms one box by many affine matrices (row-vector style, translation in row 3 and the last
+	// column ignored), four matrices at a time with SSE2.  Uses Arvo's method: the center goes through
+	// the matrix and the half-diagonal through its absolute value, which bounds the same eight corners
+	// as boxTransform, up to rounding.  The results are written as separate arrays per axis, so
+	// pMinsOut[axis][i] and pMaxsOut[axis][i] bound the box transformed by pMatrices[i].
+	// An empty box is copied to every output unchanged.
+	void boxTransformBatch(
+			box3_arg a,
+			const float4x4 * pMatrices,
+			int count,
+			float * const pMinsOut[3],
+			float * const pMaxsOut[3]);
+
 	template <typename T, int n>
 	T distance(box<T, n> const & a, point<T, n> const & b)
 	{
@@ -0,0 +1,214 @@
+//----------------------------------------------------------------------------------
+// File:        InstanceTransform.cpp
+// SDK Version: 2.0
+// Email:       vrsupport@nvidia.com
+// Site:        http://developer.nvidia.com/
+//
+// Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//----------------------------------------------------------------------------------
+
+#include "InstanceTransform.h"
+#include <assert.h>
+
+// Rounds to the nearest half, ties to even, like the hardware conversions; overflow goes to infinity
+static uint FloatToHalf(float value)
+{
+	uint bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const uint sign = (bits >> 16) & 0x8000;
+	const uint magnitude = bits & 0x7fffffff;
+
+	// Infinity or NaN, which stays a NaN
+	if (magnitude >= 0x7f800000)
+		return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+
+	// At or above halfway between the largest half (65504) and the next power of two
+	if (magnitude >= 0x477ff000)
+		return sign | 0x7c00;
+
+	// Denormal halves, in units of 2^-24; below 2^-25 rounds to zero
+	if (magnitude < 0x38800000)
+	{
+		if (magnitude <= 0x33000000)
+			return sign;
+
+		const uint mantissa = (magnitude & 0x7fffff) | 0x800000;
+		const uint shift = 126 - (magnitude >> 23);
+		const uint remainder = mantissa & ((1u << shift) - 1);
+		const uint halfway = 1u << (shift - 1);
+		uint result = mantissa >> shift;
+		if (remainder > halfway || (remainder == halfway && (result & 1)))
+			result++;
+		return sign | result;
+	}
+
+	// Normal halves: rebias the exponent and round off 13 bits of mantissa; a carry into the exponent is still right
+	const uint remainder = magnitude & 0x1fff;
+	uint result = (magnitude - 0x38000000) >> 13;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1)))
+		result++;
+	return sign | result;
+}
+
+static float HalfToFloat(uint half)
+{
+	const uint sign = (half & 0x8000) << 16;
+	const uint exponent = (half >> 10) & 0x1f;
+	const uint mantissa = half & 0x3ff;
+
+	if (exponent == 0)
+	{
+		// Zero or denormal, which is exact in float
+		float value = float(mantissa) * (1.0f / 16777216.0f);
+		return sign ? -value : value;
+	}
+
+	uint bits;
+	if (exponent == 0x1f)
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	else
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+uint GetInstanceStride(InstanceFormat format)
+{
+	switch (format)
+	{
+	case InstanceFormat::FLOAT3X4:	return sizeof(InstanceFloat3x4);
+	case InstanceFormat::QUANTIZED:	return sizeof(InstanceQuantized);
+	default:						return sizeof(float4x4);
+	}
+}
+
+void PackInstances(InstanceFormat format, const float4x4* matrices, uint count, void* output)
+{
+	assert(matrices || count == 0);
+
+	switch (format)
+	{
+	case InstanceFormat::FLOAT3X4:
+		for (uint i = 0; i < count; i++)
+		{
+			const float4x4& m = matrices[i];
+			InstanceFloat3x4& packed = ((InstanceFloat3x4*)output)[i];
+
+			for (uint axis = 0; axis < 3; axis++)
+				packed.columns[axis] = makefloat4(m[0][axis], m[1][axis], m[2][axis], m[3][axis]);
+		}
+		break;
+
+	case InstanceFormat::QUANTIZED:
+		for (uint i = 0; i < count; i++)
+		{
+			const float4x4& m = matrices[i];
+			InstanceQuantized& packed = ((InstanceQuantized*)output)[i];
+
+			uint halves[10];
+			for (uint row = 0; row < 3; row++)
+			{
+				for (uint axis = 0; axis < 3; axis++)
+					halves[row * 3 + axis] = FloatToHalf(m[row][axis]);
+			}
+			halves[9] = 0;
+
+			for (uint j = 0; j < 5; j++)
+				packed.basis[j] = halves[j * 2] | (halves[j * 2 + 1] << 16);
+
+			packed.translation = makefloat3(m[3].x, m[3].y, m[3].z);
+		}
+		break;
+
+	default:
+		memcpy(output, matrices, count * sizeof(float4x4));
+		break;
+	}
+}
+
+float4x4 UnpackInstance(InstanceFormat format, const void* packed)
+{
+	float4x4 m = float4x4::identity();
+
+	switch (format)
+	{
+	case InstanceFormat::FLOAT3X4:
+	{
+		const InstanceFloat3x4& instance = *(const InstanceFloat3x4*)packed;
+		for (uint row = 0; row < 4; row++)
+		{
+			for (uint axis = 0; axis < 3; axis++)
+				m[row][axis] = instance.columns[axis][row];
+		}
+		break;
+	}
+
+	case InstanceFormat::QUANTIZED:
+	{
+		const InstanceQuantized& instance = *(const InstanceQuantized*)packed;
+		for (uint j = 0; j < 9; j++)
+			m[j / 3][j % 3] = HalfToFloat(instance.basis[j / 2] >> ((j & 1) * 16));
+		m[3] = makefloat4(instance.translation, 1.0f);
+		break;
+	}
+
+	default:
+		m = *(const float4x4*)packed;
+		break;
+	}
+
+	return m;
+}
+
+float GetQuantizationError(const float4x4& matrix, const box3& objectBounds)
+{
+	if (objectBounds.isempty())
+		return 0.f;
+
+	InstanceQuantized packed;
+	PackInstances(InstanceFormat::QUANTIZED, &matrix, 1, &packed);
+	float4x4 rounded = UnpackInstance(InstanceFormat::QUANTIZED, &packed);
+
+	// The error in each world coordinate is the dot product of the object space point with the rounding
+	// of that column, which is largest at the corner where each term is largest
+	float3 extent = max(abs(makefloat3(objectBounds.m_mins)), abs(makefloat3(objectBounds.m_maxs)));
+
+	float error = 0.f;
+	for (uint axis = 0; axis < 3; axis++)
+	{
+		float axisError = 0.f;
+		for (uint row = 0; row < 3; row++)
+			axisError += extent[row] * fabsf(matrix[row][axis] - rounded[row][axis]);
+		error = __max(error, axisError);
+	}
+
+	return error;
+}
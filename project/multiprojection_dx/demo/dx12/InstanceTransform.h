@@ -0,0 +1,77 @@
+//----------------------------------------------------------------------------------
+// File:        InstanceTransform.h
+// SDK Version: 2.0
+// Email:       vrsupport@nvidia.com
+// Site:        http://developer.nvidia.com/
+//
+// Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//----------------------------------------------------------------------------------
+
+#pragma once
+
+#include <Windows.h>
+#include <util.h>
+
+using namespace util;
+
+// Instance transforms, in the layouts that world_vs.hlsl reads from the instance buffers. The instance matrices
+// are affine and row-vector style, so their last column is always (0,0,0,1), and only the first three columns
+// need to be uploaded.
+enum struct InstanceFormat
+{
+	FLOAT4X4 = 0,			// The whole matrix, 64 bytes
+	FLOAT3X4,				// The first three columns, 48 bytes; exact
+	QUANTIZED,				// The 3x3 part in half precision and the translation in full, 32 bytes
+	COUNT
+};
+
+struct InstanceFloat3x4
+{
+	float4 columns[3];		// So that dot(columns[axis], float4(position, 1)) is the world space coordinate
+};
+
+struct InstanceQuantized
+{
+	float3 translation;
+	uint basis[5];			// The rows of the 3x3 part, two halves per uint with the low one first; the last high half is 0
+};
+
+cassert(sizeof(InstanceFloat3x4) == 48);
+cassert(sizeof(InstanceQuantized) == 32);
+
+uint GetInstanceStride(InstanceFormat format);
+
+// Writes count matrices to output in the format, GetInstanceStride(format) bytes each
+void PackInstances(InstanceFormat format, const float4x4* matrices, uint count, void* output);
+
+// The matrix that the vertex shader will use for a packed instance; for QUANTIZED, the basis is rounded to half precision
+float4x4 UnpackInstance(InstanceFormat format, const void* packed);
+
+// Bounds the distance, along any axis, between where QUANTIZED and the exact matrix put a point of the box.
+// The translation isn't rounded, so this only depends on the size of the box, not on where the instance is.
+float GetQuantizationError(const float4x4& matrix, const box3& objectBounds);
@@ -0,0 +1,524 @@
+//----------------------------------------------------------------------------------
+// File:        OcclusionBuffer.cpp
+// SDK Version: 2.0
+// Email:       vrsupport@nvidia.com
+// Site:        http://developer.nvidia.com/
+//
+// Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//----------------------------------------------------------------------------------
+
+
+#include "OcclusionBuffer.h"
+#include <ppl.h>
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+
+// Triangles are clipped to the near plane, and to a guard band this many times the size of the screen so that
+// the edge functions stay precise; the rasterizer takes care of the rest of the screen edges
+static const float GUARD_BAND = 4.0f;
+
+enum ClipPlanes
+{
+	CLIP_NEAR = 0,
+	CLIP_LEFT,
+	CLIP_RIGHT,
+	CLIP_BOTTOM,
+	CLIP_TOP,
+	CLIP_PLANES_COUNT
+};
+
+// A triangle clipped by every plane has at most this many vertices
+static const uint MAX_CLIPPED_VERTICES = 3 + CLIP_PLANES_COUNT;
+
+static float ClipDistance(const float4& p, uint plane, float zNear)
+{
+	switch (plane)
+	{
+	case CLIP_NEAR:		return p.w - zNear;
+	case CLIP_LEFT:		return GUARD_BAND * p.w + p.x;
+	case CLIP_RIGHT:	return GUARD_BAND * p.w - p.x;
+	case CLIP_BOTTOM:	return GUARD_BAND * p.w + p.y;
+	default:			return GUARD_BAND * p.w - p.y;
+	}
+}
+
+static uint ClipCodes(const float4& p, float zNear)
+{
+	const float guardBand = GUARD_BAND * p.w;
+
+	return (p.w < zNear ? 1 << CLIP_NEAR : 0) |
+		(p.x < -guardBand ? 1 << CLIP_LEFT : 0) |
+		(p.x > guardBand ? 1 << CLIP_RIGHT : 0) |
+		(p.y < -guardBand ? 1 << CLIP_BOTTOM : 0) |
+		(p.y > guardBand ? 1 << CLIP_TOP : 0);
+}
+
+// Sutherland-Hodgman, against the planes in planeMask
+static uint ClipPolygon(float4* polygon, uint verticesNum, uint planeMask, float zNear)
+{
+	float4 clipped[MAX_CLIPPED_VERTICES];
+
+	for (uint plane = 0; plane < CLIP_PLANES_COUNT && verticesNum >= 3; plane++)
+	{
+		if (!(planeMask & (1 << plane)))
+			continue;
+
+		uint clippedNum = 0;
+		for (uint v = 0; v < verticesNum; v++)
+		{
+			const float4& a = polygon[v];
+			const float4& b = polygon[v + 1 < verticesNum ? v + 1 : 0];
+			float distanceA = ClipDistance(a, plane, zNear);
+			float distanceB = ClipDistance(b, plane, zNear);
+
+			if (distanceA >= 0)
+				clipped[clippedNum++] = a;
+
+			if ((distanceA >= 0) != (distanceB >= 0))
+				clipped[clippedNum++] = a + (b - a) * (distanceA / (distanceA - distanceB));
+		}
+
+		memcpy(polygon, clipped, clippedNum * sizeof(float4));
+		verticesNum = clippedNum;
+	}
+
+	return verticesNum;
+}
+
+// Pixels, with y going down, and 1/w for depth
+static float3 ProjectToScreen(const float4& p, float halfWidth, float halfHeight)
+{
+	float invW = 1.0f / p.w;
+	return makefloat3((p.x * invW + 1.0f) * halfWidth, (1.0f - p.y * invW) * halfHeight, invW);
+}
+
+struct ProjectedVertex
+{
+	float4 clip;
+	float3 screen;					// Only if it's inside all the clip planes
+	uint codes;
+};
+
+OcclusionBuffer::OcclusionBuffer()
+	: m_Width(0)
+	, m_Height(0)
+	, m_TilesX(0)
+	, m_TilesY(0)
+	, m_WorldToClip(float4x4::identity())
+	, m_ZNear(0)
+	, m_Rendered(false)
+{
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	Init();
+}
+
+void OcclusionBuffer::Init(uint width, uint height)
+{
+	m_TilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	m_TilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	m_Width = m_TilesX * TILE_SIZE;
+	m_Height = m_TilesY * TILE_SIZE;
+
+	m_Depth.assign(m_Width * m_Height, 0.f);
+	m_TileMin.assign(m_TilesX * m_TilesY, 0.f);
+	m_TileMax.assign(m_TilesX * m_TilesY, 0.f);
+	m_RowTriangles.assign(m_TilesY, std::vector<uint>());
+	m_Rendered = false;
+}
+
+void OcclusionBuffer::Begin(const float4x4& worldToClip, float zNear)
+{
+	m_WorldToClip = worldToClip;
+	m_ZNear = zNear;
+	m_Occluders.clear();
+	m_Rendered = false;
+}
+
+void OcclusionBuffer::AddOccluder(const float3* positions, uint verticesNum, const uint* indices, uint trianglesNum, const float4x4& objectToWorld)
+{
+	Occluder occluder;
+	occluder.positions = positions;
+	occluder.verticesNum = verticesNum;
+	occluder.indices = indices;
+	occluder.trianglesNum = trianglesNum;
+	occluder.objectToClip = objectToWorld * m_WorldToClip;
+	occluder.firstTriangle = 0;
+	occluder.setupTrianglesNum = 0;
+	occluder.depthMax = 0;
+
+	m_Occluders.push_back(occluder);
+}
+
+void OcclusionBuffer::Render()
+{
+	LARGE_INTEGER timeBegin, timeEnd, timeFreq;
+	QueryPerformanceCounter(&timeBegin);
+
+	// Clipping can turn a triangle into several, but it's rare for a mesh to need twice as many; past that, the rest
+	// of its triangles are dropped, which only loses some occlusion
+	uint trianglesCapacity = 0;
+	for (auto& occluder : m_Occluders)
+	{
+		occluder.firstTriangle = trianglesCapacity;
+		trianglesCapacity += occluder.trianglesNum * 2;
+	}
+
+	if (m_Triangles.size() < trianglesCapacity)
+		m_Triangles.resize(trianglesCapacity);
+
+	concurrency::parallel_for(size_t(0), m_Occluders.size(), [this](size_t occluder)
+	{
+		SetupOccluder(m_Occluders[occluder]);
+	});
+
+	// Front to back, so that the farther occluders mostly fall behind tiles that are already covered
+	m_OccluderOrder.clear();
+	for (uint occluder = 0; occluder < m_Occluders.size(); occluder++)
+	{
+		if (m_Occluders[occluder].setupTrianglesNum)
+			m_OccluderOrder.push_back(occluder);
+	}
+
+	std::sort(m_OccluderOrder.begin(), m_OccluderOrder.end(), [this](uint a, uint b) { return m_Occluders[a].depthMax > m_Occluders[b].depthMax; });
+
+	// Bin the triangles by tile row, so that each row only goes through the ones that overlap it
+	for (auto& row : m_RowTriangles)
+		row.clear();
+
+	for (uint occluderIndex : m_OccluderOrder)
+	{
+		const Occluder& occluder = m_Occluders[occluderIndex];
+
+		for (uint triangle = occluder.firstTriangle; triangle < occluder.firstTriangle + occluder.setupTrianglesNum; triangle++)
+		{
+			for (int tileY = m_Triangles[triangle].minY / TILE_SIZE; tileY <= m_Triangles[triangle].maxY / TILE_SIZE; tileY++)
+				m_RowTriangles[tileY].push_back(triangle);
+		}
+	}
+
+	// Each tile row is rasterized separately, so the threads never write to the same pixels
+	concurrency::parallel_for(0u, m_TilesY, [this](uint tileY)
+	{
+		RasterizeTileRow(tileY);
+	});
+
+	m_Rendered = true;
+
+	QueryPerformanceCounter(&timeEnd);
+	QueryPerformanceFrequency(&timeFreq);
+
+	m_Stats.OccludersRendered = uint(m_Occluders.size());
+	m_Stats.TrianglesRendered = 0;
+	for (const auto& occluder : m_Occluders)
+		m_Stats.TrianglesRendered += occluder.setupTrianglesNum;
+	m_Stats.RenderTimeMs = float(double(timeEnd.QuadPart - timeBegin.QuadPart) * 1000.0 / double(timeFreq.QuadPart));
+}
+
+void OcclusionBuffer::SetupOccluder(Occluder& occluder)
+{
+	const float halfWidth = 0.5f * float(m_Width);
+	const float halfHeight = 0.5f * float(m_Height);
+
+	// Every vertex is transformed, classified and projected once, however many triangles share it
+	std::vector<ProjectedVertex> vertices(occluder.verticesNum);
+	for (uint v = 0; v < occluder.verticesNum; v++)
+	{
+		ProjectedVertex& vertex = vertices[v];
+		vertex.clip = makefloat4(occluder.positions[v], 1.0f) * occluder.objectToClip;
+		vertex.codes = ClipCodes(vertex.clip, m_ZNear);
+		if (!vertex.codes)
+			vertex.screen = ProjectToScreen(vertex.clip, halfWidth, halfHeight);
+	}
+
+	SetupTriangle* triangles = m_Triangles.data() + occluder.firstTriangle;
+	const uint trianglesCapacity = occluder.trianglesNum * 2;
+	uint trianglesNum = 0;
+	float depthMax = 0;
+
+	for (uint t = 0; t < occluder.trianglesNum; t++)
+	{
+		const ProjectedVertex* corners[3];
+		uint codesAny = 0;
+		uint codesAll = ~0u;
+
+		for (uint k = 0; k < 3; k++)
+		{
+			corners[k] = &vertices[occluder.indices[t * 3 + k]];
+			codesAny |= corners[k]->codes;
+			codesAll &= corners[k]->codes;
+		}
+
+		if (codesAll)
+			continue;
+
+		float3 screen[MAX_CLIPPED_VERTICES];
+		uint verticesNum = 3;
+
+		if (codesAny)
+		{
+			float4 polygon[MAX_CLIPPED_VERTICES] = { corners[0]->clip, corners[1]->clip, corners[2]->clip };
+			verticesNum = ClipPolygon(polygon, 3, codesAny, m_ZNear);
+
+			for (uint v = 0; v < verticesNum; v++)
+				screen[v] = ProjectToScreen(polygon[v], halfWidth, halfHeight);
+		}
+		else
+		{
+			for (uint k = 0; k < 3; k++)
+				screen[k] = corners[k]->screen;
+		}
+
+		for (uint v = 2; v < verticesNum && trianglesNum < trianglesCapacity; v++)
+		{
+			const float3 p[3] = { screen[0], screen[v - 1], screen[v] };
+			SetupTriangle& triangle = triangles[trianglesNum];
+
+			// Pixels whose centers can be inside; most small and distant triangles don't cover any
+			float minX = __min(p[0].x, __min(p[1].x, p[2].x));
+			float maxX = __max(p[0].x, __max(p[1].x, p[2].x));
+			float minY = __min(p[0].y, __min(p[1].y, p[2].y));
+			float maxY = __max(p[0].y, __max(p[1].y, p[2].y));
+
+			triangle.minX = __max(int(ceilf(minX - 0.5f)), 0);
+			triangle.maxX = __min(int(floorf(maxX - 0.5f)), int(m_Width) - 1);
+			triangle.minY = __max(int(ceilf(minY - 0.5f)), 0);
+			triangle.maxY = __min(int(floorf(maxY - 0.5f)), int(m_Height) - 1);
+
+			if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+				continue;
+
+			// Edge k runs from p[k] to p[k + 1], and is zero on both, and twice the triangle's area at the third vertex
+			float area = 0;
+			for (uint k = 0; k < 3; k++)
+			{
+				const float3& a = p[k];
+				const float3& b = p[k < 2 ? k + 1 : 0];
+				triangle.edgeA[k] = a.y - b.y;
+				triangle.edgeB[k] = b.x - a.x;
+				triangle.edgeC[k] = a.x * b.y - a.y * b.x;
+				area += triangle.edgeC[k];
+			}
+
+			if (area == 0)
+				continue;
+
+			// Either winding is an occluder; make the inside positive
+			if (area < 0)
+			{
+				for (uint k = 0; k < 3; k++)
+				{
+					triangle.edgeA[k] = -triangle.edgeA[k];
+					triangle.edgeB[k] = -triangle.edgeB[k];
+					triangle.edgeC[k] = -triangle.edgeC[k];
+				}
+				area = -area;
+			}
+
+			// 1/w is linear in screen space: each vertex's value weighted by the edge opposite it
+			const float invArea = 1.0f / area;
+			triangle.depthA = (triangle.edgeA[1] * p[0].z + triangle.edgeA[2] * p[1].z + triangle.edgeA[0] * p[2].z) * invArea;
+			triangle.depthB = (triangle.edgeB[1] * p[0].z + triangle.edgeB[2] * p[1].z + triangle.edgeB[0] * p[2].z) * invArea;
+			triangle.depthC = (triangle.edgeC[1] * p[0].z + triangle.edgeC[2] * p[1].z + triangle.edgeC[0] * p[2].z) * invArea;
+			triangle.depthMin = __min(p[0].z, __min(p[1].z, p[2].z));
+			triangle.depthMax = __max(p[0].z, __max(p[1].z, p[2].z));
+
+			// Evaluate everything at pixel centers, and write the farthest depth the triangle has anywhere in the pixel
+			for (uint k = 0; k < 3; k++)
+				triangle.edgeC[k] += 0.5f * (triangle.edgeA[k] + triangle.edgeB[k]);
+			triangle.depthC += 0.5f * (triangle.depthA + triangle.depthB) - 0.5f * (fabsf(triangle.depthA) + fabsf(triangle.depthB));
+
+			depthMax = __max(depthMax, triangle.depthMax);
+			trianglesNum++;
+		}
+	}
+
+	occluder.setupTrianglesNum = trianglesNum;
+	occluder.depthMax = depthMax;
+}
+
+// Farthest depth of a tile's pixels
+static float TileDepthMin(const float* pixels, uint pixelsNum)
+{
+	__m128 depthMin = _mm_loadu_ps(pixels);
+	for (uint i = 4; i < pixelsNum; i += 4)
+		depthMin = _mm_min_ps(depthMin, _mm_loadu_ps(pixels + i));
+
+	depthMin = _mm_min_ps(depthMin, _mm_shuffle_ps(depthMin, depthMin, _MM_SHUFFLE(1, 0, 3, 2)));
+	depthMin = _mm_min_ps(depthMin, _mm_shuffle_ps(depthMin, depthMin, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(depthMin);
+}
+
+static float TileDepthMax(const float* pixels, uint pixelsNum)
+{
+	__m128 depthMax = _mm_loadu_ps(pixels);
+	for (uint i = 4; i < pixelsNum; i += 4)
+		depthMax = _mm_max_ps(depthMax, _mm_loadu_ps(pixels + i));
+
+	depthMax = _mm_max_ps(depthMax, _mm_shuffle_ps(depthMax, depthMax, _MM_SHUFFLE(1, 0, 3, 2)));
+	depthMax = _mm_max_ps(depthMax, _mm_shuffle_ps(depthMax, depthMax, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(depthMax);
+}
+
+void OcclusionBuffer::RasterizeTileRow(uint tileY)
+{
+	const uint tilePixelsNum = TILE_SIZE * TILE_SIZE;
+	const int rowMinY = int(tileY * TILE_SIZE);
+	const int rowMaxY = rowMinY + TILE_SIZE - 1;
+	float* rowDepth = m_Depth.data() + tileY * m_TilesX * tilePixelsNum;
+	float* rowTileMin = m_TileMin.data() + tileY * m_TilesX;
+
+	// Nothing is at 1/w = 0
+	memset(rowDepth, 0, m_TilesX * tilePixelsNum * sizeof(float));
+	memset(rowTileMin, 0, m_TilesX * sizeof(float));
+
+	const __m128 laneOffsets = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (uint triangleIndex : m_RowTriangles[tileY])
+	{
+		const SetupTriangle& triangle = m_Triangles[triangleIndex];
+		const int minY = __max(triangle.minY, rowMinY);
+		const int maxY = __min(triangle.maxY, rowMaxY);
+
+		const __m128 edgeA0 = _mm_set1_ps(triangle.edgeA[0]), edgeA1 = _mm_set1_ps(triangle.edgeA[1]), edgeA2 = _mm_set1_ps(triangle.edgeA[2]);
+		const __m128 depthA = _mm_set1_ps(triangle.depthA);
+		const __m128 depthMin = _mm_set1_ps(triangle.depthMin);
+
+		for (int tileX = triangle.minX / TILE_SIZE; tileX <= triangle.maxX / TILE_SIZE; tileX++)
+		{
+			// The tile is already covered by something nearer than all of the triangle
+			if (triangle.depthMax <= rowTileMin[tileX])
+				continue;
+
+			float* tilePixels = rowDepth + tileX * tilePixelsNum;
+			const int minX = __max(triangle.minX, tileX * TILE_SIZE) & ~3;
+			const int maxX = __min(triangle.maxX, tileX * TILE_SIZE + TILE_SIZE - 1);
+			bool written = false;
+
+			for (int y = minY; y <= maxY; y++)
+			{
+				const float fy = float(y);
+				const __m128 edgeRow0 = _mm_set1_ps(triangle.edgeB[0] * fy + triangle.edgeC[0]);
+				const __m128 edgeRow1 = _mm_set1_ps(triangle.edgeB[1] * fy + triangle.edgeC[1]);
+				const __m128 edgeRow2 = _mm_set1_ps(triangle.edgeB[2] * fy + triangle.edgeC[2]);
+				const __m128 depthRow = _mm_set1_ps(triangle.depthB * fy + triangle.depthC);
+				float* pixelRow = tilePixels + (y - rowMinY) * TILE_SIZE;
+
+				// Four pixels at a time, which never straddle a tile
+				for (int x = minX; x <= maxX; x += 4)
+				{
+					const __m128 fx = _mm_add_ps(_mm_set1_ps(float(x)), laneOffsets);
+
+					__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA0, fx), edgeRow0), zero);
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA1, fx), edgeRow1), zero));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA2, fx), edgeRow2), zero));
+
+					if (!_mm_movemask_ps(inside))
+						continue;
+
+					__m128 depth = _mm_max_ps(_mm_add_ps(_mm_mul_ps(depthA, fx), depthRow), depthMin);
+
+					// Depth is positive everywhere, so masked out lanes keep what's there
+					float* pixels = pixelRow + (x % TILE_SIZE);
+					_mm_storeu_ps(pixels, _mm_max_ps(_mm_loadu_ps(pixels), _mm_and_ps(inside, depth)));
+					written = true;
+				}
+			}
+
+			if (written)
+				rowTileMin[tileX] = TileDepthMin(tilePixels, tilePixelsNum);
+		}
+	}
+
+	for (uint tileX = 0; tileX < m_TilesX; tileX++)
+		m_TileMax[tileY * m_TilesX + tileX] = TileDepthMax(rowDepth + tileX * tilePixelsNum, tilePixelsNum);
+}
+
+bool OcclusionBuffer::IsVisible(const box3& box) const
+{
+	assert(m_Rendered);
+
+	// The box's screen rectangle and its nearest point; a box that reaches the near plane is never occluded
+	float minX = FLT_MAX, maxX = -FLT_MAX;
+	float minY = FLT_MAX, maxY = -FLT_MAX;
+	float boxDepth = 0;
+
+	for (int corner = 0; corner < 8; corner++)
+	{
+		float4 p = makefloat4(makefloat3(box.getCorner(corner)), 1.0f) * m_WorldToClip;
+		if (p.w < m_ZNear)
+			return true;
+
+		float invW = 1.0f / p.w;
+		float x = (p.x * invW + 1.0f) * 0.5f * float(m_Width);
+		float y = (1.0f - p.y * invW) * 0.5f * float(m_Height);
+
+		minX = __min(minX, x); maxX = __max(maxX, x);
+		minY = __min(minY, y); maxY = __max(maxY, y);
+		boxDepth = __max(boxDepth, invW);
+	}
+
+	// Every pixel the rectangle touches; a box entirely off the screen isn't visible in this view
+	if (maxX < 0 || maxY < 0 || minX >= float(m_Width) || minY >= float(m_Height))
+		return false;
+
+	const int pixelMinX = __max(int(minX), 0);
+	const int pixelMaxX = __min(int(maxX), int(m_Width) - 1);
+	const int pixelMinY = __max(int(minY), 0);
+	const int pixelMaxY = __min(int(maxY), int(m_Height) - 1);
+
+	for (int tileY = pixelMinY / TILE_SIZE; tileY <= pixelMaxY / TILE_SIZE; tileY++)
+	{
+		for (int tileX = pixelMinX / TILE_SIZE; tileX <= pixelMaxX / TILE_SIZE; tileX++)
+		{
+			const uint tile = tileY * m_TilesX + tileX;
+
+			// In front of everything in the tile, or behind everything in it
+			if (boxDepth >= m_TileMax[tile])
+				return true;
+			if (boxDepth < m_TileMin[tile])
+				continue;
+
+			const float* pixels = m_Depth.data() + tile * TILE_SIZE * TILE_SIZE;
+			const int x0 = __max(pixelMinX - tileX * TILE_SIZE, 0), x1 = __min(pixelMaxX - tileX * TILE_SIZE, TILE_SIZE - 1);
+			const int y0 = __max(pixelMinY - tileY * TILE_SIZE, 0), y1 = __min(pixelMaxY - tileY * TILE_SIZE, TILE_SIZE - 1);
+
+			for (int y = y0; y <= y1; y++)
+			{
+				for (int x = x0; x <= x1; x++)
+				{
+					if (boxDepth >= pixels[y * TILE_SIZE + x])
+						return true;
+				}
+			}
+		}
+	}
+
+	return false;
+}
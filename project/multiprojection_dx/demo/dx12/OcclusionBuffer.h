@@ -0,0 +1,128 @@
+//----------------------------------------------------------------------------------
+// File:        OcclusionBuffer.h
+// SDK Version: 2.0
+// Email:       vrsupport@nvidia.com
+// Site:        http://developer.nvidia.com/
+//
+// Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//----------------------------------------------------------------------------------
+
+#pragma once
+
+#include <Windows.h>
+#include <util.h>
+#include <vector>
+
+using namespace util;
+
+// Software occlusion culling: a few large occluders are rasterized on the CPU into a small depth buffer, and instance
+// bounds are tested against it before they're drawn. The buffer holds 1/w of the nearest occluder at each pixel center,
+// which works the same for the regular and the reversed depth projections. It's split into TILE_SIZE square tiles,
+// each with the min and max of its pixels, so most boxes are decided a tile at a time.
+// Occluders are sampled at pixel centers, so at this resolution their silhouettes can be up to half a pixel too wide;
+// everything else is conservative, i.e. a box is only reported occluded if it's behind the occluders at every pixel
+// it covers.
+class OcclusionBuffer
+{
+public:
+	enum { TILE_SIZE = 8, DEFAULT_WIDTH = 512, DEFAULT_HEIGHT = 256 };
+
+	struct Stats
+	{
+		uint OccludersRendered;
+		uint TrianglesRendered;			// After clipping
+		float RenderTimeMs;
+	};
+
+	OcclusionBuffer();
+
+	// The size is rounded up to whole tiles
+	void Init(uint width = DEFAULT_WIDTH, uint height = DEFAULT_HEIGHT);
+
+	// Starts a new frame: clears the occluders, and sets the view they're rendered from. Geometry closer than zNear
+	// (along clip w) is clipped away, and boxes that reach it are always visible.
+	void Begin(const float4x4& worldToClip, float zNear);
+
+	// Queues a triangle list; the arrays have to stay valid until Render
+	void AddOccluder(const float3* positions, uint verticesNum, const uint* indices, uint trianglesNum, const float4x4& objectToWorld);
+
+	// Transforms and rasterizes the queued occluders, in parallel
+	void Render();
+
+	// Tests a world space box; can be called from any number of threads once Render has returned
+	bool IsVisible(const box3& box) const;
+
+	// Forgets the last frame, e.g. when the occluders it was rendered from are deleted
+	void Invalidate() { m_Occluders.clear(); m_Rendered = false; }
+
+	bool IsRendered() const { return m_Rendered; }
+	const float4x4& GetWorldToClip() const { return m_WorldToClip; }
+	Stats GetStats() const { return m_Stats; }
+
+protected:
+	struct Occluder
+	{
+		const float3* positions;
+		uint verticesNum;
+		const uint* indices;
+		uint trianglesNum;
+		float4x4 objectToClip;
+		uint firstTriangle;				// In m_Triangles, which has room for clipping to double the triangles
+		uint setupTrianglesNum;
+		float depthMax;					// Of its nearest triangle
+	};
+
+	// Edge functions and a 1/w plane, in pixels, ready to be rasterized
+	struct SetupTriangle
+	{
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthA, depthB, depthC;
+		float depthMin, depthMax;
+		int minX, minY, maxX, maxY;
+	};
+
+	void SetupOccluder(Occluder& occluder);
+	void RasterizeTileRow(uint tileY);
+
+	uint								m_Width;
+	uint								m_Height;
+	uint								m_TilesX;
+	uint								m_TilesY;
+	std::vector<float>					m_Depth;			// Tile by tile, TILE_SIZE * TILE_SIZE pixels each, row by row
+	std::vector<float>					m_TileMin;
+	std::vector<float>					m_TileMax;
+
+	float4x4							m_WorldToClip;
+	float								m_ZNear;
+	std::vector<Occluder>				m_Occluders;
+	std::vector<uint>					m_OccluderOrder;	// Nearest first
+	std::vector<SetupTriangle>			m_Triangles;
+	std::vector<std::vector<uint>>		m_RowTriangles;		// Triangles that overlap each tile row, front to back
+	bool								m_Rendered;
+	Stats								m_Stats;
+};
@@ -34,6 +34,7 @@
 
 
 #include "Scene.h"
+#include "OcclusionBuffer.h"
 #include "assimp/cimport.h"
 #include "assimp/postprocess.h"
 #include "FreeImage.h"
@@ -45,533 +46,2227 @@ HRESULT Scene::Load(const char* fileName, uint flags)
 	flags |= aiProcess_CalcTangentSpace;
 	flags |= aiProcess_GenNormals;
 
-	m_pScene = (aiScene*)aiImportFile(fileName, flags);
+	m_ScenePath = fileName;
 
-	if (!m_pScene)
+	WIN32_FILE_ATTRIBUTE_DATA attributes = {};
+	if (!GetFileAttributesExA(fileName, GetFileExInfoStandard, &attributes))
 	{
-		printf("unable to load scene file `%s`: %s\n", fileName, aiGetErrorString());
+		printf("unable to load scene file `%s`: file not found\n", fileName);
 		return E_FAIL;
 	}
 
-	m_ScenePath = fileName;
+	UINT64 sourceSize = (UINT64(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	UINT64 sourceWriteTime = (UINT64(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+
+	// The cache lives next to the source file and replaces the import entirely while it's up to date
+	std::string cachePath = m_ScenePath + ".meshcache";
+	if (LoadCache(cachePath, flags, sourceSize, sourceWriteTime))
+		return S_OK;
 
-	uint facesNum = 0;
-	uint verticesNum = 0;
+	const aiScene* pScene = aiImportFile(fileName, flags);
 
-	for (uint i = 0; i < m_pScene->mNumMeshes; ++i)
+	if (!pScene)
 	{
-		facesNum += m_pScene->mMeshes[i]->mNumFaces;
-		verticesNum += m_pScene->mMeshes[i]->mNumVertices;
+		printf("unable to load scene file `%s`: %s\n", fileName, aiGetErrorString());
+		return E_FAIL;
 	}
 
+	BuildFromImport(pScene);
+	aiReleaseImport(pScene);
+
+	WriteCache(cachePath, flags, sourceSize, sourceWriteTime);
+
 	return S_OK;
 }
 
+void Scene::BuildFromImport(const aiScene* pScene)
+{
+	const uint meshesNum = pScene->mNumMeshes;
+
+	// Sort the meshes by material
+	std::vector<std::pair<uint, uint>> meshMaterials(meshesNum);
+	for (uint sceneMesh = 0; sceneMesh < meshesNum; ++sceneMesh)
+	{
+		meshMaterials[sceneMesh] = std::pair<uint, uint>(sceneMesh, pScene->mMeshes[sceneMesh]->mMaterialIndex);
+	}
+
+	std::sort(meshMaterials.begin(), meshMaterials.end(), [](std::pair<uint, uint> a, std::pair<uint, uint> b) { return a.second < b.second; });
+
+	m_IndexOffsets.resize(meshesNum);
+	m_VertexOffsets.resize(meshesNum);
+	m_MeshToSceneMapping.resize(meshesNum);
+	m_MeshIndicesNum.resize(meshesNum);
+	m_MeshMaterials.resize(meshesNum);
+
+	uint totalIndices = 0;
+	uint totalVertices = 0;
+
+	// Count all the indices and vertices first
+	for (uint meshID = 0; meshID < meshesNum; ++meshID)
+	{
+		uint sceneMesh = meshMaterials[meshID].first;
+		const aiMesh* pMesh = pScene->mMeshes[sceneMesh];
+
+		m_IndexOffsets[meshID] = totalIndices;
+		m_VertexOffsets[meshID] = totalVertices;
+		m_MeshToSceneMapping[meshID] = sceneMesh;
+		m_MeshIndicesNum[meshID] = pMesh->mNumFaces * 3;
+		m_MeshMaterials[meshID] = pMesh->mMaterialIndex;
+
+		totalIndices += pMesh->mNumFaces * 3;
+		totalVertices += pMesh->mNumVertices;
+	}
+
+	// Create buffer images
+	m_Indices.resize(totalIndices);
+	m_Vertices.resize(totalVertices);
+
+	// Copy data into buffer images
+	for (uint meshID = 0; meshID < meshesNum; ++meshID)
+	{
+		uint sceneMesh = m_MeshToSceneMapping[meshID];
+		uint indexOffset = m_IndexOffsets[meshID];
+		uint vertexOffset = m_VertexOffsets[meshID];
+
+		const aiMesh* pMesh = pScene->mMeshes[sceneMesh];
+			
+		// Indices
+		for (uint f = 0; f < pMesh->mNumFaces; ++f)
+		{
+			memcpy(&m_Indices[indexOffset + f * 3], pMesh->mFaces[f].mIndices, sizeof(int) * 3);
+		}
+
+
+		for (unsigned int nVertex = 0; nVertex < pMesh->mNumVertices; nVertex++)
+		{
+			Vertex* pVertex = &m_Vertices[vertexOffset + nVertex];
+			pVertex->m_pos = *(float3*)&pMesh->mVertices[nVertex];
+
+			if(pMesh->HasTextureCoords(0)) 
+				pVertex->m_texcoord = *(float2*)&pMesh->mTextureCoords[0][nVertex];
+
+			if(pMesh->HasNormals()) 
+				pVertex->m_normal = EncodeVectorAsRGBA8S(pMesh->mNormals[nVertex]);
+
+			if (pMesh->HasTangentsAndBitangents())
+			{
+				pVertex->m_tangent = EncodeVectorAsRGBA8S(pMesh->mTangents[nVertex]);
+				pVertex->m_bitangent = EncodeVectorAsRGBA8S(pMesh->mBitangents[nVertex]);
+			}
+		}
+	}
+
+	// Object space bounds of each mesh, which UpdateBounds transforms by the instance matrices
+	const float maxFloat = 3.402823466e+38F;
+	m_SceneMeshBounds.resize(meshesNum);
+
+	for (uint sceneMesh = 0; sceneMesh < meshesNum; sceneMesh++)
+	{
+		const aiMesh* pMesh = pScene->mMeshes[sceneMesh];
+		point3 meshMin = makepoint3(maxFloat);
+		point3 meshMax = makepoint3(-maxFloat);
+
+		for (uint v = 0; v < pMesh->mNumVertices; ++v)
+		{
+			meshMin.x = __min(meshMin.x, pMesh->mVertices[v].x);
+			meshMin.y = __min(meshMin.y, pMesh->mVertices[v].y);
+			meshMin.z = __min(meshMin.z, pMesh->mVertices[v].z);
+
+			meshMax.x = __max(meshMax.x, pMesh->mVertices[v].x);
+			meshMax.y = __max(meshMax.y, pMesh->mVertices[v].y);
+			meshMax.z = __max(meshMax.z, pMesh->mVertices[v].z);
+		}
+
+		m_SceneMeshBounds[sceneMesh] = makebox3(meshMin, meshMax);
+	}
+
+	m_MaterialSources.resize(pScene->mNumMaterials);
+
+	for (uint materialIndex = 0; materialIndex < pScene->mNumMaterials; ++materialIndex)
+	{
+		aiString texturePath;
+		const aiMaterial* material = pScene->mMaterials[materialIndex];
+		MaterialSource* source = &m_MaterialSources[materialIndex];
+
+		if (material->GetTexture(aiTextureType_DIFFUSE, 0, &texturePath) == AI_SUCCESS)
+			source->m_DiffuseTexture = texturePath.C_Str();
+
+		// The sample doesn't use specular maps, so there's no need to keep them.
+
+		if (material->GetTexture(aiTextureType_HEIGHT, 0, &texturePath) == AI_SUCCESS)
+			source->m_NormalsTexture = texturePath.C_Str();
+
+		if (material->GetTexture(aiTextureType_EMISSIVE, 0, &texturePath) == AI_SUCCESS)
+			source->m_EmissiveTexture = texturePath.C_Str();
+
+		aiColor3D color;
+		if (material->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS)
+			source->m_DiffuseColor = makefloat3(color.r, color.g, color.b);
+	}
+
+	m_IndexData = m_Indices.empty() ? nullptr : &m_Indices[0];
+	m_VertexData = m_Vertices.empty() ? nullptr : &m_Vertices[0];
+	m_IndicesNum = totalIndices;
+	m_VerticesNum = totalVertices;
+}
+
+bool Scene::LoadCache(const std::string& cachePath, uint importFlags, UINT64 sourceSize, UINT64 sourceWriteTime)
+{
+	HANDLE file = CreateFileA(cachePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize = {};
+	GetFileSizeEx(file, &fileSize);
+
+	// The view keeps the file mapped after both handles are closed
+	const SceneCacheHeader* header = nullptr;
+	if (UINT64(fileSize.QuadPart) >= sizeof(SceneCacheHeader))
+	{
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
+		{
+			header = (const SceneCacheHeader*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+
+	if (!header)
+		return false;
+
+	// Anything that doesn't match is rebuilt (and overwritten) by importing the source again. The tables are
+	// checked as count <= room / stride, since offset + count * stride can wrap for a corrupted offset.
+	const UINT64 size = UINT64(fileSize.QuadPart);
+	auto fits = [size](UINT64 offset, uint count, UINT64 stride) { return offset <= size && count <= (size - offset) / stride; };
+
+	bool valid = header->magic == SceneCacheHeader::MAGIC &&
+		header->version == SceneCacheHeader::VERSION &&
+		header->sourceSize == sourceSize &&
+		header->sourceWriteTime == sourceWriteTime &&
+		header->importFlags == importFlags &&
+		header->vertexSize == sizeof(Vertex) &&
+		fits(header->meshesOffset, header->meshesNum, sizeof(SceneCacheMesh)) &&
+		fits(header->materialsOffset, header->materialsNum, sizeof(SceneCacheMaterial)) &&
+		fits(header->indicesOffset, header->indicesNum, sizeof(uint)) &&
+		fits(header->verticesOffset, header->verticesNum, sizeof(Vertex)) &&
+		header->indicesOffset % sizeof(uint) == 0 &&
+		header->verticesOffset % sizeof(float) == 0;
+
+	const BYTE* base = (const BYTE*)header;
+	const SceneCacheMesh* meshes = valid ? (const SceneCacheMesh*)(base + header->meshesOffset) : nullptr;
+	const uint* indices = valid ? (const uint*)(base + header->indicesOffset) : nullptr;
+
+	// Every index of a mesh is drawn (and read by SelectOccluders) relative to its vertex offset, so each one
+	// has to land inside the vertex buffer too. It's one pass over indices that are about to be uploaded anyway.
+	for (uint meshID = 0; valid && meshID < header->meshesNum; meshID++)
+	{
+		const SceneCacheMesh& mesh = meshes[meshID];
+		valid = mesh.sceneMesh < header->meshesNum &&
+			(mesh.materialIndex < header->materialsNum || header->materialsNum == 0) &&
+			mesh.indexOffset <= header->indicesNum &&
+			mesh.indicesNum <= header->indicesNum - mesh.indexOffset &&
+			mesh.vertexOffset <= header->verticesNum;
+
+		const uint meshVerticesNum = valid ? header->verticesNum - mesh.vertexOffset : 0;
+		for (uint i = 0; valid && i < mesh.indicesNum; i++)
+			valid = indices[mesh.indexOffset + i] < meshVerticesNum;
+	}
+
+	if (!valid)
+	{
+		UnmapViewOfFile(header);
+		return false;
+	}
+
+	const uint meshesNum = header->meshesNum;
+	m_IndexOffsets.resize(meshesNum);
+	m_VertexOffsets.resize(meshesNum);
+	m_MeshToSceneMapping.resize(meshesNum);
+	m_MeshIndicesNum.resize(meshesNum);
+	m_MeshMaterials.resize(meshesNum);
+	m_SceneMeshBounds.resize(meshesNum);
+
+	for (uint meshID = 0; meshID < meshesNum; meshID++)
+	{
+		const SceneCacheMesh& mesh = meshes[meshID];
+		m_IndexOffsets[meshID] = mesh.indexOffset;
+		m_VertexOffsets[meshID] = mesh.vertexOffset;
+		m_MeshToSceneMapping[meshID] = mesh.sceneMesh;
+		m_MeshIndicesNum[meshID] = mesh.indicesNum;
+		m_MeshMaterials[meshID] = mesh.materialIndex;
+		m_SceneMeshBounds[mesh.sceneMesh] = makebox3(makepoint3(mesh.boundsMin), makepoint3(mesh.boundsMax));
+	}
+
+	const SceneCacheMaterial* materials = (const SceneCacheMaterial*)(base + header->materialsOffset);
+	m_MaterialSources.resize(header->materialsNum);
+
+	for (uint materialIndex = 0; materialIndex < header->materialsNum; materialIndex++)
+	{
+		const SceneCacheMaterial& material = materials[materialIndex];
+		MaterialSource* source = &m_MaterialSources[materialIndex];
+
+		// The strings were written NUL-terminated, but don't trust the file to still be
+		source->m_DiffuseTexture.assign(material.diffuseTexture, strnlen(material.diffuseTexture, MAX_PATH));
+		source->m_NormalsTexture.assign(material.normalsTexture, strnlen(material.normalsTexture, MAX_PATH));
+		source->m_EmissiveTexture.assign(material.emissiveTexture, strnlen(material.emissiveTexture, MAX_PATH));
+		source->m_DiffuseColor = material.diffuseColor;
+	}
+
+	// The buffers are uploaded straight from the view in FinalizeInit
+	m_MappedCache = header;
+	m_IndexData = indices;
+	m_VertexData = (const Vertex*)(base + header->verticesOffset);
+	m_IndicesNum = header->indicesNum;
+	m_VerticesNum = header->verticesNum;
+
+	return true;
+}
+
+void Scene::WriteCache(const std::string& cachePath, uint importFlags, UINT64 sourceSize, UINT64 sourceWriteTime) const
+{
+	const uint meshesNum = GetMeshesNum();
+	const uint materialsNum = uint(m_MaterialSources.size());
+
+	std::vector<SceneCacheMesh> meshes(meshesNum);
+	for (uint meshID = 0; meshID < meshesNum; meshID++)
+	{
+		SceneCacheMesh& mesh = meshes[meshID];
+		mesh.sceneMesh = m_MeshToSceneMapping[meshID];
+		mesh.materialIndex = m_MeshMaterials[meshID];
+		mesh.indexOffset = m_IndexOffsets[meshID];
+		mesh.vertexOffset = m_VertexOffsets[meshID];
+		mesh.indicesNum = m_MeshIndicesNum[meshID];
+		mesh.boundsMin = makefloat3(m_SceneMeshBounds[mesh.sceneMesh].m_mins);
+		mesh.boundsMax = makefloat3(m_SceneMeshBounds[mesh.sceneMesh].m_maxs);
+	}
+
+	// Texture paths longer than the table's fixed strings can't be cached; such a scene is always imported
+	std::vector<SceneCacheMaterial> materials(materialsNum);
+	for (uint materialIndex = 0; materialIndex < materialsNum; materialIndex++)
+	{
+		const MaterialSource& source = m_MaterialSources[materialIndex];
+		SceneCacheMaterial& material = materials[materialIndex];
+		memset(&material, 0, sizeof(material));
+
+		if (strcpy_s(material.diffuseTexture, source.m_DiffuseTexture.c_str()) != 0 ||
+			strcpy_s(material.normalsTexture, source.m_NormalsTexture.c_str()) != 0 ||
+			strcpy_s(material.emissiveTexture, source.m_EmissiveTexture.c_str()) != 0)
+		{
+			printf("not caching scene file `%s`: a texture path is too long\n", m_ScenePath.c_str());
+			return;
+		}
+
+		material.diffuseColor = source.m_DiffuseColor;
+	}
+
+	SceneCacheHeader header = {};
+	header.magic = SceneCacheHeader::MAGIC;
+	header.version = SceneCacheHeader::VERSION;
+	header.sourceSize = sourceSize;
+	header.sourceWriteTime = sourceWriteTime;
+	header.importFlags = importFlags;
+	header.vertexSize = sizeof(Vertex);
+	header.meshesNum = meshesNum;
+	header.materialsNum = materialsNum;
+	header.indicesNum = m_IndicesNum;
+	header.verticesNum = m_VerticesNum;
+	header.meshesOffset = sizeof(SceneCacheHeader);
+	header.materialsOffset = header.meshesOffset + UINT64(meshesNum) * sizeof(SceneCacheMesh);
+	header.indicesOffset = header.materialsOffset + UINT64(materialsNum) * sizeof(SceneCacheMaterial);
+	header.verticesOffset = header.indicesOffset + UINT64(m_IndicesNum) * sizeof(uint);
+
+	// Write under a temporary name and rename it into place, so a reader (or another instance of the
+	// sample) never sees a half-written file
+	char suffix[32];
+	sprintf_s(suffix, ".%u.tmp", GetCurrentThreadId());
+	std::string tempPath = cachePath + suffix;
+
+	FILE* file = nullptr;
+	if (fopen_s(&file, tempPath.c_str(), "wb") != 0)
+		return;
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (written && meshesNum)
+		written = fwrite(&meshes[0], sizeof(SceneCacheMesh), meshesNum, file) == meshesNum;
+	if (written && materialsNum)
+		written = fwrite(&materials[0], sizeof(SceneCacheMaterial), materialsNum, file) == materialsNum;
+	if (written && m_IndicesNum)
+		written = fwrite(m_IndexData, sizeof(uint), m_IndicesNum, file) == m_IndicesNum;
+	if (written && m_VerticesNum)
+		written = fwrite(m_VertexData, sizeof(Vertex), m_VerticesNum, file) == m_VerticesNum;
+	written = (fclose(file) == 0) && written;
+
+	if (!written || !MoveFileExA(tempPath.c_str(), cachePath.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileA(tempPath.c_str());
+	}
+}
+
 void Scene::Release()
 {
 	printf("Releasing the scene...\n");
 
-	aiReleaseImport(m_pScene);
-	m_pScene = NULL;
+	// Frees the geometry once it's been uploaded, whether it was imported or mapped from the cache
+	m_Indices.clear();
+	m_Indices.shrink_to_fit();
+	m_Vertices.clear();
+	m_Vertices.shrink_to_fit();
+
+	if (m_MappedCache)
+	{
+		UnmapViewOfFile(m_MappedCache);
+		m_MappedCache = nullptr;
+	}
+
+	m_IndexData = nullptr;
+	m_VertexData = nullptr;
 }
 
 void Scene::UpdateBounds()
 {
-	assert(m_pScene != NULL);
-
 	const float maxFloat = 3.402823466e+38F;
 	point3 _minBoundary = makepoint3(maxFloat);
 	point3 _maxBoundary = makepoint3(-maxFloat);
 
-	if (m_pScene->mNumMeshes)
+	// The instance matrices come from the scene description, not the source file, so the instance bounds
+	// are always computed here from the (imported or cached) object space bounds of each mesh
+	const uint sceneMeshesNum = uint(m_SceneMeshBounds.size());
+	if (sceneMeshesNum)
 	{
-		m_SceneMeshInstanceBounds.resize(m_pScene->mNumMeshes);
-		m_CulledInstanceCounts.resize(m_pScene->mNumMeshes);
+		m_InstanceBounds.resize(sceneMeshesNum * uint(m_InstanceMatrices.size()));
+
+		// Every view has to be culled again with the new bounds
+		for (uint view = 0; view < CULL_VIEWS_COUNT; view++)
+		{
+			m_CulledInstanceCounts[view].assign(sceneMeshesNum, 0);
+			m_CullViews[view].valid = false;
+		}
+
+		m_SceneToMeshMapping.resize(sceneMeshesNum);
+		for (uint meshID = 0; meshID < m_MeshToSceneMapping.size(); meshID++)
+			m_SceneToMeshMapping[m_MeshToSceneMapping[meshID]] = meshID;
 
 		m_SceneBounds.m_mins = _minBoundary;
 		m_SceneBounds.m_maxs = _maxBoundary;
 
-		for (uint sceneMesh = 0; sceneMesh < m_pScene->mNumMeshes; sceneMesh++)
+		UpdateInstanceBounds(0, uint(m_InstanceMatrices.size()));
+		UpdatePackedInstances(0, uint(m_InstanceMatrices.size()));
+
+		// The root of the tree bounds the whole scene
+		m_InstanceBVH.Build(m_InstanceBounds);
+		m_InstancesMoved = false;
+
+		if (!m_InstanceBVH.IsEmpty())
+			m_SceneBounds = m_InstanceBVH.GetBounds();
+	}
+}
+
+void Scene::UpdateInstanceBounds(uint firstInstance, uint instancesNum)
+{
+	// The instance matrices are affine, so each mesh box goes through all of them at once as a center and extent
+	const uint numInstances = uint(m_InstanceMatrices.size());
+	if (instancesNum == 0)
+		return;
+
+	for (uint sceneMesh = 0; sceneMesh < m_SceneMeshBounds.size(); sceneMesh++)
+	{
+		const uint first = sceneMesh * numInstances + firstInstance;
+		float* const mins[] = { &m_InstanceBounds.m_MinX[first], &m_InstanceBounds.m_MinY[first], &m_InstanceBounds.m_MinZ[first] };
+		float* const maxs[] = { &m_InstanceBounds.m_MaxX[first], &m_InstanceBounds.m_MaxY[first], &m_InstanceBounds.m_MaxZ[first] };
+
+		boxTransformBatch(m_SceneMeshBounds[sceneMesh], &m_InstanceMatrices[firstInstance], int(instancesNum), mins, maxs);
+	}
+}
+
+void Scene::SetInstanceMatrices(uint firstInstance, uint instancesNum, const float4x4* matrices)
+{
+	assert(m_InstanceBounds.size() == m_SceneMeshBounds.size() * m_InstanceMatrices.size());
+	assert(firstInstance + instancesNum <= m_InstanceMatrices.size());
+
+	if (instancesNum == 0)
+		return;
+
+	memcpy(&m_InstanceMatrices[firstInstance], matrices, instancesNum * sizeof(float4x4));
+
+	UpdateInstanceBounds(firstInstance, instancesNum);
+	UpdatePackedInstances(firstInstance, instancesNum);
+
+	// Several instances can move in a frame, so the tree is refitted once, by the next FrustumCull
+	m_InstancesMoved = true;
+
+	for (uint view = 0; view < CULL_VIEWS_COUNT; view++)
+		m_CullViews[view].valid = false;
+}
+
+void Scene::UpdatePackedInstances(uint firstInstance, uint instancesNum)
+{
+	// FLOAT4X4 is uploaded straight from the matrices
+	if (m_InstanceFormat == InstanceFormat::FLOAT4X4)
+	{
+		m_PackedInstances.clear();
+		return;
+	}
+
+	const uint stride = GetInstanceStride(m_InstanceFormat);
+	m_PackedInstances.resize(m_InstanceMatrices.size() * stride);
+
+	if (instancesNum)
+		PackInstances(m_InstanceFormat, &m_InstanceMatrices[firstInstance], instancesNum, &m_PackedInstances[firstInstance * stride]);
+}
+
+const BYTE* Scene::GetPackedInstance(uint instance) const
+{
+	if (m_InstanceFormat == InstanceFormat::FLOAT4X4)
+		return (const BYTE*)(m_InstanceMatrices.data() + instance);
+
+	return m_PackedInstances.data() + instance * GetInstanceStride(m_InstanceFormat);
+}
+
+void Scene::SetInstanceFormat(InstanceFormat format)
+{
+	if (format == m_InstanceFormat)
+		return;
+
+	m_InstanceFormat = format;
+	UpdatePackedInstances(0, uint(m_InstanceMatrices.size()));
+
+	if (format == InstanceFormat::QUANTIZED && !m_InstanceMatrices.empty())
+	{
+		box3 objectBounds = makebox3Empty();
+		for (const box3& bounds : m_SceneMeshBounds)
+			objectBounds = boxUnion(objectBounds, bounds);
+
+		float error = 0.f;
+		for (const float4x4& matrix : m_InstanceMatrices)
+			error = __max(error, GetQuantizationError(matrix, objectBounds));
+
+		printf("%s: quantized instance transforms are within %g units of the exact ones\n", m_ScenePath.c_str(), error);
+	}
+
+	// The buffers' stride has changed, so they're made again, and the culling results are uploaded again
+	if (m_rendererInterface && !m_InstanceBuffers_rhi.empty())
+	{
+		for (auto it : m_InstanceBuffers_rhi)
+		{
+			m_rendererInterface->destroyBuffer(it);
+		}
+
+		CreateInstanceBuffers();
+
+		if (m_SingleInstanceBuffer)
+			m_rendererInterface->writeBuffer(m_InstanceBuffers_rhi[0], GetPackedInstance(0), GetInstanceStride(m_InstanceFormat));
+	}
+
+	for (uint view = 0; view < CULL_VIEWS_COUNT; view++)
+		m_CullViews[view].valid = false;
+}
+
+uint GetMipLevelsNum(uint width, uint height)
+{
+	uint size = __min(width, height);
+	uint levelsNum = (uint)(logf((float)size) / logf(2.0f)) + 1;
+
+	return levelsNum;
+}
+
+void TextureUploadQueue::Reset(UINT64 memoryBudget)
+{
+	Clear();
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_MemoryBudget = memoryBudget;
+	m_Shutdown = false;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+void TextureUploadQueue::Push(Texture2DEx* texture, FIBITMAP* const* mipData, uint mipLevels)
+{
+	assert(texture && texture->Texture);
+	assert(mipLevels > 0 && mipLevels <= 16);
+
+	PendingTexture pending = {};
+	pending.texture = texture;
+	pending.mipLevels = mipLevels;
+	for (uint mipLevel = 0; mipLevel < mipLevels; mipLevel++)
+	{
+		pending.mipData[mipLevel] = mipData[mipLevel];
+		pending.mipPixels[mipLevel] = FreeImage_GetBits(mipData[mipLevel]);
+		pending.mipRowPitches[mipLevel] = FreeImage_GetPitch(mipData[mipLevel]);
+		pending.byteSize += UINT64(FreeImage_GetPitch(mipData[mipLevel])) * FreeImage_GetHeight(mipData[mipLevel]);
+	}
+
+	Enqueue(pending);
+}
+
+void TextureUploadQueue::Push(Texture2DEx* texture, const MipCacheHeader* mappedFile)
+{
+	assert(texture && texture->Texture);
+	assert(mappedFile->mipLevels > 0 && mappedFile->mipLevels <= 16);
+
+	PendingTexture pending = {};
+	pending.texture = texture;
+	pending.mipLevels = mappedFile->mipLevels;
+	pending.mappedFile = mappedFile;
+	for (uint mipLevel = 0; mipLevel < mappedFile->mipLevels; mipLevel++)
+	{
+		const MipCacheHeader::Mip& mip = mappedFile->mips[mipLevel];
+		pending.mipPixels[mipLevel] = (const BYTE*)mappedFile + mip.offset;
+		pending.mipRowPitches[mipLevel] = mip.rowPitch;
+		pending.byteSize += UINT64(mip.rowPitch) * mip.height;
+	}
+
+	Enqueue(pending);
+}
+
+void TextureUploadQueue::Enqueue(const PendingTexture& pending)
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	if (!m_Shutdown && m_BytesPending > 0 && m_BytesPending + pending.byteSize > m_MemoryBudget)
+	{
+		m_Stats.PushStalls++;
+		m_SpaceAvailable.wait(lock, [this, &pending]() 
+		{ 
+			return m_Shutdown || m_BytesPending == 0 || m_BytesPending + pending.byteSize <= m_MemoryBudget; 
+		});
+	}
+
+	// Nobody is going to upload it
+	if (m_Shutdown)
+	{
+		lock.unlock();
+		FreePending(pending);
+		return;
+	}
+
+	m_Pending.push_back(pending);
+	m_BytesPending += pending.byteSize;
+	m_Stats.PeakBytesPending = __max(m_Stats.PeakBytesPending, m_BytesPending);
+}
+
+uint TextureUploadQueue::Upload(NVRHI::IRendererInterface* rendererInterface, UINT64 maxBytes)
+{
+	uint texturesUploaded = 0;
+	UINT64 bytesUploaded = 0;
+
+	while (bytesUploaded < maxBytes)
+	{
+		// Take the texture out of the queue first, so the loading tasks can keep pushing while it's written
+		PendingTexture pending;
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_Pending.empty())
+				break;
+
+			pending = m_Pending.front();
+			m_Pending.pop_front();
+		}
+
+		for (uint mipLevel = 0; mipLevel < pending.mipLevels; mipLevel++)
+		{
+			rendererInterface->writeTexture(pending.texture->Texture, mipLevel, pending.mipPixels[mipLevel], pending.mipRowPitches[mipLevel], 0);
+		}
+
+		FreePending(pending);
+
+		texturesUploaded++;
+		bytesUploaded += pending.byteSize;
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_BytesPending -= pending.byteSize;
+			m_Stats.TexturesUploaded++;
+			m_Stats.BytesUploaded += pending.byteSize;
+		}
+		m_SpaceAvailable.notify_all();
+	}
+
+	if (texturesUploaded > 0)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.PeakBytesPerFrame = __max(m_Stats.PeakBytesPerFrame, bytesUploaded);
+	}
+
+	return texturesUploaded;
+}
+
+void TextureUploadQueue::Clear()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	for (auto& pending : m_Pending)
+	{
+		FreePending(pending);
+	}
+	m_Pending.clear();
+	m_BytesPending = 0;
+	m_SpaceAvailable.notify_all();
+}
+
+void TextureUploadQueue::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Shutdown = true;
+	}
+	Clear();
+}
+
+void TextureUploadQueue::FreePending(const PendingTexture& pending)
+{
+	if (pending.mappedFile)
+	{
+		UnmapViewOfFile(pending.mappedFile);
+		return;
+	}
+
+	for (uint mipLevel = 0; mipLevel < pending.mipLevels; mipLevel++)
+		FreeImage_Unload(pending.mipData[mipLevel]);
+}
+
+bool TextureUploadQueue::IsEmpty()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Pending.empty();
+}
+
+TextureUploadQueue::Stats TextureUploadQueue::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+std::string TextureCache::NormalizePath(const std::string& path)
+{
+	// Windows paths are case-insensitive and take either slash; also fold away "." and ".." components
+	std::vector<std::string> components;
+	std::string component;
+	bool absolute = !path.empty() && (path[0] == '\\' || path[0] == '/');
+
+	for (size_t i = 0; i <= path.size(); i++)
+	{
+		char c = (i < path.size()) ? path[i] : '\\';
+		if (c == '\\' || c == '/')
+		{
+			if (component == "..")
+			{
+				if (!components.empty() && components.back() != "..")
+					components.pop_back();
+				else if (!absolute)
+					components.push_back(component);
+			}
+			else if (!component.empty() && component != ".")
+			{
+				components.push_back(component);
+			}
+			component.clear();
+		}
+		else
+		{
+			component += char(tolower((unsigned char)c));
+		}
+	}
+
+	std::string result = absolute ? "\\" : "";
+	for (size_t i = 0; i < components.size(); i++)
+	{
+		if (i > 0)
+			result += '\\';
+		result += components[i];
+	}
+	return result;
+}
+
+std::string TextureCache::GetPathKey(const std::string& normalizedPath, bool sRGB)
+{
+	// '|' can't appear in a Windows path
+	return normalizedPath + (sRGB ? "|srgb" : "|linear");
+}
+
+bool TextureCache::ReadWholeFile(const std::string& path, std::vector<BYTE>& data)
+{
+	data.clear();
+
+	FILE* file = nullptr;
+	if (fopen_s(&file, path.c_str(), "rb") != 0)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long fileSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (fileSize > 0)
+	{
+		data.resize(fileSize);
+		if (fread(&data[0], 1, fileSize, file) != size_t(fileSize))
+			data.clear();
+	}
+	fclose(file);
+
+	return !data.empty();
+}
+
+static void PrintLoadError(const std::string& path)
+{
+	char error[MAX_PATH + 50];
+	sprintf_s(error, "Couldn't load texture file `%s`\n", path.c_str());
+	OutputDebugStringA(error);
+}
+
+static UINT64 HashBytes(const BYTE* data, size_t size)
+{
+	// 64-bit FNV-1a
+	UINT64 hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+void TextureCache::Init(NVRHI::IRendererInterface* rendererInterface, TextureUploadQueue* uploadQueue, const std::string& mipCacheDirectory)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_RendererInterface = rendererInterface;
+	m_UploadQueue = uploadQueue;
+	m_MipCacheDirectory = mipCacheDirectory;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+
+	if (!m_MipCacheDirectory.empty())
+		CreateDirectoryA(m_MipCacheDirectory.c_str(), nullptr);
+}
+
+std::string TextureCache::GetMipCachePath(UINT64 sourceHash) const
+{
+	char name[32];
+	sprintf_s(name, "%016llx.mips", sourceHash);
+	return m_MipCacheDirectory + "\\" + name;
+}
+
+const MipCacheHeader* TextureCache::MapMipCache(UINT64 sourceHash, UINT64 sourceSize)
+{
+	HANDLE file = CreateFileA(GetMipCachePath(sourceHash).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER fileSize = {};
+	GetFileSizeEx(file, &fileSize);
+
+	// The view keeps the file mapped after both handles are closed
+	const MipCacheHeader* header = nullptr;
+	if (UINT64(fileSize.QuadPart) >= sizeof(MipCacheHeader))
+	{
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
+		{
+			header = (const MipCacheHeader*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+
+	if (!header)
+		return nullptr;
+
+	// Anything that doesn't match is rebuilt (and overwritten) by decoding the source again
+	bool valid = header->magic == MipCacheHeader::MAGIC && 
+		header->version == MipCacheHeader::VERSION &&
+		header->sourceHash == sourceHash && 
+		header->sourceSize == sourceSize &&
+		(header->bytesPerPixel == 1 || header->bytesPerPixel == 4) &&
+		header->mipLevels > 0 && header->mipLevels <= 16;
+
+	for (uint mipLevel = 0; valid && mipLevel < header->mipLevels; mipLevel++)
+	{
+		const MipCacheHeader::Mip& mip = header->mips[mipLevel];
+		// Each of these fits in 64 bits, so a corrupt offset or size can't wrap around and pass
+		valid = UINT64(mip.rowPitch) >= UINT64(mip.width) * header->bytesPerPixel &&
+			mip.offset <= UINT64(fileSize.QuadPart) &&
+			UINT64(mip.rowPitch) * mip.height <= UINT64(fileSize.QuadPart) - mip.offset;
+	}
+
+	if (!valid)
+	{
+		UnmapViewOfFile(header);
+		return nullptr;
+	}
+
+	return header;
+}
+
+void TextureCache::WriteMipCache(UINT64 sourceHash, UINT64 sourceSize, uint originalBPP, FIBITMAP* const* mipData, uint mipLevels)
+{
+	MipCacheHeader header = {};
+	header.magic = MipCacheHeader::MAGIC;
+	header.version = MipCacheHeader::VERSION;
+	header.sourceHash = sourceHash;
+	header.sourceSize = sourceSize;
+	header.originalBPP = originalBPP;
+	header.bytesPerPixel = FreeImage_GetBPP(mipData[0]) / 8;
+	header.mipLevels = mipLevels;
+
+	UINT64 offset = sizeof(MipCacheHeader);
+	for (uint mipLevel = 0; mipLevel < mipLevels; mipLevel++)
+	{
+		MipCacheHeader::Mip& mip = header.mips[mipLevel];
+		mip.width = FreeImage_GetWidth(mipData[mipLevel]);
+		mip.height = FreeImage_GetHeight(mipData[mipLevel]);
+		mip.rowPitch = FreeImage_GetPitch(mipData[mipLevel]);
+		mip.offset = offset;
+		offset += UINT64(mip.rowPitch) * mip.height;
+	}
+
+	// Write under a temporary name and rename it into place, so a reader (or another instance of the
+	// sample) never sees a half-written file
+	std::string path = GetMipCachePath(sourceHash);
+	char suffix[32];
+	sprintf_s(suffix, ".%u.tmp", GetCurrentThreadId());
+	std::string tempPath = path + suffix;
+
+	FILE* file = nullptr;
+	if (fopen_s(&file, tempPath.c_str(), "wb") != 0)
+		return;
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (uint mipLevel = 0; written && mipLevel < mipLevels; mipLevel++)
+	{
+		size_t mipSize = size_t(header.mips[mipLevel].rowPitch) * header.mips[mipLevel].height;
+		written = fwrite(FreeImage_GetBits(mipData[mipLevel]), 1, mipSize, file) == mipSize;
+	}
+	written = (fclose(file) == 0) && written;
+
+	if (written && MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.MipCacheWrites++;
+	}
+	else
+	{
+		DeleteFileA(tempPath.c_str());
+	}
+}
+
+std::string TextureCache::GetSourceIndexPath(const std::string& normalizedPath) const
+{
+	char name[32];
+	sprintf_s(name, "%016llx.source", HashBytes((const BYTE*)normalizedPath.c_str(), normalizedPath.size()));
+	return m_MipCacheDirectory + "\\" + name;
+}
+
+bool TextureCache::ReadSourceIndex(const std::string& normalizedPath, UINT64 sourceSize, UINT64 sourceWriteTime, UINT64& sourceHash)
+{
+	MipCacheSource source = {};
+	FILE* file = nullptr;
+	if (fopen_s(&file, GetSourceIndexPath(normalizedPath).c_str(), "rb") != 0)
+		return false;
+
+	bool read = fread(&source, sizeof(source), 1, file) == 1;
+	fclose(file);
+
+	// A stale or mismatched entry is overwritten once the source has been hashed again
+	if (!read ||
+		source.magic != MipCacheSource::MAGIC ||
+		source.version != MipCacheSource::VERSION ||
+		source.sourceSize != sourceSize ||
+		source.sourceWriteTime != sourceWriteTime ||
+		strncmp(source.path, normalizedPath.c_str(), sizeof(source.path)) != 0)
+	{
+		return false;
+	}
+
+	sourceHash = source.sourceHash;
+	return true;
+}
+
+void TextureCache::WriteSourceIndex(const std::string& normalizedPath, UINT64 sourceSize, UINT64 sourceWriteTime, UINT64 sourceHash)
+{
+	if (normalizedPath.size() >= MAX_PATH)
+		return;
+
+	MipCacheSource source = {};
+	source.magic = MipCacheSource::MAGIC;
+	source.version = MipCacheSource::VERSION;
+	source.sourceSize = sourceSize;
+	source.sourceWriteTime = sourceWriteTime;
+	source.sourceHash = sourceHash;
+	strcpy_s(source.path, normalizedPath.c_str());
+
+	// Same as the mip chains: write under a temporary name and rename it into place
+	std::string path = GetSourceIndexPath(normalizedPath);
+	char suffix[32];
+	sprintf_s(suffix, ".%u.tmp", GetCurrentThreadId());
+	std::string tempPath = path + suffix;
+
+	FILE* file = nullptr;
+	if (fopen_s(&file, tempPath.c_str(), "wb") != 0)
+		return;
+
+	bool written = fwrite(&source, sizeof(source), 1, file) == 1;
+	written = (fclose(file) == 0) && written;
+
+	if (!written || !MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+		DeleteFileA(tempPath.c_str());
+}
+
+Texture2DEx* TextureCache::Acquire(const std::string& path, bool sRGB, Scene::LoadingStats& stats, concurrency::task_group& taskGroup)
+{
+	std::string normalizedPath = NormalizePath(path);
+	std::string key = GetPathKey(normalizedPath, sRGB);
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Stats.Requests++;
+
+	// First see if this texture is already loaded (or being loaded).
+
+	auto it = m_EntriesByPath.find(key);
+	if (it != m_EntriesByPath.end())
+	{
+		m_Stats.PathHits++;
+		it->second->refCount++;
+		return it->second;
+	}
+
+	// Allocate a new texture slot for this file name and return it. Load the file later in a thread pool;
+	// the loading task holds a reference of its own until it's done.
+
+	Entry* entry = new Entry();
+	entry->path = normalizedPath;
+	entry->sRGB = sRGB;
+	entry->refCount = 2;
+	entry->loading = true;
+	m_EntriesByPath[key] = entry;
+	InterlockedIncrement(&stats.TexturesTotal);
+
+	taskGroup.run([this, entry, &stats]() 
+	{
+		LoadEntry(entry, stats);
+		FinishLoading(entry);
+	});
+
+	return entry;
+}
+
+void TextureCache::LoadEntry(Entry* entry, Scene::LoadingStats& stats)
+{
+	const bool sRGB = entry->sRGB;
+
+	// A source that an earlier run hashed, and that hasn't changed since, has its hash in the mip cache's index;
+	// it's only read if its mip chain has to be decoded, or another texture's hash matches and the bytes have to
+	// be compared. Anything else is read whole first, so its contents can be matched against the other textures.
+
+	WIN32_FILE_ATTRIBUTE_DATA attributes = {};
+	UINT64 sourceSize = 0;
+	UINT64 sourceWriteTime = 0;
+	if (GetFileAttributesExA(entry->path.c_str(), GetFileExInfoStandard, &attributes))
+	{
+		sourceSize = (UINT64(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+		sourceWriteTime = (UINT64(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	}
+
+	std::vector<BYTE> fileData;
+	UINT64 contentHash = 0;
+	if (sourceSize > 0 && !m_MipCacheDirectory.empty() && ReadSourceIndex(entry->path, sourceSize, sourceWriteTime, contentHash))
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.SourceIndexHits++;
+	}
+	else
+	{
+		if (!ReadWholeFile(entry->path, fileData))
+		{
+			PrintLoadError(entry->path);
+			return;
+		}
+
+		contentHash = HashBytes(&fileData[0], fileData.size());
+
+		// Unless it changed since its attributes were read
+		if (!m_MipCacheDirectory.empty() && fileData.size() == sourceSize)
+			WriteSourceIndex(entry->path, sourceSize, sourceWriteTime, contentHash);
+
+		sourceSize = fileData.size();
+	}
+
+	Entry* contentOwner = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		entry->contentHash = contentHash;
+
+		auto it = m_EntriesByContent.find(ContentKey(contentHash, sRGB));
+		if (it != m_EntriesByContent.end())
+		{
+			// Keep it alive while its file is compared, outside the lock
+			contentOwner = it->second;
+			contentOwner->refCount++;
+		}
+		else
+		{
+			m_EntriesByContent[ContentKey(contentHash, sRGB)] = entry;
+		}
+	}
+
+	// The hash only says the files are probably the same; a collision would show another image
+	if (contentOwner)
+	{
+		std::vector<BYTE> ownerData;
+		bool sameContents = (!fileData.empty() || ReadWholeFile(entry->path, fileData)) &&
+			ReadWholeFile(contentOwner->path, ownerData) && ownerData == fileData;
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (sameContents)
+		{
+			entry->contentOwner = contentOwner;
+			m_Stats.ContentHits++;
+		}
+		else
+		{
+			// Load it on its own; it isn't registered by content, so nothing else shares it
+			ReleaseLocked(contentOwner);
+			contentOwner = nullptr;
+			m_Stats.ContentMismatches++;
+		}
+	}
+
+	// Same image under another path: share its texture once its decode finishes
+	if (contentOwner)
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_LoadFinished.wait(lock, [contentOwner]() { return !contentOwner->loading; });
+
+		entry->Texture = contentOwner->Texture;
+		entry->originalBPP = contentOwner->originalBPP;
+		if (entry->Texture)
+			InterlockedIncrement(&stats.TexturesLoaded);
+		return;
+	}
+
+	// A mip chain decoded by an earlier run can go straight to upload
+	const MipCacheHeader* mappedFile = m_MipCacheDirectory.empty() ? nullptr : MapMipCache(contentHash, sourceSize);
+	if (mappedFile)
+	{
+		std::vector<BYTE>().swap(fileData);
+
+		const MipCacheHeader::Mip& lastMip = mappedFile->mips[mappedFile->mipLevels - 1];
+		UINT64 mappedSize = lastMip.offset + UINT64(lastMip.rowPitch) * lastMip.height;
+
+		// Fault the pages in here, so the render thread doesn't wait on the disk while it uploads them
+		volatile BYTE touch = 0;
+		for (UINT64 offset = 0; offset < mappedSize; offset += 4096)
+			touch = ((const BYTE*)mappedFile)[offset];
+		(void)touch;
+
+		entry->originalBPP = mappedFile->originalBPP;
+
+		NVRHI::TextureDesc textureDesc;
+		textureDesc.width = mappedFile->mips[0].width;
+		textureDesc.height = mappedFile->mips[0].height;
+		textureDesc.format = (mappedFile->bytesPerPixel == 1) ? NVRHI::Format::R8_UNORM : 
+			(sRGB ? NVRHI::Format::SBGRA8_UNORM : NVRHI::Format::BGRA8_UNORM);
+		textureDesc.mipLevels = mappedFile->mipLevels;
+		textureDesc.debugName = entry->path.c_str();
+		entry->Texture = m_RendererInterface->createTexture(textureDesc, nullptr);
+
+		m_UploadQueue->Push(entry, mappedFile);
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stats.MipCacheHits++;
+		}
+		InterlockedIncrement(&stats.TexturesLoaded);
+		return;
+	}
+
+	if (fileData.empty() && !ReadWholeFile(entry->path, fileData))
+	{
+		PrintLoadError(entry->path);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.Decodes++;
+	}
+
+	FIMEMORY* memory = FreeImage_OpenMemory(&fileData[0], DWORD(fileData.size()));
+	FREE_IMAGE_FORMAT imageFormat = FreeImage_GetFileTypeFromMemory(memory);
+	FIBITMAP* pBitmap = FreeImage_LoadFromMemory(imageFormat, memory);
+	FreeImage_CloseMemory(memory);
+
+	// The bitmap has its own copy of the pixels
+	std::vector<BYTE>().swap(fileData);
+
+	if (pBitmap)
+	{
+		uint width = FreeImage_GetWidth(pBitmap);
+		uint height = FreeImage_GetHeight(pBitmap);
+		uint bpp = FreeImage_GetBPP(pBitmap);
+		entry->originalBPP = bpp;
+
+		NVRHI::Format::Enum formatRHI = NVRHI::Format::UNKNOWN;
+
+		switch (bpp)
+		{
+		case 8:
+			formatRHI = NVRHI::Format::R8_UNORM;
+			break;
+
+		case 24:
+		{
+			FIBITMAP* newBitmap = FreeImage_ConvertTo32Bits(pBitmap);
+			FreeImage_Unload(pBitmap);
+			pBitmap = newBitmap;
+			formatRHI = sRGB ? NVRHI::Format::SBGRA8_UNORM : NVRHI::Format::BGRA8_UNORM;
+			break;
+		}
+
+		case 32:
+			formatRHI = sRGB ? NVRHI::Format::SBGRA8_UNORM : NVRHI::Format::BGRA8_UNORM;
+			break;
+
+		default:
+			FreeImage_Unload(pBitmap);
+			return;
+		}
+
+		NVRHI::TextureDesc textureDesc;
+		textureDesc.width = width;
+		textureDesc.height = height;
+		textureDesc.format = formatRHI;
+		textureDesc.mipLevels = GetMipLevelsNum(width, height);
+		textureDesc.debugName = entry->path.c_str();
+		NVRHI::TextureHandle textureHandle = m_RendererInterface->createTexture(textureDesc, nullptr);
+		entry->Texture = textureHandle;
+
+		FIBITMAP* mipData[16] = {};
+		mipData[0] = pBitmap;
+
+		for (uint mipLevel = 1; mipLevel < textureDesc.mipLevels; mipLevel++)
+		{
+			width /= 2;
+			height /= 2;
+			mipData[mipLevel] = FreeImage_Rescale(mipData[mipLevel - 1], width, height, FILTER_BILINEAR);
+		}
+
+		if (!m_MipCacheDirectory.empty())
+			WriteMipCache(contentHash, sourceSize, bpp, mipData, textureDesc.mipLevels);
+
+		// Hand the mips over for upload right away; this waits if too many decoded textures are already queued
+		m_UploadQueue->Push(entry, mipData, textureDesc.mipLevels);
+
+		InterlockedIncrement(&stats.TexturesLoaded);
+	}
+	else
+	{
+		PrintLoadError(entry->path);
+	}
+}
+
+void TextureCache::FinishLoading(Entry* entry)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		entry->loading = false;
+		ReleaseLocked(entry);
+	}
+	m_LoadFinished.notify_all();
+}
+
+void TextureCache::Release(Texture2DEx* texture)
+{
+	if (!texture)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	ReleaseLocked(static_cast<Entry*>(texture));
+}
+
+void TextureCache::ReleaseLocked(Entry* entry)
+{
+	assert(entry->refCount > 0);
+	if (--entry->refCount > 0)
+		return;
+
+	// Only the loading task's own reference can be the last one while the entry is loading
+	assert(!entry->loading);
+
+	m_EntriesByPath.erase(GetPathKey(entry->path, entry->sRGB));
+
+	if (entry->contentOwner)
+	{
+		ReleaseLocked(entry->contentOwner);
+	}
+	else
+	{
+		auto it = m_EntriesByContent.find(ContentKey(entry->contentHash, entry->sRGB));
+		if (it != m_EntriesByContent.end() && it->second == entry)
+			m_EntriesByContent.erase(it);
+
+		if (entry->Texture)
+			m_RendererInterface->destroyTexture(entry->Texture);
+	}
+
+	delete entry;
+}
+
+TextureCache::Stats TextureCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+Texture2DEx* Scene::LoadTextureFromFileAsync(const char* name, bool sRGB, LoadingStats& stats, concurrency::task_group& taskGroup)
+{
+	std::string str_path = GetScenePath();
+	size_t pos = str_path.find_last_of("\\/");
+	str_path = pos ? str_path.substr(0, pos) : "";
+	str_path += '\\';
+	str_path += name;
+
+	Texture2DEx* texture = m_TextureCache->Acquire(str_path, sRGB, stats, taskGroup);
+	m_Textures.push_back(texture);
+
+	return texture;
+}
+
+HRESULT CreateStaticBuffer1(NVRHI::IRendererInterface* rendererInterface, NVRHI::BufferHandle& buffer, uint size, bool isVertexBuffer, void* pData)
+{
+	NVRHI::BufferDesc desc;
+	desc.isVertexBuffer = isVertexBuffer;
+	desc.isIndexBuffer = !isVertexBuffer;
+	desc.byteSize = size;
+	buffer = rendererInterface->createBuffer(desc, pData);
+	return 0;
+}
+
+uint EncodeVectorAsRGBA8S(aiVector3D v)
+{
+	float3 vv = normalize(makefloat3(v.x, v.y, v.z));
+	uint x = uint(vv.x * 127.0f);
+	uint y = uint(vv.y * 127.0f);
+	uint z = uint(vv.z * 127.0f);
+	return (x & 0xff) | ((y & 0xff) << 8) | ((z & 0xff) << 16);
+}
+
+HRESULT Scene::InitResources(NVRHI::IRendererInterface* rendererInterface, TextureCache* textureCache, LoadingStats& stats, concurrency::task_group& taskGroup)
+{	
+	m_rendererInterface = rendererInterface;
+	m_TextureCache = textureCache;
+	
+	if (!m_MeshToSceneMapping.empty())
+	{
+		// Create buffers; they're filled in FinalizeInit
+		NVRHI::BufferDesc desc;
+		desc.isIndexBuffer = true;
+		desc.byteSize = m_IndicesNum * sizeof(int);
+		m_IndexBuffer_rhi = m_rendererInterface->createBuffer(desc, nullptr);
+
+		desc.isIndexBuffer = false;
+		desc.isVertexBuffer = true;
+		desc.byteSize = m_VerticesNum * sizeof(Vertex);
+		m_VertexBuffer_rhi = m_rendererInterface->createBuffer(desc, nullptr);
+	}
+
+	m_Materials.resize(m_MaterialSources.size());
+
+	for (uint materialIndex = 0; materialIndex < m_MaterialSources.size(); ++materialIndex)
+	{
+		const MaterialSource* source = &m_MaterialSources[materialIndex];
+		Material* sceneMaterial = &m_Materials[materialIndex];
+
+		if (!source->m_DiffuseTexture.empty())
+			sceneMaterial->m_DiffuseTexture = LoadTextureFromFileAsync(source->m_DiffuseTexture.c_str(), true, stats, taskGroup);
+
+		if (!source->m_NormalsTexture.empty())
+			sceneMaterial->m_NormalsTexture = LoadTextureFromFileAsync(source->m_NormalsTexture.c_str(), false, stats, taskGroup);
+
+		if (!source->m_EmissiveTexture.empty())
+			sceneMaterial->m_EmissiveTexture = LoadTextureFromFileAsync(source->m_EmissiveTexture.c_str(), false, stats, taskGroup);
+
+		sceneMaterial->m_DiffuseColor = source->m_DiffuseColor;
+	}
+
+	// For a scene with single instance, use one instance matrix buffer for everything.
+	// Frustum culling will not overwrite that buffer, it will only set the mesh instance counts to 0 or 1.
+	// Otherwise each view gets a buffer per mesh, created the first time the view is culled.
+	m_SingleInstanceBuffer = (m_InstanceMatrices.size() == 1);
+	CreateInstanceBuffers();
+
+	for (uint view = 0; view < CULL_VIEWS_COUNT; view++)
+		m_CullViews[view].valid = false;
+
+	return S_OK;
+}
+
+void Scene::CreateInstanceBuffers()
+{
+	if (m_SingleInstanceBuffer)
+	{
+		NVRHI::BufferDesc bufferDesc;
+		bufferDesc.byteSize = GetInstanceStride(m_InstanceFormat);
+		bufferDesc.structStride = GetInstanceStride(m_InstanceFormat);
+		m_InstanceBuffers_rhi.assign(1, m_rendererInterface->createBuffer(bufferDesc, nullptr));
+	}
+	else
+	{
+		m_InstanceBuffers_rhi.assign(CULL_VIEWS_COUNT * GetMeshesNum(), nullptr);
+	}
+}
+
+void Scene::FinalizeInit()
+{
+	if (m_IndicesNum)
+		m_rendererInterface->writeBuffer(m_IndexBuffer_rhi, m_IndexData, m_IndicesNum * sizeof(uint));
+	if (m_VerticesNum)
+		m_rendererInterface->writeBuffer(m_VertexBuffer_rhi, m_VertexData, m_VerticesNum * sizeof(Vertex));
+
+	if (m_SingleInstanceBuffer)
+	{
+		m_rendererInterface->writeBuffer(m_InstanceBuffers_rhi[0], GetPackedInstance(0), GetInstanceStride(m_InstanceFormat));
+	}
+
+	// The textures' pixels have already gone through the upload queue
+	for (auto texture : m_Textures)
+	{
+		if (!texture->Texture)
+        {
+            // If the texture failed to load, unbind it from all materials.
+            for (auto& material : m_Materials)
+            {
+                if (material.m_DiffuseTexture == texture) 
+                    material.m_DiffuseTexture = nullptr;
+                if (material.m_EmissiveTexture == texture) 
+                    material.m_EmissiveTexture = nullptr;
+                if (material.m_NormalsTexture == texture) 
+                    material.m_NormalsTexture = nullptr;
+                if (material.m_SpecularTexture == texture) 
+                    material.m_SpecularTexture = nullptr;
+            }
+        }
+	}
+
+	for(auto& material : m_Materials)
+	{
+		if (material.m_DiffuseTexture && material.m_DiffuseTexture->Texture && material.m_DiffuseTexture->originalBPP == 32)
+			material.m_AlphaTested = true;
+	}
+
+	// Needs the geometry and the alpha test flags
+	SelectOccluders();
+
+	// The GPU has its own copy now
+	Release();
+}
+
+void Scene::SelectOccluders()
+{
+	m_Occluders.clear();
+
+	const uint numInstances = uint(m_InstanceMatrices.size());
+	if (!m_IndexData || !m_VertexData || numInstances == 0)
+		return;
+
+	// Biggest meshes first; alpha tested ones have holes, so they can't hide anything
+	std::vector<std::pair<float, uint>> candidates;
+	for (uint meshID = 0; meshID < GetMeshesNum(); meshID++)
+	{
+		const Material* material = GetMaterial(meshID);
+		if ((material && material->m_AlphaTested) || m_MeshIndicesNum[meshID] == 0)
+			continue;
+
+		float3 size = m_SceneMeshBounds[m_MeshToSceneMapping[meshID]].diagonal();
+		candidates.push_back(std::make_pair(size.x * size.y + size.y * size.z + size.z * size.x, meshID));
+	}
+
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, uint>& a, const std::pair<float, uint>& b) { return a.first > b.first; });
+
+	uint trianglesNum = 0;
+	for (const auto& candidate : candidates)
+	{
+		uint meshID = candidate.second;
+		uint meshTrianglesNum = m_MeshIndicesNum[meshID] / 3;
+		if (trianglesNum + meshTrianglesNum * numInstances > OCCLUDER_TRIANGLES_MAX)
+			continue;
+
+		trianglesNum += meshTrianglesNum * numInstances;
+
+		OccluderMesh occluder;
+		occluder.sceneMesh = m_MeshToSceneMapping[meshID];
+
+		const uint* indices = m_IndexData + m_IndexOffsets[meshID];
+		occluder.indices.assign(indices, indices + meshTrianglesNum * 3);
+
+		uint verticesNum = 0;
+		for (uint index : occluder.indices)
+			verticesNum = __max(verticesNum, index + 1);
+
+		const Vertex* vertices = m_VertexData + m_VertexOffsets[meshID];
+		occluder.positions.resize(verticesNum);
+		for (uint v = 0; v < verticesNum; v++)
+			occluder.positions[v] = vertices[v].m_pos;
+
+		m_Occluders.push_back(std::move(occluder));
+	}
+
+	printf("Selected %d occluder meshes, %d triangles\n", int(m_Occluders.size()), trianglesNum);
+}
+
+void Scene::AddOccluders(OcclusionBuffer& buffer, const Frustum& frustum) const
+{
+	const uint numInstances = uint(m_InstanceMatrices.size());
+	if (m_InstanceBounds.size() != m_SceneMeshBounds.size() * numInstances)
+		return;
+
+	for (const auto& occluder : m_Occluders)
+	{
+		for (uint instance = 0; instance < numInstances; instance++)
+		{
+			if (!frustum.intersectsWith(m_InstanceBounds.get(occluder.sceneMesh * numInstances + instance)))
+				continue;
+
+			buffer.AddOccluder(occluder.positions.data(), uint(occluder.positions.size()), occluder.indices.data(),
+				uint(occluder.indices.size() / 3), m_InstanceMatrices[instance]);
+		}
+	}
+}
+
+void Scene::ReleaseResources()
+{
+	if (!m_rendererInterface)
+		return;
+
+	m_rendererInterface->destroyBuffer(m_IndexBuffer_rhi);
+	m_rendererInterface->destroyBuffer(m_VertexBuffer_rhi);
+
+	// Other scenes may still be using these textures; the cache destroys each one with its last reference
+	for (auto texture : m_Textures)
+	{
+		m_TextureCache->Release(texture);
+	}
+	m_Textures.clear();
+
+	for (auto it : m_InstanceBuffers_rhi)
+	{
+		m_rendererInterface->destroyBuffer(it);
+	}
+	m_InstanceBuffers_rhi.clear();
+}
+
+NVRHI::BufferHandle Scene::GetIndexBuffer_rhi(uint meshID, OUT uint &offset) const
+{
+	if (meshID >= m_IndexOffsets.size()) return NULL;
+
+	offset = m_IndexOffsets[meshID];
+	return m_IndexBuffer_rhi;
+}
+
+NVRHI::BufferHandle Scene::GetVertexBuffer_rhi(uint meshID, OUT uint &offset) const
+{
+	if (meshID >= m_VertexOffsets.size()) return NULL;
+
+	offset = m_VertexOffsets[meshID];
+	return m_VertexBuffer_rhi;
+}
+
+const Material* Scene::GetMaterial(uint meshID) const
+{
+	if (meshID < m_MeshMaterials.size() && m_MeshMaterials[meshID] < m_Materials.size())
+	{
+		return &m_Materials[m_MeshMaterials[meshID]];
+	}
+
+	return NULL;
+}
+
+uint Scene::GetMeshIndicesNum(uint meshID) const
+{
+	if (meshID < m_MeshIndicesNum.size())
+	{
+		return m_MeshIndicesNum[meshID];
+	}
+
+	return 0;
+}
+
+uint Frustum::cullBoxes(const BoxesSoA& boxes, uint first, uint count, uint* visible) const
+{
+	const Frustum* frustum = this;
+	const uint frustumMask = 1;
+	uint visibleNum = 0;
+
+	cullBoxes(&frustum, 1, &frustumMask, 1, boxes, first, count, &visible, &visibleNum);
+
+	return visibleNum;
+}
+
+void Frustum::cullBoxes(const Frustum* const* frustums, uint frustumsNum, const uint* listFrustumMasks, uint listsNum,
+	const BoxesSoA& boxes, uint first, uint count, uint* const* visible, uint* visibleNums)
+{
+	assert(frustumsNum <= MAX_CULL_FRUSTUMS);
+	assert(first + count <= boxes.size());
+
+	for (uint list = 0; list < listsNum; list++)
+		visibleNums[list] = 0;
+
+	if (count == 0)
+		return;
+
+	// For each plane, the box corner furthest along its inner side depends only on the signs of the normal,
+	// so rather than selecting per box it's a choice between the min and max arrays, made once per call
+	const float* cornerX[MAX_CULL_FRUSTUMS][PLANES_COUNT];
+	const float* cornerY[MAX_CULL_FRUSTUMS][PLANES_COUNT];
+	const float* cornerZ[MAX_CULL_FRUSTUMS][PLANES_COUNT];
+	__m128 normalX[MAX_CULL_FRUSTUMS][PLANES_COUNT];
+	__m128 normalY[MAX_CULL_FRUSTUMS][PLANES_COUNT];
+	__m128 normalZ[MAX_CULL_FRUSTUMS][PLANES_COUNT];
+	__m128 distance[MAX_CULL_FRUSTUMS][PLANES_COUNT];
+
+	for (uint f = 0; f < frustumsNum; ++f)
+	{
+		const Plane* planes = frustums[f]->planes;
+
+		for (int i = 0; i < PLANES_COUNT; ++i)
+		{
+			cornerX[f][i] = planes[i].normal.x > 0 ? &boxes.m_MinX[first] : &boxes.m_MaxX[first];
+			cornerY[f][i] = planes[i].normal.y > 0 ? &boxes.m_MinY[first] : &boxes.m_MaxY[first];
+			cornerZ[f][i] = planes[i].normal.z > 0 ? &boxes.m_MinZ[first] : &boxes.m_MaxZ[first];
+			normalX[f][i] = _mm_set1_ps(planes[i].normal.x);
+			normalY[f][i] = _mm_set1_ps(planes[i].normal.y);
+			normalZ[f][i] = _mm_set1_ps(planes[i].normal.z);
+			distance[f][i] = _mm_set1_ps(planes[i].distance);
+		}
+	}
+
+	for (uint group = 0; group < count; group += 4)
+	{
+		// Bit (f * 4 + lane) is set if box lane is inside frustum f
+		uint insideMasks = 0;
+
+		for (uint f = 0; f < frustumsNum; ++f)
 		{
-			point3 meshMin = _minBoundary;
-			point3 meshMax = _maxBoundary;
-
-			for (uint v = 0; v < m_pScene->mMeshes[sceneMesh]->mNumVertices; ++v)
+			// Same products and sums, in the same order, as the scalar test, so the results agree exactly
+			__m128 outside = _mm_setzero_ps();
+			for (int i = 0; i < PLANES_COUNT; ++i)
 			{
-				meshMin.x = __min(meshMin.x, m_pScene->mMeshes[sceneMesh]->mVertices[v].x);
-				meshMin.y = __min(meshMin.y, m_pScene->mMeshes[sceneMesh]->mVertices[v].y);
-				meshMin.z = __min(meshMin.z, m_pScene->mMeshes[sceneMesh]->mVertices[v].z);
-
-				meshMax.x = __max(meshMax.x, m_pScene->mMeshes[sceneMesh]->mVertices[v].x);
-				meshMax.y = __max(meshMax.y, m_pScene->mMeshes[sceneMesh]->mVertices[v].y);
-				meshMax.z = __max(meshMax.z, m_pScene->mMeshes[sceneMesh]->mVertices[v].z);
+				__m128 planeDot = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(normalX[f][i], _mm_loadu_ps(cornerX[f][i] + group)), _mm_mul_ps(normalY[f][i], _mm_loadu_ps(cornerY[f][i] + group))),
+					_mm_mul_ps(normalZ[f][i], _mm_loadu_ps(cornerZ[f][i] + group)));
+				outside = _mm_or_ps(outside, _mm_cmpgt_ps(planeDot, distance[f][i]));
 			}
 
-			const point3 bboxVertices[] = {
-				makepoint3(meshMin.x, meshMin.y, meshMin.z),
-				makepoint3(meshMin.x, meshMin.y, meshMax.z),
-				makepoint3(meshMin.x, meshMax.y, meshMin.z),
-				makepoint3(meshMin.x, meshMax.y, meshMax.z),
-				makepoint3(meshMax.x, meshMin.y, meshMin.z),
-				makepoint3(meshMax.x, meshMin.y, meshMax.z),
-				makepoint3(meshMax.x, meshMax.y, meshMin.z),
-				makepoint3(meshMax.x, meshMax.y, meshMax.z),
-			};
+			insideMasks |= (~uint(_mm_movemask_ps(outside)) & 0xf) << (f * 4);
+		}
 
-			m_SceneMeshInstanceBounds[sceneMesh].resize(m_InstanceMatrices.size());
+		// Compact the visible lanes into each list; lanes past the end are read from the padding and dropped here
+		uint lanes = __min(4u, count - group);
 
-			for (uint instance = 0; instance < m_InstanceMatrices.size(); instance++)
+		for (uint list = 0; list < listsNum; list++)
+		{
+			uint insideMask = 0;
+			for (uint f = 0; f < frustumsNum; ++f)
 			{
-				point3 instanceMin = _minBoundary;
-				point3 instanceMax = _maxBoundary;
-
-				for (uint v = 0; v < 8; v++)
-				{
-					float4 transformedVertex = makefloat4(makefloat3(bboxVertices[v]), 1.0f) * m_InstanceMatrices[instance];
-					transformedVertex /= transformedVertex.w;
-
-					point3 transformedPt = makepoint3(transformedVertex);
-
-					instanceMin = min(instanceMin, transformedPt);
-					instanceMax = max(instanceMax, transformedPt);
-				}
+				if (listFrustumMasks[list] & (1 << f))
+					insideMask |= insideMasks >> (f * 4);
+			}
 
-				m_SceneMeshInstanceBounds[sceneMesh][instance] = makebox3(instanceMin, instanceMax);
+			uint* listVisible = visible[list];
+			uint visibleNum = visibleNums[list];
 
-				m_SceneBounds.m_mins = min(m_SceneBounds.m_mins, instanceMin);
-				m_SceneBounds.m_maxs = max(m_SceneBounds.m_maxs, instanceMax);
+			for (uint lane = 0; lane < lanes; lane++)
+			{
+				listVisible[visibleNum] = group + lane;
+				visibleNum += (insideMask >> lane) & 1;
 			}
 
+			visibleNums[list] = visibleNum;
 		}
 	}
 }
 
-uint GetMipLevelsNum(uint width, uint height)
+// Bounds of two boxes together. Unlike boxUnion, empty boxes aren't dropped.
+static box3 EncloseBoxes(const box3& a, const box3& b)
 {
-	uint size = __min(width, height);
-	uint levelsNum = (uint)(logf((float)size) / logf(2.0f)) + 1;
+	return makebox3(min(a.m_mins, b.m_mins), max(a.m_maxs, b.m_maxs));
+}
 
-	return levelsNum;
+// Bounds of both corners of a box. Frustum::intersectsWith reads the corners of a box with min > max as they are,
+// so a node has to contain all of them for its tests to hold for every box under it.
+static box3 BoxCorners(const box3& box)
+{
+	return makebox3(min(box.m_mins, box.m_maxs), max(box.m_mins, box.m_maxs));
 }
 
-Texture2DEx* Scene::LoadTextureFromFileAsync(const char* name, bool sRGB, LoadingStats& stats, concurrency::task_group& taskGroup)
+// Proportional to the surface area, which is all the SAH needs
+static float HalfArea(const box3& box)
 {
-	std::string str_path = GetScenePath();
-	size_t pos = str_path.find_last_of("\\/");
-	str_path = pos ? str_path.substr(0, pos) : "";
-	str_path += '\\';
-	str_path += name;
+	float3 size = box.diagonal();
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
 
-	std::string name_copy = name;
+void InstanceBVH::Build(const BoxesSoA& boxes)
+{
+	const uint boxesNum = boxes.size();
 
-	// First see if this texture is already loaded (or being loaded).
+	m_Nodes.clear();
+	m_BoxIndices.resize(boxesNum);
+
+	if (boxesNum == 0)
+		return;
 
-	Texture2DEx* texture = m_LoadedTextures[str_path];
-	if (texture)
+	std::vector<point3> centers(boxesNum);
+	for (uint box = 0; box < boxesNum; box++)
 	{
-		return texture;
+		m_BoxIndices[box] = box;
+		centers[box] = boxes.get(box).center();
 	}
 
-	// Allocate a new texture slot for this file name and return it. Load the file later in a thread pool.
-	// LoadTextureFromFileAsync function for a given scene is only called from one thread, so there is no 
-	// chance of loading the same texture twice.
+	// Every split leaves at least one box on each side, so there are at most 2 * boxesNum - 1 nodes
+	m_Nodes.reserve(2 * boxesNum - 1);
 
-	texture = new Texture2DEx();
-	m_LoadedTextures[str_path] = texture;
-	InterlockedIncrement(&stats.TexturesTotal);
+	Node root = { makebox3Empty(), 0, 0, boxesNum };
+	m_Nodes.push_back(root);
+
+	std::vector<uint> pending(1, 0);
 
-	taskGroup.run([this, sRGB, &stats, texture, str_path, name_copy]() 
+	while (!pending.empty())
 	{
-		FREE_IMAGE_FORMAT imageFormat = FreeImage_GetFileType(str_path.c_str());
+		const uint nodeIndex = pending.back();
+		pending.pop_back();
+
+		const uint first = m_Nodes[nodeIndex].boxFirst;
+		const uint count = m_Nodes[nodeIndex].boxCount;
+		uint* indices = m_BoxIndices.data() + first;
+
+		box3 bounds = BoxCorners(boxes.get(indices[0]));
+		box3 centerBounds = makebox3(centers[indices[0]], centers[indices[0]]);
+		for (uint i = 1; i < count; i++)
+		{
+			bounds = EncloseBoxes(bounds, BoxCorners(boxes.get(indices[i])));
+			centerBounds = boxUnion(centerBounds, centers[indices[i]]);
+		}
+
+		m_Nodes[nodeIndex].bounds = bounds;
+
+		if (count <= MAX_LEAF_BOXES)
+			continue;
 
-		FIBITMAP* pBitmap = FreeImage_Load(imageFormat, str_path.c_str());
-		if (pBitmap)
+		// Split across the axis the centers are most spread out along
+		const float3 extent = centerBounds.diagonal();
+		const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+		// If they're all in the same place, any split is as good as another
+		uint leftCount = count / 2;
+
+		if (extent[axis] > 0)
 		{
-			uint width = FreeImage_GetWidth(pBitmap);
-			uint height = FreeImage_GetHeight(pBitmap);
-			uint bpp = FreeImage_GetBPP(pBitmap);
-			texture->originalBPP = bpp;
+			// Bin the boxes by center, and split at the bin boundary with the lowest surface area heuristic cost
+			const float axisMin = centerBounds.m_mins[axis];
+			const float binScale = SAH_BINS / extent[axis];
+			auto binOf = [&](uint box) { return __min(uint((centers[box][axis] - axisMin) * binScale), uint(SAH_BINS - 1)); };
 
-			NVRHI::Format::Enum formatRHI = NVRHI::Format::UNKNOWN;
+			uint binCounts[SAH_BINS] = {};
+			box3 binBounds[SAH_BINS];
+			for (uint bin = 0; bin < SAH_BINS; bin++)
+				binBounds[bin] = makebox3Empty();
 
-			switch (bpp)
+			for (uint i = 0; i < count; i++)
 			{
-			case 8:
-				formatRHI = NVRHI::Format::R8_UNORM;
-				break;
+				uint bin = binOf(indices[i]);
+				binCounts[bin]++;
+				binBounds[bin] = boxUnion(binBounds[bin], boxes.get(indices[i]));
+			}
 
-			case 24:
+			// Cost of everything from each bin up, then sweep up from the bottom to find the best boundary
+			float rightCosts[SAH_BINS];
+			box3 sideBounds = makebox3Empty();
+			uint sideCount = 0;
+			for (uint bin = SAH_BINS - 1; bin > 0; bin--)
 			{
-				FIBITMAP* newBitmap = FreeImage_ConvertTo32Bits(pBitmap);
-				FreeImage_Unload(pBitmap);
-				pBitmap = newBitmap;
-				formatRHI = sRGB ? NVRHI::Format::SBGRA8_UNORM : NVRHI::Format::BGRA8_UNORM;
-				break;
+				sideBounds = boxUnion(sideBounds, binBounds[bin]);
+				sideCount += binCounts[bin];
+				rightCosts[bin] = sideCount ? HalfArea(sideBounds) * sideCount : 0;
 			}
 
-			case 32:
-				formatRHI = sRGB ? NVRHI::Format::SBGRA8_UNORM : NVRHI::Format::BGRA8_UNORM;
-				break;
+			float bestCost = std::numeric_limits<float>::max();
+			uint bestBin = 0;
+			sideBounds = makebox3Empty();
+			sideCount = 0;
+			for (uint bin = 1; bin < SAH_BINS; bin++)
+			{
+				sideBounds = boxUnion(sideBounds, binBounds[bin - 1]);
+				sideCount += binCounts[bin - 1];
+				if (sideCount == 0 || sideCount == count)
+					continue;
 
-			default:
-				FreeImage_Unload(pBitmap);
-				return;
+				float cost = HalfArea(sideBounds) * sideCount + rightCosts[bin];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestBin = bin;
+				}
 			}
 
-			NVRHI::TextureDesc textureDesc;
-			textureDesc.width = width;
-			textureDesc.height = height;
-			textureDesc.format = formatRHI;
-			textureDesc.mipLevels = GetMipLevelsNum(width, height);
-			textureDesc.debugName = name_copy.c_str();
-			NVRHI::TextureHandle textureHandle = m_rendererInterface->createTexture(textureDesc, nullptr);
-			texture->Texture = textureHandle;
+			if (bestBin)
+				leftCount = uint(std::partition(indices, indices + count, [&](uint box) { return binOf(box) < bestBin; }) - indices);
+		}
 
-			texture->mipData[0] = pBitmap;
+		// Children are always added after their parent, which Refit relies on
+		const uint children = uint(m_Nodes.size());
+		const Node left = { makebox3Empty(), 0, first, leftCount };
+		const Node right = { makebox3Empty(), 0, first + leftCount, count - leftCount };
 
-			for (uint mipLevel = 1; mipLevel < textureDesc.mipLevels; mipLevel++)
-			{
-				width /= 2;
-				height /= 2;
-				texture->mipData[mipLevel] = FreeImage_Rescale(texture->mipData[mipLevel - 1], width, height, FILTER_BILINEAR);
-			}
+		m_Nodes[nodeIndex].children = children;
+		m_Nodes.push_back(left);
+		m_Nodes.push_back(right);
 
-			InterlockedIncrement(&stats.TexturesLoaded);
+		pending.push_back(children + 1);
+		pending.push_back(children);
+	}
+}
+
+void InstanceBVH::Refit(const BoxesSoA& boxes)
+{
+	// Going backwards, every node's children have been refitted before it
+	for (uint nodeIndex = uint(m_Nodes.size()); nodeIndex-- > 0; )
+	{
+		Node& node = m_Nodes[nodeIndex];
+
+		if (node.children)
+		{
+			node.bounds = EncloseBoxes(m_Nodes[node.children].bounds, m_Nodes[node.children + 1].bounds);
 		}
 		else
 		{
-			char error[MAX_PATH + 50];
-			sprintf_s(error, "Couldn't load texture file `%s`\n", str_path.c_str());
-			OutputDebugStringA(error);
+			node.bounds = BoxCorners(boxes.get(m_BoxIndices[node.boxFirst]));
+			for (uint i = 1; i < node.boxCount; i++)
+				node.bounds = EncloseBoxes(node.bounds, BoxCorners(boxes.get(m_BoxIndices[node.boxFirst + i])));
 		}
-	});
-
-	return texture;
+	}
 }
 
-HRESULT CreateStaticBuffer1(NVRHI::IRendererInterface* rendererInterface, NVRHI::BufferHandle& buffer, uint size, bool isVertexBuffer, void* pData)
+// Tests a box against the planes in planesMask, with the same corners and arithmetic as Frustum::intersectsWith(box3).
+// Returns false if it's outside any of them; otherwise clears the planes it's entirely inside of. Rounding is monotonic,
+// so a box that contains another can only be outside a plane if the other one is too, and inside it if the other is.
+static bool ClipBoxToPlanes(const Frustum& frustum, const box3& box, uint& planesMask)
 {
-	NVRHI::BufferDesc desc;
-	desc.isVertexBuffer = isVertexBuffer;
-	desc.isIndexBuffer = !isVertexBuffer;
-	desc.byteSize = size;
-	buffer = rendererInterface->createBuffer(desc, pData);
-	return 0;
-}
+	for (int i = 0; i < Frustum::PLANES_COUNT; ++i)
+	{
+		if (!(planesMask & (1 << i)))
+			continue;
 
-uint EncodeVectorAsRGBA8S(aiVector3D v)
-{
-	float3 vv = normalize(makefloat3(v.x, v.y, v.z));
-	uint x = uint(vv.x * 127.0f);
-	uint y = uint(vv.y * 127.0f);
-	uint z = uint(vv.z * 127.0f);
-	return (x & 0xff) | ((y & 0xff) << 8) | ((z & 0xff) << 16);
-}
+		const Plane& plane = frustum.planes[i];
+		float3 minPt, maxPt;
 
-HRESULT Scene::InitResources(NVRHI::IRendererInterface* rendererInterface, LoadingStats& stats, concurrency::task_group& taskGroup)
-{	
-	m_rendererInterface = rendererInterface;
-	
-	if (!m_pScene)
-		return E_FAIL;
+		minPt.x = plane.normal.x > 0 ? box.m_mins.x : box.m_maxs.x;
+		minPt.y = plane.normal.y > 0 ? box.m_mins.y : box.m_maxs.y;
+		minPt.z = plane.normal.z > 0 ? box.m_mins.z : box.m_maxs.z;
 
-	if (m_pScene->mNumMeshes)
-	{
-		std::vector<std::pair<uint, uint>> meshMaterials(m_pScene->mNumMeshes);
-		for (uint sceneMesh = 0; sceneMesh < m_pScene->mNumMeshes; ++sceneMesh)
-		{
-			meshMaterials[sceneMesh] = std::pair<uint, uint>(sceneMesh, m_pScene->mMeshes[sceneMesh]->mMaterialIndex);
-		}
+		float minDistance = plane.normal.x * minPt.x + plane.normal.y * minPt.y + plane.normal.z * minPt.z;
+		if (minDistance > plane.distance)
+			return false;
 
-		std::sort(meshMaterials.begin(), meshMaterials.end(), [](std::pair<uint, uint> a, std::pair<uint, uint> b) { return a.second < b.second; });
+		maxPt.x = plane.normal.x > 0 ? box.m_maxs.x : box.m_mins.x;
+		maxPt.y = plane.normal.y > 0 ? box.m_maxs.y : box.m_mins.y;
+		maxPt.z = plane.normal.z > 0 ? box.m_maxs.z : box.m_mins.z;
 
-		m_IndexOffsets.resize(m_pScene->mNumMeshes);
-		m_VertexOffsets.resize(m_pScene->mNumMeshes);
+		float maxDistance = plane.normal.x * maxPt.x + plane.normal.y * maxPt.y + plane.normal.z * maxPt.z;
+		if (maxDistance <= plane.distance)
+			planesMask &= ~(1u << i);
+	}
 
-		uint totalIndices = 0;
-		uint totalVertices = 0;
+	return true;
+}
 
-		// Count all the indices and vertices first
-		for (uint meshID = 0; meshID < m_pScene->mNumMeshes; ++meshID)
-		{
-			m_IndexOffsets[meshID] = totalIndices;
-			m_VertexOffsets[meshID] = totalVertices;
-			uint sceneMesh = meshMaterials[meshID].first;
+void InstanceBVH::Cull(const Frustum* const* frustums, uint frustumsNum, const BoxesSoA& boxes,
+	std::vector<uint>& visible, std::vector<uint>& visibleFrustums, Stats* stats) const
+{
+	assert(frustumsNum <= Frustum::MAX_CULL_FRUSTUMS);
 
-			totalIndices += m_pScene->mMeshes[sceneMesh]->mNumFaces * 3;
-			totalVertices += m_pScene->mMeshes[sceneMesh]->mNumVertices;
-		}
+	visible.clear();
+	visibleFrustums.clear();
 
-		//printf("%d meshes, %d indices, %d vertices\n", m_pScene->mNumMeshes, totalIndices, totalVertices);
+	Stats counters = {};
 
-		// Create buffer images
-		m_Indices.resize(totalIndices);
-		m_Vertices.resize(totalVertices);
+	// A node's state has, for each frustum f, the planes it still straddles at bit f * PLANES_COUNT, and bit INSIDE_SHIFT + f
+	// if it's entirely inside; a frustum it's outside of has neither
+	const uint ALL_PLANES = (1 << Frustum::PLANES_COUNT) - 1;
+	const uint INSIDE_SHIFT = Frustum::MAX_CULL_FRUSTUMS * Frustum::PLANES_COUNT;
 
-		m_MeshToSceneMapping.resize(m_pScene->mNumMeshes);
+	std::vector<PendingNode>& pending = m_Pending;
+	pending.clear();
 
-		// Copy data into buffer images
-		for (uint meshID = 0; meshID < m_pScene->mNumMeshes; ++meshID)
-		{
-			m_MeshToSceneMapping[meshID] = meshMaterials[meshID].first;
+	if (!m_Nodes.empty() && frustumsNum > 0)
+	{
+		PendingNode root = { 0, 0 };
+		for (uint f = 0; f < frustumsNum; f++)
+			root.state |= ALL_PLANES << (f * Frustum::PLANES_COUNT);
 
-			uint sceneMesh = meshMaterials[meshID].first;
-			uint indexOffset = m_IndexOffsets[meshID];
-			uint vertexOffset = m_VertexOffsets[meshID];
+		pending.push_back(root);
+	}
 
-			const aiMesh* pMesh = m_pScene->mMeshes[sceneMesh];
-			
-			// Indices
-			for (uint f = 0; f < pMesh->mNumFaces; ++f)
-			{
-				memcpy(&m_Indices[indexOffset + f * 3], pMesh->mFaces[f].mIndices, sizeof(int) * 3);
-			}
+	while (!pending.empty())
+	{
+		const PendingNode entry = pending.back();
+		pending.pop_back();
 
+		const Node& node = m_Nodes[entry.node];
+		uint state = entry.state;
 
-			for (unsigned int nVertex = 0; nVertex < pMesh->mNumVertices; nVertex++)
-			{
-				Vertex* pVertex = &m_Vertices[vertexOffset + nVertex];
-				pVertex->m_pos = *(float3*)&pMesh->mVertices[nVertex];
+		counters.NodesVisited++;
 
-				if(pMesh->HasTextureCoords(0)) 
-					pVertex->m_texcoord = *(float2*)&pMesh->mTextureCoords[0][nVertex];
+		for (uint f = 0; f < frustumsNum; f++)
+		{
+			uint planesMask = (state >> (f * Frustum::PLANES_COUNT)) & ALL_PLANES;
+			if (!planesMask)
+				continue;
 
-				if(pMesh->HasNormals()) 
-					pVertex->m_normal = EncodeVectorAsRGBA8S(pMesh->mNormals[nVertex]);
+			state &= ~(ALL_PLANES << (f * Frustum::PLANES_COUNT));
 
-				if (pMesh->HasTangentsAndBitangents())
-				{
-					pVertex->m_tangent = EncodeVectorAsRGBA8S(pMesh->mTangents[nVertex]);
-					pVertex->m_bitangent = EncodeVectorAsRGBA8S(pMesh->mBitangents[nVertex]);
-				}
-			}
+			if (ClipBoxToPlanes(*frustums[f], node.bounds, planesMask))
+				state |= planesMask ? planesMask << (f * Frustum::PLANES_COUNT) : 1 << (INSIDE_SHIFT + f);
 		}
 
-		// Create buffers
-		NVRHI::BufferDesc desc;
-		desc.isIndexBuffer = true;
-		desc.byteSize = totalIndices * sizeof(int);
-		m_IndexBuffer_rhi = m_rendererInterface->createBuffer(desc, nullptr);
-
-		desc.isIndexBuffer = false;
-		desc.isVertexBuffer = true;
-		desc.byteSize = totalVertices * sizeof(Vertex);
-		m_VertexBuffer_rhi = m_rendererInterface->createBuffer(desc, nullptr);
-	}
+		if (!state)
+			continue;
 
-	if (m_pScene->HasMaterials())
-	{
-		m_Materials.resize(m_pScene->mNumMaterials);
+		const uint insideFrustums = state >> INSIDE_SHIFT;
 
-		for (uint materialIndex = 0; materialIndex < m_pScene->mNumMaterials; ++materialIndex)
+		if (!(state & ((1 << INSIDE_SHIFT) - 1)))
 		{
-			aiString texturePath;
-			aiMaterial* material = m_pScene->mMaterials[materialIndex];
-			Material* sceneMaterial = &m_Materials[materialIndex];
+			// Every frustum the node touches contains it entirely, so the whole subtree is visible to them
+			counters.SubtreesAccepted++;
 
-			if (material->GetTexture(aiTextureType_DIFFUSE, 0, &texturePath) == AI_SUCCESS)
+			for (uint i = node.boxFirst; i < node.boxFirst + node.boxCount; i++)
 			{
-				sceneMaterial->m_DiffuseTexture = LoadTextureFromFileAsync(texturePath.C_Str(), true, stats, taskGroup);
+				visible.push_back(m_BoxIndices[i]);
+				visibleFrustums.push_back(insideFrustums);
 			}
+			continue;
+		}
 
-            /* The sample doesn't use specular maps, so there's need to load them.
-			if (material->GetTexture(aiTextureType_SPECULAR, 0, &texturePath) == AI_SUCCESS)
-			{
-				sceneMaterial->m_SpecularTexture = LoadTextureFromFileAsync(texturePath.C_Str(), false, stats, taskGroup);
-			}*/
+		if (node.children)
+		{
+			PendingNode left = { node.children, state };
+			PendingNode right = { node.children + 1, state };
+			pending.push_back(right);
+			pending.push_back(left);
+			continue;
+		}
 
-			if (material->GetTexture(aiTextureType_HEIGHT, 0, &texturePath) == AI_SUCCESS)
-			{
-				sceneMaterial->m_NormalsTexture = LoadTextureFromFileAsync(texturePath.C_Str(), false, stats, taskGroup);
-			}
+		// Test the leaf's boxes against just the planes the leaf straddles
+		for (uint i = node.boxFirst; i < node.boxFirst + node.boxCount; i++)
+		{
+			const uint box = m_BoxIndices[i];
+			const box3 boxBounds = boxes.get(box);
+			uint boxFrustums = insideFrustums;
+
+			counters.BoxesTested++;
 
-			if (material->GetTexture(aiTextureType_EMISSIVE, 0, &texturePath) == AI_SUCCESS)
+			for (uint f = 0; f < frustumsNum; f++)
 			{
-				sceneMaterial->m_EmissiveTexture = LoadTextureFromFileAsync(texturePath.C_Str(), false, stats, taskGroup);
+				uint planesMask = (state >> (f * Frustum::PLANES_COUNT)) & ALL_PLANES;
+				if (planesMask && ClipBoxToPlanes(*frustums[f], boxBounds, planesMask))
+					boxFrustums |= 1 << f;
 			}
 
-			aiColor3D color;
-			if (material->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS)
+			if (boxFrustums)
 			{
-				sceneMaterial->m_DiffuseColor = makefloat3(color.r, color.g, color.b);
+				visible.push_back(box);
+				visibleFrustums.push_back(boxFrustums);
 			}
 		}
 	}
 
-	// For a scene with single instance, use one instance matrix buffer for everything.
-	// Frustum culling will not overwrite that buffer, it will only set the mesh instance counts to 0 or 1.
-	m_SingleInstanceBuffer = (m_InstanceMatrices.size() == 1);
-	uint instanceBuffersNum = m_SingleInstanceBuffer ? 1 : GetMeshesNum();
+	if (stats)
+		*stats = counters;
+}
 
-	m_InstanceBuffers_rhi.resize(instanceBuffersNum);
-	for (uint bufferID = 0; bufferID < instanceBuffersNum; bufferID++)
-	{
-		NVRHI::BufferDesc bufferDesc;
-		bufferDesc.byteSize = uint(sizeof(float4x4) * m_InstanceMatrices.size());
-		bufferDesc.structStride = sizeof(float4x4);
-		NVRHI::BufferHandle buffer = m_rendererInterface->createBuffer(bufferDesc, nullptr);
-		m_InstanceBuffers_rhi[bufferID] = buffer;
-	}
+// Copies the visible instances to the start of the staging range, in whichever layout T is
+template <typename T>
+static void GatherInstances(BYTE* output, const BYTE* instances, const uint* visible, uint visibleNum)
+{
+	T* dst = (T*)output;
+	const T* src = (const T*)instances;
 
-	return S_OK;
+	for (uint j = 0; j < visibleNum; j++)
+		dst[j] = src[visible[j]];
 }
 
-void Scene::FinalizeInit()
+void Scene::FrustumCull(const Frustum* frustums, const OcclusionBuffer* const* occlusion, uint viewMask, bool enableCulling, bool useTree)
 {
-	m_rendererInterface->writeBuffer(m_IndexBuffer_rhi, &m_Indices[0], m_Indices.size() * sizeof(m_Indices[0]));
-	m_rendererInterface->writeBuffer(m_VertexBuffer_rhi, &m_Vertices[0], m_Vertices.size() * sizeof(m_Vertices[0]));
+	const uint numMeshes = GetMeshesNum();
+	const uint numInstances = uint(m_InstanceMatrices.size());
+	const uint stride = GetInstanceStride(m_InstanceFormat);
 
-	if (m_SingleInstanceBuffer)
+	m_InstanceBytesUploaded = 0;
+
+	// Instances moved by SetInstanceMatrix since the last cull; their views have already been invalidated
+	if (m_InstancesMoved)
 	{
-		m_rendererInterface->writeBuffer(m_InstanceBuffers_rhi[0], &m_InstanceMatrices[0], m_InstanceMatrices.size() * sizeof(m_InstanceMatrices[0]));
+		m_InstanceBVH.Refit(m_InstanceBounds);
+		m_InstancesMoved = false;
+
+		if (!m_InstanceBVH.IsEmpty())
+			m_SceneBounds = m_InstanceBVH.GetBounds();
+
+		if (m_SingleInstanceBuffer)
+		{
+			m_rendererInterface->writeBuffer(m_InstanceBuffers_rhi[0], GetPackedInstance(0), stride);
+			m_InstanceBytesUploaded += stride;
+		}
 	}
 
-	for (auto it : m_LoadedTextures)
+	// Find the views whose results are out of date, and the frusta that have to be tested for them
+	const Frustum* testedFrustums[Frustum::MAX_CULL_FRUSTUMS];
+	uint testedFrustumsNum = 0;
+	uint frustumBits[CULL_VIEWS_COUNT] = {};
+	uint views[CULL_VIEWS_COUNT];
+	uint viewFrustumMasks[CULL_VIEWS_COUNT];
+	const OcclusionBuffer* viewOcclusion[CULL_VIEWS_COUNT][2];		// Null if the view isn't occlusion culled
+	uint viewsNum = 0;
+
+	for (uint view = 0; view < CULL_VIEWS_COUNT; view++)
 	{
-		if (it.second->Texture)
+		if (!(viewMask & (1 << view)))
+			continue;
+
+		const uint sourceViews[2] = {
+			view == CULL_VIEW_STEREO ? uint(CULL_VIEW_LEFT) : view,
+			view == CULL_VIEW_STEREO ? uint(CULL_VIEW_RIGHT) : view
+		};
+
+		const bool occlusionCulling = enableCulling && occlusion &&
+			occlusion[sourceViews[0]] && occlusion[sourceViews[0]]->IsRendered() &&
+			occlusion[sourceViews[1]] && occlusion[sourceViews[1]]->IsRendered();
+
+		CullViewState& state = m_CullViews[view];
+		if (state.valid && state.enableCulling == enableCulling && state.occlusionCulling == occlusionCulling &&
+			(!enableCulling || (state.frustums[0] == frustums[sourceViews[0]] && state.frustums[1] == frustums[sourceViews[1]])))
+			continue;
+
+		state.frustums[0] = frustums[sourceViews[0]];
+		state.frustums[1] = frustums[sourceViews[1]];
+		state.enableCulling = enableCulling;
+		state.occlusionCulling = occlusionCulling;
+		state.valid = true;
+
+		viewOcclusion[viewsNum][0] = occlusionCulling ? occlusion[sourceViews[0]] : nullptr;
+		viewOcclusion[viewsNum][1] = occlusionCulling && sourceViews[1] != sourceViews[0] ? occlusion[sourceViews[1]] : nullptr;
+		m_OccludedInstancesNum[view] = 0;
+		memset(&m_TreeStats[view], 0, sizeof(m_TreeStats[view]));
+
+		uint frustumMask = 0;
+		for (uint i = 0; i < 2; i++)
 		{
-			NVRHI::TextureDesc textureDesc = m_rendererInterface->describeTexture(it.second->Texture);
-
-			for (uint mipLevel = 0; mipLevel < textureDesc.mipLevels; mipLevel++)
+			uint sourceView = sourceViews[i];
+			if (!frustumBits[sourceView])
 			{
-				FIBITMAP* mipData = it.second->mipData[mipLevel];
-				void* pData = FreeImage_GetBits(mipData);
-				uint rowPitch = FreeImage_GetPitch(mipData);
-
-				m_rendererInterface->writeTexture(it.second->Texture, mipLevel, pData, rowPitch, 0);
-
-				FreeImage_Unload(mipData);
-				it.second->mipData[mipLevel] = nullptr;
+				frustumBits[sourceView] = 1 << testedFrustumsNum;
+				testedFrustums[testedFrustumsNum++] = &frustums[sourceView];
 			}
+			frustumMask |= frustumBits[sourceView];
 		}
-        else
-        {
-            // If the texture failed to load, unbind it from all materials.
-            for (auto& material : m_Materials)
-            {
-                if (material.m_DiffuseTexture == it.second) 
-                    material.m_DiffuseTexture = nullptr;
-                if (material.m_EmissiveTexture == it.second) 
-                    material.m_EmissiveTexture = nullptr;
-                if (material.m_NormalsTexture == it.second) 
-                    material.m_NormalsTexture = nullptr;
-                if (material.m_SpecularTexture == it.second) 
-                    material.m_SpecularTexture = nullptr;
-            }
-        }
-	}
 
-	for(auto& material : m_Materials)
-	{
-		if (material.m_DiffuseTexture && material.m_DiffuseTexture->Texture && material.m_DiffuseTexture->originalBPP == 32)
-			material.m_AlphaTested = true;
+		views[viewsNum] = view;
+		viewFrustumMasks[viewsNum] = frustumMask;
+		viewsNum++;
 	}
-}
 
-void Scene::ReleaseResources()
-{
-	if (!m_rendererInterface)
+	if (viewsNum == 0)
 		return;
 
-	m_rendererInterface->destroyBuffer(m_IndexBuffer_rhi);
-	m_rendererInterface->destroyBuffer(m_VertexBuffer_rhi);
-
-	for (auto it : m_LoadedTextures)
+	for (uint i = 0; i < viewsNum; i++)
 	{
-		m_rendererInterface->destroyTexture(it.second->Texture);
-		delete it.second;
+		if (m_VisibleList[views[i]].size() != m_InstanceBounds.size())
+			m_VisibleList[views[i]].resize(m_InstanceBounds.size());
 	}
-	m_LoadedTextures.clear();
 
-	for (auto it : m_InstanceBuffers_rhi)
+	// Only for boxes that are already known to be in the frustum; occluded means hidden from every source view
+	auto isOccluded = [&](uint i, const box3& box)
 	{
-		m_rendererInterface->destroyBuffer(it);
-	}
-	m_InstanceBuffers_rhi.clear();
-}
-
-NVRHI::BufferHandle Scene::GetIndexBuffer_rhi(uint meshID, OUT uint &offset) const
-{
-	if (meshID >= m_IndexOffsets.size()) return NULL;
-
-	offset = m_IndexOffsets[meshID];
-	return m_IndexBuffer_rhi;
-}
-
-NVRHI::BufferHandle Scene::GetVertexBuffer_rhi(uint meshID, OUT uint &offset) const
-{
-	if (meshID >= m_VertexOffsets.size()) return NULL;
-
-	offset = m_VertexOffsets[meshID];
-	return m_VertexBuffer_rhi;
-}
+		return !viewOcclusion[i][0]->IsVisible(box) && !(viewOcclusion[i][1] && viewOcclusion[i][1]->IsVisible(box));
+	};
 
-const Material* Scene::GetMaterial(uint meshID) const
-{
-	if (m_pScene->HasMaterials() && meshID < m_MeshToSceneMapping.size())
+	// The views share one traversal, so they also share its stats
+	auto cullTree = [&]()
 	{
-		uint materialIndex = m_pScene->mMeshes[m_MeshToSceneMapping[meshID]]->mMaterialIndex;
-		return &m_Materials[materialIndex];
-	}
+		m_InstanceBVH.Cull(testedFrustums, testedFrustumsNum, m_InstanceBounds, m_TreeVisible, m_TreeVisibleFrustums, &m_TreeStats[views[0]]);
+		for (uint i = 1; i < viewsNum; i++)
+			m_TreeStats[views[i]] = m_TreeStats[views[0]];
+	};
 
-	return NULL;
-}
+	if(m_SingleInstanceBuffer)
+	{ 
+		// With one instance, the bounds of all the meshes are contiguous, so they're culled in one go
+		uint* visible[CULL_VIEWS_COUNT];
+		uint visibleNums[CULL_VIEWS_COUNT];
 
-uint Scene::GetMeshIndicesNum(uint meshID) const
-{
-	if (m_pScene && meshID < m_pScene->mNumMeshes)
-	{
-		return m_pScene->mMeshes[m_MeshToSceneMapping[meshID]]->mNumFaces * 3;
-	}
+		for (uint i = 0; i < viewsNum; i++)
+		{
+			std::vector<uint>& counts = m_CulledInstanceCounts[views[i]];
+			counts.assign(numMeshes, enableCulling ? 0 : 1);
+			visible[i] = m_VisibleList[views[i]].data();
+		}
 
-	return 0;
-}
+		if (enableCulling && useTree)
+		{
+			cullTree();
 
-void Scene::FrustumCull(const Frustum& frustum, bool enableCulling)
-{
-	const uint numMeshes = GetMeshesNum();
-	const uint numInstances = uint(m_InstanceMatrices.size());
+			for (uint j = 0; j < m_TreeVisible.size(); j++)
+			{
+				for (uint i = 0; i < viewsNum; i++)
+				{
+					if (m_TreeVisibleFrustums[j] & viewFrustumMasks[i])
+						m_CulledInstanceCounts[views[i]][m_SceneToMeshMapping[m_TreeVisible[j]]] = 1;
+				}
+			}
+		}
+		else if (enableCulling)
+		{
+			Frustum::cullBoxes(testedFrustums, testedFrustumsNum, viewFrustumMasks, viewsNum, m_InstanceBounds, 0, numMeshes, visible, visibleNums);
 
-	if(m_SingleInstanceBuffer)
-	{ 
-		for (uint meshID = 0; meshID < numMeshes; meshID++)
+			for (uint i = 0; i < viewsNum; i++)
+			{
+				for (uint j = 0; j < visibleNums[i]; j++)
+					m_CulledInstanceCounts[views[i]][m_SceneToMeshMapping[visible[i][j]]] = 1;
+			}
+		}
+
+		for (uint i = 0; i < viewsNum; i++)
 		{
-			uint sceneMesh = m_MeshToSceneMapping[meshID];
+			if (!viewOcclusion[i][0])
+				continue;
 
-			m_CulledInstanceCounts[meshID] = (!enableCulling || frustum.intersectsWith(m_SceneMeshInstanceBounds[sceneMesh][0])) ? 1 : 0;
+			std::vector<uint>& counts = m_CulledInstanceCounts[views[i]];
+			uint* occludedNum = &m_OccludedInstancesNum[views[i]];
+
+			concurrency::parallel_for(0u, numMeshes, [&](uint meshID)
+			{
+				if (counts[meshID] && isOccluded(i, m_InstanceBounds.get(m_MeshToSceneMapping[meshID])))
+				{
+					counts[meshID] = 0;
+					InterlockedIncrement(occludedNum);
+				}
+			});
 		}
 	}
 	else
 	{
-		std::vector<float4x4> matrices;
-		matrices.resize(numInstances);
+		for (uint i = 0; i < viewsNum; i++)
+		{
+			if (m_CulledInstances[views[i]].size() != m_InstanceBounds.size() * stride)
+				m_CulledInstances[views[i]].resize(m_InstanceBounds.size() * stride);
+		}
 
-		for (uint meshID = 0; meshID < numMeshes; meshID++)
+		if (enableCulling && useTree)
 		{
-			uint sceneMesh = m_MeshToSceneMapping[meshID];
-			uint culledInstancesNum = 0;
-			if (enableCulling)
+			// One traversal for all the views; each visible instance goes to its mesh's part of each view's list
+			cullTree();
+
+			for (uint i = 0; i < viewsNum; i++)
+				m_CulledInstanceCounts[views[i]].assign(numMeshes, 0);
+
+			for (uint j = 0; j < m_TreeVisible.size(); j++)
 			{
-				for (uint instanceID = 0; instanceID < numInstances; instanceID++)
+				uint sceneMesh = m_TreeVisible[j] / numInstances;
+				uint instance = m_TreeVisible[j] - sceneMesh * numInstances;
+				uint meshID = m_SceneToMeshMapping[sceneMesh];
+
+				for (uint i = 0; i < viewsNum; i++)
 				{
-					if (frustum.intersectsWith(m_SceneMeshInstanceBounds[sceneMesh][instanceID]))
+					if (m_TreeVisibleFrustums[j] & viewFrustumMasks[i])
 					{
-						matrices[culledInstancesNum] = m_InstanceMatrices[instanceID];
-						culledInstancesNum++;
+						uint& count = m_CulledInstanceCounts[views[i]][meshID];
+						m_VisibleList[views[i]][sceneMesh * numInstances + count++] = instance;
 					}
 				}
 			}
-			else
+		}
+
+		if (enableCulling)
+		{
+			// Each mesh culls and compacts its instances into its own part of each view's staging array,
+			// or with the tree, just gathers the ones it found
+			concurrency::parallel_for(0u, numMeshes, [&](uint meshID)
 			{
-				culledInstancesNum = numInstances;
-				memcpy(&matrices[0], &m_InstanceMatrices[0], sizeof(float4x4) * numInstances);
-			}
+				uint sceneMesh = m_MeshToSceneMapping[meshID];
+				uint* visible[CULL_VIEWS_COUNT];
+				uint visibleNums[CULL_VIEWS_COUNT];
+
+				for (uint i = 0; i < viewsNum; i++)
+					visible[i] = m_VisibleList[views[i]].data() + sceneMesh * numInstances;
+
+				if (useTree)
+				{
+					for (uint i = 0; i < viewsNum; i++)
+						visibleNums[i] = m_CulledInstanceCounts[views[i]][meshID];
+				}
+				else
+				{
+					Frustum::cullBoxes(testedFrustums, testedFrustumsNum, viewFrustumMasks, viewsNum, m_InstanceBounds, sceneMesh * numInstances, numInstances, visible, visibleNums);
+				}
+
+				// Drop the occluded instances from the lists, keeping the order
+				for (uint i = 0; i < viewsNum; i++)
+				{
+					if (!viewOcclusion[i][0])
+						continue;
+
+					uint unoccludedNum = 0;
+					for (uint j = 0; j < visibleNums[i]; j++)
+					{
+						uint instance = visible[i][j];
+						if (!isOccluded(i, m_InstanceBounds.get(sceneMesh * numInstances + instance)))
+							visible[i][unoccludedNum++] = instance;
+					}
+
+					if (unoccludedNum < visibleNums[i])
+						InterlockedExchangeAdd(&m_OccludedInstancesNum[views[i]], visibleNums[i] - unoccludedNum);
+					visibleNums[i] = unoccludedNum;
+				}
 
-			m_CulledInstanceCounts[meshID] = culledInstancesNum;
+				for (uint i = 0; i < viewsNum; i++)
+				{
+					BYTE* instances = m_CulledInstances[views[i]].data() + sceneMesh * numInstances * stride;
+
+					switch (m_InstanceFormat)
+					{
+					case InstanceFormat::FLOAT3X4:	GatherInstances<InstanceFloat3x4>(instances, GetPackedInstance(0), visible[i], visibleNums[i]); break;
+					case InstanceFormat::QUANTIZED:	GatherInstances<InstanceQuantized>(instances, GetPackedInstance(0), visible[i], visibleNums[i]); break;
+					default:						GatherInstances<float4x4>(instances, GetPackedInstance(0), visible[i], visibleNums[i]); break;
+					}
+
+					m_CulledInstanceCounts[views[i]][meshID] = visibleNums[i];
+				}
+			});
+		}
+
+		// Uploads go through the renderer's command list, so they stay on this thread, and only cover the visible instances
+		for (uint i = 0; i < viewsNum; i++)
+		{
+			uint view = views[i];
 
-			if (culledInstancesNum > 0)
+			for (uint meshID = 0; meshID < numMeshes; meshID++)
 			{
-				m_rendererInterface->writeBuffer(m_InstanceBuffers_rhi[meshID], &matrices[0], sizeof(float4x4) * numInstances);
+				uint culledInstancesNum = enableCulling ? m_CulledInstanceCounts[view][meshID] : numInstances;
+				const BYTE* instances = enableCulling ? m_CulledInstances[view].data() + m_MeshToSceneMapping[meshID] * numInstances * stride : GetPackedInstance(0);
+
+				m_CulledInstanceCounts[view][meshID] = culledInstancesNum;
+
+				if (culledInstancesNum > 0)
+				{
+					NVRHI::BufferHandle& buffer = m_InstanceBuffers_rhi[view * numMeshes + meshID];
+					if (!buffer)
+					{
+						NVRHI::BufferDesc bufferDesc;
+						bufferDesc.byteSize = stride * numInstances;
+						bufferDesc.structStride = stride;
+						buffer = m_rendererInterface->createBuffer(bufferDesc, nullptr);
+					}
+
+					m_rendererInterface->writeBuffer(buffer, instances, stride * culledInstancesNum);
+					m_InstanceBytesUploaded += stride * culledInstancesNum;
+				}
 			}
 		}
 	}
@@ -40,8 +40,13 @@
 #include "assimp/scene.h"
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
 #include <ppl.h>
 #include "GFSDK_NVRHI.h"
+#include "InstanceTransform.h"
 
 using namespace util;
 
@@ -74,6 +79,35 @@ struct Plane
 	}
 };
 
+// Axis-aligned boxes in structure-of-arrays form, so that the frustum can test four at once.
+// The arrays have 3 floats of padding at the end, so a 4-wide load is valid at any index.
+struct BoxesSoA
+{
+	std::vector<float> m_MinX, m_MinY, m_MinZ;
+	std::vector<float> m_MaxX, m_MaxY, m_MaxZ;
+
+	enum { PADDING = 3 };
+
+	uint size() const { return m_MinX.empty() ? 0 : uint(m_MinX.size()) - PADDING; }
+
+	void resize(uint count)
+	{
+		m_MinX.assign(count + PADDING, 0.f); m_MinY.assign(count + PADDING, 0.f); m_MinZ.assign(count + PADDING, 0.f);
+		m_MaxX.assign(count + PADDING, 0.f); m_MaxY.assign(count + PADDING, 0.f); m_MaxZ.assign(count + PADDING, 0.f);
+	}
+
+	void set(uint index, const box3& box)
+	{
+		m_MinX[index] = box.m_mins.x; m_MinY[index] = box.m_mins.y; m_MinZ[index] = box.m_mins.z;
+		m_MaxX[index] = box.m_maxs.x; m_MaxY[index] = box.m_maxs.y; m_MaxZ[index] = box.m_maxs.z;
+	}
+
+	box3 get(uint index) const
+	{
+		return makebox3(m_MinX[index], m_MinY[index], m_MinZ[index], m_MaxX[index], m_MaxY[index], m_MaxZ[index]);
+	}
+};
+
 struct Frustum
 {
 	enum FrustumPlanes
@@ -146,6 +180,65 @@ struct Frustum
 		return true;
 	}
 
+	bool operator == (const Frustum &f) const { return memcmp(planes, f.planes, sizeof(planes)) == 0; }
+
+	// Tests boxes [first, first + count) four at a time, with exactly the same arithmetic as intersectsWith(box3),
+	// and writes the ones that intersect to visible[] as offsets from first, in order. Returns how many there are.
+	uint cullBoxes(const BoxesSoA& boxes, uint first, uint count, uint* visible) const;
+
+	// The same for several frusta in one pass over the boxes. Each output list gets the boxes that intersect any of
+	// the frusta in its mask (bit i for frustums[i]), and its length is written to visibleNums[list].
+	enum { MAX_CULL_FRUSTUMS = 4 };
+	static void cullBoxes(const Frustum* const* frustums, uint frustumsNum, const uint* listFrustumMasks, uint listsNum,
+		const BoxesSoA& boxes, uint first, uint count, uint* const* visible, uint* visibleNums);
+};
+
+// Bounding volume hierarchy over a set of boxes, for culling them a subtree at a time. Each node covers a contiguous
+// range of m_BoxIndices, so a subtree that's entirely inside the frusta is accepted as one range, and the planes a node
+// is entirely inside of aren't tested again further down. The topology is built once with a binned SAH; when the boxes
+// move, Refit only recomputes the node bounds.
+class InstanceBVH
+{
+public:
+	struct Node
+	{
+		box3 bounds;
+		uint children;			// Index of the first of two adjacent children, or 0 for a leaf
+		uint boxFirst;			// Range of m_BoxIndices covered by the subtree
+		uint boxCount;
+	};
+
+	struct Stats
+	{
+		uint NodesVisited;
+		uint BoxesTested;
+		uint SubtreesAccepted;
+	};
+
+	enum { MAX_LEAF_BOXES = 4, SAH_BINS = 16 };
+
+	void Build(const BoxesSoA& boxes);
+	void Refit(const BoxesSoA& boxes);
+	void Clear() { m_Nodes.clear(); m_BoxIndices.clear(); }
+	bool IsEmpty() const { return m_Nodes.empty(); }
+	const box3& GetBounds() const { return m_Nodes[0].bounds; }
+
+	// Replaces visible[] with the boxes that intersect any of the frusta, in tree order, and visibleFrustums[] with the
+	// mask of frusta (bit i for frustums[i]) each one intersects. Agrees exactly with Frustum::intersectsWith(box3).
+	// Uses the tree's own traversal stack, so one tree can't be culled from several threads at once.
+	void Cull(const Frustum* const* frustums, uint frustumsNum, const BoxesSoA& boxes,
+		std::vector<uint>& visible, std::vector<uint>& visibleFrustums, Stats* stats = nullptr) const;
+
+protected:
+	struct PendingNode
+	{
+		uint node;
+		uint state;
+	};
+
+	std::vector<Node> m_Nodes;
+	std::vector<uint> m_BoxIndices;
+	mutable std::vector<PendingNode> m_Pending;		// Scratch space for Cull, kept so it isn't allocated every frame
 };
 
 struct FIBITMAP;
@@ -154,16 +247,132 @@ struct Texture2DEx
 {
 	int originalBPP;
 	NVRHI::TextureHandle Texture;
-	FIBITMAP* mipData[16];
 
 	Texture2DEx()
 		: originalBPP(0)
 		, Texture(nullptr)
 	{ 
-		memset(mipData, 0, sizeof(mipData));
 	}
 };
 
+// Header of a decoded mip chain in the on-disk mip cache, followed by each level's rows, exactly as
+// FreeImage decoded them (bottom-up, with its row pitch). One file per source image, named by the hash
+// of the source file's contents, so a later load can map it and go straight to upload.
+struct MipCacheHeader
+{
+	enum { MAGIC = 0x5043494d, VERSION = 1 };		// "MICP"
+
+	uint magic;
+	uint version;
+	UINT64 sourceHash;
+	UINT64 sourceSize;
+	uint originalBPP;								// Before the 24 -> 32 bit conversion
+	uint bytesPerPixel;
+	uint mipLevels;
+	uint padding;
+	struct Mip
+	{
+		uint width;
+		uint height;
+		uint rowPitch;
+		uint padding;
+		UINT64 offset;								// From the start of the file
+	} mips[16];
+};
+
+// Entry of the mip cache's index of source files, one file per source path: the hash of the source's
+// contents when it had this size and write time. A later load that finds the source unchanged looks its
+// mip chain up by that hash, without reading and hashing the whole source again.
+struct MipCacheSource
+{
+	enum { MAGIC = 0x5243534d, VERSION = 1 };		// "MSCR"
+
+	uint magic;
+	uint version;
+	UINT64 sourceSize;
+	UINT64 sourceWriteTime;
+	UINT64 sourceHash;
+	char path[MAX_PATH];							// Normalized; the file name is only a hash of it
+};
+
+// Decoded textures waiting to be uploaded. The loading tasks push each texture as soon as its mips
+// are decoded, and the render thread uploads a few of them per frame and frees their pixels, so only
+// about memoryBudget bytes of decoded mips are alive at once instead of every texture in the scene.
+class TextureUploadQueue
+{
+public:
+	struct Stats
+	{
+		uint TexturesUploaded;
+		UINT64 BytesUploaded;
+		UINT64 PeakBytesPending;		// Decoded mips alive at once, waiting for upload
+		UINT64 PeakBytesPerFrame;		// Largest single call to Upload
+		uint PushStalls;				// Times a loading task waited for the queue to drain
+	};
+
+protected:
+	struct PendingTexture
+	{
+		Texture2DEx* texture;
+		const void* mipPixels[16];
+		uint mipRowPitches[16];
+		uint mipLevels;
+		UINT64 byteSize;
+		FIBITMAP* mipData[16];						// Freed after upload, if decoded
+		const MipCacheHeader* mappedFile;			// Unmapped after upload, if read from the mip cache
+	};
+
+	std::deque<PendingTexture>			m_Pending;
+	UINT64								m_BytesPending;
+	UINT64								m_MemoryBudget;
+	Stats								m_Stats;
+	std::mutex							m_Mutex;
+	std::condition_variable				m_SpaceAvailable;
+	bool								m_Shutdown;
+
+	void Enqueue(const PendingTexture& pending);
+	static void FreePending(const PendingTexture& pending);
+
+public:
+	TextureUploadQueue(UINT64 memoryBudget = 256 << 20)
+		: m_BytesPending(0)
+		, m_MemoryBudget(memoryBudget)
+		, m_Shutdown(false)
+	{
+		memset(&m_Stats, 0, sizeof(m_Stats));
+	}
+
+	~TextureUploadQueue()
+	{
+		Clear();
+	}
+
+	// Frees anything still queued and clears the stats, before loading a new set of scenes
+	void Reset(UINT64 memoryBudget);
+
+	// Called from the loading tasks. Takes ownership of the mips, and blocks while the queue already
+	// holds more than the memory budget; a texture bigger than the whole budget goes in once the queue is empty.
+	// After Shutdown, the mips are freed right away instead.
+	void Push(Texture2DEx* texture, FIBITMAP* const* mipData, uint mipLevels);
+
+	// Same, for a mip chain mapped from the mip cache; takes ownership of the view
+	void Push(Texture2DEx* texture, const MipCacheHeader* mappedFile);
+
+	// Called from the render thread. Uploads queued textures, oldest first, until at least maxBytes
+	// have been written or the queue is empty, and frees their mips. Returns the number of textures uploaded.
+	uint Upload(NVRHI::IRendererInterface* rendererInterface, UINT64 maxBytes);
+
+	// Frees everything still queued without uploading it
+	void Clear();
+
+	// Called when the render thread stops uploading, e.g. while loading is cancelled: frees everything
+	// queued, and wakes the loading tasks waiting in Push so they can finish. Reset starts taking textures again.
+	void Shutdown();
+
+	bool IsEmpty();
+	Stats GetStats();
+};
+
 struct Material
 {
 	Texture2DEx* m_DiffuseTexture;
@@ -183,6 +392,64 @@ struct Material
 	}
 };
 
+// Texture file names and constants of a material, as imported, before any textures are loaded
+struct MaterialSource
+{
+	std::string m_DiffuseTexture;
+	std::string m_NormalsTexture;
+	std::string m_EmissiveTexture;
+	float3 m_DiffuseColor;
+
+	MaterialSource()
+		: m_DiffuseColor(makefloat3(0.f))
+	{
+	}
+};
+
+// Layout of a scene cache file: the header, then the mesh table, the material table, the indices
+// and the vertices, at the header's offsets. Everything is in its final form (meshes sorted by material,
+// vertices packed), so a later load maps the file and uploads the buffers straight from it.
+struct SceneCacheHeader
+{
+	enum { MAGIC = 0x434e4353, VERSION = 1 };		// "SCNC"
+
+	uint magic;
+	uint version;
+	UINT64 sourceSize;								// The cache is stale if the source file changes
+	UINT64 sourceWriteTime;
+	uint importFlags;
+	uint vertexSize;
+	uint meshesNum;
+	uint materialsNum;
+	uint indicesNum;
+	uint verticesNum;
+	UINT64 meshesOffset;
+	UINT64 materialsOffset;
+	UINT64 indicesOffset;
+	UINT64 verticesOffset;
+};
+
+struct SceneCacheMesh								// In draw order (meshID)
+{
+	uint sceneMesh;									// Index in the source file
+	uint materialIndex;
+	uint indexOffset;
+	uint vertexOffset;
+	uint indicesNum;
+	float3 boundsMin;								// Object space
+	float3 boundsMax;
+};
+
+struct SceneCacheMaterial
+{
+	char diffuseTexture[MAX_PATH];
+	char normalsTexture[MAX_PATH];
+	char emissiveTexture[MAX_PATH];
+	float3 diffuseColor;
+};
+
+class TextureCache;
+class OcclusionBuffer;
 
 class Scene
 {
@@ -195,11 +462,24 @@ public:
 		uint TexturesLoaded;
 	};
 
+	// Culling results are kept per view, each with its own instance buffers, so the passes of a frame don't
+	// overwrite each other's, and a view that hasn't moved since it was last culled isn't culled or uploaded again.
+	enum CullView
+	{
+		CULL_VIEW_SHADOW = 0,
+		CULL_VIEW_LEFT,							// Also the mono camera
+		CULL_VIEW_RIGHT,
+		CULL_VIEW_STEREO,						// Visible to either eye, for single-pass and instanced stereo
+		CULL_VIEWS_COUNT
+	};
+
 protected:
 	NVRHI::IRendererInterface*			m_rendererInterface;
-	aiScene*							m_pScene;
 
-	std::vector<std::vector<box3>>		m_SceneMeshInstanceBounds;
+	BoxesSoA							m_InstanceBounds;		// [sceneMesh * instances + instance], world space
+	InstanceBVH							m_InstanceBVH;			// Over m_InstanceBounds
+	bool								m_InstancesMoved;		// Since the last FrustumCull, so the tree needs a refit
+	std::vector<box3>					m_SceneMeshBounds;		// Object space, per mesh in the source file
 	box3								m_SceneBounds;
 	bool								m_SingleInstanceBuffer;
 
@@ -207,29 +487,94 @@ protected:
 
 	NVRHI::BufferHandle					m_IndexBuffer_rhi;
 	NVRHI::BufferHandle					m_VertexBuffer_rhi;
-	std::vector<NVRHI::BufferHandle>	m_InstanceBuffers_rhi;
-	std::vector<uint>					m_CulledInstanceCounts;
+	std::vector<NVRHI::BufferHandle>	m_InstanceBuffers_rhi;	// [view * meshes + meshID], created on first use; or one shared by all views
+	std::vector<uint>					m_SceneToMeshMapping;
+
+	struct CullViewState
+	{
+		Frustum frustums[2];									// What the results are for: the view's frustum, or each eye's
+		bool enableCulling;
+		bool occlusionCulling;
+		bool valid;
+
+		CullViewState() : enableCulling(false), occlusionCulling(false), valid(false) { }
+	};
+
+	CullViewState						m_CullViews[CULL_VIEWS_COUNT];
+	std::vector<uint>					m_CulledInstanceCounts[CULL_VIEWS_COUNT];
+	std::vector<uint>					m_VisibleList[CULL_VIEWS_COUNT];			// Scratch space for Frustum::cullBoxes, laid out like m_InstanceBounds
+	std::vector<BYTE>					m_CulledInstances[CULL_VIEWS_COUNT];		// Visible instances of each mesh, compacted at the start of its range
+	std::vector<uint>					m_TreeVisible;			// Scratch space for InstanceBVH::Cull
+	std::vector<uint>					m_TreeVisibleFrustums;
+	uint								m_OccludedInstancesNum[CULL_VIEWS_COUNT];	// Inside the frustum, but hidden by the occluders
+	InstanceBVH::Stats					m_TreeStats[CULL_VIEWS_COUNT];				// Of the traversal that culled each view; zero without the tree
+	UINT64								m_InstanceBytesUploaded;
+
+	// Meshes that are big enough to hide others, with their own copy of the geometry for the occlusion buffer,
+	// since the scene's is freed once it's been uploaded
+	enum { OCCLUDER_TRIANGLES_MAX = 65536 };		// Over all their instances
+
+	struct OccluderMesh
+	{
+		uint sceneMesh;
+		std::vector<float3> positions;
+		std::vector<uint> indices;
+	};
+
+	std::vector<OccluderMesh>			m_Occluders;
 
 	std::vector<uint>					m_IndexOffsets;
 	std::vector<uint>					m_VertexOffsets;
 	std::vector<Material>				m_Materials;
 	std::vector<float4x4>				m_InstanceMatrices;
+	InstanceFormat						m_InstanceFormat;		// Of the instance buffers
+	std::vector<BYTE>					m_PackedInstances;		// m_InstanceMatrices in m_InstanceFormat, unless that's FLOAT4X4
 
 	std::vector<uint>					m_MeshToSceneMapping;
-	std::map<std::string, Texture2DEx*> m_LoadedTextures;
+	std::vector<uint>					m_MeshIndicesNum;
+	std::vector<uint>					m_MeshMaterials;
+	std::vector<MaterialSource>			m_MaterialSources;
+	std::vector<Texture2DEx*>			m_Textures;				// One reference in m_TextureCache per entry
+	TextureCache*						m_TextureCache;
 
+	// Geometry waiting for upload in FinalizeInit: either built from the import, or mapped from the scene cache
 	std::vector<uint>					m_Indices;
 	std::vector<Vertex>					m_Vertices;
+	const SceneCacheHeader*				m_MappedCache;
+	const uint*							m_IndexData;
+	const Vertex*						m_VertexData;
+	uint								m_IndicesNum;
+	uint								m_VerticesNum;
 
 	Texture2DEx* LoadTextureFromFileAsync(const char* name, bool sRGB, LoadingStats& stats, concurrency::task_group& taskGroup);
 
+	void BuildFromImport(const aiScene* pScene);
+	bool LoadCache(const std::string& cachePath, uint importFlags, UINT64 sourceSize, UINT64 sourceWriteTime);
+	void WriteCache(const std::string& cachePath, uint importFlags, UINT64 sourceSize, UINT64 sourceWriteTime) const;
+	void UpdateInstanceBounds(uint firstInstance, uint instancesNum);
+	void UpdatePackedInstances(uint firstInstance, uint instancesNum);
+	const BYTE* GetPackedInstance(uint instance) const;
+	void CreateInstanceBuffers();
+	void SelectOccluders();
+
 public:
 	Scene()
-		: m_pScene(NULL)
+		: m_rendererInterface(nullptr)
+		, m_InstancesMoved(false)
+		, m_InstanceFormat(InstanceFormat::FLOAT4X4)
 		, m_SingleInstanceBuffer(false)
+		, m_TextureCache(nullptr)
 		, m_IndexBuffer_rhi(nullptr)
 		, m_VertexBuffer_rhi(nullptr)
+		, m_MappedCache(nullptr)
+		, m_IndexData(nullptr)
+		, m_VertexData(nullptr)
+		, m_IndicesNum(0)
+		, m_VerticesNum(0)
+		, m_InstanceBytesUploaded(0)
 	{
+		memset(m_OccludedInstancesNum, 0, sizeof(m_OccludedInstancesNum));
+		memset(m_TreeStats, 0, sizeof(m_TreeStats));
 	}
 
 	virtual ~Scene()
@@ -239,7 +584,7 @@ public:
 	}
 	
 	HRESULT Load(const char* fileName, uint flags = 0);
-	HRESULT InitResources(NVRHI::IRendererInterface* rendererInterface, LoadingStats& stats, concurrency::task_group& taskGroup);
+	HRESULT InitResources(NVRHI::IRendererInterface* rendererInterface, TextureCache* textureCache, LoadingStats& stats, concurrency::task_group& taskGroup);
 	void FinalizeInit();
 	void UpdateBounds();
 	void Release();
@@ -247,19 +592,124 @@ public:
 
 	const char* GetScenePath() { return m_ScenePath.c_str(); }
 
-	uint GetMeshesNum() const { return m_pScene ? m_pScene->mNumMeshes : 0; }
+	uint GetMeshesNum() const { return uint(m_MeshToSceneMapping.size()); }
 
-	void FrustumCull(const Frustum& frustum, bool enableCulling);
+	// Culls the views in viewMask (bit per CullView) in one pass over the bounds. frustums[] is indexed by view;
+	// the stereo view is culled with the left and right eyes' frusta, which needn't be in the mask themselves.
+	// With useTree, the instances are culled through the BVH instead of one by one; the results are the same.
+	// occlusion[] is also indexed by view, and may be null or have null entries: a view whose source views all have
+	// a rendered occlusion buffer also drops the instances that are hidden in every one of them.
+	void FrustumCull(const Frustum* frustums, const OcclusionBuffer* const* occlusion, uint viewMask, bool enableCulling, bool useTree);
+
+	// Queues this scene's occluder instances that intersect the frustum
+	void AddOccluders(OcclusionBuffer& buffer, const Frustum& frustum) const;
 
 	NVRHI::BufferHandle GetIndexBuffer_rhi(uint meshID, uint &offset) const;
 	NVRHI::BufferHandle GetVertexBuffer_rhi(uint meshID, uint &offset) const;
 
 	void AddInstance(const float4x4& matrix) { m_InstanceMatrices.push_back(matrix); }
-	uint GetCulledInstancesNum(uint meshID) const { return m_CulledInstanceCounts[meshID]; }
+	// Move instances after UpdateBounds; the BVH is refitted, not rebuilt, before the next cull.
+	// Moving a range of instances at once transforms their bounds four at a time.
+	void SetInstanceMatrices(uint firstInstance, uint instancesNum, const float4x4* matrices);
+	void SetInstanceMatrix(uint instance, const float4x4& matrix) { SetInstanceMatrices(instance, 1, &matrix); }
+	// The layout of the instance buffers, which has to match the vertex shader's. Changing it re-creates them.
+	void SetInstanceFormat(InstanceFormat format);
+	InstanceFormat GetInstanceFormat() const { return m_InstanceFormat; }
+	uint GetCulledInstancesNum(CullView view, uint meshID) const { return m_CulledInstanceCounts[view][meshID]; }
+	uint GetOccludedInstancesNum(CullView view) const { return m_OccludedInstancesNum[view]; }
+	const InstanceBVH::Stats& GetTreeStats(CullView view) const { return m_TreeStats[view]; }
+	UINT64 GetInstanceBytesUploaded() const { return m_InstanceBytesUploaded; }	// By the last FrustumCull
 	bool IsSingleInstanceBuffer() const { return m_SingleInstanceBuffer; }
-	NVRHI::BufferHandle GetInstanceBuffer_rhi(uint meshID) const { return m_InstanceBuffers_rhi[m_SingleInstanceBuffer ? 0 : meshID]; }
+	NVRHI::BufferHandle GetInstanceBuffer_rhi(CullView view, uint meshID) const { return m_InstanceBuffers_rhi[m_SingleInstanceBuffer ? 0 : view * GetMeshesNum() + meshID]; }
 
 	const Material* GetMaterial(uint meshID) const;
 
 	uint GetMeshIndicesNum(uint meshID) const;
+};
+
+// Textures shared by every Scene in the process. Files are looked up by normalized path, so each one
+// is decoded and uploaded once however many scenes (or materials) use it, and concurrent requests for
+// a file that's still loading get the same in-flight texture. Files are also hashed after they're read,
+// so the same image under two different paths shares one GPU texture once the bytes are compared; the
+// second load waits for the first one's decode instead of doing its own. Both lookups also match on
+// sRGB, since the texture format depends on it. Textures are reference counted and destroyed when the
+// last scene using them releases them.
+// Decoded mip chains are also kept on disk, in the mip cache directory, by the same hash; later runs
+// map them and skip the decode, conversion and rescaling entirely. The directory also indexes each
+// source's hash by its path, size and write time, so an unchanged source isn't even read again.
+class TextureCache
+{
+public:
+	struct Stats
+	{
+		uint Requests;
+		uint PathHits;					// Requests for a file that was already loaded or loading
+		uint ContentHits;				// Files whose contents matched a texture loaded under another path
+		uint ContentMismatches;			// Files whose hash matched another's, but not their contents
+		uint Decodes;
+		uint MipCacheHits;				// Mip chains mapped from the mip cache instead of decoded
+		uint SourceIndexHits;			// Files whose hash came from the mip cache's index, without reading them
+		uint MipCacheWrites;
+	};
+
+protected:
+	struct Entry : Texture2DEx
+	{
+		std::string path;
+		bool sRGB;
+		UINT64 contentHash;
+		uint refCount;
+		bool loading;
+		Entry* contentOwner;			// Entry whose GPU texture this one shares, if any
+
+		Entry() : sRGB(false), contentHash(0), refCount(0), loading(false), contentOwner(nullptr) { }
+	};
+
+	typedef std::pair<UINT64, bool> ContentKey;		// Hash of the file, and sRGB
+
+	NVRHI::IRendererInterface*					m_RendererInterface;
+	TextureUploadQueue*							m_UploadQueue;
+	std::string									m_MipCacheDirectory;
+	std::unordered_map<std::string, Entry*>		m_EntriesByPath;		// By GetPathKey
+	std::map<ContentKey, Entry*>				m_EntriesByContent;
+	Stats										m_Stats;
+	std::mutex									m_Mutex;
+	std::condition_variable						m_LoadFinished;
+
+	static std::string GetPathKey(const std::string& normalizedPath, bool sRGB);
+	static bool ReadWholeFile(const std::string& path, std::vector<BYTE>& data);
+
+	void LoadEntry(Entry* entry, Scene::LoadingStats& stats);
+	void FinishLoading(Entry* entry);
+	void ReleaseLocked(Entry* entry);
+
+	std::string GetMipCachePath(UINT64 sourceHash) const;
+	const MipCacheHeader* MapMipCache(UINT64 sourceHash, UINT64 sourceSize);
+	void WriteMipCache(UINT64 sourceHash, UINT64 sourceSize, uint originalBPP, FIBITMAP* const* mipData, uint mipLevels);
+
+	std::string GetSourceIndexPath(const std::string& normalizedPath) const;
+	bool ReadSourceIndex(const std::string& normalizedPath, UINT64 sourceSize, UINT64 sourceWriteTime, UINT64& sourceHash);
+	void WriteSourceIndex(const std::string& normalizedPath, UINT64 sourceSize, UINT64 sourceWriteTime, UINT64 sourceHash);
+
+public:
+	TextureCache()
+		: m_RendererInterface(nullptr)
+		, m_UploadQueue(nullptr)
+	{
+		memset(&m_Stats, 0, sizeof(m_Stats));
+	}
+
+	// Also clears the stats, before loading a new set of scenes. An empty mip cache directory disables the mip cache.
+	void Init(NVRHI::IRendererInterface* rendererInterface, TextureUploadQueue* uploadQueue, const std::string& mipCacheDirectory);
+
+	// Returns the texture for a file, adding a reference, and starts decoding it on the task group
+	// if nobody has yet. Safe to call from several threads at once.
+	Texture2DEx* Acquire(const std::string& path, bool sRGB, Scene::LoadingStats& stats, concurrency::task_group& taskGroup);
+
+	// Drops a reference from Acquire, destroying the texture with the last one
+	void Release(Texture2DEx* texture);
+
+	Stats GetStats();
+
+	static std::string NormalizePath(const std::string& path);
 };
\ No newline at end of file
@@ -73,6 +73,7 @@ ShaderState::ShaderState(ShaderFactory* pFactory, NVRHI::IRendererInterface*  pR
 	static const char* numberStrings[] = { "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10" };
 	static const char* stereoStrings[] = { "STEREO_MODE_NONE", "STEREO_MODE_INSTANCED", "STEREO_MODE_SINGLE_PASS" };
 	static const char* projectionStrings[] = { "NV_VR_PROJECTION_PLANAR", "NV_VR_PROJECTION_MULTI_RES", "NV_VR_PROJECTION_LENS_MATCHED" };
+	static const char* instanceFormatStrings[] = { "INSTANCE_FORMAT_FLOAT4X4", "INSTANCE_FORMAT_FLOAT3X4", "INSTANCE_FORMAT_QUANTIZED" };
 
 	{
 		std::vector<shaderMacro> Macros;
@@ -165,11 +166,17 @@ ShaderState::ShaderState(ShaderFactory* pFactory, NVRHI::IRendererInterface*  pR
 	}
 
 
-	pFactory->CreateShader("world_vs", nullptr, NVRHI::ShaderType::SHADER_VERTEX, &m_pVsShadow);
+	{
+		std::vector<shaderMacro> Macros;
+		Macros.push_back(shaderMacro{ "INSTANCE_FORMAT", instanceFormatStrings[effect.instanceFormat] });
+
+		pFactory->CreateShader("world_vs", &Macros, NVRHI::ShaderType::SHADER_VERTEX, &m_pVsShadow);
+	}
 
 	{
 		std::vector<shaderMacro> Macros;
 		Macros.push_back(shaderMacro{ "STEREO_MODE", stereoStrings[effect.stereoMode] });
+		Macros.push_back(shaderMacro{ "INSTANCE_FORMAT", instanceFormatStrings[effect.instanceFormat] });
 
 		if (StereoMode(effect.stereoMode) == StereoMode::SINGLE_PASS && NvFeatureLevel(effect.featureLevel) == NvFeatureLevel::PASCAL_GPU)
 		{
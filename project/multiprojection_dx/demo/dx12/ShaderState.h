@@ -75,6 +75,7 @@ public:
 			unsigned int featureLevel : 2;
 			unsigned int msaaSampleCount : 4;
 			unsigned int temporalAA : 1;
+			unsigned int instanceFormat : 2;
 		};
 
 		unsigned int value;
@@ -125,6 +125,7 @@ RendererErrorCallback g_ErrorCallback;
 #include <nv_vr.h>
 #include "shaders/shader-slots.h"
 #include "Scene.h"
+#include "OcclusionBuffer.h"
 #include "json/reader.h"
 #include <fstream>
 #include <Shlwapi.h>
@@ -196,6 +197,12 @@ bool						g_suppressTemporalAA		= false;
 int							g_sceneIndex				= 0;
 std::string					g_sceneName					= "sponza.json";
 
+// Scene loading
+uint						g_textureMemoryBudgetMB		= 256;		// decoded textures waiting for upload
+uint						g_textureUploadPerFrameMB	= 32;
+bool						g_useMipCache				= true;
+std::string					g_mipCacheDirectory			= "mipcache";	// relative to the media directory
+
 // Common multi-projection data
 Nv::VR::Data				g_projectionData			= {};
 Nv::VR::Data				g_projectionDataPrev		= {};
@@ -219,6 +226,9 @@ Nv::VR::LensMatched::Configuration	g_lensMatchedConfig			= Nv::VR::LensMatched::
 Nv::VR::LensMatched::Configuration	g_lensMatchedConfigVR[2]	= {};
 float						g_resolutionScale			= 1.0f;
 bool						g_frustumCulling			= true;
+bool						g_hierarchicalCulling		= true;
+bool						g_occlusionCulling			= false;
+InstanceFormat				g_instanceFormat			= InstanceFormat::FLOAT3X4;
 bool						g_fakeVREnabled				= false;
 bool						g_instancedStereoEnabled	= false;
 bool						g_singlePassStereoEnabled	= false;
@@ -443,8 +453,11 @@ public:
 	bool								m_bLoadingScene;
 	std::thread*						m_pSceneLoadingThread;
 	Scene::LoadingStats					m_SceneLoadingStats;
+	TextureUploadQueue					m_TextureUploadQueue;
+	TextureCache						m_TextureCache;
 
 	ShadowMap							m_shadowMap;
+	OcclusionBuffer						m_occlusionBuffers[2];		// Per eye; the mono camera uses the first
 
 	float4x4							m_matWorldToClipPrev;
 	float4x4							m_matWorldToClipPrevR;
@@ -467,15 +480,16 @@ public:
 	virtual void						OnRender(NVRHI::TextureHandle& mainRenderTarget) /*override*/;
 
 	void								ResetCamera();
-	void								DrawObjects(NVRHI::DrawCallState& drawCallState, NVRHI::ShaderHandle pPs, NVRHI::ShaderHandle pPsAlphaTest, bool bShadowMapPass);
-	void								DrawObjectInstances(NVRHI::DrawCallState& drawCallState, NVRHI::ShaderHandle pPs, NVRHI::ShaderHandle pPsAlphaTest, Scene* pScene, bool bShadowMapPass);
+	void								DrawObjects(NVRHI::DrawCallState& drawCallState, NVRHI::ShaderHandle pPs, NVRHI::ShaderHandle pPsAlphaTest, Scene::CullView view, bool bShadowMapPass);
+	void								DrawObjectInstances(NVRHI::DrawCallState& drawCallState, NVRHI::ShaderHandle pPs, NVRHI::ShaderHandle pPsAlphaTest, Scene* pScene, Scene::CullView view, bool bShadowMapPass);
 	void								CalcEyeMatrices(bool vrActive, int eye, float4x4* ref_worldToClip, point3* ref_cameraPos, affine3* ref_eyeToWorld);
 	void								CalculateProjectionMatrices();
 	void								RenderScene();
-	void								DrawRepeatedScene(NVRHI::DrawCallState& drawCallState);
+	void								DrawRepeatedScene(NVRHI::DrawCallState& drawCallState, Scene::CullView view);
 	void								RenderShadowMap();
-	void								FrustumCull(const float4x4& matWorldToClip);
-	void								FrustumCullStereo(const float4x4& matWorldToClipLeft, const float4x4& matWorldToClipRight);
+	void								FrustumCull(Scene::CullView view, const float4x4& matWorldToClip);
+	void								FrustumCullStereo(const float4x4& matWorldToClipLeft, const float4x4& matWorldToClipRight, uint viewMask);
+	void								RenderOcclusionBuffer(uint eye, const float4x4& matWorldToClip);
 	StereoMode							GetCurrentStereoMode();
 
 	// HMD support
@@ -798,6 +812,8 @@ public:
 
 		TwTerminate();
 
+		CancelSceneLoading();
+
 		for (auto pScene : m_scenes)
 		{
 			delete pScene;
@@ -907,14 +923,32 @@ public:
         m_pqFlattenImage = m_RendererInterface->createPerformanceQuery("FlattenImage");
 	}
 
+	// Stops the loading thread, if it's still going. Nothing uploads the decoded textures from here on,
+	// so the loading tasks waiting for room in the upload queue are let go, and their mips freed.
+	void CancelSceneLoading()
+	{
+		if (!m_pSceneLoadingThread)
+			return;
+
+		m_TextureUploadQueue.Shutdown();
+		m_pSceneLoadingThread->join();
+		delete m_pSceneLoadingThread;
+		m_pSceneLoadingThread = nullptr;
+		m_bLoadingScene = false;
+	}
+
 	void LoadSceneAsync()
 	{
+		CancelSceneLoading();
+
 		for (auto pScene : m_scenes)
 			delete pScene;
 
 		m_scenes.clear();
 
 		m_shadowMap.Invalidate();
+		m_occlusionBuffers[0].Invalidate();
+		m_occlusionBuffers[1].Invalidate();
 
 		std::string rootPath = "common/media/";
 		std::string scenePath;
@@ -931,6 +965,8 @@ public:
 
 		m_bLoadingScene = true;
 		memset(&m_SceneLoadingStats, 0, sizeof(Scene::LoadingStats));
+		m_TextureUploadQueue.Reset(UINT64(g_textureMemoryBudgetMB) << 20);
+		m_TextureCache.Init(m_RendererInterface, &m_TextureUploadQueue, g_useMipCache ? rootPath + g_mipCacheDirectory : std::string());
 
 		m_pSceneLoadingThread = new std::thread([this, rootPath, scenePath]() 
 		{
@@ -961,6 +997,7 @@ public:
 		InterlockedIncrement(&m_SceneLoadingStats.ObjectsTotal);
 
 		Scene* object = new Scene();
+		object->SetInstanceFormat(g_instanceFormat);
 
 		Json::Value& instances = node["instances"];
 		for (UINT index = 0; index < instances.size(); index++)
@@ -984,7 +1021,7 @@ public:
 
 			object->UpdateBounds();
 
-			if (FAILED(object->InitResources(m_RendererInterface, m_SceneLoadingStats, taskGroup)))
+			if (FAILED(object->InitResources(m_RendererInterface, &m_TextureCache, m_SceneLoadingStats, taskGroup)))
 			{
 				ERR("Couldn't load the textures for scene file %s", fileName.c_str());
 				return;
@@ -1020,6 +1057,7 @@ public:
 		effect.featureLevel = uint(g_featureLevel);
 		effect.msaaSampleCount = g_msaaSampleCount;
 		effect.temporalAA = g_temporalAA;
+		effect.instanceFormat = uint(g_instanceFormat);
 
 		if (!m_pShaderState || effect.value != m_pShaderState->m_Effect.value)
 		{
@@ -1387,20 +1425,47 @@ void VRWorksSample::OnRender(NVRHI::TextureHandle& mainRenderTarget)
 
 	NVRHI::TextureHandle pRtFinal = nullptr;
 
+	// Upload the textures decoded so far, a few per frame, so their pixels are freed while loading
+	// goes on instead of all piling up until the end
+	if (m_pSceneLoadingThread)
+		m_TextureUploadQueue.Upload(m_RendererInterface, UINT64(g_textureUploadPerFrameMB) << 20);
+
 	if (m_pSceneLoadingThread && !m_bLoadingScene)
 	{
 		m_pSceneLoadingThread->join();
 		delete m_pSceneLoadingThread;
 		m_pSceneLoadingThread = nullptr;
 
+		// Every texture has been pushed by now; upload whatever is left before the scenes use them
+		m_TextureUploadQueue.Upload(m_RendererInterface, ~0ull);
+
+		TextureUploadQueue::Stats uploadStats = m_TextureUploadQueue.GetStats();
+		LOG("Uploaded %u textures, %.1f MB; peak %.1f MB decoded and waiting, %.1f MB in one frame; loaders waited %u times",
+			uploadStats.TexturesUploaded, double(uploadStats.BytesUploaded) / 1048576.0,
+			double(uploadStats.PeakBytesPending) / 1048576.0, double(uploadStats.PeakBytesPerFrame) / 1048576.0,
+			uploadStats.PushStalls);
+
+		TextureCache::Stats cacheStats = m_TextureCache.GetStats();
+		LOG("Texture cache: %u requests, %u shared by path, %u shared by contents (%u hash matches with other contents), %u decoded, %u mapped from the mip cache, %u written to it; %u sources found unchanged in its index",
+			cacheStats.Requests, cacheStats.PathHits, cacheStats.ContentHits, cacheStats.ContentMismatches, cacheStats.Decodes,
+			cacheStats.MipCacheHits, cacheStats.MipCacheWrites, cacheStats.SourceIndexHits);
+
 		for (auto scene : m_scenes)
 			scene->FinalizeInit();
+
+		// The occluders are only selected by FinalizeInit
+		m_occlusionBuffers[0].Invalidate();
+		m_occlusionBuffers[1].Invalidate();
 	}
 
 	if (m_pShaderState && !m_bLoadingScene)
 	{
 		PERF_SECTION(m_pqFrame);
 
+		// The instance buffers have to be laid out the way the vertex shader reads them
+		for (auto scene : m_scenes)
+			scene->SetInstanceFormat(InstanceFormat(m_pShaderState->m_Effect.instanceFormat));
+
 		RenderShadowMap();
 
 		VerifyRenderTargetDims();
@@ -1646,36 +1711,70 @@ void VRWorksSample::CalcEyeMatrices(bool vrActive, int eye, float4x4* ref_worldT
 	}
 }
 
-void VRWorksSample::FrustumCull(const float4x4& matWorldToClip)
+void VRWorksSample::FrustumCull(Scene::CullView view, const float4x4& matWorldToClip)
 {
-	Frustum frustum(matWorldToClip);
+	Frustum frustums[Scene::CULL_VIEWS_COUNT];
+	frustums[view] = Frustum(matWorldToClip);
+
+	// The shadow map sees what the camera can't, so only the camera is occlusion culled
+	const OcclusionBuffer* occlusion[Scene::CULL_VIEWS_COUNT] = {};
+	if (g_frustumCulling && g_occlusionCulling && view != Scene::CULL_VIEW_SHADOW)
+	{
+		RenderOcclusionBuffer(0, matWorldToClip);
+		occlusion[view] = &m_occlusionBuffers[0];
+	}
 
 	int maxObjects = (int)m_scenes.size();
 	for (int i = 0; i < maxObjects; ++i)
 	{
 		Scene* pScene = m_scenes[i];
-		pScene->FrustumCull(frustum, g_frustumCulling);
+		pScene->FrustumCull(frustums, occlusion, 1 << view, g_frustumCulling, g_hierarchicalCulling);
 	}
 }
 
-void VRWorksSample::FrustumCullStereo(const float4x4& matWorldToClipLeft, const float4x4& matWorldToClipRight)
+void VRWorksSample::FrustumCullStereo(const float4x4& matWorldToClipLeft, const float4x4& matWorldToClipRight, uint viewMask)
 {
-	Frustum frustumLeft(matWorldToClipLeft);
-	Frustum frustumRight(matWorldToClipRight);
-	Frustum frustum = frustumLeft;
-	frustum.planes[Frustum::RIGHT_PLANE] = frustumRight.planes[Frustum::RIGHT_PLANE];
+	// The stereo view gets whatever either eye sees, so both eyes' frusta are needed whichever views are asked for
+	Frustum frustums[Scene::CULL_VIEWS_COUNT];
+	frustums[Scene::CULL_VIEW_LEFT] = Frustum(matWorldToClipLeft);
+	frustums[Scene::CULL_VIEW_RIGHT] = Frustum(matWorldToClipRight);
+
+	const OcclusionBuffer* occlusion[Scene::CULL_VIEWS_COUNT] = {};
+	if (g_frustumCulling && g_occlusionCulling)
+	{
+		RenderOcclusionBuffer(0, matWorldToClipLeft);
+		RenderOcclusionBuffer(1, matWorldToClipRight);
+		occlusion[Scene::CULL_VIEW_LEFT] = &m_occlusionBuffers[0];
+		occlusion[Scene::CULL_VIEW_RIGHT] = &m_occlusionBuffers[1];
+	}
 	
 	int maxObjects = (int)m_scenes.size();
 	for (int i = 0; i < maxObjects; ++i)
 	{
 		Scene* pScene = m_scenes[i];
-		pScene->FrustumCull(frustum, g_frustumCulling);
+		pScene->FrustumCull(frustums, occlusion, viewMask, g_frustumCulling, g_hierarchicalCulling);
 	}
 }
 
+void VRWorksSample::RenderOcclusionBuffer(uint eye, const float4x4& matWorldToClip)
+{
+	// Like the culling results, the buffer is kept until the eye moves
+	OcclusionBuffer& buffer = m_occlusionBuffers[eye];
+	if (buffer.IsRendered() && all(buffer.GetWorldToClip() == matWorldToClip))
+		return;
+
+	buffer.Begin(matWorldToClip, g_zNear);
+
+	Frustum frustum(matWorldToClip);
+	for (auto pScene : m_scenes)
+		pScene->AddOccluders(buffer, frustum);
+
+	buffer.Render();
+}
+
 
 
-void VRWorksSample::DrawRepeatedScene(NVRHI::DrawCallState& drawCallState)
+void VRWorksSample::DrawRepeatedScene(NVRHI::DrawCallState& drawCallState, Scene::CullView view)
 {
 	drawCallState.VS.shader = m_pShaderState->m_pVsWorld;
 	drawCallState.PS.shader = m_pShaderState->m_pGsWorld;
@@ -1683,21 +1782,21 @@ void VRWorksSample::DrawRepeatedScene(NVRHI::DrawCallState& drawCallState)
 
 	for (int i = 0; i < g_repeatRenderingCount; ++i)
 	{
-		DrawObjects(drawCallState, m_pShaderState->m_pPsForward, m_pShaderState->m_pPsForward, false);
+		DrawObjects(drawCallState, m_pShaderState->m_pPsForward, m_pShaderState->m_pPsForward, view, false);
 	}
 }
 
-void VRWorksSample::DrawObjects(NVRHI::DrawCallState& drawCallState, NVRHI::ShaderHandle pPs, NVRHI::ShaderHandle pPsAlphaTest, bool bShadowMapPass)
+void VRWorksSample::DrawObjects(NVRHI::DrawCallState& drawCallState, NVRHI::ShaderHandle pPs, NVRHI::ShaderHandle pPsAlphaTest, Scene::CullView view, bool bShadowMapPass)
 {
 	int maxObjects = (int)m_scenes.size();
 	for (int i = 0; i < maxObjects; ++i)
 	{
 		Scene* pScene = m_scenes[i];
-		DrawObjectInstances(drawCallState, pPs, pPsAlphaTest, pScene, bShadowMapPass);
+		DrawObjectInstances(drawCallState, pPs, pPsAlphaTest, pScene, view, bShadowMapPass);
 	}
 }
 
-void VRWorksSample::DrawObjectInstances(NVRHI::DrawCallState& drawCallState, NVRHI::ShaderHandle pPs, NVRHI::ShaderHandle pPsAlphaTest, Scene* pScene, bool bShadowMapPass)
+void VRWorksSample::DrawObjectInstances(NVRHI::DrawCallState& drawCallState, NVRHI::ShaderHandle pPs, NVRHI::ShaderHandle pPsAlphaTest, Scene* pScene, Scene::CullView view, bool bShadowMapPass)
 {
 	drawCallState.primType = NVRHI::PrimitiveType::TRIANGLE_LIST;
 	drawCallState.inputLayout = m_pShaderState->m_pInputLayout;
@@ -1716,7 +1815,7 @@ void VRWorksSample::DrawObjectInstances(NVRHI::DrawCallState& drawCallState, NVR
     std::vector<NVRHI::DrawArguments> drawCalls;
 
     if (pScene->IsSingleInstanceBuffer())
-        NVRHI::BindBuffer(drawCallState.VS, 0, pScene->GetInstanceBuffer_rhi(0));
+        NVRHI::BindBuffer(drawCallState.VS, 0, pScene->GetInstanceBuffer_rhi(view, 0));
 
 	for (UINT i = 0; i < numMeshes; ++i)
 	{
@@ -1725,13 +1824,13 @@ void VRWorksSample::DrawObjectInstances(NVRHI::DrawCallState& drawCallState, NVR
 		if (material == NULL)
 			continue;
 
-		UINT numInstances = pScene->GetCulledInstancesNum(i);
+		UINT numInstances = pScene->GetCulledInstancesNum(view, i);
 
 		if (numInstances == 0)
 			continue;
 
         if(!pScene->IsSingleInstanceBuffer())
-		    NVRHI::BindBuffer(drawCallState.VS, 0, pScene->GetInstanceBuffer_rhi(i));
+		    NVRHI::BindBuffer(drawCallState.VS, 0, pScene->GetInstanceBuffer_rhi(view, i));
 
 		if (material != lastMaterial)
 		{
@@ -1858,8 +1957,9 @@ void VRWorksSample::RenderShadowMap()
 	drawCallState.PS.textureSamplers[0].sampler = m_pSsTrilinearRepeatAniso;
 	drawCallState.PS.textureSamplers[0].slot = SAMP_DEFAULT;
 
-	FrustumCull(cbFrame.m_matWorldToClip);
-	DrawObjects(drawCallState, nullptr, m_pShaderState->m_pPsShadowAlphaTest, true);
+	// The shadow view's results stay valid while the light doesn't move, even though the camera views are culled every frame
+	FrustumCull(Scene::CULL_VIEW_SHADOW, cbFrame.m_matWorldToClip);
+	DrawObjects(drawCallState, nullptr, m_pShaderState->m_pPsShadowAlphaTest, Scene::CULL_VIEW_SHADOW, true);
 }
 
 void VRWorksSample::RenderScene()
@@ -1968,14 +2068,14 @@ void VRWorksSample::RenderScene()
 
 		cbFrame.m_matWorldToClip = m_camera.m_worldToClip;
 
-		FrustumCull(cbFrame.m_matWorldToClip);
+		FrustumCull(Scene::CULL_VIEW_LEFT, cbFrame.m_matWorldToClip);
 
 		m_RendererInterface->writeConstantBuffer(m_cbFrame, &cbFrame, sizeof(cbFrame));
 
 		m_matWorldToClipPrev = cbFrame.m_matWorldToClip;
 		m_matWorldToClipPrevR = cbFrame.m_matWorldToClipR;
 
-		DrawRepeatedScene(drawCallState);
+		DrawRepeatedScene(drawCallState, Scene::CULL_VIEW_LEFT);
 	}
 
 	#pragma endregion
@@ -1988,6 +2088,12 @@ void VRWorksSample::RenderScene()
 
         if (g_stereoMode == StereoMode::NONE)
 		{ // render two eyes sequentially
+			// Cull both eyes in one pass, into separate result sets, before drawing either
+			float4x4 worldToClipEyes[2];
+			CalcEyeMatrices(IsVRActive(), 0, &worldToClipEyes[0], nullptr, nullptr);
+			CalcEyeMatrices(IsVRActive(), 1, &worldToClipEyes[1], nullptr, nullptr);
+			FrustumCullStereo(worldToClipEyes[0], worldToClipEyes[1], (1 << Scene::CULL_VIEW_LEFT) | (1 << Scene::CULL_VIEW_RIGHT));
+
 			for (int eye = 0; eye < 2; ++eye)
 			{
 				float4x4 worldToClip;
@@ -2020,9 +2126,7 @@ void VRWorksSample::RenderScene()
 
 				m_RendererInterface->writeConstantBuffer(m_cbFrame, &cbFrame, sizeof(cbFrame));
 
-				FrustumCull(cbFrame.m_matWorldToClip);
-
-				DrawRepeatedScene(drawCallState);
+				DrawRepeatedScene(drawCallState, eye == 0 ? Scene::CULL_VIEW_LEFT : Scene::CULL_VIEW_RIGHT);
 			}
 		}
 		else if (g_singlePassStereoEnabled || g_instancedStereoEnabled)
@@ -2067,9 +2171,9 @@ void VRWorksSample::RenderScene()
 			m_matWorldToClipPrev = cbFrame.m_matWorldToClip;
 			m_matWorldToClipPrevR = cbFrame.m_matWorldToClipR;
 
-			FrustumCullStereo(cbFrame.m_matWorldToClip, cbFrame.m_matWorldToClipR);
+			FrustumCullStereo(cbFrame.m_matWorldToClip, cbFrame.m_matWorldToClipR, 1 << Scene::CULL_VIEW_STEREO);
 
-			DrawRepeatedScene(drawCallState);
+			DrawRepeatedScene(drawCallState, Scene::CULL_VIEW_STEREO);
 		}
 	}
 
@@ -2861,7 +2965,7 @@ public:
 
 		// Create bar for FPS display
 		TwBar * pTwBarFPS = TwNewBar("FPS");
-		TwDefine("FPS position='10 10' size='320 170' valueswidth=80 refresh=0.5");
+		TwDefine("FPS position='10 10' size='320 200' valueswidth=80 refresh=0.5");
 		TwAddVarCB(
 				pTwBarFPS, "FPS", TW_TYPE_FLOAT,
 				nullptr,
@@ -2903,6 +3007,76 @@ public:
 				},
 				nullptr,
 			"precision=2");
+
+		TwAddVarCB(
+				pTwBarFPS, "Instance upload (KB)", TW_TYPE_FLOAT,
+				nullptr,
+				[](void * value, void * demo) {
+					UINT64 bytes = 0;
+					for (auto pScene : ((VRWorksSample*)demo)->m_scenes)
+						bytes += pScene->GetInstanceBytesUploaded();
+					*(float*)value = float(bytes) / 1024.f;
+				},
+				m_sample,
+				"precision=1");
+
+		TwAddVarCB(
+				pTwBarFPS, "Occlusion time (ms)", TW_TYPE_FLOAT,
+				nullptr,
+				[](void * value, void * demo) {
+					VRWorksSample* sample = (VRWorksSample*)demo;
+					float time = sample->m_occlusionBuffers[0].GetStats().RenderTimeMs;
+					if (sample->IsVROrFakeVRActive())
+						time += sample->m_occlusionBuffers[1].GetStats().RenderTimeMs;
+					*(float*)value = g_occlusionCulling ? time : 0.f;
+				},
+				m_sample,
+				"precision=2");
+
+		TwAddVarCB(
+				pTwBarFPS, "Occluded Instances", TW_TYPE_INT32,
+				nullptr,
+				[](void * value, void * demo) {
+					VRWorksSample* sample = (VRWorksSample*)demo;
+					Scene::CullView view = sample->IsVROrFakeVRActive() && g_stereoMode != StereoMode::NONE ? Scene::CULL_VIEW_STEREO : Scene::CULL_VIEW_LEFT;
+					int occluded = 0;
+					if (g_occlusionCulling)
+					{
+						for (auto pScene : sample->m_scenes)
+							occluded += pScene->GetOccludedInstancesNum(view);
+					}
+					*(int*)value = occluded;
+				},
+				m_sample,
+				"");
+
+		TwAddVarCB(
+				pTwBarFPS, "BVH Nodes Visited", TW_TYPE_INT32,
+				nullptr,
+				[](void * value, void * demo) {
+					VRWorksSample* sample = (VRWorksSample*)demo;
+					Scene::CullView view = sample->IsVROrFakeVRActive() && g_stereoMode != StereoMode::NONE ? Scene::CULL_VIEW_STEREO : Scene::CULL_VIEW_LEFT;
+					int nodes = 0;
+					for (auto pScene : sample->m_scenes)
+						nodes += pScene->GetTreeStats(view).NodesVisited;
+					*(int*)value = nodes;
+				},
+				m_sample,
+				"");
+
+		TwAddVarCB(
+				pTwBarFPS, "BVH Instances Tested", TW_TYPE_INT32,
+				nullptr,
+				[](void * value, void * demo) {
+					VRWorksSample* sample = (VRWorksSample*)demo;
+					Scene::CullView view = sample->IsVROrFakeVRActive() && g_stereoMode != StereoMode::NONE ? Scene::CULL_VIEW_STEREO : Scene::CULL_VIEW_LEFT;
+					int tested = 0;
+					for (auto pScene : sample->m_scenes)
+						tested += pScene->GetTreeStats(view).BoxesTested;
+					*(int*)value = tested;
+				},
+				m_sample,
+				"");
 	
 		TwAddVarCB(
 			pTwBarFPS, "Rendered MPixels", TW_TYPE_FLOAT,
@@ -2981,6 +3155,20 @@ public:
 
 		TwAddVarRW(pTwBarRendering, "Frustum Culling", TW_TYPE_BOOLCPP, &g_frustumCulling, "");
 
+		TwAddVarRW(pTwBarRendering, "Hierarchical Culling", TW_TYPE_BOOLCPP, &g_hierarchicalCulling, "");
+
+		TwAddVarRW(pTwBarRendering, "Occlusion Culling", TW_TYPE_BOOLCPP, &g_occlusionCulling, "");
+
+		{
+			TwEnumVal instanceFormatEV[] = {
+				{ int(InstanceFormat::FLOAT4X4), "Float4x4 (64 B)" },
+				{ int(InstanceFormat::FLOAT3X4), "Float3x4 (48 B)" },
+				{ int(InstanceFormat::QUANTIZED), "Quantized (32 B)" }
+			};
+			TwType instanceFormatType = TwDefineEnum("Instance Format", instanceFormatEV, dim(instanceFormatEV));
+			TwAddVarRW(pTwBarRendering, "Instance Format", instanceFormatType, &g_instanceFormat, "");
+		}
+
 		{   // Scene selection
 			TwEnumVal sceneEV[] = {
 				{ 0, "Sponza" },
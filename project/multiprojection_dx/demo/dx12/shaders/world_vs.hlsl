@@ -34,7 +34,55 @@
 
 #include "shader-common.hlsli"
 
-StructuredBuffer<float4x4> t_InstanceMatrices : register(t0);
+#define INSTANCE_FORMAT_FLOAT4X4 0
+#define INSTANCE_FORMAT_FLOAT3X4 1
+#define INSTANCE_FORMAT_QUANTIZED 2
+
+#ifndef INSTANCE_FORMAT
+#define INSTANCE_FORMAT INSTANCE_FORMAT_FLOAT4X4
+#endif
+
+// Matches InstanceFloat3x4 and InstanceQuantized in InstanceTransform.h
+struct InstanceFloat3x4
+{
+	float4 columns[3];
+};
+
+struct InstanceQuantized
+{
+	float3 translation;
+	uint basis[5];
+};
+
+#if INSTANCE_FORMAT == INSTANCE_FORMAT_FLOAT3X4
+StructuredBuffer<InstanceFloat3x4> t_Instances : register(t0);
+
+float3 TransformInstance(uint instance, float3 pos)
+{
+	InstanceFloat3x4 t = t_Instances[instance];
+	float4 p = float4(pos, 1.0);
+	return float3(dot(t.columns[0], p), dot(t.columns[1], p), dot(t.columns[2], p));
+}
+#elif INSTANCE_FORMAT == INSTANCE_FORMAT_QUANTIZED
+StructuredBuffer<InstanceQuantized> t_Instances : register(t0);
+
+float3 TransformInstance(uint instance, float3 pos)
+{
+	InstanceQuantized t = t_Instances[instance];
+	float3 row0 = float3(f16tof32(t.basis[0]), f16tof32(t.basis[0] >> 16), f16tof32(t.basis[1]));
+	float3 row1 = float3(f16tof32(t.basis[1] >> 16), f16tof32(t.basis[2]), f16tof32(t.basis[2] >> 16));
+	float3 row2 = float3(f16tof32(t.basis[3]), f16tof32(t.basis[3] >> 16), f16tof32(t.basis[4]));
+	return pos.x * row0 + pos.y * row1 + pos.z * row2 + t.translation;
+}
+#else
+StructuredBuffer<float4x4> t_Instances : register(t0);
+
+float3 TransformInstance(uint instance, float3 pos)
+{
+	float4 worldPos = mul(t_Instances[instance], float4(pos, 1.0));
+	return worldPos.xyz / worldPos.w;
+}
+#endif
 
 VSOutput main(
 	in Vertex i_vtx,
@@ -49,14 +97,11 @@ VSOutput main(
 	VSOutput output;
 
 #if (STEREO_MODE == STEREO_MODE_INSTANCED) 
-	float4x4 instanceMatrix = (t_InstanceMatrices[i_instance >> 1]);
+	i_vtx.m_pos = TransformInstance(i_instance >> 1, i_vtx.m_pos);
 #else
-	float4x4 instanceMatrix = (t_InstanceMatrices[i_instance]);
+	i_vtx.m_pos = TransformInstance(i_instance, i_vtx.m_pos);
 #endif
 
-	float4 worldPos = mul(instanceMatrix, float4(i_vtx.m_pos, 1.0));
-	i_vtx.m_pos = worldPos.xyz / worldPos.w;
-
 	float4 pos = float4(i_vtx.m_pos, 1.0);
 
 	output.vtx = i_vtx;
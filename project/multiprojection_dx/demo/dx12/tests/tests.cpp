@@ -0,0 +1,2167 @@
+//----------------------------------------------------------------------------------
+// File:        tests.cpp
+// SDK Version: 2.0
+// Email:       vrsupport@nvidia.com
+// Site:        http://developer.nvidia.com/
+//
+// Copyright (c) 2016, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+//----------------------------------------------------------------------------------
+
+#include "Scene.h"
+#include "OcclusionBuffer.h"
+#include "FreeImage.h"
+#include <atomic>
+#include <thread>
+#include <cstdio>
+
+// Tests and benchmarks for the scene code, run against a stub renderer interface that only keeps
+// count of what would have been created and uploaded, so they need no GPU.
+// Run with no arguments to run them all, or name the ones to run on the command line.
+// Each one logs its measurements, and fails if anything is outside its tolerance; the exit
+// code is the number of failures.
+
+namespace
+{
+	int s_errorCount = 0;
+
+	void LogToStdout(const char * message)
+	{
+		fputs(message, stdout);
+	}
+
+	void CountError(const char * message)
+	{
+		fprintf(stderr, "%s\n", message);
+		++s_errorCount;
+	}
+
+	// Milliseconds between two QueryPerformanceCounter timestamps
+	float ElapsedMs(INT64 timestampStart, INT64 timestampEnd)
+	{
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		return 1000.0f * float(timestampEnd - timestampStart) / float(frequency.QuadPart);
+	}
+
+	INT64 Timestamp()
+	{
+		LARGE_INTEGER timestamp;
+		QueryPerformanceCounter(&timestamp);
+		return timestamp.QuadPart;
+	}
+
+
+
+	// A renderer interface with no device behind it. Textures and buffers are only records of their
+	// descriptions; writes are checked against them, touched end to end so a dangling pointer shows up,
+	// and counted. Safe to call from several threads at once, like the real ones.
+	class StubRendererInterface : public NVRHI::IRendererInterface
+	{
+	public:
+		struct Stats
+		{
+			uint TexturesCreated;
+			uint TexturesDestroyed;
+			uint TextureWrites;
+			UINT64 TextureBytesWritten;
+			uint BuffersCreated;
+			uint BuffersDestroyed;
+			uint BufferWrites;
+			UINT64 BufferBytesWritten;
+			uint BadWrites;					// Out of range of the resource they were written to
+		};
+
+		StubRendererInterface()
+		{
+			memset(&m_Stats, 0, sizeof(m_Stats));
+		}
+
+		~StubRendererInterface()
+		{
+			for (auto& it : m_Textures)
+				delete it.second;
+			for (auto& it : m_Buffers)
+				delete it.second;
+		}
+
+		Stats GetStats()
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			return m_Stats;
+		}
+
+		virtual NVRHI::TextureHandle createTexture(const NVRHI::TextureDesc& d, const void* data) override
+		{
+			(void)data;
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			NVRHI::TextureDesc* desc = new NVRHI::TextureDesc(d);
+			NVRHI::TextureHandle handle = reinterpret_cast<NVRHI::TextureHandle>(desc);
+			m_Textures[handle] = desc;
+			m_Stats.TexturesCreated++;
+			return handle;
+		}
+
+		virtual NVRHI::TextureDesc describeTexture(NVRHI::TextureHandle t) override
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			auto it = m_Textures.find(t);
+			return (it != m_Textures.end()) ? *it->second : NVRHI::TextureDesc();
+		}
+
+		virtual void writeTexture(NVRHI::TextureHandle t, uint32_t subresource, const void* data, uint32_t rowPitch, uint32_t depthPitch) override
+		{
+			(void)depthPitch;
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stats.TextureWrites++;
+
+			auto it = m_Textures.find(t);
+			if (it == m_Textures.end() || subresource >= it->second->mipLevels)
+			{
+				m_Stats.BadWrites++;
+				return;
+			}
+
+			uint height = __max(it->second->height >> subresource, 1u);
+			UINT64 size = UINT64(rowPitch) * height;
+			Touch(data, size);
+			m_Stats.TextureBytesWritten += size;
+		}
+
+		virtual void destroyTexture(NVRHI::TextureHandle t) override
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			auto it = m_Textures.find(t);
+			if (it == m_Textures.end())
+				return;
+			delete it->second;
+			m_Textures.erase(it);
+			m_Stats.TexturesDestroyed++;
+		}
+
+		virtual NVRHI::BufferHandle createBuffer(const NVRHI::BufferDesc& d, const void* data) override
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			NVRHI::BufferDesc* desc = new NVRHI::BufferDesc(d);
+			NVRHI::BufferHandle handle = reinterpret_cast<NVRHI::BufferHandle>(desc);
+			m_Buffers[handle] = desc;
+			m_Stats.BuffersCreated++;
+			if (data)
+				Touch(data, d.byteSize);
+			return handle;
+		}
+
+		virtual void writeBuffer(NVRHI::BufferHandle b, const void* data, size_t dataSize) override
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stats.BufferWrites++;
+
+			auto it = m_Buffers.find(b);
+			if (it == m_Buffers.end() || dataSize > it->second->byteSize)
+			{
+				m_Stats.BadWrites++;
+				return;
+			}
+
+			Touch(data, dataSize);
+			m_Stats.BufferBytesWritten += dataSize;
+			m_BufferBytesWritten[b] += dataSize;
+		}
+
+		UINT64 GetBufferBytesWritten(NVRHI::BufferHandle b)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			auto it = m_BufferBytesWritten.find(b);
+			return it == m_BufferBytesWritten.end() ? 0 : it->second;
+		}
+
+		virtual void destroyBuffer(NVRHI::BufferHandle b) override
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			auto it = m_Buffers.find(b);
+			if (it == m_Buffers.end())
+				return;
+			delete it->second;
+			m_Buffers.erase(it);
+			m_BufferBytesWritten.erase(b);
+			m_Stats.BuffersDestroyed++;
+		}
+
+		// Nothing else is used by the code under test
+		virtual void clearTextureFloat(NVRHI::TextureHandle, const NVRHI::Color&) override { }
+		virtual void clearTextureUInt(NVRHI::TextureHandle, uint32_t) override { }
+		virtual void resolveTexture(NVRHI::TextureHandle, NVRHI::TextureHandle, NVRHI::Format::Enum, uint32_t, uint32_t) override { }
+		virtual void clearBufferUInt(NVRHI::BufferHandle, uint32_t) override { }
+		virtual void copyToBuffer(NVRHI::BufferHandle, uint32_t, NVRHI::BufferHandle, uint32_t, size_t) override { }
+		virtual void readBuffer(NVRHI::BufferHandle, void*, size_t* dataSize) override { *dataSize = 0; }
+		virtual NVRHI::ConstantBufferHandle createConstantBuffer(const NVRHI::ConstantBufferDesc&, const void*) override { return nullptr; }
+		virtual void writeConstantBuffer(NVRHI::ConstantBufferHandle, const void*, size_t) override { }
+		virtual void destroyConstantBuffer(NVRHI::ConstantBufferHandle) override { }
+		virtual NVRHI::ShaderHandle createShader(const NVRHI::ShaderDesc&, const void*, const size_t) override { return nullptr; }
+		virtual void destroyShader(NVRHI::ShaderHandle) override { }
+		virtual NVRHI::SamplerHandle createSampler(const NVRHI::SamplerDesc&) override { return nullptr; }
+		virtual void destroySampler(NVRHI::SamplerHandle) override { }
+		virtual NVRHI::InputLayoutHandle createInputLayout(const NVRHI::VertexAttributeDesc*, uint32_t, const void*, const size_t) override { return nullptr; }
+		virtual void destroyInputLayout(NVRHI::InputLayoutHandle) override { }
+		virtual NVRHI::PerformanceQueryHandle createPerformanceQuery(const char*) override { return nullptr; }
+		virtual void destroyPerformanceQuery(NVRHI::PerformanceQueryHandle) override { }
+		virtual void beginPerformanceQuery(NVRHI::PerformanceQueryHandle, bool) override { }
+		virtual void endPerformanceQuery(NVRHI::PerformanceQueryHandle) override { }
+		virtual float getPerformanceQueryTimeMS(NVRHI::PerformanceQueryHandle) override { return 0.f; }
+		virtual NVRHI::GraphicsAPI::Enum getGraphicsAPI() override { return NVRHI::GraphicsAPI::D3D12; }
+		virtual void* getAPISpecificInterface(NVRHI::APISpecificInterface::Enum) override { return nullptr; }
+		virtual NVRHI::ShaderHandle createShaderFromAPIInterface(NVRHI::ShaderType::Enum, const void*) override { return nullptr; }
+		virtual bool isOpenGLExtensionSupported(const char*) override { return false; }
+		virtual void* getOpenGLProcAddress(const char*) override { return nullptr; }
+		virtual void draw(const NVRHI::DrawCallState&, const NVRHI::DrawArguments*, uint32_t) override { }
+		virtual void drawIndexed(const NVRHI::DrawCallState&, const NVRHI::DrawArguments*, uint32_t) override { }
+		virtual void drawIndirect(const NVRHI::DrawCallState&, NVRHI::BufferHandle, uint32_t) override { }
+		virtual void dispatch(const NVRHI::DispatchState&, uint32_t, uint32_t, uint32_t) override { }
+		virtual void dispatchIndirect(const NVRHI::DispatchState&, NVRHI::BufferHandle, uint32_t) override { }
+		virtual void executeRenderThreadCommand(NVRHI::IRenderThreadCommand* onCommand) override { onCommand->executeAndDispose(); }
+		virtual void setModifiedWMode(bool, uint32_t, const float*, const float*) override { }
+		virtual void setSinglePassStereoMode(bool, uint32_t, bool) override { }
+		virtual uint32_t getNumberOfAFRGroups() override { return 1; }
+		virtual uint32_t getAFRGroupOfCurrentFrame(uint32_t) override { return 0; }
+		virtual void setEnableUavBarriersForTexture(NVRHI::TextureHandle, bool) override { }
+		virtual void setEnableUavBarriersForBuffer(NVRHI::BufferHandle, bool) override { }
+
+	protected:
+		static void Touch(const void* data, UINT64 size)
+		{
+			volatile BYTE touch = 0;
+			for (UINT64 offset = 0; offset < size; offset += 4096)
+				touch = ((const BYTE*)data)[offset];
+			if (size > 0)
+				touch = ((const BYTE*)data)[size - 1];
+			(void)touch;
+		}
+
+		std::mutex										m_Mutex;
+		std::map<NVRHI::TextureHandle, NVRHI::TextureDesc*>	m_Textures;
+		std::map<NVRHI::BufferHandle, NVRHI::BufferDesc*>	m_Buffers;
+		std::map<NVRHI::BufferHandle, UINT64>				m_BufferBytesWritten;
+		Stats											m_Stats;
+	};
+
+
+
+	// Texture upload queue: loading threads push decoded mip chains while the "render thread" uploads
+	// a few megabytes per frame. Checks that everything pushed is written exactly once, that the
+	// decoded mips alive at once stay within the budget, and that Shutdown lets a blocked Push go.
+
+	// A 32-bit mip chain, the way TextureCache builds one
+	uint AllocateMips(uint size, FIBITMAP** mipData)
+	{
+		uint mipLevels = 0;
+		for (uint mipSize = size; mipSize > 0; mipSize /= 2)
+		{
+			mipData[mipLevels] = FreeImage_Allocate(mipSize, mipSize, 32);
+			memset(FreeImage_GetBits(mipData[mipLevels]), int(mipLevels), FreeImage_GetPitch(mipData[mipLevels]) * mipSize);
+			mipLevels++;
+		}
+		return mipLevels;
+	}
+
+	Texture2DEx* CreateTexture(StubRendererInterface& renderer, uint size, uint mipLevels)
+	{
+		NVRHI::TextureDesc textureDesc;
+		textureDesc.width = size;
+		textureDesc.height = size;
+		textureDesc.format = NVRHI::Format::BGRA8_UNORM;
+		textureDesc.mipLevels = mipLevels;
+
+		Texture2DEx* texture = new Texture2DEx();
+		texture->Texture = renderer.createTexture(textureDesc, nullptr);
+		return texture;
+	}
+
+	uint MipChainLevels(uint size)
+	{
+		uint mipLevels = 0;
+		for (uint mipSize = size; mipSize > 0; mipSize /= 2)
+			mipLevels++;
+		return mipLevels;
+	}
+
+	UINT64 MipChainBytes(uint size)
+	{
+		UINT64 bytes = 0;
+		for (uint mipSize = size; mipSize > 0; mipSize /= 2)
+			bytes += UINT64(mipSize) * 4 * mipSize;
+		return bytes;
+	}
+
+	bool TestTextureUploadQueue()
+	{
+		StubRendererInterface renderer;
+
+		// Several loaders pushing more than the budget between them, uploaded a few textures per frame
+		const uint loadersNum = 4;
+		const uint texturesPerLoader = 12;
+		const uint textureSize = 512;
+		const UINT64 budget = 4 << 20;
+		const UINT64 perFrame = 2 << 20;
+
+		TextureUploadQueue queue(budget);
+		std::vector<Texture2DEx*> textures;
+		for (uint i = 0; i < loadersNum * texturesPerLoader; i++)
+			textures.push_back(CreateTexture(renderer, textureSize, MipChainLevels(textureSize)));
+
+		std::atomic<uint> loadersDone(0);
+		std::vector<std::thread> loaders;
+		INT64 timestampStart = Timestamp();
+		for (uint loader = 0; loader < loadersNum; loader++)
+		{
+			loaders.emplace_back([&, loader]()
+			{
+				for (uint i = 0; i < texturesPerLoader; i++)
+				{
+					FIBITMAP* mipData[16] = {};
+					uint mipLevels = AllocateMips(textureSize, mipData);
+					queue.Push(textures[loader * texturesPerLoader + i], mipData, mipLevels);
+				}
+				loadersDone++;
+			});
+		}
+
+		uint frames = 0;
+		while (loadersDone < loadersNum || !queue.IsEmpty())
+		{
+			queue.Upload(&renderer, perFrame);
+			frames++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		for (auto& loader : loaders)
+			loader.join();
+		INT64 timestampEnd = Timestamp();
+
+		TextureUploadQueue::Stats stats = queue.GetStats();
+		StubRendererInterface::Stats rendererStats = renderer.GetStats();
+		const uint texturesNum = loadersNum * texturesPerLoader;
+		const UINT64 bytesExpected = UINT64(texturesNum) * MipChainBytes(textureSize);
+
+		LOG("Upload queue: %u textures, %.1f MB in %u frames, %.1f ms; peak %.2f MB pending (budget %.1f MB), %.2f MB in one frame; %u stalls",
+			stats.TexturesUploaded, double(stats.BytesUploaded) / 1048576.0, frames, ElapsedMs(timestampStart, timestampEnd),
+			double(stats.PeakBytesPending) / 1048576.0, double(budget) / 1048576.0,
+			double(stats.PeakBytesPerFrame) / 1048576.0, stats.PushStalls);
+
+		bool passed = true;
+		if (stats.TexturesUploaded != texturesNum || stats.BytesUploaded != bytesExpected ||
+			rendererStats.TextureBytesWritten != bytesExpected ||
+			rendererStats.TextureWrites != texturesNum * MipChainLevels(textureSize) ||
+			rendererStats.BadWrites != 0)
+		{
+			LOG("Uploaded %u textures, %llu bytes (%llu written in %u writes, %u bad); expected %u, %llu",
+				stats.TexturesUploaded, stats.BytesUploaded, rendererStats.TextureBytesWritten, rendererStats.TextureWrites,
+				rendererStats.BadWrites, texturesNum, bytesExpected);
+			passed = false;
+		}
+
+		// Every texture is smaller than the budget, so the queue should never hold more than that
+		if (stats.PeakBytesPending > budget || stats.PushStalls == 0)
+		{
+			LOG("Peak %llu bytes pending with a budget of %llu, and %u stalls", stats.PeakBytesPending, budget, stats.PushStalls);
+			passed = false;
+		}
+
+		// Shutdown with a loader stuck waiting for room: the first texture fills the budget, so the second
+		// one blocks until something is uploaded, which never happens
+		queue.Reset(MipChainBytes(textureSize));
+
+		FIBITMAP* mipData[16] = {};
+		uint mipLevels = AllocateMips(textureSize, mipData);
+		queue.Push(textures[0], mipData, mipLevels);
+
+		std::atomic<bool> blockedPushReturned(false);
+		std::thread blockedLoader([&]()
+		{
+			FIBITMAP* mipData[16] = {};
+			uint mipLevels = AllocateMips(textureSize, mipData);
+			queue.Push(textures[1], mipData, mipLevels);
+			blockedPushReturned = true;
+		});
+
+		for (int wait = 0; wait < 5000 && queue.GetStats().PushStalls == 0; wait++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (queue.GetStats().PushStalls != 1 || blockedPushReturned)
+		{
+			LOG("The second push didn't wait for room in the queue");
+			passed = false;
+		}
+
+		timestampStart = Timestamp();
+		queue.Shutdown();
+		for (int wait = 0; wait < 5000 && !blockedPushReturned; wait++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		timestampEnd = Timestamp();
+
+		if (!blockedPushReturned)
+		{
+			// Leave it stuck rather than hang the tests
+			LOG("Shutdown didn't wake the blocked push");
+			blockedLoader.detach();
+			return false;
+		}
+		blockedLoader.join();
+		LOG("Shutdown let the blocked push go after %.2f ms", ElapsedMs(timestampStart, timestampEnd));
+
+		// Nothing is queued, or uploaded, once shut down; pushes are dropped until the next Reset
+		UINT64 bytesWrittenBefore = renderer.GetStats().TextureBytesWritten;
+		mipLevels = AllocateMips(textureSize, mipData);
+		queue.Push(textures[2], mipData, mipLevels);
+		if (!queue.IsEmpty() || queue.Upload(&renderer, ~0ull) != 0 || renderer.GetStats().TextureBytesWritten != bytesWrittenBefore)
+		{
+			LOG("The queue took a texture after Shutdown");
+			passed = false;
+		}
+
+		queue.Reset(budget);
+		mipLevels = AllocateMips(textureSize, mipData);
+		queue.Push(textures[3], mipData, mipLevels);
+		if (queue.Upload(&renderer, ~0ull) != 1)
+		{
+			LOG("The queue didn't take textures again after Reset");
+			passed = false;
+		}
+
+		for (auto texture : textures)
+		{
+			renderer.destroyTexture(texture->Texture);
+			delete texture;
+		}
+
+		return passed;
+	}
+
+
+
+	// Texture cache: the same file asked for as sRGB and as linear gets two textures, since their formats
+	// differ; a copy of a file under another name shares the first one's texture; and a file whose hash
+	// matches another's but whose bytes don't is loaded on its own. The last case is set up by rewriting
+	// a file after it's been loaded, since real 64-bit hash collisions are hard to come by.
+
+	std::string GetTestDirectory(const char* name)
+	{
+		char tempPath[MAX_PATH];
+		GetTempPathA(MAX_PATH, tempPath);
+		std::string directory = std::string(tempPath) + name;
+		CreateDirectoryA(directory.c_str(), nullptr);
+		return directory + "\\";
+	}
+
+	// A 32-bit image with a pattern that depends on the seed
+	bool WriteTestImage(const std::string& path, uint size, uint seed)
+	{
+		FIBITMAP* bitmap = FreeImage_Allocate(size, size, 32);
+		for (uint y = 0; y < size; y++)
+		{
+			BYTE* row = FreeImage_GetScanLine(bitmap, y);
+			for (uint x = 0; x < size * 4; x++)
+				row[x] = BYTE((x * 7 + y * 13) ^ (seed * 101));
+		}
+		bool written = FreeImage_Save(FIF_TGA, bitmap, path.c_str()) != FALSE;
+		FreeImage_Unload(bitmap);
+		return written;
+	}
+
+	// Waits for the loading tasks, uploading as they go, like the demo's render thread
+	void FinishLoading(concurrency::task_group& taskGroup, TextureUploadQueue& queue, StubRendererInterface& renderer)
+	{
+		std::atomic<bool> loaded(false);
+		std::thread waiter([&]() { taskGroup.wait(); loaded = true; });
+		while (!loaded)
+		{
+			queue.Upload(&renderer, ~0ull);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		waiter.join();
+		queue.Upload(&renderer, ~0ull);
+	}
+
+	bool TestTextureCache()
+	{
+		std::string directory = GetTestDirectory("texture-cache-test");
+		const uint imageSize = 64;
+		if (!WriteTestImage(directory + "a.tga", imageSize, 1) ||
+			!WriteTestImage(directory + "copy-of-a.tga", imageSize, 1) ||
+			!WriteTestImage(directory + "b.tga", imageSize, 2))
+		{
+			LOG("Couldn't write the test images to %s", directory.c_str());
+			return false;
+		}
+
+		StubRendererInterface renderer;
+		TextureUploadQueue queue;
+		TextureCache cache;
+		cache.Init(&renderer, &queue, std::string());
+
+		Scene::LoadingStats loadingStats = {};
+		concurrency::task_group taskGroup;
+		Texture2DEx* aSRGB = cache.Acquire(directory + "a.tga", true, loadingStats, taskGroup);
+		Texture2DEx* aLinear = cache.Acquire(directory + "a.tga", false, loadingStats, taskGroup);
+		Texture2DEx* aSRGBAgain = cache.Acquire(directory + ".\\A.TGA", true, loadingStats, taskGroup);
+		Texture2DEx* b = cache.Acquire(directory + "b.tga", true, loadingStats, taskGroup);
+		FinishLoading(taskGroup, queue, renderer);
+
+		// Ask for the copy only once a's decode is done, so it's a's file that gets compared
+		Texture2DEx* copyOfA = cache.Acquire(directory + "copy-of-a.tga", true, loadingStats, taskGroup);
+		FinishLoading(taskGroup, queue, renderer);
+
+		bool passed = true;
+		if (!aSRGB->Texture || !aLinear->Texture || !b->Texture || !copyOfA->Texture)
+		{
+			LOG("A texture didn't load");
+			passed = false;
+		}
+		else
+		{
+			if (aSRGBAgain != aSRGB || aLinear->Texture == aSRGB->Texture ||
+				renderer.describeTexture(aSRGB->Texture).format != NVRHI::Format::SBGRA8_UNORM ||
+				renderer.describeTexture(aLinear->Texture).format != NVRHI::Format::BGRA8_UNORM)
+			{
+				LOG("The same file as sRGB and as linear should have two textures, in those formats");
+				passed = false;
+			}
+
+			if (copyOfA->Texture != aSRGB->Texture || b->Texture == aSRGB->Texture)
+			{
+				LOG("The copy of a file should share its texture, and a different file shouldn't");
+				passed = false;
+			}
+		}
+
+		// Rewrite b's file, and load the original contents under another name: the hash matches the
+		// entry that was loaded from b, but its file no longer has the same bytes, so nothing is shared
+		WriteTestImage(directory + "b-original.tga", imageSize, 2);
+		WriteTestImage(directory + "b.tga", imageSize, 3);
+		Texture2DEx* bOriginal = cache.Acquire(directory + "b-original.tga", true, loadingStats, taskGroup);
+		FinishLoading(taskGroup, queue, renderer);
+
+		if (!bOriginal->Texture || bOriginal->Texture == b->Texture)
+		{
+			LOG("A file whose hash matched but whose bytes didn't shared a texture");
+			passed = false;
+		}
+
+		TextureCache::Stats stats = cache.GetStats();
+		LOG("Texture cache: %u requests, %u shared by path, %u shared by contents, %u hash matches with other contents, %u decoded",
+			stats.Requests, stats.PathHits, stats.ContentHits, stats.ContentMismatches, stats.Decodes);
+		if (stats.PathHits != 1 || stats.ContentHits != 1 || stats.ContentMismatches != 1 || stats.Decodes != 4)
+		{
+			LOG("Expected 1 shared by path, 1 shared by contents, 1 mismatch and 4 decodes");
+			passed = false;
+		}
+
+		// The last reference to each texture destroys it, whoever else shared it
+		Texture2DEx* textures[] = { aSRGB, aLinear, aSRGBAgain, b, copyOfA, bOriginal };
+		for (uint i = 0; i < dim(textures); i++)
+			cache.Release(textures[i]);
+
+		StubRendererInterface::Stats rendererStats = renderer.GetStats();
+		if (rendererStats.TexturesDestroyed != rendererStats.TexturesCreated || rendererStats.BadWrites != 0)
+		{
+			LOG("%u textures created, %u destroyed, %u bad writes",
+				rendererStats.TexturesCreated, rendererStats.TexturesDestroyed, rendererStats.BadWrites);
+			passed = false;
+		}
+
+		const char* files[] = { "a.tga", "copy-of-a.tga", "b.tga", "b-original.tga" };
+		for (uint i = 0; i < dim(files); i++)
+			DeleteFileA((directory + files[i]).c_str());
+
+		return passed;
+	}
+
+
+
+	// Mip cache: loads a few images three times with the mip cache on. The first run decodes them and
+	// writes their mip chains; the second finds every source unchanged in the index and maps its mips
+	// without reading it; the third does the same except for one image that was rewritten in between.
+	// Also checks that mip cache files with corrupt offsets and sizes are rejected, not mapped.
+
+	// Opens up the mip cache internals for the corruption checks
+	class MipCacheProbe : public TextureCache
+	{
+	public:
+		using TextureCache::MapMipCache;
+		using TextureCache::WriteMipCache;
+		using TextureCache::GetMipCachePath;
+	};
+
+	void DeleteDirectory(const std::string& directory)
+	{
+		WIN32_FIND_DATAA findData;
+		HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &findData);
+		if (find != INVALID_HANDLE_VALUE)
+		{
+			do
+			{
+				if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+					DeleteFileA((directory + "\\" + findData.cFileName).c_str());
+			}
+			while (FindNextFileA(find, &findData));
+			FindClose(find);
+		}
+		RemoveDirectoryA(directory.c_str());
+	}
+
+	TextureCache::Stats LoadThroughMipCache(const std::vector<std::string>& paths, const std::string& mipCacheDirectory, UINT64& bytesUploaded, float& loadMs)
+	{
+		StubRendererInterface renderer;
+		TextureUploadQueue queue;
+		TextureCache cache;
+		cache.Init(&renderer, &queue, mipCacheDirectory);
+
+		INT64 timestampStart = Timestamp();
+		Scene::LoadingStats loadingStats = {};
+		concurrency::task_group taskGroup;
+		std::vector<Texture2DEx*> textures;
+		for (auto& path : paths)
+			textures.push_back(cache.Acquire(path, true, loadingStats, taskGroup));
+		FinishLoading(taskGroup, queue, renderer);
+		loadMs = ElapsedMs(timestampStart, Timestamp());
+
+		for (auto texture : textures)
+			cache.Release(texture);
+
+		bytesUploaded = renderer.GetStats().TextureBytesWritten;
+		return cache.GetStats();
+	}
+
+	bool TestMipCache()
+	{
+		std::string directory = GetTestDirectory("mip-cache-test");
+		std::string mipCacheDirectory = directory + "mips";
+		DeleteDirectory(mipCacheDirectory);
+
+		std::vector<std::string> paths;
+		const uint imageSizes[] = { 256, 128, 64, 32 };
+		for (uint i = 0; i < dim(imageSizes); i++)
+		{
+			char name[32];
+			sprintf_s(name, "image%u.tga", i);
+			paths.push_back(directory + name);
+			if (!WriteTestImage(paths.back(), imageSizes[i], i))
+			{
+				LOG("Couldn't write the test images to %s", directory.c_str());
+				return false;
+			}
+		}
+
+		const uint imagesNum = uint(paths.size());
+		const char* runNames[] = { "cold", "warm", "one changed" };
+		uint expectedSourceIndexHits[] = { 0, imagesNum, imagesNum - 1 };
+		uint expectedMipCacheHits[] = { 0, imagesNum, imagesNum - 1 };
+		uint expectedDecodes[] = { imagesNum, 0, 1 };
+		UINT64 bytesUploaded[3] = {};
+
+		bool passed = true;
+		for (uint run = 0; run < 3; run++)
+		{
+			// A different size, so the change shows even if the write time doesn't move
+			if (run == 2)
+				WriteTestImage(paths[1], imageSizes[1] / 2, 47);
+
+			float loadMs = 0.f;
+			TextureCache::Stats stats = LoadThroughMipCache(paths, mipCacheDirectory, bytesUploaded[run], loadMs);
+			LOG("Mip cache, %s: %u sources found in the index, %u mapped, %u decoded, %u written, %.1f MB uploaded in %.2f ms",
+				runNames[run], stats.SourceIndexHits, stats.MipCacheHits, stats.Decodes, stats.MipCacheWrites,
+				double(bytesUploaded[run]) / 1048576.0, loadMs);
+
+			if (stats.SourceIndexHits != expectedSourceIndexHits[run] || stats.MipCacheHits != expectedMipCacheHits[run] ||
+				stats.Decodes != expectedDecodes[run] || stats.MipCacheWrites != expectedDecodes[run])
+			{
+				LOG("Expected %u found in the index, %u mapped, %u decoded and written",
+					expectedSourceIndexHits[run], expectedMipCacheHits[run], expectedDecodes[run]);
+				passed = false;
+			}
+		}
+
+		if (bytesUploaded[1] != bytesUploaded[0])
+		{
+			LOG("The mapped mips uploaded %llu bytes, the decoded ones %llu", bytesUploaded[1], bytesUploaded[0]);
+			passed = false;
+		}
+
+		// Mip cache files whose mips run past the end of the file, including ones where the offset plus
+		// the size wraps around to something small
+		StubRendererInterface renderer;
+		TextureUploadQueue queue;
+		MipCacheProbe probe;
+		probe.Init(&renderer, &queue, mipCacheDirectory);
+
+		const UINT64 sourceHash = 0x0123456789abcdefull;
+		const UINT64 sourceSize = 4096;
+		struct Corruption
+		{
+			const char* name;
+			size_t fieldOffset;
+			UINT64 value;
+			size_t valueSize;
+		};
+		const Corruption corruptions[] =
+		{
+			{ "none", 0, 0, 0 },
+			{ "offset wraps around", offsetof(MipCacheHeader, mips[0].offset), ~0ull - 255, sizeof(UINT64) },
+			{ "offset past the end", offsetof(MipCacheHeader, mips[1].offset), 1ull << 40, sizeof(UINT64) },
+			{ "height past the end", offsetof(MipCacheHeader, mips[0].height), 0xffffffffull, sizeof(uint) },
+			{ "pitch below the width", offsetof(MipCacheHeader, mips[0].rowPitch), 4, sizeof(uint) },
+		};
+
+		for (uint i = 0; i < dim(corruptions); i++)
+		{
+			FIBITMAP* mipData[16] = {};
+			uint mipLevels = AllocateMips(16, mipData);
+			probe.WriteMipCache(sourceHash, sourceSize, 32, mipData, mipLevels);
+			for (uint mipLevel = 0; mipLevel < mipLevels; mipLevel++)
+				FreeImage_Unload(mipData[mipLevel]);
+
+			if (corruptions[i].valueSize)
+			{
+				FILE* file = nullptr;
+				if (fopen_s(&file, probe.GetMipCachePath(sourceHash).c_str(), "r+b") != 0)
+				{
+					LOG("Couldn't open the mip cache file to corrupt it");
+					return false;
+				}
+				fseek(file, long(corruptions[i].fieldOffset), SEEK_SET);
+				fwrite(&corruptions[i].value, corruptions[i].valueSize, 1, file);
+				fclose(file);
+			}
+
+			const MipCacheHeader* header = probe.MapMipCache(sourceHash, sourceSize);
+			bool expectValid = (corruptions[i].valueSize == 0);
+			if ((header != nullptr) != expectValid)
+			{
+				LOG("Mip cache file with corruption \"%s\" was %s", corruptions[i].name, header ? "accepted" : "rejected");
+				passed = false;
+			}
+			if (header)
+				UnmapViewOfFile(header);
+		}
+
+		DeleteDirectory(mipCacheDirectory);
+		for (auto& path : paths)
+			DeleteFileA(path.c_str());
+
+		return passed;
+	}
+
+
+
+	// Frustum culling: Frustum::cullBoxes against Frustum::intersectsWith, one box at a time, on 10k to 1M
+	// random boxes seen by a few cameras, alone and as a stereo pair. The visible lists have to be exactly
+	// the same, since the SIMD test is meant to do the same arithmetic four boxes at a time.
+
+	// World to clip for a camera at eye looking at target, with y up. The projection looks down +z, so
+	// the view's -z axis points away from the target.
+	float4x4 LookAtWorldToClip(const float3& eye, const float3& target, float verticalFOV, float zNear, float zFar)
+	{
+		affine3 viewToWorld = lookatZ(eye - target, makefloat3(0.f, 1.f, 0.f));
+		viewToWorld.m_translation = eye;
+		return affineToHomogeneous(transpose(viewToWorld)) * perspProjD3DStyle(verticalFOV, 16.f / 9.f, zNear, zFar);
+	}
+
+	// Boxes scattered over a cube of the given size around the origin. Every 97th one is inside out, like
+	// the bounds of an empty mesh, since those have to agree too.
+	void RandomBoxes(RNG& rng, uint count, float fieldSize, float maxBoxSize, BoxesSoA& boxes)
+	{
+		boxes.resize(count);
+		for (uint i = 0; i < count; i++)
+		{
+			point3 center = makepoint3(makefloat3(rng.randFloat(), rng.randFloat(), rng.randFloat()) * fieldSize - 0.5f * fieldSize);
+			float3 halfSize = makefloat3(rng.randFloat(), rng.randFloat(), rng.randFloat()) * (0.5f * maxBoxSize);
+			if (i % 97 == 0)
+				halfSize = -halfSize;
+			boxes.set(i, makebox3(center - halfSize, center + halfSize));
+		}
+	}
+
+	bool TestFrustumCull()
+	{
+		RNG rng(44);
+		const uint boxCounts[] = { 10000, 100000, 1000000 };
+		const uint camerasNum = 4;
+		const float fieldSize = 1000.f;
+
+		bool passed = true;
+		for (uint boxCount : boxCounts)
+		{
+			BoxesSoA boxes;
+			RandomBoxes(rng, boxCount, fieldSize, 20.f, boxes);
+
+			std::vector<uint> expected[3];
+			std::vector<uint> visible[3];
+			for (uint list = 0; list < 3; list++)
+			{
+				expected[list].reserve(boxCount);
+				visible[list].resize(boxCount);
+			}
+
+			float scalarMs = 0.f;
+			float simdMs = 0.f;
+			float stereoMs = 0.f;
+			UINT64 visibleTotal = 0;
+
+			for (uint camera = 0; camera < camerasNum; camera++)
+			{
+				// From inside the field looking across it, and from outside looking in
+				float3 eye = makefloat3(rng.randFloat(), rng.randFloat(), rng.randFloat()) * fieldSize - 0.5f * fieldSize;
+				if (camera & 1)
+					eye *= 2.f;
+				float3 target = makefloat3(rng.randFloat(), rng.randFloat(), rng.randFloat()) * (0.5f * fieldSize) - 0.25f * fieldSize;
+				float3 right = normalize(cross(makefloat3(0.f, 1.f, 0.f), target - eye)) * 0.064f;
+
+				Frustum frustums[2] = {
+					Frustum(LookAtWorldToClip(eye - right, target, 1.5f, 0.1f, 2.f * fieldSize)),
+					Frustum(LookAtWorldToClip(eye + right, target, 1.5f, 0.1f, 2.f * fieldSize)),
+				};
+
+				// Not starting on a multiple of four, as a mesh's instances usually don't
+				const uint first = camera + 1;
+				const uint count = boxCount - first;
+
+				INT64 timestampStart = Timestamp();
+				for (uint list = 0; list < 3; list++)
+					expected[list].clear();
+				for (uint i = 0; i < count; i++)
+				{
+					box3 box = boxes.get(first + i);
+					bool left = frustums[0].intersectsWith(box);
+					bool right = frustums[1].intersectsWith(box);
+					if (left)
+						expected[0].push_back(i);
+					if (right)
+						expected[1].push_back(i);
+					if (left || right)
+						expected[2].push_back(i);
+				}
+				INT64 timestampScalar = Timestamp();
+
+				uint visibleNum = frustums[0].cullBoxes(boxes, first, count, visible[0].data());
+				INT64 timestampSimd = Timestamp();
+
+				// Left, right and either, in one pass
+				const Frustum* frustumPointers[2] = { &frustums[0], &frustums[1] };
+				const uint listFrustumMasks[3] = { 1, 2, 3 };
+				uint* lists[3] = { visible[0].data(), visible[1].data(), visible[2].data() };
+				uint visibleNums[3];
+				bool singleMatches = (visibleNum == expected[0].size() &&
+					std::equal(expected[0].begin(), expected[0].end(), visible[0].begin()));
+
+				Frustum::cullBoxes(frustumPointers, 2, listFrustumMasks, 3, boxes, first, count, lists, visibleNums);
+				INT64 timestampStereo = Timestamp();
+
+				scalarMs += ElapsedMs(timestampStart, timestampScalar);
+				simdMs += ElapsedMs(timestampScalar, timestampSimd);
+				stereoMs += ElapsedMs(timestampSimd, timestampStereo);
+				visibleTotal += expected[0].size();
+
+				if (!singleMatches)
+				{
+					LOG("%u boxes, camera %u: cullBoxes found %u visible, intersectsWith %u", boxCount, camera, visibleNum, uint(expected[0].size()));
+					passed = false;
+				}
+
+				for (uint list = 0; list < 3; list++)
+				{
+					if (visibleNums[list] != expected[list].size() ||
+						!std::equal(expected[list].begin(), expected[list].end(), visible[list].begin()))
+					{
+						LOG("%u boxes, camera %u: the stereo cullBoxes' list %u has %u visible, intersectsWith %u",
+							boxCount, camera, list, visibleNums[list], uint(expected[list].size()));
+						passed = false;
+					}
+				}
+			}
+
+			LOG("Frustum culling %u boxes, %.1f%% visible: intersectsWith %.2f ms, cullBoxes %.2f ms (%.1fx); both eyes in one pass %.2f ms",
+				boxCount, 100.0 * double(visibleTotal) / (double(boxCount) * camerasNum), scalarMs / camerasNum, simdMs / camerasNum,
+				scalarMs / __max(simdMs, 1e-6f), stereoMs / camerasNum);
+		}
+
+		return passed;
+	}
+
+
+	// Instance upload: culls a grid of instanced boxes from cameras that see none, some, most and all of it,
+	// and checks that each cull uploads exactly the visible instances, in every instance format and with or
+	// without the tree, and that culling the same view again uploads nothing.
+
+	// A scene made of boxes instead of an imported file. Each mesh is a closed box, so it can also be chosen
+	// as an occluder; there are no materials, so there are no textures to load.
+	class BoxScene : public Scene
+	{
+	public:
+		using Scene::LoadCache;
+		using Scene::WriteCache;
+
+		uint AddMaterial(const char* diffuseTexture, const float3& diffuseColor)
+		{
+			MaterialSource source;
+			source.m_DiffuseTexture = diffuseTexture;
+			source.m_DiffuseColor = diffuseColor;
+			m_MaterialSources.push_back(source);
+			return uint(m_MaterialSources.size() - 1);
+		}
+
+		void AddBox(const box3& bounds, uint materialIndex = 0)
+		{
+			// Two triangles per face; corner i is on the max side of axis j if bit j of i is set
+			static const uint boxIndices[36] =
+			{
+				0, 2, 6, 0, 6, 4,		1, 3, 7, 1, 7, 5,
+				0, 1, 5, 0, 5, 4,		2, 3, 7, 2, 7, 6,
+				0, 1, 3, 0, 3, 2,		4, 5, 7, 4, 7, 6,
+			};
+
+			m_IndexOffsets.push_back(uint(m_Indices.size()));
+			m_VertexOffsets.push_back(uint(m_Vertices.size()));
+			m_MeshToSceneMapping.push_back(uint(m_SceneMeshBounds.size()));
+			m_MeshIndicesNum.push_back(dim(boxIndices));
+			m_MeshMaterials.push_back(materialIndex);
+			m_SceneMeshBounds.push_back(bounds);
+
+			m_Indices.insert(m_Indices.end(), boxIndices, boxIndices + dim(boxIndices));
+			for (int corner = 0; corner < 8; corner++)
+			{
+				Vertex vertex = {};
+				vertex.m_pos = makefloat3(bounds.getCorner(corner));
+				m_Vertices.push_back(vertex);
+			}
+
+			m_IndexData = m_Indices.data();
+			m_VertexData = m_Vertices.data();
+			m_IndicesNum = uint(m_Indices.size());
+			m_VerticesNum = uint(m_Vertices.size());
+		}
+
+		// Does what the demo does once a scene has been loaded and its instances added
+		void Finish(NVRHI::IRendererInterface* rendererInterface)
+		{
+			Scene::LoadingStats loadingStats = {};
+			concurrency::task_group taskGroup;
+
+			UpdateBounds();
+			InitResources(rendererInterface, nullptr, loadingStats, taskGroup);
+			taskGroup.wait();
+			FinalizeInit();
+		}
+
+		// Compares what a scene cache holds: the geometry, the mesh table and the materials
+		bool HasSameGeometry(const BoxScene& other) const
+		{
+			if (m_IndicesNum != other.m_IndicesNum || m_VerticesNum != other.m_VerticesNum ||
+				memcmp(m_IndexData, other.m_IndexData, m_IndicesNum * sizeof(uint)) != 0 ||
+				memcmp(m_VertexData, other.m_VertexData, m_VerticesNum * sizeof(Vertex)) != 0 ||
+				m_IndexOffsets != other.m_IndexOffsets || m_VertexOffsets != other.m_VertexOffsets ||
+				m_MeshToSceneMapping != other.m_MeshToSceneMapping || m_MeshIndicesNum != other.m_MeshIndicesNum ||
+				m_MeshMaterials != other.m_MeshMaterials || m_SceneMeshBounds != other.m_SceneMeshBounds ||
+				m_MaterialSources.size() != other.m_MaterialSources.size())
+				return false;
+
+			for (size_t i = 0; i < m_MaterialSources.size(); i++)
+			{
+				const MaterialSource& a = m_MaterialSources[i];
+				const MaterialSource& b = other.m_MaterialSources[i];
+				if (a.m_DiffuseTexture != b.m_DiffuseTexture || a.m_NormalsTexture != b.m_NormalsTexture ||
+					a.m_EmissiveTexture != b.m_EmissiveTexture || any(a.m_DiffuseColor != b.m_DiffuseColor))
+					return false;
+			}
+			return true;
+		}
+
+		const BoxesSoA& GetInstanceBounds() const { return m_InstanceBounds; }
+		const InstanceBVH& GetInstanceBVH() const { return m_InstanceBVH; }
+		uint GetInstancesNum() const { return uint(m_InstanceMatrices.size()); }
+	};
+
+	float4x4 TranslationMatrix(float x, float y, float z)
+	{
+		return affineToHomogeneous(translation(makefloat3(x, y, z)));
+	}
+
+	uint CountVisibleInstances(const BoxScene& scene, const Frustum& frustum)
+	{
+		const BoxesSoA& bounds = scene.GetInstanceBounds();
+		uint visibleNum = 0;
+		for (uint i = 0; i < bounds.size(); i++)
+		{
+			if (frustum.intersectsWith(bounds.get(i)))
+				visibleNum++;
+		}
+		return visibleNum;
+	}
+
+	bool TestInstanceUpload()
+	{
+		StubRendererInterface renderer;
+		BoxScene scene;
+		scene.AddBox(makebox3(-1.f, 0.f, -1.f, 1.f, 2.f, 1.f));
+		scene.AddBox(makebox3(-0.5f, 2.f, -0.5f, 0.5f, 6.f, 0.5f));
+		scene.AddBox(makebox3(-3.f, 0.f, -3.f, 3.f, 0.2f, 3.f));
+
+		const uint gridSize = 40;
+		const float spacing = 10.f;
+		for (uint z = 0; z < gridSize; z++)
+		{
+			for (uint x = 0; x < gridSize; x++)
+				scene.AddInstance(TranslationMatrix(x * spacing, 0.f, z * spacing));
+		}
+		scene.Finish(&renderer);
+
+		const float center = 0.5f * spacing * (gridSize - 1);
+		const float farEdge = spacing * (gridSize - 1);
+		struct Camera
+		{
+			const char* name;
+			float3 eye;
+			float3 target;
+		};
+		const Camera cameras[] =
+		{
+			{ "looking away",	makefloat3(center, 20.f, -50.f),		makefloat3(center, 20.f, -1000.f) },
+			{ "at the edge",	makefloat3(center, 20.f, farEdge - 15.f),	makefloat3(center, 0.f, farEdge + 1000.f) },
+			{ "in the middle",	makefloat3(center, 20.f, center),		makefloat3(center, 0.f, farEdge) },
+			{ "from outside",	makefloat3(center, 300.f, -500.f),		makefloat3(center, 0.f, center) },
+		};
+
+		const uint meshesNum = scene.GetMeshesNum();
+		const uint boxesNum = meshesNum * scene.GetInstancesNum();
+		const Scene::CullView view = Scene::CULL_VIEW_LEFT;
+		const InstanceFormat formats[] = { InstanceFormat::FLOAT4X4, InstanceFormat::FLOAT3X4, InstanceFormat::QUANTIZED };
+
+		bool passed = true;
+		for (const Camera& camera : cameras)
+		{
+			Frustum frustums[Scene::CULL_VIEWS_COUNT];
+			frustums[view] = Frustum(LookAtWorldToClip(camera.eye, camera.target, 1.5f, 0.1f, 2000.f));
+			const uint expectedVisible = CountVisibleInstances(scene, frustums[view]);
+
+			UINT64 formatBytes[dim(formats)] = {};
+			for (uint format = 0; format < dim(formats); format++)
+			{
+				scene.SetInstanceFormat(formats[format]);
+				const UINT64 stride = GetInstanceStride(formats[format]);
+
+				for (int useTree = 0; useTree < 2; useTree++)
+				{
+					// Switching between the flat loop and the tree alone doesn't make a view out of date
+					frustums[view] = Frustum(LookAtWorldToClip(camera.eye + makefloat3(0.f, useTree * 0.01f, 0.f), camera.target, 1.5f, 0.1f, 2000.f));
+					const uint visible = useTree ? CountVisibleInstances(scene, frustums[view]) : expectedVisible;
+
+					UINT64 bytesBefore = renderer.GetStats().BufferBytesWritten;
+					scene.FrustumCull(frustums, nullptr, 1 << view, true, useTree != 0);
+					UINT64 bytes = renderer.GetStats().BufferBytesWritten - bytesBefore;
+
+					uint culledNum = 0;
+					for (uint meshID = 0; meshID < meshesNum; meshID++)
+						culledNum += scene.GetCulledInstancesNum(view, meshID);
+
+					if (bytes != stride * visible || scene.GetInstanceBytesUploaded() != bytes || culledNum != visible)
+					{
+						LOG("Camera %s, %u-byte instances%s: uploaded %llu bytes for %u culled instances, expected %llu bytes for %u",
+							camera.name, uint(stride), useTree ? " with the tree" : "", bytes, culledNum, stride * visible, visible);
+						passed = false;
+					}
+
+					// Nothing has moved, so there's nothing to upload
+					bytesBefore = renderer.GetStats().BufferBytesWritten;
+					scene.FrustumCull(frustums, nullptr, 1 << view, true, useTree != 0);
+					if (renderer.GetStats().BufferBytesWritten != bytesBefore || scene.GetInstanceBytesUploaded() != 0)
+					{
+						LOG("Camera %s, %u-byte instances%s: culling the same view again uploaded %llu bytes",
+							camera.name, uint(stride), useTree ? " with the tree" : "", renderer.GetStats().BufferBytesWritten - bytesBefore);
+						passed = false;
+					}
+
+					if (!useTree)
+						formatBytes[format] = bytes;
+				}
+			}
+
+			LOG("Instance upload, camera %s: %u of %u instances visible, %llu / %llu / %llu bytes as 64 / 48 / 32-byte instances",
+				camera.name, expectedVisible, boxesNum, formatBytes[0], formatBytes[1], formatBytes[2]);
+		}
+
+		// With culling off, every instance is uploaded
+		Frustum frustums[Scene::CULL_VIEWS_COUNT];
+		UINT64 bytesBefore = renderer.GetStats().BufferBytesWritten;
+		scene.FrustumCull(frustums, nullptr, 1 << view, false, false);
+		UINT64 bytes = renderer.GetStats().BufferBytesWritten - bytesBefore;
+		UINT64 expectedBytes = UINT64(GetInstanceStride(scene.GetInstanceFormat())) * boxesNum;
+		if (bytes != expectedBytes)
+		{
+			LOG("With culling off, uploaded %llu bytes instead of %llu", bytes, expectedBytes);
+			passed = false;
+		}
+
+		if (renderer.GetStats().BadWrites)
+		{
+			LOG("%u instance buffer writes were out of range", renderer.GetStats().BadWrites);
+			passed = false;
+		}
+
+		return passed;
+	}
+
+
+	// Multi-view culling: the shadow view is culled on its own, then the camera's views are culled together
+	// with it in one pass, as the camera moves. The shadow frustum doesn't change, so the shadow view has to
+	// upload nothing and keep its counts. Every pass also has to come out the same as culling a copy of the
+	// scene one view at a time, count for count and byte for byte, with the flat loop and with the tree.
+
+	// Everything written to a view's instance buffers so far
+	UINT64 GetViewBytesWritten(StubRendererInterface& renderer, const Scene& scene, Scene::CullView view)
+	{
+		UINT64 bytes = 0;
+		for (uint meshID = 0; meshID < scene.GetMeshesNum(); meshID++)
+			bytes += renderer.GetBufferBytesWritten(scene.GetInstanceBuffer_rhi(view, meshID));
+		return bytes;
+	}
+
+	bool TestMultiViewCull()
+	{
+		StubRendererInterface renderer;
+
+		// Culled all views at once, and one view at a time
+		BoxScene scenes[2];
+		const uint gridSize = 40;
+		const float spacing = 10.f;
+		for (BoxScene& scene : scenes)
+		{
+			scene.AddBox(makebox3(-1.f, 0.f, -1.f, 1.f, 2.f, 1.f));
+			scene.AddBox(makebox3(-0.5f, 2.f, -0.5f, 0.5f, 6.f, 0.5f));
+			scene.AddBox(makebox3(-3.f, 0.f, -3.f, 3.f, 0.2f, 3.f));
+			for (uint z = 0; z < gridSize; z++)
+			{
+				for (uint x = 0; x < gridSize; x++)
+					scene.AddInstance(TranslationMatrix(x * spacing, 0.f, z * spacing));
+			}
+			scene.Finish(&renderer);
+		}
+		BoxScene& together = scenes[0];
+		BoxScene& separate = scenes[1];
+
+		// A light looking down on part of the grid
+		const float center = 0.5f * spacing * (gridSize - 1);
+		Frustum frustums[Scene::CULL_VIEWS_COUNT];
+		frustums[Scene::CULL_VIEW_SHADOW] = Frustum(LookAtWorldToClip(makefloat3(100.f, 300.f, 90.f), makefloat3(100.f, 0.f, 100.f), 0.8f, 1.f, 1000.f));
+
+		const uint meshesNum = together.GetMeshesNum();
+		std::vector<uint> shadowCounts(meshesNum);
+		uint shadowVisible = 0;
+		for (BoxScene& scene : scenes)
+			scene.FrustumCull(frustums, nullptr, 1 << Scene::CULL_VIEW_SHADOW, true, false);
+		for (uint meshID = 0; meshID < meshesNum; meshID++)
+		{
+			shadowCounts[meshID] = together.GetCulledInstancesNum(Scene::CULL_VIEW_SHADOW, meshID);
+			shadowVisible += shadowCounts[meshID];
+		}
+
+		bool passed = true;
+		if (shadowVisible == 0)
+		{
+			LOG("The shadow view doesn't see any instances");
+			passed = false;
+		}
+
+		// The camera walks across the grid and turns; the last position differs from the first, so the second
+		// round, with the tree, culls every view again too
+		const float3 eyes[] =
+		{
+			makefloat3(center, 20.f, -50.f),
+			makefloat3(center, 20.f, -40.f),
+			makefloat3(center + 50.f, 15.f, center),
+			makefloat3(100.f, 10.f, 100.f),
+			makefloat3(center, 300.f, -500.f),
+		};
+		// The eyes are far apart and look past each other, so the stereo view has instances only one of them sees
+		const float3 target = makefloat3(center, 0.f, center);
+		const float3 right = makefloat3(5.f, 0.f, 0.f);
+		const uint cameraViews = (1 << Scene::CULL_VIEW_LEFT) | (1 << Scene::CULL_VIEW_RIGHT) | (1 << Scene::CULL_VIEW_STEREO);
+		const uint stride = GetInstanceStride(together.GetInstanceFormat());
+
+		for (int useTree = 0; useTree < 2; useTree++)
+		{
+			for (uint camera = 0; camera < dim(eyes); camera++)
+			{
+				frustums[Scene::CULL_VIEW_LEFT] = Frustum(LookAtWorldToClip(eyes[camera] - right, target + right * 20.f, 1.5f, 0.1f, 2000.f));
+				frustums[Scene::CULL_VIEW_RIGHT] = Frustum(LookAtWorldToClip(eyes[camera] + right, target - right * 20.f, 1.5f, 0.1f, 2000.f));
+
+				UINT64 togetherBytes[Scene::CULL_VIEWS_COUNT];
+				UINT64 separateBytes[Scene::CULL_VIEWS_COUNT];
+				for (uint view = 0; view < Scene::CULL_VIEWS_COUNT; view++)
+				{
+					togetherBytes[view] = GetViewBytesWritten(renderer, together, Scene::CullView(view));
+					separateBytes[view] = GetViewBytesWritten(renderer, separate, Scene::CullView(view));
+				}
+
+				together.FrustumCull(frustums, nullptr, (1 << Scene::CULL_VIEW_SHADOW) | cameraViews, true, useTree != 0);
+				const UINT64 bytesUploaded = together.GetInstanceBytesUploaded();
+				for (uint view = 0; view < Scene::CULL_VIEWS_COUNT; view++)
+					separate.FrustumCull(frustums, nullptr, 1 << view, true, useTree != 0);
+
+				uint camerasVisible = 0;
+				for (uint view = 0; view < Scene::CULL_VIEWS_COUNT; view++)
+				{
+					togetherBytes[view] = GetViewBytesWritten(renderer, together, Scene::CullView(view)) - togetherBytes[view];
+					separateBytes[view] = GetViewBytesWritten(renderer, separate, Scene::CullView(view)) - separateBytes[view];
+
+					uint mismatches = 0;
+					uint visible = 0;
+					for (uint meshID = 0; meshID < meshesNum; meshID++)
+					{
+						uint count = together.GetCulledInstancesNum(Scene::CullView(view), meshID);
+						mismatches += (count != separate.GetCulledInstancesNum(Scene::CullView(view), meshID)) ? 1 : 0;
+						visible += count;
+					}
+
+					// The shadow view isn't culled again, so its bytes are checked on their own below
+					if (mismatches || togetherBytes[view] != separateBytes[view] ||
+						(view != Scene::CULL_VIEW_SHADOW && togetherBytes[view] != UINT64(stride) * visible))
+					{
+						LOG("Camera %u%s, view %u: %u instances and %llu bytes culled in one pass, %llu bytes one view at a time, %u meshes' counts differ",
+							camera, useTree ? " with the tree" : "", view, visible, togetherBytes[view], separateBytes[view], mismatches);
+						passed = false;
+					}
+
+					if (view != Scene::CULL_VIEW_SHADOW)
+						camerasVisible += visible;
+				}
+
+				if (togetherBytes[Scene::CULL_VIEW_SHADOW] != 0)
+				{
+					LOG("Camera %u%s: the unchanged shadow view uploaded %llu bytes", camera, useTree ? " with the tree" : "", togetherBytes[Scene::CULL_VIEW_SHADOW]);
+					passed = false;
+				}
+
+				for (uint meshID = 0; meshID < meshesNum; meshID++)
+				{
+					if (together.GetCulledInstancesNum(Scene::CULL_VIEW_SHADOW, meshID) != shadowCounts[meshID])
+					{
+						LOG("Camera %u%s: the shadow view's count for mesh %u changed from %u to %u", camera, useTree ? " with the tree" : "",
+							meshID, shadowCounts[meshID], together.GetCulledInstancesNum(Scene::CULL_VIEW_SHADOW, meshID));
+						passed = false;
+					}
+				}
+
+				if (bytesUploaded != UINT64(stride) * camerasVisible)
+				{
+					LOG("Camera %u%s: the pass uploaded %llu bytes for %u instances in the camera's views", camera, useTree ? " with the tree" : "", bytesUploaded, camerasVisible);
+					passed = false;
+				}
+
+				if (!useTree)
+				{
+					LOG("Multi-view cull, camera %u: %u instances in the left, right and stereo views, %u in the unchanged shadow view",
+						camera, camerasVisible, shadowVisible);
+				}
+			}
+		}
+
+		if (renderer.GetStats().BadWrites)
+		{
+			LOG("%u instance buffer writes were out of range", renderer.GetStats().BadWrites);
+			passed = false;
+		}
+
+		return passed;
+	}
+
+
+	// Instance BVH: culls a dense city and a building full of furnished rooms through the tree and with the
+	// flat loop, for a stereo pair of frusta, and logs how many nodes and boxes the tree had to test compared
+	// to the flat loop's every box. Then moves some of the instances with SetInstanceMatrices, which refits
+	// the tree on the next cull, and checks again. The tree has to find exactly the same boxes, with the
+	// same frusta, every time.
+
+	float4x4 InstanceMatrix(const float3& position, const float3& scale, float yaw)
+	{
+		return affineToHomogeneous(scaling(scale) * rotation(makefloat3(0.f, 1.f, 0.f), yaw) * translation(position));
+	}
+
+	// Blocks of buildings of random heights, with a few street lamps around each
+	void BuildCityScene(BoxScene& scene, RNG& rng, uint blocksPerSide)
+	{
+		scene.AddBox(makebox3(-10.f, 0.f, -10.f, 10.f, 1.f, 10.f));
+		scene.AddBox(makebox3(-0.2f, 0.f, -0.2f, 0.2f, 5.f, 0.2f));
+
+		const float blockSize = 30.f;
+		for (uint z = 0; z < blocksPerSide; z++)
+		{
+			for (uint x = 0; x < blocksPerSide; x++)
+			{
+				float3 position = makefloat3(x * blockSize, 0.f, z * blockSize);
+				float3 scale = makefloat3(rng.randFloat(0.6f, 1.f), rng.randFloat(5.f, 80.f), rng.randFloat(0.6f, 1.f));
+				scene.AddInstance(InstanceMatrix(position, scale, 0.f));
+
+				for (uint lamp = 0; lamp < 3; lamp++)
+					scene.AddInstance(InstanceMatrix(position + makefloat3(13.f, 0.f, rng.randFloat(-12.f, 12.f)), makefloat3(1.f), 0.f));
+			}
+		}
+	}
+
+	// Floors of rooms, each with a table, chairs and some clutter in it
+	void BuildInteriorScene(BoxScene& scene, RNG& rng, uint roomsPerSide, uint floorsNum)
+	{
+		scene.AddBox(makebox3(-1.f, 0.f, -0.5f, 1.f, 0.8f, 0.5f));
+		scene.AddBox(makebox3(-0.25f, 0.f, -0.25f, 0.25f, 1.f, 0.25f));
+		scene.AddBox(makebox3(-0.1f, 0.f, -0.1f, 0.1f, 0.3f, 0.1f));
+
+		const float roomSize = 6.f;
+		const float floorHeight = 3.f;
+		for (uint floor = 0; floor < floorsNum; floor++)
+		{
+			for (uint z = 0; z < roomsPerSide; z++)
+			{
+				for (uint x = 0; x < roomsPerSide; x++)
+				{
+					float3 roomCenter = makefloat3(x * roomSize, floor * floorHeight, z * roomSize);
+					for (uint item = 0; item < 12; item++)
+					{
+						float3 offset = makefloat3(rng.randFloat(-2.5f, 2.5f), 0.f, rng.randFloat(-2.5f, 2.5f));
+						scene.AddInstance(InstanceMatrix(roomCenter + offset, makefloat3(1.f), rng.randFloat(0.f, 6.28f)));
+					}
+				}
+			}
+		}
+	}
+
+	// Culls the scene's instance bounds through its tree and with the flat loop, and checks that each box is
+	// found visible to the same frusta both ways
+	bool CompareTreeToFlat(const BoxScene& scene, const Frustum* const* frustums, const char* name, InstanceBVH::Stats& stats, float& treeMs, float& flatMs)
+	{
+		const BoxesSoA& bounds = scene.GetInstanceBounds();
+		const uint boxesNum = bounds.size();
+
+		std::vector<uint> treeVisible, treeVisibleFrustums;
+		INT64 timestampStart = Timestamp();
+		scene.GetInstanceBVH().Cull(frustums, 2, bounds, treeVisible, treeVisibleFrustums, &stats);
+		INT64 timestampTree = Timestamp();
+
+		std::vector<uint> flatVisible[2] = { std::vector<uint>(boxesNum), std::vector<uint>(boxesNum) };
+		uint* lists[2] = { flatVisible[0].data(), flatVisible[1].data() };
+		const uint listFrustumMasks[2] = { 1, 2 };
+		uint visibleNums[2];
+		Frustum::cullBoxes(frustums, 2, listFrustumMasks, 2, bounds, 0, boxesNum, lists, visibleNums);
+		INT64 timestampFlat = Timestamp();
+
+		treeMs = ElapsedMs(timestampStart, timestampTree);
+		flatMs = ElapsedMs(timestampTree, timestampFlat);
+
+		std::vector<uint> treeMasks(boxesNum, 0), flatMasks(boxesNum, 0);
+		for (uint j = 0; j < treeVisible.size(); j++)
+			treeMasks[treeVisible[j]] |= treeVisibleFrustums[j] | 0x100;		// Marks the box as found, to catch duplicates
+		for (uint f = 0; f < 2; f++)
+		{
+			for (uint j = 0; j < visibleNums[f]; j++)
+				flatMasks[flatVisible[f][j]] |= (1 << f) | 0x100;
+		}
+
+		uint mismatches = 0;
+		for (uint box = 0; box < boxesNum; box++)
+		{
+			if (treeMasks[box] != flatMasks[box])
+				mismatches++;
+		}
+
+		if (mismatches || treeVisible.size() != std::count_if(flatMasks.begin(), flatMasks.end(), [](uint mask) { return mask != 0; }))
+		{
+			LOG("%s: the tree and the flat loop disagree on %u of %u boxes", name, mismatches, boxesNum);
+			return false;
+		}
+		return true;
+	}
+
+	bool TestInstanceBVH()
+	{
+		RNG rng(47);
+		StubRendererInterface renderer;
+
+		BoxScene city;
+		BuildCityScene(city, rng, 100);
+		city.Finish(&renderer);
+
+		BoxScene interior;
+		BuildInteriorScene(interior, rng, 20, 4);
+		interior.Finish(&renderer);
+
+		struct Camera
+		{
+			const char* name;
+			BoxScene* scene;
+			float3 eye;
+			float3 target;
+			float zFar;
+		};
+		const Camera cameras[] =
+		{
+			{ "city, down a street",	&city,		makefloat3(13.f, 2.f, 5.f),			makefloat3(13.f, 2.f, 3000.f),		1000.f },
+			{ "city, over the roofs",	&city,		makefloat3(-50.f, 150.f, -50.f),	makefloat3(3000.f, 0.f, 1500.f),	1200.f },
+			{ "interior, in a room",	&interior,	makefloat3(60.f, 4.5f, 60.f),		makefloat3(63.f, 3.f, 63.f),		200.f },
+			{ "interior, across a floor",	&interior,	makefloat3(-5.f, 1.5f, -5.f),		makefloat3(120.f, 1.5f, 120.f),		200.f },
+		};
+
+		bool passed = true;
+		for (const Camera& camera : cameras)
+		{
+			float3 right = normalize(cross(makefloat3(0.f, 1.f, 0.f), camera.target - camera.eye)) * 0.032f;
+			Frustum frustums[2] = {
+				Frustum(LookAtWorldToClip(camera.eye - right, camera.target, 1.5f, 0.1f, camera.zFar)),
+				Frustum(LookAtWorldToClip(camera.eye + right, camera.target, 1.5f, 0.1f, camera.zFar)),
+			};
+			const Frustum* frustumPointers[2] = { &frustums[0], &frustums[1] };
+
+			InstanceBVH::Stats stats;
+			float treeMs, flatMs;
+			passed = CompareTreeToFlat(*camera.scene, frustumPointers, camera.name, stats, treeMs, flatMs) && passed;
+
+			LOG("Instance BVH, %s: %u nodes visited, %u boxes tested, %u subtrees accepted, %.2f ms; the flat loop tests %u boxes, %.2f ms",
+				camera.name, stats.NodesVisited, stats.BoxesTested, stats.SubtreesAccepted, treeMs, camera.scene->GetInstanceBounds().size(), flatMs);
+		}
+
+		// Move a tenth of the city's instances a little, and one of them across the city, and cull again through the
+		// scene, which refits the tree first
+		const uint instancesNum = city.GetInstancesNum();
+		const uint movedFirst = instancesNum / 3;
+		const uint movedNum = instancesNum / 10;
+		std::vector<float4x4> moved(movedNum);
+		for (uint i = 0; i < movedNum; i++)
+			moved[i] = InstanceMatrix(makefloat3(rng.randFloat(0.f, 3000.f), 0.f, rng.randFloat(0.f, 3000.f)), makefloat3(1.f), 0.f);
+
+		INT64 timestampStart = Timestamp();
+		city.SetInstanceMatrices(movedFirst, movedNum, moved.data());
+		city.SetInstanceMatrix(7, InstanceMatrix(makefloat3(2900.f, 0.f, 2900.f), makefloat3(1.f, 200.f, 1.f), 0.f));
+		INT64 timestampMoved = Timestamp();
+
+		Frustum frustums[Scene::CULL_VIEWS_COUNT];
+		frustums[Scene::CULL_VIEW_LEFT] = Frustum(LookAtWorldToClip(cameras[1].eye, cameras[1].target, 1.5f, 0.1f, cameras[1].zFar));
+		frustums[Scene::CULL_VIEW_RIGHT] = Frustum(LookAtWorldToClip(cameras[0].eye, cameras[0].target, 1.5f, 0.1f, cameras[0].zFar));
+		city.FrustumCull(frustums, nullptr, 1 << Scene::CULL_VIEW_STEREO, true, true);
+		INT64 timestampCulled = Timestamp();
+
+		const Frustum* frustumPointers[2] = { &frustums[Scene::CULL_VIEW_LEFT], &frustums[Scene::CULL_VIEW_RIGHT] };
+		InstanceBVH::Stats stats;
+		float treeMs, flatMs;
+		passed = CompareTreeToFlat(city, frustumPointers, "city, after moving instances", stats, treeMs, flatMs) && passed;
+
+		// The scene keeps the stats of the traversal that culled the view
+		const InstanceBVH::Stats& sceneStats = city.GetTreeStats(Scene::CULL_VIEW_STEREO);
+		if (sceneStats.NodesVisited != stats.NodesVisited || sceneStats.BoxesTested != stats.BoxesTested)
+		{
+			LOG("The scene's tree stats for the stereo view are %u nodes and %u boxes, its traversal's %u and %u",
+				sceneStats.NodesVisited, sceneStats.BoxesTested, stats.NodesVisited, stats.BoxesTested);
+			passed = false;
+		}
+
+		// What rebuilding the tree from scratch would have cost instead of the refit
+		InstanceBVH rebuilt;
+		INT64 timestampRebuild = Timestamp();
+		rebuilt.Build(city.GetInstanceBounds());
+		float rebuildMs = ElapsedMs(timestampRebuild, Timestamp());
+
+		LOG("Instance BVH, moved %u of %u city instances: %.2f ms to move them, %.2f ms to refit and cull; a rebuild would take %.2f ms",
+			movedNum + 1, instancesNum, ElapsedMs(timestampStart, timestampMoved), ElapsedMs(timestampMoved, timestampCulled), rebuildMs);
+
+		return passed;
+	}
+
+
+	// Occlusion culling: a golden scene whose answer is known, a long wall with a crate hidden behind each
+	// section of it, a crate in front and a pole tall enough to show over it. Every hidden crate in the frustum
+	// has to be culled, and nothing else, for one eye and for a stereo pair, with and without the tree. Then a
+	// city block seen from the street, where only the latency and the number culled are logged.
+
+	struct OcclusionRun
+	{
+		uint frustumVisible[4];			// Per mesh
+		uint culled[4];
+		uint occluded;
+		float renderMs;
+		float cullMs;
+		float cullWithoutOcclusionMs;
+		uint trianglesRendered;
+	};
+
+	// Renders each eye's occlusion buffer and culls the view with it, the way the demo does
+	void CullWithOcclusion(BoxScene& scene, const float4x4* worldToClip, uint eyesNum, bool useTree, OcclusionBuffer* buffers, OcclusionRun& run)
+	{
+		const Scene::CullView view = eyesNum == 2 ? Scene::CULL_VIEW_STEREO : Scene::CULL_VIEW_LEFT;
+		Frustum frustums[Scene::CULL_VIEWS_COUNT];
+		const OcclusionBuffer* occlusion[Scene::CULL_VIEWS_COUNT] = {};
+
+		run.renderMs = 0.f;
+		run.trianglesRendered = 0;
+		for (uint eye = 0; eye < eyesNum; eye++)
+		{
+			Scene::CullView eyeView = eye ? Scene::CULL_VIEW_RIGHT : Scene::CULL_VIEW_LEFT;
+			frustums[eyeView] = Frustum(worldToClip[eye]);
+			occlusion[eyeView] = &buffers[eye];
+
+			buffers[eye].Begin(worldToClip[eye], 0.1f);
+			scene.AddOccluders(buffers[eye], frustums[eyeView]);
+			buffers[eye].Render();
+			run.renderMs += buffers[eye].GetStats().RenderTimeMs;
+			run.trianglesRendered += buffers[eye].GetStats().TrianglesRendered;
+		}
+
+		// Without occlusion first, for the latency it adds
+		INT64 timestampStart = Timestamp();
+		scene.FrustumCull(frustums, nullptr, 1 << view, true, useTree);
+		INT64 timestampFrustum = Timestamp();
+		scene.FrustumCull(frustums, occlusion, 1 << view, true, useTree);
+		INT64 timestampOcclusion = Timestamp();
+
+		run.cullWithoutOcclusionMs = ElapsedMs(timestampStart, timestampFrustum);
+		run.cullMs = ElapsedMs(timestampFrustum, timestampOcclusion);
+		run.occluded = scene.GetOccludedInstancesNum(view);
+
+		const BoxesSoA& bounds = scene.GetInstanceBounds();
+		const uint instancesNum = scene.GetInstancesNum();
+		for (uint meshID = 0; meshID < __min(scene.GetMeshesNum(), 4u); meshID++)
+		{
+			run.culled[meshID] = scene.GetCulledInstancesNum(view, meshID);
+			run.frustumVisible[meshID] = 0;
+			for (uint instance = 0; instance < instancesNum; instance++)
+			{
+				box3 box = bounds.get(meshID * instancesNum + instance);
+				bool visible = false;
+				for (uint eye = 0; eye < eyesNum; eye++)
+					visible = visible || frustums[eye ? Scene::CULL_VIEW_RIGHT : Scene::CULL_VIEW_LEFT].intersectsWith(box);
+				run.frustumVisible[meshID] += visible ? 1 : 0;
+			}
+		}
+	}
+
+	bool TestOcclusionCulling()
+	{
+		StubRendererInterface renderer;
+		OcclusionBuffer buffers[2];
+		buffers[0].Init();
+		buffers[1].Init();
+
+		// Meshes 0 to 3: a wall section, a crate behind it, a crate in front of it, and a pole behind it that's
+		// taller than the wall. The sections are as wide as their spacing, so the wall is continuous.
+		BoxScene wall;
+		wall.AddBox(makebox3(-5.f, 0.f, 0.f, 5.f, 5.f, 0.5f));
+		wall.AddBox(makebox3(-1.f, 0.f, 4.f, 1.f, 2.f, 6.f));
+		wall.AddBox(makebox3(-1.f, 0.f, -6.f, 1.f, 1.f, -4.f));
+		wall.AddBox(makebox3(-0.2f, 0.f, 4.f, 0.2f, 8.f, 4.4f));
+		for (int section = -20; section <= 20; section++)
+			wall.AddInstance(TranslationMatrix(section * 10.f, 0.f, 0.f));
+		wall.Finish(&renderer);
+
+		const float3 eye = makefloat3(3.f, 2.f, -30.f);
+		const float3 right = makefloat3(0.032f, 0.f, 0.f);
+		const float3 target = makefloat3(3.f, 2.f, 0.f);
+
+		bool passed = true;
+		for (uint eyesNum = 1; eyesNum <= 2; eyesNum++)
+		{
+			float4x4 worldToClip[2];
+			for (uint i = 0; i < eyesNum; i++)
+			{
+				float3 eyeOffset = eyesNum == 1 ? makefloat3(0.f) : (i ? right : -right);
+				worldToClip[i] = LookAtWorldToClip(eye + eyeOffset, target + eyeOffset, 1.f, 0.1f, 500.f);
+			}
+
+			for (int useTree = 0; useTree < 2; useTree++)
+			{
+				OcclusionRun run;
+				CullWithOcclusion(wall, worldToClip, eyesNum, useTree != 0, buffers, run);
+
+				const char* name = eyesNum == 2 ? (useTree ? "stereo, tree" : "stereo") : (useTree ? "mono, tree" : "mono");
+				if (run.frustumVisible[1] == 0 || run.culled[1] != 0 || run.occluded != run.frustumVisible[1] ||
+					run.culled[0] != run.frustumVisible[0] || run.culled[2] != run.frustumVisible[2] || run.culled[3] != run.frustumVisible[3])
+				{
+					LOG("Occlusion, wall, %s: %u occluded; %u / %u / %u / %u of %u / %u / %u / %u wall sections, hidden crates, front crates and poles kept",
+						name, run.occluded, run.culled[0], run.culled[1], run.culled[2], run.culled[3],
+						run.frustumVisible[0], run.frustumVisible[1], run.frustumVisible[2], run.frustumVisible[3]);
+					passed = false;
+				}
+
+				if (!useTree)
+				{
+					LOG("Occlusion, wall, %s: %u of %u hidden crates occluded; %u triangles rendered in %.2f ms, culled in %.2f ms (%.2f ms without occlusion)",
+						name, run.occluded, run.frustumVisible[1], run.trianglesRendered, run.renderMs, run.cullMs, run.cullWithoutOcclusionMs);
+				}
+			}
+		}
+
+		// A city small enough for all its buildings to be occluders, seen from the street by both eyes
+		RNG rng(48);
+		BoxScene city;
+		BuildCityScene(city, rng, 20);
+		city.Finish(&renderer);
+
+		float4x4 worldToClip[2] = {
+			LookAtWorldToClip(makefloat3(13.f - 0.032f, 2.f, 5.f), makefloat3(400.f, 2.f, 300.f), 1.5f, 0.1f, 1000.f),
+			LookAtWorldToClip(makefloat3(13.f + 0.032f, 2.f, 5.f), makefloat3(400.f, 2.f, 300.f), 1.5f, 0.1f, 1000.f),
+		};
+
+		OcclusionRun run;
+		CullWithOcclusion(city, worldToClip, 2, true, buffers, run);
+		uint frustumVisible = run.frustumVisible[0] + run.frustumVisible[1];
+		uint culled = run.culled[0] + run.culled[1];
+		LOG("Occlusion, city street, stereo: %u of %u instances in the frusta occluded; %u triangles rendered in %.2f ms, culled in %.2f ms (%.2f ms without occlusion)",
+			run.occluded, frustumVisible, run.trianglesRendered, run.renderMs, run.cullMs, run.cullWithoutOcclusionMs);
+
+		if (run.occluded + culled != frustumVisible)
+		{
+			LOG("Occlusion, city street: %u occluded and %u kept, but %u are in the frusta", run.occluded, culled, frustumVisible);
+			passed = false;
+		}
+
+		return passed;
+	}
+
+
+	// Box transform: boxTransformBatch against boxTransform's eight corners, for a million random affine
+	// matrices with rotations, non-uniform and mirroring scales and large translations, on boxes near and
+	// far from the origin. The bounds have to agree to within rounding, every count from 0 to 9 has to
+	// write exactly its own outputs, and an empty box has to come out unchanged.
+
+	bool TestBoxTransform()
+	{
+		RNG rng(49);
+		const uint matricesNum = 1000003;
+
+		std::vector<affine3> affines(matricesNum);
+		std::vector<float4x4> matrices(matricesNum);
+		for (uint i = 0; i < matricesNum; i++)
+		{
+			float3 axis = normalize(makefloat3(rng.randFloat(-1.f, 1.f), rng.randFloat(-1.f, 1.f), rng.randFloat(-1.f, 1.f)) + makefloat3(1e-3f));
+			float3 scale = makefloat3(rng.randFloat(-4.f, 4.f), rng.randFloat(-4.f, 4.f), rng.randFloat(-4.f, 4.f));
+			float3 position = makefloat3(rng.randFloat(-1000.f, 1000.f), rng.randFloat(-1000.f, 1000.f), rng.randFloat(-1000.f, 1000.f));
+			affines[i] = scaling(scale) * rotation(axis, rng.randFloat(0.f, 6.28f)) * translation(position);
+			matrices[i] = affineToHomogeneous(affines[i]);
+		}
+
+		const box3 boxes[] =
+		{
+			makebox3(-1.f, -1.f, -1.f, 1.f, 1.f, 1.f),
+			makebox3(480.f, -20.f, 300.f, 520.f, 60.f, 301.f),
+			makebox3(-0.001f, 0.f, -50.f, 0.001f, 0.f, 50.f),
+		};
+
+		std::vector<float> mins[3], maxs[3];
+		for (uint axis = 0; axis < 3; axis++)
+		{
+			mins[axis].resize(matricesNum);
+			maxs[axis].resize(matricesNum);
+		}
+		float* const minsOut[3] = { mins[0].data(), mins[1].data(), mins[2].data() };
+		float* const maxsOut[3] = { maxs[0].data(), maxs[1].data(), maxs[2].data() };
+		std::vector<box3> expected(matricesNum);
+
+		bool passed = true;
+		for (const box3& box : boxes)
+		{
+			INT64 timestampStart = Timestamp();
+			boxTransformBatch(box, matrices.data(), int(matricesNum), minsOut, maxsOut);
+			INT64 timestampBatch = Timestamp();
+			for (uint i = 0; i < matricesNum; i++)
+				expected[i] = boxTransform(box, affines[i]);
+			INT64 timestampCorners = Timestamp();
+
+			// The rounding error of a corner is relative to the size of the terms summed for it, not of the result
+			float maxError = 0.f;
+			uint mismatches = 0;
+			float boxSize[3];
+			for (uint axis = 0; axis < 3; axis++)
+				boxSize[axis] = __max(fabsf(box.m_mins[axis]), fabsf(box.m_maxs[axis]));
+
+			for (uint i = 0; i < matricesNum; i++)
+			{
+				for (uint axis = 0; axis < 3; axis++)
+				{
+					const float3x3& linear = affines[i].m_linear;
+					float magnitude = fabsf(affines[i].m_translation[axis]) +
+						boxSize[0] * fabsf(linear[0][axis]) + boxSize[1] * fabsf(linear[1][axis]) + boxSize[2] * fabsf(linear[2][axis]);
+					float error = __max(fabsf(mins[axis][i] - expected[i].m_mins[axis]), fabsf(maxs[axis][i] - expected[i].m_maxs[axis])) / __max(magnitude, 1e-30f);
+
+					maxError = __max(maxError, error);
+					if (error > 8 * FLT_EPSILON)
+						mismatches++;
+				}
+			}
+
+			LOG("Box transform of (%g %g %g)-(%g %g %g) by %u matrices: boxTransformBatch %.2f ms, boxTransform %.2f ms; max error %.2g of the magnitude",
+				box.m_mins.x, box.m_mins.y, box.m_mins.z, box.m_maxs.x, box.m_maxs.y, box.m_maxs.z, matricesNum,
+				ElapsedMs(timestampStart, timestampBatch), ElapsedMs(timestampBatch, timestampCorners), maxError);
+
+			if (mismatches)
+			{
+				LOG("%u bounds were further than rounding from boxTransform's", mismatches);
+				passed = false;
+			}
+		}
+
+		// The tail of a batch: only the outputs for the matrices given are written
+		const float guard = -12345.f;
+		for (uint count = 0; count <= 9; count++)
+		{
+			for (uint axis = 0; axis < 3; axis++)
+			{
+				std::fill(mins[axis].begin(), mins[axis].begin() + 16, guard);
+				std::fill(maxs[axis].begin(), maxs[axis].begin() + 16, guard);
+			}
+
+			boxTransformBatch(boxes[0], matrices.data(), int(count), minsOut, maxsOut);
+
+			for (uint axis = 0; axis < 3; axis++)
+			{
+				for (uint i = 0; i < 16; i++)
+				{
+					bool written = (mins[axis][i] != guard || maxs[axis][i] != guard);
+					if (written != (i < count))
+					{
+						LOG("A batch of %u matrices %s output %u", count, written ? "wrote" : "didn't write", i);
+						passed = false;
+					}
+				}
+			}
+		}
+
+		// An empty box stays empty
+		box3 empty = makebox3Empty();
+		boxTransformBatch(empty, matrices.data(), 5, minsOut, maxsOut);
+		for (uint axis = 0; axis < 3; axis++)
+		{
+			for (uint i = 0; i < 5; i++)
+			{
+				if (mins[axis][i] != empty.m_mins[axis] || maxs[axis][i] != empty.m_maxs[axis])
+				{
+					LOG("An empty box came out of the batch as %g to %g on axis %u", mins[axis][i], maxs[axis][i], axis);
+					passed = false;
+				}
+			}
+		}
+
+		return passed;
+	}
+
+
+	// Scene cache: a scene written to a cache file and loaded back has to come out with the same buffers,
+	// mesh table and materials. Then the file is loaded with a different import, a changed source and
+	// corrupted contents, each of which has to be rejected: tables and buffers past the end of a truncated
+	// file, offsets that wrap around, a mesh whose indices run past the index buffer and indices that point
+	// past the vertex buffer.
+
+	bool WriteFileBytes(const std::string& path, const std::vector<BYTE>& bytes)
+	{
+		FILE* file = nullptr;
+		if (fopen_s(&file, path.c_str(), "wb") != 0)
+			return false;
+		bool written = bytes.empty() || fwrite(bytes.data(), bytes.size(), 1, file) == 1;
+		return (fclose(file) == 0) && written;
+	}
+
+	bool TestSceneCache()
+	{
+		std::string directory = GetTestDirectory("scene-cache-test");
+		std::string cachePath = directory + "boxes.meshcache";
+
+		const uint importFlags = 0x8b;
+		const UINT64 sourceSize = 123456789;
+		const UINT64 sourceWriteTime = 0x01d2a3b4c5d6e7f8ull;
+
+		RNG rng(43);
+		BoxScene scene;
+		uint brick = scene.AddMaterial("textures\\brick.dds", makefloat3(0.8f, 0.4f, 0.3f));
+		uint metal = scene.AddMaterial("textures\\metal.dds", makefloat3(0.5f, 0.5f, 0.6f));
+		for (uint i = 0; i < 50; i++)
+		{
+			float3 center = makefloat3(rng.randFloat(-100.f, 100.f), rng.randFloat(0.f, 20.f), rng.randFloat(-100.f, 100.f));
+			float3 halfSize = makefloat3(rng.randFloat(0.1f, 5.f), rng.randFloat(0.1f, 5.f), rng.randFloat(0.1f, 5.f));
+			scene.AddBox(makebox3(makepoint3(center - halfSize), makepoint3(center + halfSize)), i < 20 ? brick : metal);
+		}
+
+		INT64 timestampStart = Timestamp();
+		scene.WriteCache(cachePath, importFlags, sourceSize, sourceWriteTime);
+		INT64 timestampWritten = Timestamp();
+
+		bool passed = true;
+		{
+			BoxScene loaded;
+			if (!loaded.LoadCache(cachePath, importFlags, sourceSize, sourceWriteTime))
+			{
+				LOG("The scene cache that was just written wasn't loaded");
+				return false;
+			}
+			INT64 timestampLoaded = Timestamp();
+
+			if (!loaded.HasSameGeometry(scene))
+			{
+				LOG("The scene loaded from the cache doesn't match the one written to it");
+				passed = false;
+			}
+
+			LOG("Scene cache: %u meshes, %u indices and %u vertices written in %.2f ms, loaded in %.2f ms",
+				scene.GetMeshesNum(), 36 * scene.GetMeshesNum(), 8 * scene.GetMeshesNum(),
+				ElapsedMs(timestampStart, timestampWritten), ElapsedMs(timestampWritten, timestampLoaded));
+		}
+
+		std::vector<BYTE> bytes;
+		FILE* file = nullptr;
+		if (fopen_s(&file, cachePath.c_str(), "rb") == 0)
+		{
+			fseek(file, 0, SEEK_END);
+			bytes.resize(size_t(ftell(file)));
+			fseek(file, 0, SEEK_SET);
+			if (fread(bytes.data(), bytes.size(), 1, file) != 1)
+				bytes.clear();
+			fclose(file);
+		}
+		if (bytes.size() < sizeof(SceneCacheHeader))
+		{
+			LOG("Couldn't read back the scene cache file %s", cachePath.c_str());
+			return false;
+		}
+
+		const SceneCacheHeader header = *(const SceneCacheHeader*)bytes.data();
+		const size_t lastMesh = size_t(header.meshesOffset) + (header.meshesNum - 1) * sizeof(SceneCacheMesh);
+		struct Corruption
+		{
+			const char* name;
+			uint importFlags;
+			UINT64 sourceSize;
+			UINT64 sourceWriteTime;
+			size_t bytesRemoved;
+			size_t fieldOffset;
+			UINT64 value;
+			size_t valueSize;
+		};
+		const Corruption corruptions[] =
+		{
+			{ "none", importFlags, sourceSize, sourceWriteTime, 0, 0, 0, 0 },
+			{ "other import flags", importFlags ^ 4, sourceSize, sourceWriteTime, 0, 0, 0, 0 },
+			{ "source size changed", importFlags, sourceSize + 1, sourceWriteTime, 0, 0, 0, 0 },
+			{ "source write time changed", importFlags, sourceSize, sourceWriteTime + 1, 0, 0, 0, 0 },
+			{ "last byte missing", importFlags, sourceSize, sourceWriteTime, 1, 0, 0, 0 },
+			{ "only the header left", importFlags, sourceSize, sourceWriteTime, bytes.size() - sizeof(SceneCacheHeader), 0, 0, 0 },
+			{ "vertex offset wraps around", importFlags, sourceSize, sourceWriteTime, 0, offsetof(SceneCacheHeader, verticesOffset), ~0ull - 15, sizeof(UINT64) },
+			{ "index offset past the end", importFlags, sourceSize, sourceWriteTime, 0, offsetof(SceneCacheHeader, indicesOffset), 1ull << 40, sizeof(UINT64) },
+			{ "mesh table wraps around", importFlags, sourceSize, sourceWriteTime, 0, offsetof(SceneCacheHeader, meshesOffset), ~0ull - sizeof(SceneCacheMesh) + 1, sizeof(UINT64) },
+			{ "mesh indices past the end", importFlags, sourceSize, sourceWriteTime, 0, lastMesh + offsetof(SceneCacheMesh, indexOffset), header.indicesNum - 35, sizeof(uint) },
+			{ "mesh index range wraps around", importFlags, sourceSize, sourceWriteTime, 0, lastMesh + offsetof(SceneCacheMesh, indicesNum), 0xffffffffull, sizeof(uint) },
+			{ "mesh vertices past the end", importFlags, sourceSize, sourceWriteTime, 0, lastMesh + offsetof(SceneCacheMesh, vertexOffset), header.verticesNum - 4, sizeof(uint) },
+			{ "index past the vertices", importFlags, sourceSize, sourceWriteTime, 0, size_t(header.indicesOffset) + 5 * sizeof(uint), header.verticesNum, sizeof(uint) },
+		};
+
+		for (const Corruption& corruption : corruptions)
+		{
+			std::vector<BYTE> corrupted(bytes.begin(), bytes.end() - corruption.bytesRemoved);
+			if (corruption.valueSize)
+				memcpy(&corrupted[corruption.fieldOffset], &corruption.value, corruption.valueSize);
+
+			if (!WriteFileBytes(cachePath, corrupted))
+			{
+				LOG("Couldn't write the corrupted scene cache file");
+				return false;
+			}
+
+			BoxScene loaded;
+			bool accepted = loaded.LoadCache(cachePath, corruption.importFlags, corruption.sourceSize, corruption.sourceWriteTime);
+			bool expectAccepted = (corrupted.size() == bytes.size() && corruption.valueSize == 0 && corruption.importFlags == importFlags &&
+				corruption.sourceSize == sourceSize && corruption.sourceWriteTime == sourceWriteTime);
+			if (accepted != expectAccepted)
+			{
+				LOG("Scene cache file with corruption \"%s\" was %s", corruption.name, accepted ? "accepted" : "rejected");
+				passed = false;
+			}
+		}
+
+		DeleteDirectory(directory);
+		return passed;
+	}
+
+
+	// Instance transform: FLOAT4X4 and FLOAT3X4 have to give back random scaled, rotated and translated matrices
+	// bit for bit. QUANTIZED has to keep every point of a mesh's bounds within GetQuantizationError of where the
+	// exact matrix puts it, and reach the bound on boxes centered on the origin. The half conversion is checked
+	// through the packed basis: zeros, denormals, overflow, NaN and ties, then every half there is, which has to
+	// come back to the same bits after unpacking and packing again.
+
+	// Packs a QUANTIZED instance with the value as its first basis element, and returns that element's half
+	uint PackHalf(float value)
+	{
+		float4x4 m = float4x4::identity();
+		m[0][0] = value;
+		InstanceQuantized packed;
+		PackInstances(InstanceFormat::QUANTIZED, &m, 1, &packed);
+		return packed.basis[0] & 0xffff;
+	}
+
+	float UnpackHalf(uint half)
+	{
+		InstanceQuantized packed = {};
+		packed.basis[0] = half;
+		return UnpackInstance(InstanceFormat::QUANTIZED, &packed)[0][0];
+	}
+
+	bool TestInstanceTransform()
+	{
+		bool passed = true;
+
+		const InstanceFormat formats[] = { InstanceFormat::FLOAT4X4, InstanceFormat::FLOAT3X4, InstanceFormat::QUANTIZED };
+		const uint strides[] = { 64, 48, 32 };
+		for (uint format = 0; format < dim(formats); format++)
+		{
+			if (GetInstanceStride(formats[format]) != strides[format])
+			{
+				LOG("Instance format %u is %u bytes, not %u", format, GetInstanceStride(formats[format]), strides[format]);
+				passed = false;
+			}
+		}
+
+		RNG rng(50);
+		const uint matricesNum = 10000;
+		std::vector<float4x4> matrices(matricesNum);
+		for (uint i = 0; i < matricesNum; i++)
+		{
+			float3 axis = normalize(makefloat3(rng.randFloat(-1.f, 1.f), rng.randFloat(-1.f, 1.f), rng.randFloat(-1.f, 1.f)) + makefloat3(1e-3f));
+			float3 scale = makefloat3(rng.randFloat(-8.f, 8.f), rng.randFloat(-8.f, 8.f), rng.randFloat(-8.f, 8.f));
+			float3 position = makefloat3(rng.randFloat(-5000.f, 5000.f), rng.randFloat(-5000.f, 5000.f), rng.randFloat(-5000.f, 5000.f));
+			matrices[i] = affineToHomogeneous(scaling(scale) * rotation(axis, rng.randFloat(0.f, 6.28f)) * translation(position));
+		}
+
+		// Packed back to back, with nothing written past the last one
+		std::vector<BYTE> packed(matricesNum * sizeof(float4x4) + 16);
+		for (uint format = 0; format < 2; format++)
+		{
+			const uint stride = GetInstanceStride(formats[format]);
+			std::fill(packed.begin(), packed.end(), BYTE(0xcd));
+			PackInstances(formats[format], matrices.data(), matricesNum, packed.data());
+
+			uint mismatches = 0;
+			for (uint i = 0; i < matricesNum; i++)
+			{
+				float4x4 unpacked = UnpackInstance(formats[format], &packed[i * stride]);
+				if (memcmp(&unpacked, &matrices[i], sizeof(float4x4)) != 0)
+					mismatches++;
+			}
+
+			bool overrun = std::any_of(packed.begin() + matricesNum * stride, packed.end(), [](BYTE b) { return b != 0xcd; });
+			if (mismatches || overrun)
+			{
+				LOG("%u-byte instances: %u of %u matrices didn't come back bit for bit%s", stride, mismatches, matricesNum,
+					overrun ? ", and the packing wrote past the last one" : "");
+				passed = false;
+			}
+		}
+
+		// Transforms in double, so that the only difference between the two matrices' results is the rounding of the basis
+		auto transformedDifference = [](const float4x4& a, const float4x4& b, const float3& p, uint axis)
+		{
+			double da = a[3][axis], db = b[3][axis];
+			for (uint row = 0; row < 3; row++)
+			{
+				da += double(p[row]) * a[row][axis];
+				db += double(p[row]) * b[row][axis];
+			}
+			return fabs(da - db);
+		};
+
+		std::vector<InstanceQuantized> quantized(matricesNum);
+		PackInstances(InstanceFormat::QUANTIZED, matrices.data(), matricesNum, quantized.data());
+
+		uint outsideBound = 0;
+		uint looseBounds = 0;
+		double worstRatio = 0.0;
+		for (uint i = 0; i < matricesNum; i++)
+		{
+			// Every other box is centered on the origin, where some corner lands exactly on the bound
+			const bool centered = (i & 1) == 0;
+			float3 halfSize = makefloat3(rng.randFloat(0.01f, 50.f), rng.randFloat(0.01f, 50.f), rng.randFloat(0.01f, 50.f));
+			float3 center = centered ? makefloat3(0.f) : makefloat3(rng.randFloat(-50.f, 50.f), rng.randFloat(-50.f, 50.f), rng.randFloat(-50.f, 50.f));
+			box3 bounds = makebox3(makepoint3(center - halfSize), makepoint3(center + halfSize));
+
+			const float4x4 unpacked = UnpackInstance(InstanceFormat::QUANTIZED, &quantized[i]);
+			const double bound = GetQuantizationError(matrices[i], bounds);
+			const double tolerance = bound * 1e-5 + 1e-30;
+
+			double worst = 0.0;
+			for (int corner = 0; corner < 8; corner++)
+			{
+				float3 p = makefloat3(bounds.getCorner(corner));
+				for (uint axis = 0; axis < 3; axis++)
+					worst = __max(worst, transformedDifference(matrices[i], unpacked, p, axis));
+			}
+			for (uint sample = 0; sample < 8; sample++)
+			{
+				float3 p = center + halfSize * makefloat3(rng.randFloat(-1.f, 1.f), rng.randFloat(-1.f, 1.f), rng.randFloat(-1.f, 1.f));
+				for (uint axis = 0; axis < 3; axis++)
+					worst = __max(worst, transformedDifference(matrices[i], unpacked, p, axis));
+			}
+
+			if (worst > bound + tolerance)
+				outsideBound++;
+			if (centered && worst < bound - tolerance)
+				looseBounds++;
+			if (bound > 0.0)
+				worstRatio = __max(worstRatio, worst / bound);
+		}
+
+		LOG("Instance transform, 32-byte instances: the worst point is %.6f of GetQuantizationError's bound", worstRatio);
+		if (outsideBound || looseBounds)
+		{
+			LOG("32-byte instances: %u of %u boxes had points further than GetQuantizationError, %u centered boxes didn't reach it",
+				outsideBound, matricesNum, looseBounds);
+			passed = false;
+		}
+
+		if (GetQuantizationError(matrices[0], makebox3Empty()) != 0.f)
+		{
+			LOG("An empty box has a quantization error");
+			passed = false;
+		}
+
+		// The half conversion rounds to nearest, ties to even, and overflows to infinity
+		struct HalfCase
+		{
+			const char* name;
+			float value;
+			uint half;
+		};
+		const HalfCase halfCases[] =
+		{
+			{ "zero", 0.f, 0x0000 },
+			{ "negative zero", -0.f, 0x8000 },
+			{ "one", 1.f, 0x3c00 },
+			{ "minus two", -2.f, 0xc000 },
+			{ "smallest denormal", ldexpf(1.f, -24), 0x0001 },
+			{ "largest denormal", ldexpf(1023.f, -24), 0x03ff },
+			{ "smallest normal", ldexpf(1.f, -14), 0x0400 },
+			{ "denormal rounding up to normal", ldexpf(2047.f, -25), 0x0400 },
+			{ "half the smallest denormal", ldexpf(1.f, -25), 0x0000 },
+			{ "just over half the smallest denormal", ldexpf(1.f, -25) * 1.0001f, 0x0001 },
+			{ "denormal tie to even, down", ldexpf(5.f, -25), 0x0002 },
+			{ "denormal tie to even, up", ldexpf(7.f, -25), 0x0004 },
+			{ "negative denormal", -ldexpf(3.f, -24), 0x8003 },
+			{ "below the smallest denormal", 1e-10f, 0x0000 },
+			{ "tie to even, down", 1.f + ldexpf(1.f, -11), 0x3c00 },
+			{ "tie to even, up", 1.f + ldexpf(3.f, -11), 0x3c02 },
+			{ "just over a tie", 1.f + ldexpf(1.f, -11) + ldexpf(1.f, -20), 0x3c01 },
+			{ "carry into the exponent", 2.f - ldexpf(1.f, -12), 0x4000 },
+			{ "largest half", 65504.f, 0x7bff },
+			{ "just under the overflow", 65519.f, 0x7bff },
+			{ "overflow", 65520.f, 0x7c00 },
+			{ "large negative", -1e6f, 0xfc00 },
+			{ "infinity", std::numeric_limits<float>::infinity(), 0x7c00 },
+			{ "negative infinity", -std::numeric_limits<float>::infinity(), 0xfc00 },
+		};
+
+		for (const HalfCase& halfCase : halfCases)
+		{
+			uint half = PackHalf(halfCase.value);
+			if (half != halfCase.half)
+			{
+				LOG("Half conversion, %s: %.9g packed as 0x%04x, not 0x%04x", halfCase.name, halfCase.value, half, halfCase.half);
+				passed = false;
+			}
+		}
+
+		const float nan = std::numeric_limits<float>::quiet_NaN();
+		const uint nanHalves[] = { PackHalf(nan), PackHalf(-nan) };
+		for (uint half : nanHalves)
+		{
+			if ((half & 0x7c00) != 0x7c00 || (half & 0x3ff) == 0 || !std::isnan(UnpackHalf(half)))
+			{
+				LOG("Half conversion: a NaN packed as 0x%04x", half);
+				passed = false;
+			}
+		}
+
+		// Every half is exact in float, so every one that isn't a NaN has to come back as itself. Zeros keep their sign.
+		uint roundTripMismatches = 0;
+		for (uint half = 0; half < 0x10000; half++)
+		{
+			float value = UnpackHalf(half);
+			bool isNaN = (half & 0x7c00) == 0x7c00 && (half & 0x3ff) != 0;
+			if (isNaN ? !std::isnan(value) : PackHalf(value) != half)
+				roundTripMismatches++;
+		}
+		if (roundTripMismatches)
+		{
+			LOG("Half conversion: %u halves didn't come back the same after unpacking and packing", roundTripMismatches);
+			passed = false;
+		}
+
+		return passed;
+	}
+
+
+	struct Test
+	{
+		const char *	m_name;
+		bool			(*m_func)();
+	};
+
+	const Test s_tests[] =
+	{
+		{ "texture-upload-queue",	&TestTextureUploadQueue },
+		{ "texture-cache",			&TestTextureCache },
+		{ "mip-cache",				&TestMipCache },
+		{ "frustum-cull",			&TestFrustumCull },
+		{ "instance-upload",		&TestInstanceUpload },
+		{ "multi-view-cull",		&TestMultiViewCull },
+		{ "instance-bvh",			&TestInstanceBVH },
+		{ "occlusion-culling",		&TestOcclusionCulling },
+		{ "box-transform",			&TestBoxTransform },
+		{ "scene-cache",			&TestSceneCache },
+		{ "instance-transform",		&TestInstanceTransform },
+	};
+}
+
+int main(int argc, char ** argv)
+{
+	g_logCallback = &LogToStdout;
+	g_errorCallback = &CountError;
+	g_breakOnError = false;
+
+	int failures = 0;
+	for (int i = 0; i < dim(s_tests); ++i)
+	{
+		// Run the test if it's named on the command line, or if nothing is
+		bool run = (argc <= 1);
+		for (int j = 1; j < argc && !run; ++j)
+			run = (strcmp(argv[j], s_tests[i].m_name) == 0);
+		if (!run)
+			continue;
+
+		s_errorCount = 0;
+		bool passed = s_tests[i].m_func() && s_errorCount == 0;
+		printf("%s: %s\n", s_tests[i].m_name, passed ? "passed" : "FAILED");
+		if (!passed)
+			++failures;
+	}
+
+	return failures;
+}
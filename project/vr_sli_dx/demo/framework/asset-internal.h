@@ -21,6 +21,9 @@ namespace Framework
 	//  * Version numbers for the whole pack system and each asset type are also stored in the
 	//      .zip, and mismatches will trigger recompilation.
 	//
+	//  * Texture assets are compiled in parallel batches, each to its own in-memory .zip, and
+	//      copied into the pack in list order, so the pack's contents don't depend on threading.
+	//
 	//  !!!UNDONE: build the list of sources to compile by following dependencies from some root.
 
 	namespace AssetCompiler
@@ -32,7 +35,7 @@ namespace Framework
 
 		enum MESHVER
 		{
-			MESHVER_Current = 5,
+			MESHVER_Current = 8,
 		};
 
 		enum MTLVER
@@ -42,7 +45,7 @@ namespace Framework
 
 		enum TEXVER
 		{
-			TEXVER_Current = 1,
+			TEXVER_Current = 5,
 		};
 
 		struct VersionInfo
@@ -70,6 +73,51 @@ namespace Framework
 			size_t sizeBytes,
 			mz_zip_archive * pZipOut);
 
+		// Block-compress an image to BC1, BC3, BC4, BC5, or BC7 (asset-texture-bcn.cpp).  Dims
+		// needn't be multiples of 4; blocks hanging off the edges are padded by clamping.
+		// BC4 and BC5 encode the red, and red and green, channels respectively.
+		void EncodeBCnImage(
+			const byte4 * pPixels,
+			int2_arg dims,
+			DXGI_FORMAT format,
+			BCQ bcq,
+			std::vector<byte> * pDataOut);
+
+		// Decode an image made by EncodeBCnImage, e.g. to measure its error.  For BC7, only
+		// the modes EncodeBCnImage emits are supported.
+		void DecodeBCnImage(
+			const byte * pData,
+			int2_arg dims,
+			DXGI_FORMAT format,
+			std::vector<byte4> * pPixelsOut);
+
+		// Generate mip levels 1 through mipLevels - 1 of an image (asset-texture-mips.cpp), each
+		// filtered from the level above with MIPF_Box or MIPF_Kaiser.  Level n is returned in
+		// (*pMipsOut)[n - 1].  Dims needn't be pow2; each level is CalculateMipDims of the base.
+		// sRGB images are filtered in linear space, weighted by alpha.
+		void GenerateMips(
+			const byte4 * pPixelsBase,
+			int2_arg dimsBase,
+			int mipLevels,
+			bool sRGB,
+			MIPF mipf,
+			std::vector<std::vector<byte4>> * pMipsOut);
+
+		// Generate tangent frames for an indexed triangle list (asset-mesh.cpp): face normals are
+		// summed onto the verts unless hasNormals, then normalized, and tangents are filled in
+		// with their handedness in w.  Faces are processed four at a time with SSE, and summed
+		// onto each vertex in index buffer order.  The indices are only borrowed, not changed.
+		void GenerateTangentFrames(
+			std::vector<Vertex> * pVerts,
+			std::vector<int> * pIndices,
+			bool hasNormals);
+
+		// Check whether a texture in a pack was compiled with the settings its AssetCompileInfo
+		// now asks for, out of the ones its ACK uses (asset-texture.cpp).
+		bool TextureMatchesCompileInfo(
+			mz_zip_archive * pZip,
+			const AssetCompileInfo * pACI);
+
 		// Parse an asset pack manifest (newline-delimited list of names) into a set structure.
 		void ParseManifest(
 			const char * manifest,
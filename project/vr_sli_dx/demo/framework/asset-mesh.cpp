@@ -1,18 +1,30 @@
 #include "framework.h"
 #include "asset-internal.h"
 #include <algorithm>
+#include <map>
+#include <psapi.h>
 
 namespace Framework
 {
 	// Infrastructure for compiling Wavefront .obj files to vertex/index buffers.
 	//  * Currently uses hard-coded Vertex structure.
+	//  * Files over s_streamingMinBytes are parsed a window at a time, with verts deduplicated
+	//      and faces bucketed by material as they're read, so the whole text never has to be
+	//      in memory at once.  See ParseOBJStreaming for what the peak does hold.
 	//  * Creates a single vertex buffer and index buffer, plus a material map that
 	//      identifies which faces get drawn with each material.
 	//  * Groups together all faces with the same material into a contiguous
 	//      range of indices, so they can be drawn with one draw call.
-	//  * Removes degenerate triangles.
+	//  * Detects OBJ groups that are rigid-transformed copies of an earlier group, keeps
+	//      only the first copy, and emits per-instance transforms for the rest.
+	//  * Removes degenerate and duplicate triangles, and any material ranges left empty.
 	//  * Deduplicates verts.
 	//  * Generates normals if necessary.
+	//  * Emits a separate position-only vertex stream for depth-only passes, with its own
+	//      index buffer in which verts split only by normal/UV are welded back together.
+	//      Its indices parallel the main index buffer, so the material map applies to both.
+	//  * Stores each material range's UV density, for picking the mips its textures need
+	//      at runtime.
 	//  * !!!UNDONE: Vertex cache optimization.
 
 	namespace OBJMeshCompiler
@@ -21,11 +33,58 @@ namespace Framework
 		static const char * s_suffixVerts		= "/verts";
 		static const char * s_suffixIndices		= "/indices";
 		static const char * s_suffixMtlMap		= "/material_map";
+		static const char * s_suffixPositions	= "/positions";
+		static const char * s_suffixPosIndices	= "/position_indices";
+		static const char * s_suffixInstances	= "/instances";
+
+		// OBJ files at least this big are streamed rather than loaded whole
+		static const i64 s_streamingMinBytes	= 64 * 1024 * 1024;
+
+		// Streaming parser: text read per window, and indices held in memory before spilling to disk
+		static const int s_streamWindowBytes	= 4 * 1024 * 1024;
+		static const int s_streamSpillIndices	= 4 * 1024 * 1024;
+
+		// Number of triangles or verts handed to a thread at a time in parallel stages
+		static const int s_parallelBlockSize	= 4096;
+
+		// Groups smaller than this aren't worth drawing instanced (and would otherwise
+		// match every quad in the scene)
+		static const int s_instanceMinTris		= 16;
+
+		// Percentile of the per-triangle UV-to-world area ratios taken as a range's UV density;
+		// high enough to cover the densest part of the mapping, without letting a few slivers
+		// dominate
+		static const float s_uvDensityPercentile = 0.95f;
 
 		struct MtlRange
 		{
 			std::string		m_mtlName;
 			int				m_indexStart, m_indexCount;
+			int				m_iInstanceSet;			// Index into Context::m_instanceSets, or -1
+			float			m_uvDensity;			// See Mesh::MtlRange
+		};
+
+		struct IndexSpan
+		{
+			int				m_indexStart, m_indexCount;
+		};
+
+		// Faces from an OBJ "g" or "o" statement.  The streaming parser buckets faces by material
+		// as it goes, so a group using several materials ends up split into several spans.
+		struct Group
+		{
+			std::string				m_name;
+			std::vector<IndexSpan>	m_spans;
+		};
+
+		// A group that appears more than once, up to a rigid transform.  Its triangles are
+		// kept once, at the first copy's location; m_transforms holds identity for that copy,
+		// followed by the transform from it to each of the others.
+		struct InstanceSet
+		{
+			std::string				m_name;
+			int						m_triCount;
+			std::vector<affine3>	m_transforms;
 		};
 
 		struct Context
@@ -33,6 +92,12 @@ namespace Framework
 			std::vector<Vertex>		m_verts;
 			std::vector<int>		m_indices;
 			std::vector<MtlRange>	m_mtlRanges;
+			std::vector<Group>		m_groups;
+			std::vector<InstanceSet>m_instanceSets;
+			std::vector<int>		m_adjStart;			// Per-vertex start into m_adjIndices (plus a sentinel)
+			std::vector<int>		m_adjIndices;		// Positions in m_indices referring to each vertex
+			std::vector<point3>		m_positions;		// Position-only stream for depth passes
+			std::vector<int>		m_posIndices;		// Indices into m_positions, parallel to m_indices
 			box3					m_bounds;
 			bool					m_hasNormals;
 		};
@@ -46,16 +111,25 @@ namespace Framework
 
 		// Prototype various helper functions
 		static bool ParseOBJ(const char * path, Context * pCtxOut);
+		static bool ParseOBJStreaming(const char * path, Context * pCtxOut);
+		static i64 FileSize(const char * path);
+		static void LogPeakMemory(const char * path);
+		static void DetectInstances(Context * pCtx);
+		static void ReportInstances(Context * pCtx);
 		static void RemoveDegenerateTriangles(Context * pCtx);
 		static void DeduplicateVerts(Context * pCtx);
+		static void BuildVertexAdjacency(Context * pCtx);
 		static void CalculateNormals(Context * pCtx);
 		static void NormalizeNormals(Context * pCtx);
 #if VERTEX_TANGENT
 		static void CalculateTangents(Context * pCtx);
 #endif
 		static void SortMaterials(Context * pCtx);
+		static void BuildPositionStream(Context * pCtx);
+		static void CalculateUVDensity(Context * pCtx);
 
 		static void SerializeMaterialMap(Context * pCtx, std::vector<byte> * pDataOut);
+		static void SerializeInstances(Context * pCtx, std::vector<affine3> * pTransformsOut);
 	}
 
 
@@ -76,19 +150,27 @@ namespace Framework
 
 		// Read the mesh data from the OBJ file
 		Context ctx = {};
-		if (!ParseOBJ(pACI->m_pathSrc, &ctx))
+		if (FileSize(pACI->m_pathSrc) >= s_streamingMinBytes)
+		{
+			if (!ParseOBJStreaming(pACI->m_pathSrc, &ctx))
+				return false;
+		}
+		else if (!ParseOBJ(pACI->m_pathSrc, &ctx))
+		{
 			return false;
+		}
+		LogPeakMemory(pACI->m_pathSrc);
 
 		// Clean up the mesh
+		DetectInstances(&ctx);
 		SortMaterials(&ctx);
 		RemoveDegenerateTriangles(&ctx);
 		DeduplicateVerts(&ctx);
-		if (!ctx.m_hasNormals)
-			CalculateNormals(&ctx);
-		NormalizeNormals(&ctx);
-#if VERTEX_TANGENT
-		CalculateTangents(&ctx);
-#endif
+		ReportInstances(&ctx);
+		CalculateUVDensity(&ctx);
+
+		GenerateTangentFrames(&ctx.m_verts, &ctx.m_indices, ctx.m_hasNormals);
+		BuildPositionStream(&ctx);
 
 		// Fill out the metadata struct
 		Meta meta =
@@ -101,10 +183,16 @@ namespace Framework
 		std::vector<byte> serializedMaterialMap;
 		SerializeMaterialMap(&ctx, &serializedMaterialMap);
 
+		std::vector<affine3> instanceTransforms;
+		SerializeInstances(&ctx, &instanceTransforms);
+
 		if (!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pZipOut) ||
 			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixVerts, &ctx.m_verts[0], ctx.m_verts.size() * sizeof(Vertex), pZipOut) ||
 			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixIndices, &ctx.m_indices[0], ctx.m_indices.size() * sizeof(int), pZipOut) ||
-			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMtlMap, &serializedMaterialMap[0], serializedMaterialMap.size(), pZipOut))
+			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMtlMap, &serializedMaterialMap[0], serializedMaterialMap.size(), pZipOut) ||
+			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixPositions, &ctx.m_positions[0], ctx.m_positions.size() * sizeof(point3), pZipOut) ||
+			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixPosIndices, &ctx.m_posIndices[0], ctx.m_posIndices.size() * sizeof(int), pZipOut) ||
+			!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixInstances, &instanceTransforms[0], instanceTransforms.size() * sizeof(affine3), pZipOut))
 		{
 			return false;
 		}
@@ -112,10 +200,61 @@ namespace Framework
 		return true;
 	}
 
+	namespace AssetCompiler
+	{
+		void GenerateTangentFrames(
+			std::vector<Vertex> * pVerts,
+			std::vector<int> * pIndices,
+			bool hasNormals)
+		{
+			ASSERT_ERR(pVerts);
+			ASSERT_ERR(pIndices);
+
+			using namespace OBJMeshCompiler;
+
+			// Borrow the buffers for a context of our own
+			Context ctx = {};
+			ctx.m_verts.swap(*pVerts);
+			ctx.m_indices.swap(*pIndices);
+
+			BuildVertexAdjacency(&ctx);
+			if (!hasNormals)
+				CalculateNormals(&ctx);
+			NormalizeNormals(&ctx);
+#if VERTEX_TANGENT
+			CalculateTangents(&ctx);
+#endif
+
+			ctx.m_verts.swap(*pVerts);
+			ctx.m_indices.swap(*pIndices);
+		}
+	}
+
 
 
 	namespace OBJMeshCompiler
 	{
+		// Parse vertex specification, with slashes separating position, UV, normal indices.
+		// Note that some components may be missing and will be set to zero here.
+		static void ParseOBJVertexSpec(char * pCtxVert, int * piPosOut, int * piUvOut, int * piNormalOut)
+		{
+			char * pIdx = pCtxVert;
+			while (*pCtxVert && *pCtxVert != '/')
+				++pCtxVert;
+			if (*pCtxVert)
+				*(pCtxVert++) = 0;
+			*piPosOut = atoi(pIdx);
+
+			pIdx = pCtxVert;
+			while (*pCtxVert && *pCtxVert != '/')
+				++pCtxVert;
+			if (*pCtxVert)
+				*(pCtxVert++) = 0;
+			*piUvOut = atoi(pIdx);
+
+			*piNormalOut = atoi(pCtxVert);
+		}
+
 		static bool ParseOBJ(const char * path, Context * pCtxOut)
 		{
 			ASSERT_ERR(path);
@@ -141,6 +280,11 @@ namespace Framework
 			OBJMtlRange initialRange = { std::string(), 0, 0, };
 			OBJMtlRanges.push_back(initialRange);
 
+			struct OBJGroup { std::string name; int iFaceStart, iFaceEnd; };
+			std::vector<OBJGroup> OBJgroups;
+			OBJGroup initialGroup = { std::string(), 0, 0, };
+			OBJgroups.push_back(initialGroup);
+
 			// Parse line-by-line
 			TextParsingHelper tph((char *)&data[0], path);
 			while (tph.NextLine())
@@ -192,26 +336,8 @@ namespace Framework
 
 					while (char * pCtxVert = tph.NextToken())
 					{
-						// Parse vertex specification, with slashes separating position, UV, normal indices
-						// Note that some components may be missing and will be set to zero here
 						OBJVertex vert = {};
-
-						char * pIdx = pCtxVert;
-						while (*pCtxVert && *pCtxVert != '/')
-							++pCtxVert;
-						if (*pCtxVert)
-							*(pCtxVert++) = 0;
-						vert.iPos = atoi(pIdx);
-
-						pIdx = pCtxVert;
-						while (*pCtxVert && *pCtxVert != '/')
-							++pCtxVert;
-						if (*pCtxVert)
-							*(pCtxVert++) = 0;
-						vert.iUv = atoi(pIdx);
-
-						vert.iNormal = atoi(pCtxVert);
-				
+						ParseOBJVertexSpec(pCtxVert, &vert.iPos, &vert.iUv, &vert.iNormal);
 						OBJverts.push_back(vert);
 					}
 
@@ -248,14 +374,32 @@ namespace Framework
 					makeLowercase(pRange->mtlName);
 					pRange->iFaceStart = int(OBJfaces.size());
 				}
+				else if (_stricmp(pToken, "g") == 0 || _stricmp(pToken, "o") == 0)
+				{
+					// Group names are optional, and there may be several; just keep the first
+					const char * pGroupName = tph.NextToken();
+
+					// Close the previous group, and start a new one if it was nonempty
+					OBJGroup * pGroup = &OBJgroups.back();
+					pGroup->iFaceEnd = int(OBJfaces.size());
+					if (pGroup->iFaceEnd > pGroup->iFaceStart)
+					{
+						OBJgroups.push_back(OBJGroup());
+						pGroup = &OBJgroups.back();
+					}
+
+					pGroup->name = pGroupName ? pGroupName : "";
+					pGroup->iFaceStart = int(OBJfaces.size());
+				}
 				else
 				{
 					// Unknown command; just ignore
 				}
 			}
 
-			// Close the last material range
+			// Close the last material range and group
 			OBJMtlRanges.back().iFaceEnd = int(OBJfaces.size());
+			OBJgroups.back().iFaceEnd = int(OBJfaces.size());
 
 			// Convert OBJ verts to vertex buffer
 			pCtxOut->m_verts.reserve(OBJverts.size());
@@ -304,69 +448,898 @@ namespace Framework
 				OBJMtlRange & objrange = OBJMtlRanges[iRange];
 				int iIdxStart = OBJfaces[objrange.iFaceStart].iIdxStart;
 				int iIdxEnd = OBJfaces[objrange.iFaceEnd].iIdxStart;
-				MtlRange range = { objrange.mtlName, iIdxStart, iIdxEnd - iIdxStart, };
+				MtlRange range = { objrange.mtlName, iIdxStart, iIdxEnd - iIdxStart, -1, };
 				pCtxOut->m_mtlRanges.push_back(range);
 			}
 
+			// Same for groups
+			for (int iGroup = 0, cGroup = int(OBJgroups.size()); iGroup < cGroup; ++iGroup)
+			{
+				OBJGroup & objgroup = OBJgroups[iGroup];
+				int iIdxStart = OBJfaces[objgroup.iFaceStart].iIdxStart;
+				int iIdxEnd = OBJfaces[objgroup.iFaceEnd].iIdxStart;
+				IndexSpan span = { iIdxStart, iIdxEnd - iIdxStart, };
+				Group group;
+				group.m_name = objgroup.name;
+				group.m_spans.push_back(span);
+				pCtxOut->m_groups.push_back(group);
+			}
+
 			pCtxOut->m_bounds = makebox3(int(positions.size()), &positions[0]);
 			pCtxOut->m_hasNormals = !normals.empty();
 
 			return true;
 		}
 
+		// Reads a text file a window at a time.  Each window handed back holds only whole lines,
+		// null-terminated so TextParsingHelper can run over it; the partial line at the end is
+		// carried over to the start of the next window.
+		class TextWindowReader
+		{
+		public:
+			TextWindowReader(FILE * pFile, int windowBytes)
+			:	m_pFile(pFile), m_windowBytes(windowBytes), m_eof(false)
+			{
+				ASSERT_ERR(pFile);
+				ASSERT_ERR(windowBytes > 0);
+			}
+
+			char * NextWindow()
+			{
+				if (m_eof)
+					return nullptr;
+
+				// Start with the partial line carried over from the last window
+				m_buffer.assign(m_carry.begin(), m_carry.end());
+				m_carry.clear();
+
+				size_t sizeValid = m_buffer.size();
+				for (;;)
+				{
+					m_buffer.resize(sizeValid + m_windowBytes + 1);
+					size_t sizeRead = fread(&m_buffer[sizeValid], sizeof(char), m_windowBytes, m_pFile);
+					size_t iSearchStart = sizeValid;
+					sizeValid += sizeRead;
+
+					// At the end of the file, everything left is whole lines
+					if (sizeRead < size_t(m_windowBytes) && (feof(m_pFile) || ferror(m_pFile)))
+					{
+						m_eof = true;
+						break;
+					}
+
+					// Cut after the last newline in what was just read; if there isn't one,
+					// the line is longer than a window, so keep reading
+					size_t iCut = sizeValid;
+					while (iCut > iSearchStart && m_buffer[iCut - 1] != '\n')
+						--iCut;
+					if (iCut > iSearchStart)
+					{
+						m_carry.assign(m_buffer.begin() + iCut, m_buffer.begin() + sizeValid);
+						sizeValid = iCut;
+						break;
+					}
+				}
+
+				m_buffer[sizeValid] = 0;
+				return &m_buffer[0];
+			}
+
+		private:
+			FILE *				m_pFile;
+			int					m_windowBytes;
+			bool				m_eof;
+			std::vector<char>	m_buffer;
+			std::vector<char>	m_carry;
+		};
+
+		static bool ParseOBJStreaming(const char * path, Context * pCtxOut)
+		{
+			ASSERT_ERR(path);
+			ASSERT_ERR(pCtxOut);
+
+			// Unlike ParseOBJ, this never holds more than a window of the file's text, nor a
+			// per-corner copy of the faces.  Verts are deduplicated by their OBJ index triple as
+			// they're referenced, and triangulated faces are appended to a run of indices per
+			// material, so the material ranges come out already sorted and merged.  When the runs
+			// held in memory get too big they're all appended to a temp file, and read back in
+			// material order at the end.
+			//
+			// While parsing, verts are only kept as their OBJ index triples, and the full verts are
+			// built once at the end, at their final size.  So memory peaks at the larger of:
+			//  * building the verts: the OBJ's positions, normals and UVs, plus the triples and
+			//      their lookup chains, plus the verts;
+			//  * assembling the index buffer, with all of the above but the verts freed: the
+			//      verts and the whole index buffer, which the later passes need anyway.
+
+			FILE * pFile = nullptr;
+			if (fopen_s(&pFile, path, "rt") != 0)
+			{
+				WARN("Couldn't open file %s", path);
+				return false;
+			}
+			ASSERT_ERR(pFile);
+
+			// The temp file is deleted automatically when closed ("D" mode)
+			char pathTempDir[MAX_PATH];
+			char pathSpill[MAX_PATH];
+			FILE * pFileSpill = nullptr;
+			if (!GetTempPathA(DWORD(dim(pathTempDir)), pathTempDir) ||
+				!GetTempFileNameA(pathTempDir, "obj", 0, pathSpill) ||
+				fopen_s(&pFileSpill, pathSpill, "w+bD") != 0)
+			{
+				WARN("Couldn't create temp file for parsing %s", path);
+				fclose(pFile);
+				return false;
+			}
+			ASSERT_ERR(pFileSpill);
+
+			std::vector<point3> positions;
+			std::vector<float3> normals;
+			std::vector<float2> uvs;
+
+			// Each position keeps a chain of the verts made from it, for looking up index triples.
+			// The chains are short, since a position is only split by its normals and UVs, and
+			// cost 4 bytes per position and per vert, far less than a hash table would.
+			struct OBJVertex { int iPos, iNormal, iUv; };
+			std::vector<OBJVertex> OBJverts;
+			std::vector<int> vertNextForPos;		// Next vert in the same chain, or -1
+			std::vector<int> vertFirstForPos;		// Per OBJ position index (0 = missing), or -1
+			vertFirstForPos.push_back(-1);
+
+			struct SpillChunk { i64 offset; int indexCount; };
+			struct MaterialRun
+			{
+				std::vector<int>		indices;		// Not yet spilled
+				std::vector<SpillChunk>	chunks;			// Spilled, in order
+				int						indexCount;		// Spilled or not
+				int						indexBase;		// Start of the run in the final index buffer
+			};
+			std::map<std::string, MaterialRun> mapMtlToRun;
+			MaterialRun * pRunCur = &mapMtlToRun[std::string()];
+			int indicesInMemory = 0;
+			bool spillFailed = false;
+
+			// Groups are recorded as spans within the material runs, one per material they use
+			struct RunSpan { MaterialRun * pRun; int iRunStart, count; };
+			struct StreamGroup { std::string name; std::vector<RunSpan> spans; };
+			std::vector<StreamGroup> streamGroups(1);
+
+			// Append every run's in-memory indices to the temp file
+			auto spillRuns = [&]() -> bool
+			{
+				for (auto i = mapMtlToRun.begin(), iEnd = mapMtlToRun.end(); i != iEnd; ++i)
+				{
+					MaterialRun & run = i->second;
+					if (run.indices.empty())
+						continue;
+
+					SpillChunk chunk = { _ftelli64(pFileSpill), int(run.indices.size()), };
+					if (fwrite(&run.indices[0], sizeof(int), run.indices.size(), pFileSpill) != run.indices.size())
+					{
+						WARN("Couldn't write temp file for parsing %s", path);
+						return false;
+					}
+					run.chunks.push_back(chunk);
+
+					// Release the memory, not just the contents
+					std::vector<int>().swap(run.indices);
+				}
+				indicesInMemory = 0;
+				return true;
+			};
+
+			std::vector<int> faceVerts;
+
+			// Parse window-by-window, then line-by-line within each
+			TextWindowReader reader(pFile, s_streamWindowBytes);
+			int iLine = 0;
+			while (char * pWindow = reader.NextWindow())
+			{
+				TextParsingHelper tph(pWindow, path);
+				tph.m_iLine = iLine;
+				while (tph.NextLine())
+				{
+					char * pToken = tph.NextToken();
+					if (_stricmp(pToken, "v") == 0)
+					{
+						char * tokens[3] = {};
+						tph.ExpectTokens(tokens, dim(tokens), "vertex position");
+						tph.ExpectEOL();
+
+						point3 pos;
+						pos.x = float(atof(tokens[0]));
+						pos.y = float(atof(tokens[1]));
+						pos.z = float(atof(tokens[2]));
+						positions.push_back(pos);
+						vertFirstForPos.push_back(-1);
+					}
+					else if (_stricmp(pToken, "vn") == 0)
+					{
+						char * tokens[3] = {};
+						tph.ExpectTokens(tokens, dim(tokens), "normal vector");
+						tph.ExpectEOL();
+
+						float3 normal;
+						normal.x = float(atof(tokens[0]));
+						normal.y = float(atof(tokens[1]));
+						normal.z = float(atof(tokens[2]));
+						normals.push_back(normal);
+					}
+					else if (_stricmp(pToken, "vt") == 0)
+					{
+						char * tokens[2] = {};
+						tph.ExpectTokens(tokens, dim(tokens), "UVs");
+						tph.ExpectEOL();
+
+						// Flip V-axis since OBJ UVs use a bottom-up convention
+						float2 uv;
+						uv.x = float(atof(tokens[0]));
+						uv.y = 1.0f - float(atof(tokens[1]));
+						uvs.push_back(uv);
+					}
+					else if (_stricmp(pToken, "f") == 0)
+					{
+						// Look up or create the vertex for each corner
+						faceVerts.clear();
+						bool valid = true;
+						while (char * pCtxVert = tph.NextToken())
+						{
+							OBJVertex objv = {};
+							ParseOBJVertexSpec(pCtxVert, &objv.iPos, &objv.iUv, &objv.iNormal);
+							if (objv.iPos < 0 || objv.iPos > int(positions.size()) ||
+								objv.iNormal < 0 || objv.iNormal > int(normals.size()) ||
+								objv.iUv < 0 || objv.iUv > int(uvs.size()))
+							{
+								WARN("%s: syntax error at line %d: face refers to a vertex that isn't defined yet", path, tph.m_iLine);
+								valid = false;
+								break;
+							}
+
+							int iVert = vertFirstForPos[objv.iPos];
+							while (iVert >= 0 && (OBJverts[iVert].iNormal != objv.iNormal || OBJverts[iVert].iUv != objv.iUv))
+								iVert = vertNextForPos[iVert];
+							if (iVert < 0)
+							{
+								iVert = int(OBJverts.size());
+								OBJverts.push_back(objv);
+								vertNextForPos.push_back(vertFirstForPos[objv.iPos]);
+								vertFirstForPos[objv.iPos] = iVert;
+							}
+							faceVerts.push_back(iVert);
+						}
+
+						if (!valid)
+							continue;
+						if (faceVerts.empty())
+						{
+							WARN("%s: syntax error at line %d: missing faces", path, tph.m_iLine);
+							continue;
+						}
+
+						// Triangulate the face onto the end of the current material's run
+						int iRunStart = pRunCur->indexCount;
+						for (int iVert = 2, cVert = int(faceVerts.size()); iVert < cVert; ++iVert)
+						{
+							pRunCur->indices.push_back(faceVerts[0]);
+							pRunCur->indices.push_back(faceVerts[iVert - 1]);
+							pRunCur->indices.push_back(faceVerts[iVert]);
+						}
+						int cIdx = (int(faceVerts.size()) - 2) * 3;
+						if (cIdx <= 0)
+							continue;
+						pRunCur->indexCount += cIdx;
+						indicesInMemory += cIdx;
+
+						// Extend the group's span in this material, or start one.  Nothing else is
+						// appended to the run while the group is open, so the span stays contiguous.
+						StreamGroup & group = streamGroups.back();
+						RunSpan * pSpan = nullptr;
+						for (int iSpan = 0, cSpan = int(group.spans.size()); iSpan < cSpan && !pSpan; ++iSpan)
+						{
+							if (group.spans[iSpan].pRun == pRunCur)
+								pSpan = &group.spans[iSpan];
+						}
+						if (pSpan)
+						{
+							pSpan->count += cIdx;
+						}
+						else
+						{
+							RunSpan span = { pRunCur, iRunStart, cIdx, };
+							group.spans.push_back(span);
+						}
+
+						if (indicesInMemory >= s_streamSpillIndices && !spillRuns())
+						{
+							spillFailed = true;
+							break;
+						}
+					}
+					else if (_stricmp(pToken, "usemtl") == 0)
+					{
+						const char * pMtlName = tph.ExpectOneToken("material name");
+						tph.ExpectEOL();
+						if (!pMtlName)
+							continue;
+
+						std::string mtlName = pMtlName;
+						makeLowercase(mtlName);
+						pRunCur = &mapMtlToRun[mtlName];
+					}
+					else if (_stricmp(pToken, "g") == 0 || _stricmp(pToken, "o") == 0)
+					{
+						// Group names are optional, and there may be several; just keep the first
+						const char * pGroupName = tph.NextToken();
+
+						// Start a new group if the previous one was nonempty, else overwrite it
+						if (!streamGroups.back().spans.empty())
+							streamGroups.push_back(StreamGroup());
+						streamGroups.back().name = pGroupName ? pGroupName : "";
+					}
+					else
+					{
+						// Unknown command; just ignore
+					}
+				}
+				iLine = tph.m_iLine;
+
+				if (spillFailed)
+					break;
+			}
+
+			fclose(pFile);
+			if (spillFailed)
+			{
+				fclose(pFileSpill);
+				return false;
+			}
+
+			// Build the verts; OBJ indices are 1-based, and missing components are zeros
+			pCtxOut->m_verts.resize(OBJverts.size());
+			for (int i = 0, c = int(OBJverts.size()); i < c; ++i)
+			{
+				const OBJVertex & objv = OBJverts[i];
+				Vertex * pVert = &pCtxOut->m_verts[i];
+				if (objv.iPos > 0)
+					pVert->m_pos = positions[objv.iPos - 1];
+				if (objv.iNormal > 0)
+					pVert->m_normal = normals[objv.iNormal - 1];
+				if (objv.iUv > 0)
+					pVert->m_uv = uvs[objv.iUv - 1];
+			}
+			pCtxOut->m_bounds = positions.empty() ? makebox3Empty() : makebox3(int(positions.size()), &positions[0]);
+			pCtxOut->m_hasNormals = !normals.empty();
+
+			// Free everything else the parse needed before the index buffer is assembled, so
+			// none of it is ever held alongside the whole thing
+			std::vector<point3>().swap(positions);
+			std::vector<float3>().swap(normals);
+			std::vector<float2>().swap(uvs);
+			std::vector<OBJVertex>().swap(OBJverts);
+			std::vector<int>().swap(vertNextForPos);
+			std::vector<int>().swap(vertFirstForPos);
+
+			// Lay the runs out one after another, in material order, reading spilled chunks back in
+			i64 indexCountTotal = 0;
+			for (auto i = mapMtlToRun.begin(), iEnd = mapMtlToRun.end(); i != iEnd; ++i)
+				indexCountTotal += i->second.indexCount;
+			if (indexCountTotal > INT_MAX)
+			{
+				WARN("%s: too many triangles (%lld indices)", path, indexCountTotal);
+				fclose(pFileSpill);
+				return false;
+			}
+
+			pCtxOut->m_indices.reserve(size_t(indexCountTotal));
+			for (auto i = mapMtlToRun.begin(), iEnd = mapMtlToRun.end(); i != iEnd; ++i)
+			{
+				MaterialRun & run = i->second;
+				run.indexBase = int(pCtxOut->m_indices.size());
+
+				for (int iChunk = 0, cChunk = int(run.chunks.size()); iChunk < cChunk; ++iChunk)
+				{
+					const SpillChunk & chunk = run.chunks[iChunk];
+					size_t iStart = pCtxOut->m_indices.size();
+					pCtxOut->m_indices.resize(iStart + chunk.indexCount);
+					if (_fseeki64(pFileSpill, chunk.offset, SEEK_SET) != 0 ||
+						fread(&pCtxOut->m_indices[iStart], sizeof(int), chunk.indexCount, pFileSpill) != size_t(chunk.indexCount))
+					{
+						WARN("Couldn't read temp file for parsing %s", path);
+						fclose(pFileSpill);
+						return false;
+					}
+				}
+				pCtxOut->m_indices.insert(pCtxOut->m_indices.end(), run.indices.begin(), run.indices.end());
+				std::vector<int>().swap(run.indices);
+
+				ASSERT_WARN(int(pCtxOut->m_indices.size()) - run.indexBase == run.indexCount);
+				if (run.indexCount > 0)
+				{
+					MtlRange range = { i->first, run.indexBase, run.indexCount, -1, };
+					pCtxOut->m_mtlRanges.push_back(range);
+				}
+			}
+
+			fclose(pFileSpill);
+
+			// Convert group spans to index ranges.  Sorting puts each group's spans in material
+			// order, the same for every copy of a group.
+			for (int iGroup = 0, cGroup = int(streamGroups.size()); iGroup < cGroup; ++iGroup)
+			{
+				const StreamGroup & streamGroup = streamGroups[iGroup];
+				if (streamGroup.spans.empty())
+					continue;
+
+				Group group;
+				group.m_name = streamGroup.name;
+				for (int iSpan = 0, cSpan = int(streamGroup.spans.size()); iSpan < cSpan; ++iSpan)
+				{
+					const RunSpan & runSpan = streamGroup.spans[iSpan];
+					IndexSpan span = { runSpan.pRun->indexBase + runSpan.iRunStart, runSpan.count, };
+					group.m_spans.push_back(span);
+				}
+				std::sort(group.m_spans.begin(), group.m_spans.end(),
+					[](const IndexSpan & a, const IndexSpan & b) { return a.m_indexStart < b.m_indexStart; });
+				pCtxOut->m_groups.push_back(group);
+			}
+
+			LOG("Streamed %s: %d lines, %d verts after deduplication, %lld indices",
+				path, iLine, int(pCtxOut->m_verts.size()), indexCountTotal);
+
+			return true;
+		}
+
+		static i64 FileSize(const char * path)
+		{
+			ASSERT_ERR(path);
+
+			WIN32_FILE_ATTRIBUTE_DATA attrs;
+			if (!GetFileAttributesExA(path, GetFileExInfoStandard, &attrs))
+				return 0;
+
+			return (i64(attrs.nFileSizeHigh) << 32) | i64(attrs.nFileSizeLow);
+		}
+
+		// Log the process's peak working set so far, so the memory cost of parsing can be compared
+		// between the in-memory and streaming paths
+		static void LogPeakMemory(const char * path)
+		{
+			PROCESS_MEMORY_COUNTERS counters = {};
+			counters.cb = sizeof(counters);
+			if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+				LOG("Parsed %s; peak working set so far %d MB", path, int(counters.PeakWorkingSetSize >> 20));
+		}
+
+		// Orthonormal frame spanned by a triangle, as the rows of a matrix
+		static float3x3 TriangleFrame(point3_arg pos0, point3_arg pos1, point3_arg pos2)
+		{
+			float3 axisX = normalize(pos1 - pos0);
+			float3 axisZ = normalize(cross(pos1 - pos0, pos2 - pos0));
+			float3 axisY = cross(axisZ, axisX);
+			return makefloat3x3(axisX, axisY, axisZ);
+		}
+
+		static void DetectInstances(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+			ASSERT_WARN(pCtx->m_indices.size() % 3 == 0);
+
+			int cTri = int(pCtx->m_indices.size()) / 3;
+			if (cTri == 0)
+				return;
+
+			// Verts are compared by their data rather than their indices, since they haven't been
+			// deduplicated yet, and two copies of a group have their triangles and corners in the
+			// same order (also across spans, as the parsers lay spans out the same way for each).
+			// Copies are found by hashing everything a rigid transform leaves alone (triangle
+			// count, materials, UVs), then fitting a transform to one triangle of each candidate
+			// pair and checking that it maps every other corner of one onto the other.
+
+			std::vector<int> triMtlRange(cTri, -1);
+			for (int iRange = 0, cRange = int(pCtx->m_mtlRanges.size()); iRange < cRange; ++iRange)
+			{
+				const MtlRange & range = pCtx->m_mtlRanges[iRange];
+				for (int i = range.m_indexStart / 3, iEnd = (range.m_indexStart + range.m_indexCount) / 3; i < iEnd; ++i)
+					triMtlRange[i] = iRange;
+			}
+
+			struct Prototype
+			{
+				int			m_iGroup;
+				std::vector<int> m_tris;		// Triangles of the group, in order
+				int			m_iInstanceSet;
+				int			m_iTriRef;			// Largest triangle in the group, index into m_tris
+				float3x3	m_frameRef;			// Frame of that triangle
+				float		m_tolerance;		// Max distance allowed between matched positions
+			};
+			std::unordered_map<size_t, std::vector<Prototype>> mapHashToPrototypes;
+
+			std::vector<int> triInstanceSet(cTri, -1);
+			std::vector<bool> triRemoved(cTri, false);
+
+			const int * pIndices = &pCtx->m_indices[0];
+			std::vector<int> tris;
+
+			for (int iGroup = 0, cGroup = int(pCtx->m_groups.size()); iGroup < cGroup; ++iGroup)
+			{
+				const Group & group = pCtx->m_groups[iGroup];
+				tris.clear();
+				for (int iSpan = 0, cSpan = int(group.m_spans.size()); iSpan < cSpan; ++iSpan)
+				{
+					const IndexSpan & span = group.m_spans[iSpan];
+					for (int i = span.m_indexStart / 3, iEnd = (span.m_indexStart + span.m_indexCount) / 3; i < iEnd; ++i)
+						tris.push_back(i);
+				}
+
+				int cTriGroup = int(tris.size());
+				if (cTriGroup < s_instanceMinTris)
+					continue;
+
+				// Hash the transform-invariant parts of the group (FNV-1a)
+				size_t hash = 2166136261U;
+				hash = (hash ^ size_t(cTriGroup)) * 16777619U;
+				for (int iTri = 0; iTri < cTriGroup; ++iTri)
+				{
+					hash = (hash ^ std::hash<std::string>()(pCtx->m_mtlRanges[triMtlRange[tris[iTri]]].m_mtlName)) * 16777619U;
+					for (int iCorner = 0; iCorner < 3; ++iCorner)
+					{
+						const float2 & uv = pCtx->m_verts[pIndices[tris[iTri]*3 + iCorner]].m_uv;
+						hash = (hash ^ std::hash<float>()(uv.x)) * 16777619U;
+						hash = (hash ^ std::hash<float>()(uv.y)) * 16777619U;
+					}
+				}
+
+				std::vector<Prototype> & prototypes = mapHashToPrototypes[hash];
+
+				// Look for an earlier group that this one is a copy of
+				bool foundMatch = false;
+				for (int iProto = 0, cProto = int(prototypes.size()); iProto < cProto && !foundMatch; ++iProto)
+				{
+					Prototype & proto = prototypes[iProto];
+					const Group & groupProto = pCtx->m_groups[proto.m_iGroup];
+					const std::vector<int> & trisProto = proto.m_tris;
+					if (int(trisProto.size()) != cTriGroup)
+						continue;
+
+					// Materials and UVs must match exactly
+					bool matches = true;
+					for (int iTri = 0; iTri < cTriGroup && matches; ++iTri)
+					{
+						if (pCtx->m_mtlRanges[triMtlRange[trisProto[iTri]]].m_mtlName !=
+							pCtx->m_mtlRanges[triMtlRange[tris[iTri]]].m_mtlName)
+						{
+							matches = false;
+						}
+						for (int iCorner = 0; iCorner < 3 && matches; ++iCorner)
+						{
+							if (any(pCtx->m_verts[pIndices[trisProto[iTri]*3 + iCorner]].m_uv != pCtx->m_verts[pIndices[tris[iTri]*3 + iCorner]].m_uv))
+								matches = false;
+						}
+					}
+					if (!matches)
+						continue;
+
+					// Fit a rigid transform that takes the prototype's reference triangle onto ours.
+					// In row-vector terms: pos = (posProto - origin) * transpose(frameProto) * frame + originOurs
+					const int * pIndicesRefProto = &pIndices[trisProto[proto.m_iTriRef] * 3];
+					const int * pIndicesRef = &pIndices[tris[proto.m_iTriRef] * 3];
+					point3 posRef0 = pCtx->m_verts[pIndicesRef[0]].m_pos;
+					point3 posRef1 = pCtx->m_verts[pIndicesRef[1]].m_pos;
+					point3 posRef2 = pCtx->m_verts[pIndicesRef[2]].m_pos;
+					if (all(isnear(cross(posRef1 - posRef0, posRef2 - posRef0), 0.0f)))
+						continue;
+
+					float3x3 linear = transpose(proto.m_frameRef) * TriangleFrame(posRef0, posRef1, posRef2);
+					point3 posProtoRef0 = pCtx->m_verts[pIndicesRefProto[0]].m_pos;
+					float3 translation = posRef0 - posProtoRef0 * linear;
+					affine3 transform = makeaffine3(linear, translation);
+
+					// Check that it actually maps every corner onto ours
+					for (int i = 0, c = cTriGroup * 3; i < c && matches; ++i)
+					{
+						const Vertex & vertProto = pCtx->m_verts[pIndices[trisProto[i / 3]*3 + i % 3]];
+						const Vertex & vert = pCtx->m_verts[pIndices[tris[i / 3]*3 + i % 3]];
+						if (distance(vertProto.m_pos * transform, vert.m_pos) > proto.m_tolerance)
+							matches = false;
+						else if (pCtx->m_hasNormals && !all(isnear(vertProto.m_normal * linear, vert.m_normal, 1e-3f)))
+							matches = false;
+					}
+					if (!matches)
+						continue;
+
+					// It's a copy; start a new instance set if this is the first one we've found
+					if (proto.m_iInstanceSet < 0)
+					{
+						proto.m_iInstanceSet = int(pCtx->m_instanceSets.size());
+						InstanceSet instanceSet = { groupProto.m_name, cTriGroup, };
+						instanceSet.m_transforms.push_back(affine3::identity());
+						pCtx->m_instanceSets.push_back(instanceSet);
+
+						for (int iTri = 0; iTri < cTriGroup; ++iTri)
+							triInstanceSet[trisProto[iTri]] = proto.m_iInstanceSet;
+					}
+
+					pCtx->m_instanceSets[proto.m_iInstanceSet].m_transforms.push_back(transform);
+					for (int iTri = 0; iTri < cTriGroup; ++iTri)
+						triRemoved[tris[iTri]] = true;
+
+					foundMatch = true;
+				}
+
+				if (foundMatch)
+					continue;
+
+				// Not a copy of anything yet, so it becomes a prototype itself.
+				// Use its largest triangle as the reference, for the most stable fit.
+				Prototype proto = { iGroup, std::vector<int>(), -1, -1, float3x3::identity(), 0.0f, };
+				float areaMax = 0.0f;
+				box3 bounds = makebox3Empty();
+				for (int iTri = 0; iTri < cTriGroup; ++iTri)
+				{
+					point3 pos0 = pCtx->m_verts[pIndices[tris[iTri]*3    ]].m_pos;
+					point3 pos1 = pCtx->m_verts[pIndices[tris[iTri]*3 + 1]].m_pos;
+					point3 pos2 = pCtx->m_verts[pIndices[tris[iTri]*3 + 2]].m_pos;
+					float area = length(cross(pos1 - pos0, pos2 - pos0));
+					if (area > areaMax)
+					{
+						areaMax = area;
+						proto.m_iTriRef = iTri;
+					}
+					bounds = boxUnion(boxUnion(boxUnion(bounds, pos0), pos1), pos2);
+				}
+				if (proto.m_iTriRef < 0)
+					continue;
+
+				const int * pIndicesRef = &pIndices[tris[proto.m_iTriRef] * 3];
+				proto.m_frameRef = TriangleFrame(
+										pCtx->m_verts[pIndicesRef[0]].m_pos,
+										pCtx->m_verts[pIndicesRef[1]].m_pos,
+										pCtx->m_verts[pIndicesRef[2]].m_pos);
+				proto.m_tolerance = 1e-4f * length(bounds.diagonal());
+				proto.m_tris = tris;
+				prototypes.push_back(proto);
+			}
+
+			if (pCtx->m_instanceSets.empty())
+				return;
+
+			// Rebuild the index buffer without the copies, splitting material ranges wherever
+			// the instance set changes so SortMaterials will keep them apart
+			std::vector<int> indicesNew;
+			indicesNew.reserve(pCtx->m_indices.size());
+			std::vector<MtlRange> mtlRangesNew;
+			for (int iRange = 0, cRange = int(pCtx->m_mtlRanges.size()); iRange < cRange; ++iRange)
+			{
+				const MtlRange & range = pCtx->m_mtlRanges[iRange];
+				for (int i = range.m_indexStart / 3, iEnd = (range.m_indexStart + range.m_indexCount) / 3; i < iEnd; ++i)
+				{
+					if (triRemoved[i])
+						continue;
+
+					if (mtlRangesNew.empty() ||
+						mtlRangesNew.back().m_mtlName != range.m_mtlName ||
+						mtlRangesNew.back().m_iInstanceSet != triInstanceSet[i] ||
+						mtlRangesNew.back().m_indexStart + mtlRangesNew.back().m_indexCount != int(indicesNew.size()))
+					{
+						MtlRange rangeNew = { range.m_mtlName, int(indicesNew.size()), 0, triInstanceSet[i], };
+						mtlRangesNew.push_back(rangeNew);
+					}
+
+					indicesNew.push_back(pCtx->m_indices[i*3    ]);
+					indicesNew.push_back(pCtx->m_indices[i*3 + 1]);
+					indicesNew.push_back(pCtx->m_indices[i*3 + 2]);
+					mtlRangesNew.back().m_indexCount += 3;
+				}
+			}
+
+			pCtx->m_indices.swap(indicesNew);
+			pCtx->m_mtlRanges.swap(mtlRangesNew);
+
+			// Group index ranges are stale now
+			pCtx->m_groups.clear();
+		}
+
+		static void ReportInstances(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+
+			if (pCtx->m_instanceSets.empty())
+				return;
+
+			// Count the unique verts left in each instance set after deduplication;
+			// every copy that was removed would have needed that many again
+			std::vector<int> uniqueVerts(pCtx->m_instanceSets.size(), 0);
+			std::vector<int> vertLastSet(pCtx->m_verts.size(), -1);
+			for (int iRange = 0, cRange = int(pCtx->m_mtlRanges.size()); iRange < cRange; ++iRange)
+			{
+				const MtlRange & range = pCtx->m_mtlRanges[iRange];
+				if (range.m_iInstanceSet < 0)
+					continue;
+
+				for (int i = range.m_indexStart, iEnd = range.m_indexStart + range.m_indexCount; i < iEnd; ++i)
+				{
+					int iVert = pCtx->m_indices[i];
+					if (vertLastSet[iVert] != range.m_iInstanceSet)
+					{
+						vertLastSet[iVert] = range.m_iInstanceSet;
+						++uniqueVerts[range.m_iInstanceSet];
+					}
+				}
+			}
+
+			i64 bytesSavedTotal = 0;
+			int copiesTotal = 0;
+			for (int i = 0, c = int(pCtx->m_instanceSets.size()); i < c; ++i)
+			{
+				const InstanceSet & instanceSet = pCtx->m_instanceSets[i];
+				int copies = int(instanceSet.m_transforms.size()) - 1;
+				i64 bytesPerCopy = i64(uniqueVerts[i]) * i64(sizeof(Vertex)) + i64(instanceSet.m_triCount) * 3 * i64(sizeof(int));
+				i64 bytesSaved = i64(copies) * (bytesPerCopy - i64(sizeof(affine3)));
+
+				LOG("    Instanced group \"%s\": %d tris, %d verts, %d copies, saved %lld bytes",
+					instanceSet.m_name.c_str(), instanceSet.m_triCount, uniqueVerts[i], copies, bytesSaved);
+
+				bytesSavedTotal += bytesSaved;
+				copiesTotal += copies;
+			}
+
+			LOG("Instanced %d groups, %d copies removed, saved %lld KB of vertex and index data",
+				int(pCtx->m_instanceSets.size()), copiesTotal, bytesSavedTotal / 1024);
+		}
+
 		static void RemoveDegenerateTriangles(Context * pCtx)
 		{
 			ASSERT_ERR(pCtx);
 			ASSERT_WARN(pCtx->m_indices.size() % 3 == 0);
 
-			// Remove degenerate triangles by compacting in-place
-			int iWrite = 0;
-			for (int i = 0, c = int(pCtx->m_indices.size()); i < c; i += 3)
-			{
-				int indices[3] = { pCtx->m_indices[i], pCtx->m_indices[i+1], pCtx->m_indices[i+2] };
-
-				// Gather positions for this triangle
-				point3 facePositions[3] =
-				{
-					pCtx->m_verts[indices[0]].m_pos,
-					pCtx->m_verts[indices[1]].m_pos,
-					pCtx->m_verts[indices[2]].m_pos,
-				};
-
-				// Calculate edge and normal vectors
-				float3 edge0 = facePositions[1] - facePositions[0];
-				float3 edge1 = facePositions[2] - facePositions[0];
-				float3 normal = cross(edge0, edge1);
-
-				// Triangle is degenerate if normal is near-zero
-				bool degenerate = all(isnear(normal, 0.0f));
-				if (degenerate)
-				{
-					// Fix up material ranges.  This could be done more efficiently, but on the
-					// assumption that degenerate triangles are rare and material ranges are few,
-					// this should be OK...
-					// !!!UNDONE: should remove empty material ranges after this
-					for (int iMaterial = 0, cMaterial = int(pCtx->m_mtlRanges.size()); iMaterial < cMaterial; ++iMaterial)
-					{
-						MtlRange * pMtlRange = &pCtx->m_mtlRanges[iMaterial];
-						if (iWrite < pMtlRange->m_indexStart)
-							pMtlRange->m_indexStart -= 3;
-						else if (iWrite < pMtlRange->m_indexStart + pMtlRange->m_indexCount)
-							pMtlRange->m_indexCount -= 3;
+			// Duplicate triangles are found with a hash table of index triples, hashed and
+			// compared by the vertex data they refer to, since verts haven't been deduplicated
+			// yet at this stage.  Triples are rotated to start at their lowest vertex, so a
+			// triangle with its corners cycled still matches; the opposite winding doesn't,
+			// since that's a legit back face.
+			// Note: m_tangent not included because it hasn't been computed yet.
+
+			static const int s_vertexKeyBytes = offsetof(Vertex, m_uv) + sizeof(float2);
+
+			struct TriangleKey
+			{
+				int		m_indices[3];
+			};
+
+			struct TriangleHasher
+			{
+				const Vertex * m_pVerts;
+				size_t operator () (const TriangleKey & t) const
+				{
+					// FNV-1a over the vertex data
+					size_t hash = 2166136261U;
+					for (int iCorner = 0; iCorner < 3; ++iCorner)
+					{
+						const byte * pBytes = (const byte *)&m_pVerts[t.m_indices[iCorner]];
+						for (int i = 0; i < s_vertexKeyBytes; ++i)
+							hash = (hash ^ pBytes[i]) * 16777619U;
 					}
+					return hash;
 				}
-				else
+			};
+
+			struct TriangleEqualityTester
+			{
+				const Vertex * m_pVerts;
+				bool operator () (const TriangleKey & t, const TriangleKey & u) const
+				{
+					for (int iCorner = 0; iCorner < 3; ++iCorner)
+					{
+						if (memcmp(&m_pVerts[t.m_indices[iCorner]], &m_pVerts[u.m_indices[iCorner]], s_vertexKeyBytes) != 0)
+							return false;
+					}
+					return true;
+				}
+			};
+
+			const Vertex * pVerts = &pCtx->m_verts[0];
+			TriangleHasher hasher = { pVerts };
+			TriangleEqualityTester equalityTester = { pVerts };
+			std::unordered_set<TriangleKey, TriangleHasher, TriangleEqualityTester> setTriangles(
+				pCtx->m_indices.size() / 3, hasher, equalityTester);
+
+			int numDegenerate = 0;
+			int numDuplicate = 0;
+			int numZeroUVArea = 0;
+
+			// Compact the triangles in-place, one material range at a time, rebuilding the
+			// ranges as we go and dropping any that end up empty.  Ranges are contiguous and
+			// in order after SortMaterials, so this is a single stable pass over the indices.
+			int iWrite = 0;
+			int iRangeWrite = 0;
+			for (int iRange = 0, cRange = int(pCtx->m_mtlRanges.size()); iRange < cRange; ++iRange)
+			{
+				MtlRange * pRange = &pCtx->m_mtlRanges[iRange];
+				int iRangeStart = iWrite;
+
+				// Duplicates only count within the same material
+				setTriangles.clear();
+
+				for (int i = pRange->m_indexStart, iEnd = pRange->m_indexStart + pRange->m_indexCount; i < iEnd; i += 3)
 				{
-					// Not degenerate: keep this triangle; copy its indices down to the write cursor
-					pCtx->m_indices[iWrite  ] = pCtx->m_indices[i  ];
-					pCtx->m_indices[iWrite+1] = pCtx->m_indices[i+1];
-					pCtx->m_indices[iWrite+2] = pCtx->m_indices[i+2];
+					int indices[3] = { pCtx->m_indices[i], pCtx->m_indices[i+1], pCtx->m_indices[i+2] };
+
+					// Gather positions for this triangle
+					point3 facePositions[3] =
+					{
+						pVerts[indices[0]].m_pos,
+						pVerts[indices[1]].m_pos,
+						pVerts[indices[2]].m_pos,
+					};
+
+					// Calculate edge and normal vectors
+					float3 edge0 = facePositions[1] - facePositions[0];
+					float3 edge1 = facePositions[2] - facePositions[0];
+					float3 normal = cross(edge0, edge1);
+
+					// Triangle is degenerate if normal is near-zero
+					if (all(isnear(normal, 0.0f)))
+					{
+						++numDegenerate;
+						continue;
+					}
+
+					// Rotate the corners to start at the lowest vertex, and check if we've seen it before
+					int iCornerFirst = 0;
+					for (int iCorner = 1; iCorner < 3; ++iCorner)
+					{
+						if (memcmp(&pVerts[indices[iCorner]], &pVerts[indices[iCornerFirst]], s_vertexKeyBytes) < 0)
+							iCornerFirst = iCorner;
+					}
+					TriangleKey key =
+					{
+						indices[iCornerFirst],
+						indices[(iCornerFirst + 1) % 3],
+						indices[(iCornerFirst + 2) % 3],
+					};
+					if (!setTriangles.insert(key).second)
+					{
+						++numDuplicate;
+						continue;
+					}
+
+					// Zero UV area is legit geometry, so keep the triangle, but it'll get
+					// an arbitrary tangent frame; just count them for the log.
+					float2 uvEdge0 = pVerts[indices[1]].m_uv - pVerts[indices[0]].m_uv;
+					float2 uvEdge1 = pVerts[indices[2]].m_uv - pVerts[indices[0]].m_uv;
+					if (uvEdge0.x * uvEdge1.y - uvEdge0.y * uvEdge1.x == 0.0f)
+						++numZeroUVArea;
+
+					// Keep this triangle; copy its indices down to the write cursor
+					pCtx->m_indices[iWrite  ] = indices[0];
+					pCtx->m_indices[iWrite+1] = indices[1];
+					pCtx->m_indices[iWrite+2] = indices[2];
 					iWrite += 3;
 				}
+
+				// Keep the range if it still has anything in it
+				if (iWrite > iRangeStart)
+				{
+					pRange->m_indexStart = iRangeStart;
+					pRange->m_indexCount = iWrite - iRangeStart;
+					if (iRangeWrite != iRange)
+						pCtx->m_mtlRanges[iRangeWrite] = *pRange;
+					++iRangeWrite;
+				}
 			}
 
 			ASSERT_ERR(iWrite <= int(pCtx->m_indices.size()));
 			pCtx->m_indices.resize(iWrite);
+
+			int numEmptyRanges = int(pCtx->m_mtlRanges.size()) - iRangeWrite;
+			pCtx->m_mtlRanges.resize(iRangeWrite);
+
+			if (numDegenerate > 0 || numDuplicate > 0 || numZeroUVArea > 0)
+			{
+				LOG("Removed %d degenerate and %d duplicate triangles, and %d empty material ranges; %d triangles have zero UV area",
+					numDegenerate, numDuplicate, numEmptyRanges, numZeroUVArea);
+			}
 		}
 
 		static void DeduplicateVerts(Context * pCtx)
@@ -451,35 +1424,126 @@ namespace Framework
 			pCtx->m_indices.swap(indicesRemapped);
 		}
 
+		static void BuildVertexAdjacency(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+
+			// Build a table listing, for each vertex, the positions in the index buffer that
+			// refer to it, in ascending order.  The normal and tangent passes gather over this
+			// instead of scattering onto vertices, so each vertex is owned by exactly one thread,
+			// and the triangles are still summed in the same order as a serial scatter would.
+
+			int cVert = int(pCtx->m_verts.size());
+			int cIdx = int(pCtx->m_indices.size());
+
+			pCtx->m_adjStart.assign(cVert + 1, 0);
+			for (int i = 0; i < cIdx; ++i)
+				++pCtx->m_adjStart[pCtx->m_indices[i] + 1];
+			for (int i = 0; i < cVert; ++i)
+				pCtx->m_adjStart[i + 1] += pCtx->m_adjStart[i];
+
+			std::vector<int> cursor(pCtx->m_adjStart.begin(), pCtx->m_adjStart.end() - 1);
+			pCtx->m_adjIndices.resize(cIdx);
+			for (int i = 0; i < cIdx; ++i)
+				pCtx->m_adjIndices[cursor[pCtx->m_indices[i]]++] = i;
+		}
+
+		// SIMD helpers for processing four consecutive triangles at once
+
+		static float3_simd GatherPositionsSIMD(const Context * pCtx, int iTri, int iCorner)
+		{
+			const int * pIndices = &pCtx->m_indices[iTri * 3 + iCorner];
+			const point3 & p0 = pCtx->m_verts[pIndices[0]].m_pos;
+			const point3 & p1 = pCtx->m_verts[pIndices[3]].m_pos;
+			const point3 & p2 = pCtx->m_verts[pIndices[6]].m_pos;
+			const point3 & p3 = pCtx->m_verts[pIndices[9]].m_pos;
+			float3_simd result =
+			{
+				_mm_setr_ps(p0.x, p1.x, p2.x, p3.x),
+				_mm_setr_ps(p0.y, p1.y, p2.y, p3.y),
+				_mm_setr_ps(p0.z, p1.z, p2.z, p3.z),
+			};
+			return result;
+		}
+
+		static float2_simd GatherUVsSIMD(const Context * pCtx, int iTri, int iCorner)
+		{
+			const int * pIndices = &pCtx->m_indices[iTri * 3 + iCorner];
+			const float2 & uv0 = pCtx->m_verts[pIndices[0]].m_uv;
+			const float2 & uv1 = pCtx->m_verts[pIndices[3]].m_uv;
+			const float2 & uv2 = pCtx->m_verts[pIndices[6]].m_uv;
+			const float2 & uv3 = pCtx->m_verts[pIndices[9]].m_uv;
+			float2_simd result =
+			{
+				_mm_setr_ps(uv0.x, uv1.x, uv2.x, uv3.x),
+				_mm_setr_ps(uv0.y, uv1.y, uv2.y, uv3.y),
+			};
+			return result;
+		}
+
+		static void ScatterSIMD(const float3_simd & a, float3 * pOut)
+		{
+			// Transpose back to four consecutive float3s
+			float x[4], y[4], z[4];
+			_mm_storeu_ps(x, a.x);
+			_mm_storeu_ps(y, a.y);
+			_mm_storeu_ps(z, a.z);
+			for (int i = 0; i < 4; ++i)
+				pOut[i] = makefloat3(x[i], y[i], z[i]);
+		}
+
+		static float3_simd NormalizeSIMD(const float3_simd & a)
+		{
+			__m128 length = _mm_sqrt_ps(a.x*a.x + a.y*a.y + a.z*a.z);
+			float3_simd result = { a.x / length, a.y / length, a.z / length };
+			return result;
+		}
+
 		static void CalculateNormals(Context * pCtx)
 		{
 			ASSERT_ERR(pCtx);
 			ASSERT_WARN(pCtx->m_indices.size() % 3 == 0);
+			ASSERT_ERR(pCtx->m_adjStart.size() == pCtx->m_verts.size() + 1);
 
-			// Generate a normal for each triangle, and accumulate onto vertex
-			for (int i = 0, c = int(pCtx->m_indices.size()); i < c; i += 3)
-			{
-				int indices[3] = { pCtx->m_indices[i], pCtx->m_indices[i+1], pCtx->m_indices[i+2] };
+			int cTri = int(pCtx->m_indices.size()) / 3;
+			int cVert = int(pCtx->m_verts.size());
 
-				// Gather positions for this triangle
-				point3 facePositions[3] =
+			// Generate a normal for each triangle, four at a time
+			std::vector<float3> faceNormals(cTri);
+			parallelFor(cTri, s_parallelBlockSize, [&](int iTriStart, int iTriEnd)
+			{
+				int iTri = iTriStart;
+				for (; iTri + 4 <= iTriEnd; iTri += 4)
 				{
-					pCtx->m_verts[indices[0]].m_pos,
-					pCtx->m_verts[indices[1]].m_pos,
-					pCtx->m_verts[indices[2]].m_pos,
-				};
+					float3_simd pos0 = GatherPositionsSIMD(pCtx, iTri, 0);
+					float3_simd pos1 = GatherPositionsSIMD(pCtx, iTri, 1);
+					float3_simd pos2 = GatherPositionsSIMD(pCtx, iTri, 2);
+					ScatterSIMD(NormalizeSIMD(cross(pos1 - pos0, pos2 - pos0)), &faceNormals[iTri]);
+				}
 
-				// Calculate edge and normal vectors
-				float3 edge0 = facePositions[1] - facePositions[0];
-				float3 edge1 = facePositions[2] - facePositions[0];
-				float3 normal = normalize(cross(edge0, edge1));
-				ASSERT_WARN(all(isfinite(normal)));
+				// Finish any leftovers one at a time
+				for (; iTri < iTriEnd; ++iTri)
+				{
+					const int * pIndices = &pCtx->m_indices[iTri * 3];
+					point3 pos0 = pCtx->m_verts[pIndices[0]].m_pos;
+					float3 edge0 = pCtx->m_verts[pIndices[1]].m_pos - pos0;
+					float3 edge1 = pCtx->m_verts[pIndices[2]].m_pos - pos0;
+					faceNormals[iTri] = normalize(cross(edge0, edge1));
+				}
+			});
 
-				// Accumulate onto vertices
-				pCtx->m_verts[indices[0]].m_normal += normal;
-				pCtx->m_verts[indices[1]].m_normal += normal;
-				pCtx->m_verts[indices[2]].m_normal += normal;
-			}
+			// Accumulate onto vertices
+			parallelFor(cVert, s_parallelBlockSize, [&](int iVertStart, int iVertEnd)
+			{
+				for (int iVert = iVertStart; iVert < iVertEnd; ++iVert)
+				{
+					float3 normal = pCtx->m_verts[iVert].m_normal;
+					for (int j = pCtx->m_adjStart[iVert], jEnd = pCtx->m_adjStart[iVert + 1]; j < jEnd; ++j)
+						normal += faceNormals[pCtx->m_adjIndices[j] / 3];
+					ASSERT_WARN(all(isfinite(normal)));
+					pCtx->m_verts[iVert].m_normal = normal;
+				}
+			});
 		}
 
 		static void NormalizeNormals(Context * pCtx)
@@ -487,11 +1551,14 @@ namespace Framework
 			ASSERT_ERR(pCtx);
 
 			// Normalize summed normals
-			for (int i = 0, c = int(pCtx->m_verts.size()); i < c; ++i)
+			parallelFor(int(pCtx->m_verts.size()), s_parallelBlockSize, [&](int iVertStart, int iVertEnd)
 			{
-				pCtx->m_verts[i].m_normal = normalize(pCtx->m_verts[i].m_normal);
-				ASSERT_WARN(all(isfinite(pCtx->m_verts[i].m_normal)));
-			}
+				for (int i = iVertStart; i < iVertEnd; ++i)
+				{
+					pCtx->m_verts[i].m_normal = normalize(pCtx->m_verts[i].m_normal);
+					ASSERT_WARN(all(isfinite(pCtx->m_verts[i].m_normal)));
+				}
+			});
 		}
 
 #if VERTEX_TANGENT
@@ -499,108 +1566,128 @@ namespace Framework
 		{
 			ASSERT_ERR(pCtx);
 			ASSERT_WARN(pCtx->m_indices.size() % 3 == 0);
-
-			std::vector<float3> tangents(pCtx->m_verts.size(), makefloat3(0.0f));
-			std::vector<float3> bitangents(pCtx->m_verts.size(), makefloat3(0.0f));
-
-			// Generate a tangent for each triangle, based on triangle's UV mapping,
-			// and accumulate onto vertex
-			for (int i = 0, c = int(pCtx->m_indices.size()); i < c; i += 3)
+			ASSERT_ERR(pCtx->m_adjStart.size() == pCtx->m_verts.size() + 1);
+
+			int cTri = int(pCtx->m_indices.size()) / 3;
+			int cVert = int(pCtx->m_verts.size());
+
+			// Generate a tangent and bitangent for each triangle, based on triangle's UV mapping.
+			// Mapping the unit triangle to UV space is the 2x2 matrix [uvEdge0; uvEdge1], so
+			// UV-to-position is its inverse times [edge0; edge1], which works out to:
+			//   tangent   ~ ( uvEdge1.v * edge0 - uvEdge0.v * edge1) / det
+			//   bitangent ~ (-uvEdge1.u * edge0 + uvEdge0.u * edge1) / det
+			// Only the sign of det survives normalization.  If det is zero the UV mapping is
+			// singular, so we pick some reasonable tangent and bitangent instead.
+			std::vector<float3> faceTangents(cTri);
+			std::vector<float3> faceBitangents(cTri);
+			parallelFor(cTri, s_parallelBlockSize, [&](int iTriStart, int iTriEnd)
 			{
-				int indices[3] = { pCtx->m_indices[i], pCtx->m_indices[i+1], pCtx->m_indices[i+2] };
+				__m128 signMask = _mm_set1_ps(-0.0f);
 
-				// Gather positions for this triangle
-				point3 facePositions[3] =
+				int iTri = iTriStart;
+				for (; iTri + 4 <= iTriEnd; iTri += 4)
 				{
-					pCtx->m_verts[indices[0]].m_pos,
-					pCtx->m_verts[indices[1]].m_pos,
-					pCtx->m_verts[indices[2]].m_pos,
-				};
+					float3_simd pos0 = GatherPositionsSIMD(pCtx, iTri, 0);
+					float3_simd edge0 = GatherPositionsSIMD(pCtx, iTri, 1) - pos0;
+					float3_simd edge1 = GatherPositionsSIMD(pCtx, iTri, 2) - pos0;
 
-				// Calculate edge and normal vectors
-				float3 edge0 = facePositions[1] - facePositions[0];
-				float3 edge1 = facePositions[2] - facePositions[0];
-				float3 normal = cross(edge0, edge1);
+					float2_simd uv0 = GatherUVsSIMD(pCtx, iTri, 0);
+					float2_simd uvEdge0 = GatherUVsSIMD(pCtx, iTri, 1) - uv0;
+					float2_simd uvEdge1 = GatherUVsSIMD(pCtx, iTri, 2) - uv0;
 
-				// Calculate matrix from unit triangle to position space
-				float3x3 matUnitToPosition = makefloat3x3(edge0, edge1, normal);
+					__m128 det = uvEdge0.u * uvEdge1.v - uvEdge0.v * uvEdge1.u;
+					__m128 detSign = _mm_and_ps(det, signMask);
+					__m128 nonsingular = _mm_cmpneq_ps(det, _mm_setzero_ps());
 
-				// Gather UVs for this triangle
-				float2 faceUVs[3] =
-				{
-					pCtx->m_verts[indices[0]].m_uv,
-					pCtx->m_verts[indices[1]].m_uv,
-					pCtx->m_verts[indices[2]].m_uv,
-				};
+					float3_simd tangentUV = NormalizeSIMD(edge0 * uvEdge1.v - edge1 * uvEdge0.v);
+					float3_simd bitangentUV = NormalizeSIMD(edge1 * uvEdge0.u - edge0 * uvEdge1.u);
 
-				// Calculate UV space edge vectors
-				float2 uvEdge0 = faceUVs[1] - faceUVs[0];
-				float2 uvEdge1 = faceUVs[2] - faceUVs[0];
+					float3_simd tangentFallback = NormalizeSIMD(edge0);
+					float3_simd bitangentFallback = NormalizeSIMD(cross(cross(edge0, edge1), tangentFallback));
 
-				// Calculate matrix from unit triangle to UV space
-				float3x3 matUnitToUV = float3x3::identity();
-				matUnitToUV[0].xy = uvEdge0;
-				matUnitToUV[1].xy = uvEdge1;
+					float3_simd tangent, bitangent;
+					for (int j = 0; j < 3; ++j)
+					{
+						tangent[j] = _mm_or_ps(
+										_mm_and_ps(nonsingular, _mm_xor_ps(tangentUV[j], detSign)),
+										_mm_andnot_ps(nonsingular, tangentFallback[j]));
+						bitangent[j] = _mm_or_ps(
+										_mm_and_ps(nonsingular, _mm_xor_ps(bitangentUV[j], detSign)),
+										_mm_andnot_ps(nonsingular, bitangentFallback[j]));
+					}
 
-				// The x-axis of that matrix is the tangent vector
-				float3 tangent;
-				float3 bitangent;
+					ScatterSIMD(tangent, &faceTangents[iTri]);
+					ScatterSIMD(bitangent, &faceBitangents[iTri]);
+				}
 
-				// Matrix is nonsingular.
-				if (determinant(matUnitToUV) != 0.0f)
+				// Finish any leftovers one at a time
+				for (; iTri < iTriEnd; ++iTri)
 				{
-					// Calculate matrix from UV space to position space
-					float3x3 matUVToPosition = inverse(matUnitToUV) * matUnitToPosition;
+					const int * pIndices = &pCtx->m_indices[iTri * 3];
+					point3 pos0 = pCtx->m_verts[pIndices[0]].m_pos;
+					float3 edge0 = pCtx->m_verts[pIndices[1]].m_pos - pos0;
+					float3 edge1 = pCtx->m_verts[pIndices[2]].m_pos - pos0;
 
-					tangent = normalize(matUVToPosition[0]);
-					bitangent = normalize(matUVToPosition[1]);
-				}
-				// Matrix is singular, pick some reasonable tangent and bitangent.
-				else
-				{
-					tangent = normalize(edge0);
-					bitangent = normalize(cross(normal, tangent));
+					float2 uv0 = pCtx->m_verts[pIndices[0]].m_uv;
+					float2 uvEdge0 = pCtx->m_verts[pIndices[1]].m_uv - uv0;
+					float2 uvEdge1 = pCtx->m_verts[pIndices[2]].m_uv - uv0;
+
+					float det = uvEdge0.u * uvEdge1.v - uvEdge0.v * uvEdge1.u;
+					if (det != 0.0f)
+					{
+						float detSign = (det < 0.0f) ? -1.0f : 1.0f;
+						faceTangents[iTri] = normalize(edge0 * uvEdge1.v - edge1 * uvEdge0.v) * detSign;
+						faceBitangents[iTri] = normalize(edge1 * uvEdge0.u - edge0 * uvEdge1.u) * detSign;
+					}
+					else
+					{
+						faceTangents[iTri] = normalize(edge0);
+						faceBitangents[iTri] = normalize(cross(cross(edge0, edge1), faceTangents[iTri]));
+					}
 				}
+			});
 
-				// Accumulate onto vertices
-				if ((length(tangents[indices[0]]) == 0.0) || (dot(tangents[indices[0]], tangent) > 0.0f))
-					tangents[indices[0]] += tangent;
-				if ((length(tangents[indices[1]]) == 0.0) || (dot(tangents[indices[1]], tangent) > 0.0f))
-					tangents[indices[1]] += tangent;
-				if ((length(tangents[indices[2]]) == 0.0) || (dot(tangents[indices[2]], tangent) > 0.0f))
-					tangents[indices[2]] += tangent;
+			// Accumulate onto vertices, skipping any that would flip the running sum, then
+			// orthogonalize against the normal and work out the handedness
+			parallelFor(cVert, s_parallelBlockSize, [&](int iVertStart, int iVertEnd)
+			{
+				for (int iVert = iVertStart; iVert < iVertEnd; ++iVert)
+				{
+					float3 tangentSum = makefloat3(0.0f);
+					float3 bitangentSum = makefloat3(0.0f);
+					for (int j = pCtx->m_adjStart[iVert], jEnd = pCtx->m_adjStart[iVert + 1]; j < jEnd; ++j)
+					{
+						int iTri = pCtx->m_adjIndices[j] / 3;
+						float3 faceTangent = faceTangents[iTri];
+						float3 faceBitangent = faceBitangents[iTri];
+
+						if ((length(tangentSum) == 0.0) || (dot(tangentSum, faceTangent) > 0.0f))
+							tangentSum += faceTangent;
+						if ((length(bitangentSum) == 0.0) || (dot(bitangentSum, faceBitangent) > 0.0f))
+							bitangentSum += faceBitangent;
+					}
 
-				if ((length(bitangents[indices[0]]) == 0.0) || (dot(bitangents[indices[0]], bitangent) > 0.0f))
-					bitangents[indices[0]] += bitangent;
-				if ((length(bitangents[indices[1]]) == 0.0) || (dot(bitangents[indices[1]], bitangent) > 0.0f))
-					bitangents[indices[1]] += bitangent;
-				if ((length(bitangents[indices[2]]) == 0.0) || (dot(bitangents[indices[2]], bitangent) > 0.0f))
-					bitangents[indices[2]] += bitangent;
-			}
+					float3 tangent = normalize(tangentSum);
+					float3 bitangent = normalize(bitangentSum);
 
-			// Normalize summed tangents
-			for (int i = 0, c = int(pCtx->m_verts.size()); i < c; ++i)
-			{
-				float3 tangent = normalize(tangents[i]);
-				float3 bitangent = normalize(bitangents[i]);
+					ASSERT_WARN(all(isfinite(tangent)));
+					ASSERT_WARN(all(isfinite(bitangent)));
 
-				ASSERT_WARN(all(isfinite(tangent)));
-				ASSERT_WARN(all(isfinite(bitangent)));
+					// Orthogonalization.
+					float3 normal = pCtx->m_verts[iVert].m_normal;
+					float dotVal = dot(normal, tangent);
+					tangent = normalize(tangent - normal * dotVal);
 
-				// Orthogonalization.
-				float3 normal = pCtx->m_verts[i].m_normal;
-				float dotVal = dot(normal, tangent);
-				tangent = normalize(tangent - normal * dotVal);
+					// Handedness.
+					float handedness = 1.0f;
 
-				// Handedness.
-				float handedness = 1.0f;
-				
-				dotVal = dot(cross(normal, tangent), bitangent);
-				if (dotVal < 0.0f)
-					handedness = -1.0f;
+					dotVal = dot(cross(normal, tangent), bitangent);
+					if (dotVal < 0.0f)
+						handedness = -1.0f;
 
-				pCtx->m_verts[i].m_tangent = makefloat4(tangent, handedness);
-			}
+					pCtx->m_verts[iVert].m_tangent = makefloat4(tangent, handedness);
+				}
+			});
 		}
 #endif // VERTEX_TANGENT
 
@@ -608,13 +1695,16 @@ namespace Framework
 		{
 			ASSERT_ERR(pCtx);
 
-			// Sort the material ranges by name first, and index second
+			// Sort the material ranges by instance set first (so the non-instanced ranges
+			// come first), name second, and index third
 			std::sort(
 				pCtx->m_mtlRanges.begin(),
 				pCtx->m_mtlRanges.end(),
 				[](const MtlRange & a, const MtlRange & b)
 				{
-					if (a.m_mtlName != b.m_mtlName)
+					if (a.m_iInstanceSet != b.m_iInstanceSet)
+						return a.m_iInstanceSet < b.m_iInstanceSet;
+					else if (a.m_mtlName != b.m_mtlName)
 						return a.m_mtlName < b.m_mtlName;
 					else
 						return a.m_indexStart < b.m_indexStart;
@@ -640,7 +1730,7 @@ namespace Framework
 					&pCtx->m_indices[rangeFirst.m_indexStart],
 					rangeFirst.m_indexCount * sizeof(int));
 
-				MtlRange rangeMerged = { rangeFirst.m_mtlName, 0, rangeFirst.m_indexCount, };
+				MtlRange rangeMerged = { rangeFirst.m_mtlName, 0, rangeFirst.m_indexCount, rangeFirst.m_iInstanceSet, };
 				mtlRangesMerged.push_back(rangeMerged);
 
 				indicesCopied = rangeFirst.m_indexCount;
@@ -655,15 +1745,16 @@ namespace Framework
 					&pCtx->m_indices[rangeCur.m_indexStart],
 					rangeCur.m_indexCount * sizeof(int));
 				
-				if (rangeCur.m_mtlName == mtlRangesMerged.back().m_mtlName)
+				if (rangeCur.m_mtlName == mtlRangesMerged.back().m_mtlName &&
+					rangeCur.m_iInstanceSet == mtlRangesMerged.back().m_iInstanceSet)
 				{
-					// Material name is the same as the last range, so just extend it
+					// Material name and instance set are the same as the last range, so just extend it
 					mtlRangesMerged.back().m_indexCount += rangeCur.m_indexCount;
 				}
 				else
 				{
-					// Different material name, so create a new range
-					MtlRange rangeMerged = { rangeCur.m_mtlName, indicesCopied, rangeCur.m_indexCount, };
+					// Different material name or instance set, so create a new range
+					MtlRange rangeMerged = { rangeCur.m_mtlName, indicesCopied, rangeCur.m_indexCount, rangeCur.m_iInstanceSet, };
 					mtlRangesMerged.push_back(rangeMerged);
 				}
 
@@ -677,18 +1768,156 @@ namespace Framework
 			pCtx->m_mtlRanges.swap(mtlRangesMerged);
 		}
 
+		static void BuildPositionStream(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+
+			// Set up a hash table for positions.  Verts that were only kept distinct
+			// by DeduplicateVerts because of a normal or UV seam get welded here.
+
+			struct PositionHasher
+			{
+				std::hash<float> fh;
+				size_t operator () (const point3 & p) const
+				{
+					return fh(p.x) ^ (fh(p.y) << 1) ^ (fh(p.z) << 2);
+				}
+			};
+
+			struct PositionEqualityTester
+			{
+				bool operator () (const point3 & p, const point3 & q) const
+				{
+					return all(p == q);
+				}
+			};
+
+			std::vector<int> remappingTable;
+			std::unordered_map<point3, int, PositionHasher, PositionEqualityTester> mapPosToIndex;
+
+			pCtx->m_positions.clear();
+			pCtx->m_positions.reserve(pCtx->m_verts.size());
+			remappingTable.resize(pCtx->m_verts.size(), -1);
+			mapPosToIndex.reserve(pCtx->m_verts.size());
+
+			// Verts are already deduplicated and free of orphans, so walk them directly
+			for (int i = 0, c = int(pCtx->m_verts.size()); i < c; ++i)
+			{
+				point3 pos = pCtx->m_verts[i].m_pos;
+				auto iter = mapPosToIndex.find(pos);
+				if (iter == mapPosToIndex.end())
+				{
+					int newIndex = int(pCtx->m_positions.size());
+					pCtx->m_positions.push_back(pos);
+					remappingTable[i] = newIndex;
+					mapPosToIndex.insert(std::make_pair(pos, newIndex));
+				}
+				else
+				{
+					remappingTable[i] = iter->second;
+				}
+			}
+
+			ASSERT_ERR(pCtx->m_positions.size() <= pCtx->m_verts.size());
+
+			// Remap the index buffer, keeping the same triangle order so the
+			// material ranges stay valid for the position stream too
+			pCtx->m_posIndices.resize(pCtx->m_indices.size());
+			for (int i = 0, c = int(pCtx->m_indices.size()); i < c; ++i)
+			{
+				ASSERT_ERR(remappingTable[pCtx->m_indices[i]] >= 0);
+				pCtx->m_posIndices[i] = remappingTable[pCtx->m_indices[i]];
+			}
+		}
+
+		static void CalculateUVDensity(Context * pCtx)
+		{
+			ASSERT_ERR(pCtx);
+
+			// Instances are rigid copies, so the areas are the same for all of them
+			std::vector<float> ratios;
+			for (int i = 0, cRange = int(pCtx->m_mtlRanges.size()); i < cRange; ++i)
+			{
+				MtlRange & range = pCtx->m_mtlRanges[i];
+
+				ratios.clear();
+				ratios.reserve(range.m_indexCount / 3);
+				for (int j = range.m_indexStart, jEnd = range.m_indexStart + range.m_indexCount; j < jEnd; j += 3)
+				{
+					const Vertex & v0 = pCtx->m_verts[pCtx->m_indices[j]];
+					const Vertex & v1 = pCtx->m_verts[pCtx->m_indices[j+1]];
+					const Vertex & v2 = pCtx->m_verts[pCtx->m_indices[j+2]];
+
+					// Both areas are doubled, which cancels out
+					float areaWorld = length(cross(v1.m_pos - v0.m_pos, v2.m_pos - v0.m_pos));
+					float2 uv1 = v1.m_uv - v0.m_uv;
+					float2 uv2 = v2.m_uv - v0.m_uv;
+					float areaUV = abs(uv1.x * uv2.y - uv1.y * uv2.x);
+
+					if (areaWorld > 0.0f)
+						ratios.push_back(areaUV / areaWorld);
+				}
+
+				if (ratios.empty())
+				{
+					range.m_uvDensity = 0.0f;
+					continue;
+				}
+
+				// Area ratio to linear density
+				int iPercentile = int(s_uvDensityPercentile * float(ratios.size() - 1));
+				std::nth_element(ratios.begin(), ratios.begin() + iPercentile, ratios.end());
+				range.m_uvDensity = sqrt(ratios[iPercentile]);
+			}
+		}
+
 		static void SerializeMaterialMap(Context * pCtx, std::vector<byte> * pDataOut)
 		{
 			ASSERT_ERR(pCtx);
 			ASSERT_ERR(pDataOut);
 
+			// Instance transforms are laid out as in SerializeInstances: a single identity
+			// transform shared by all non-instanced ranges, then each instance set's in order
+			std::vector<int> instanceStarts(pCtx->m_instanceSets.size());
+			int instanceStart = 1;
+			for (int i = 0, c = int(pCtx->m_instanceSets.size()); i < c; ++i)
+			{
+				instanceStarts[i] = instanceStart;
+				instanceStart += int(pCtx->m_instanceSets[i].m_transforms.size());
+			}
+
 			SerializeHelper sh(pDataOut);
 			for (int i = 0, cRange = int(pCtx->m_mtlRanges.size()); i < cRange; ++i)
 			{
 				const MtlRange & range = pCtx->m_mtlRanges[i];
+				int rangeInstanceStart = 0;
+				int rangeInstanceCount = 1;
+				if (range.m_iInstanceSet >= 0)
+				{
+					rangeInstanceStart = instanceStarts[range.m_iInstanceSet];
+					rangeInstanceCount = int(pCtx->m_instanceSets[range.m_iInstanceSet].m_transforms.size());
+				}
+
 				sh.WriteString(range.m_mtlName);
 				sh.Write(range.m_indexStart);
 				sh.Write(range.m_indexCount);
+				sh.Write(rangeInstanceStart);
+				sh.Write(rangeInstanceCount);
+				sh.Write(range.m_uvDensity);
+			}
+		}
+
+		static void SerializeInstances(Context * pCtx, std::vector<affine3> * pTransformsOut)
+		{
+			ASSERT_ERR(pCtx);
+			ASSERT_ERR(pTransformsOut);
+
+			pTransformsOut->clear();
+			pTransformsOut->push_back(affine3::identity());
+			for (int i = 0, c = int(pCtx->m_instanceSets.size()); i < c; ++i)
+			{
+				const std::vector<affine3> & transforms = pCtx->m_instanceSets[i].m_transforms;
+				pTransformsOut->insert(pTransformsOut->end(), transforms.begin(), transforms.end());
 			}
 		}
 	}
@@ -746,6 +1975,35 @@ namespace Framework
 		}
 		pMeshOut->m_indexCount = indicesSize / sizeof(int);
 
+		int positionsSize;
+		if (!pPack->LookupFile(path, s_suffixPositions, (void **)&pMeshOut->m_pPositions, &positionsSize))
+		{
+			WARN("Couldn't find positions for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		pMeshOut->m_positionCount = positionsSize / sizeof(point3);
+
+		int posIndicesSize;
+		if (!pPack->LookupFile(path, s_suffixPosIndices, (void **)&pMeshOut->m_pPosIndices, &posIndicesSize))
+		{
+			WARN("Couldn't find position indices for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		if (posIndicesSize != indicesSize)
+		{
+			WARN("Position indices for mesh %s in asset pack %s are wrong size, %d bytes (expected %d)",
+				path, pPack->m_path.c_str(), posIndicesSize, indicesSize);
+			return false;
+		}
+
+		int instancesSize;
+		if (!pPack->LookupFile(path, s_suffixInstances, (void **)&pMeshOut->m_pInstanceTransforms, &instancesSize))
+		{
+			WARN("Couldn't find instance transforms for mesh %s in asset pack %s", path, pPack->m_path.c_str());
+			return false;
+		}
+		pMeshOut->m_instanceTransformCount = instancesSize / sizeof(affine3);
+
 		byte * pMtlMap;
 		int mtlMapSize;
 		if (!pPack->LookupFile(path, s_suffixMtlMap, (void **)&pMtlMap, &mtlMapSize))
@@ -759,8 +2017,9 @@ namespace Framework
 			return false;
 		}
 
-		LOG("Loaded %s from asset pack %s - %d verts, %d indices, %d materials",
-			path, pPack->m_path.c_str(), pMeshOut->m_vertCount, pMeshOut->m_indexCount, pMeshOut->m_mtlRanges.size());
+		LOG("Loaded %s from asset pack %s - %d verts (%d positions), %d indices, %d materials, %d instance transforms",
+			path, pPack->m_path.c_str(), pMeshOut->m_vertCount, pMeshOut->m_positionCount, pMeshOut->m_indexCount, pMeshOut->m_mtlRanges.size(),
+			pMeshOut->m_instanceTransformCount);
 
 		return true;
 	}
@@ -780,7 +2039,10 @@ namespace Framework
 			const char * mtlName;
 			if (!dh.ReadString(&mtlName) ||
 				!dh.Read(&range.m_indexStart) ||
-				!dh.Read(&range.m_indexCount))
+				!dh.Read(&range.m_indexCount) ||
+				!dh.Read(&range.m_instanceStart) ||
+				!dh.Read(&range.m_instanceCount) ||
+				!dh.Read(&range.m_uvDensity))
 			{
 				return false;
 			}
@@ -793,6 +2055,33 @@ namespace Framework
 				WARN("Corrupt material map: invalid index start/count");
 				return false;
 			}
+			if (range.m_instanceStart < 0 ||
+				range.m_instanceCount <= 0 ||
+				range.m_instanceStart + range.m_instanceCount > pMeshOut->m_instanceTransformCount)
+			{
+				WARN("Corrupt material map: invalid instance start/count");
+				return false;
+			}
+			if (!(range.m_uvDensity >= 0.0f))
+			{
+				WARN("Corrupt material map: invalid UV density");
+				return false;
+			}
+
+			// Compute bounds of the range's geometry, then of all its instances
+			box3 boundsGeom = makebox3Empty();
+			for (int i = range.m_indexStart, iEnd = range.m_indexStart + range.m_indexCount; i < iEnd; ++i)
+			{
+				int iVert = pMeshOut->m_pIndices[i];
+				if (uint(iVert) < uint(pMeshOut->m_vertCount))
+					boundsGeom = boxUnion(boundsGeom, pMeshOut->m_pVerts[iVert].m_pos);
+			}
+			range.m_bounds = makebox3Empty();
+			if (!boundsGeom.isempty())
+			{
+				for (int i = range.m_instanceStart, iEnd = range.m_instanceStart + range.m_instanceCount; i < iEnd; ++i)
+					range.m_bounds = boxUnion(range.m_bounds, boxTransform(boundsGeom, pMeshOut->m_pInstanceTransforms[i]));
+			}
 
 			// Look up material by name
 			if (pMtlLib && *mtlName)
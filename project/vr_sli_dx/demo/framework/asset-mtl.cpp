@@ -319,6 +319,11 @@ namespace Framework
 				}
 			}
 
+			// No texture arrays until a TextureArrayLib assigns them
+			mtl.m_sliceDiffuseColor = makeint2(-1);
+			mtl.m_sliceSpecColor = makeint2(-1);
+			mtl.m_sliceHeight = makeint2(-1);
+
 			pMtlLibOut->m_mtls.insert(std::make_pair(std::string(mtl.m_mtlName), mtl));
 		}
 
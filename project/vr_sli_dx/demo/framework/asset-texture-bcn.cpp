@@ -0,0 +1,834 @@
+#include "framework.h"
+#include "asset-internal.h"
+
+namespace Framework
+{
+	// CPU block compressor for the BCn texture ACKs.
+	//  * BC1 and BC3 color: endpoints at the extremes of the block's principal axis (or the
+	//      diagonal of its bounding box the texels lie along, at BCQ_Fast), inset slightly,
+	//      quantized to 565, then refined by least squares against the chosen indices.
+	//      Transparent texels put BC1 blocks in 3-color mode.
+	//  * BC4 and BC5 channels: min/max endpoints in the 8-value mode, and at better than
+	//      BCQ_Fast, the 6-value mode with exact 0 and 255 as well, keeping whichever fits better.
+	//  * BC7: mode 6 only (one subset, RGBA 7.7.7.7 endpoints plus p-bits, 4-bit indices).
+	//      It's the best single mode for general content; the partitioned modes would do better
+	//      on blocks with several distinct colors.
+	//  * Error is plain squared distance in the stored (sRGB, for sRGB formats) values.
+	//  * !!!UNDONE: BC6H, and the rest of the BC7 modes.
+
+	namespace BCnEncoder
+	{
+		// Least-squares refinement passes for each BCQ level (BCQ_Normal, BCQ_Fast, BCQ_High)
+		static const int s_refinePasses[] = { 1, 0, 3, };
+		cassert(dim(s_refinePasses) == BCQ_Count);
+
+		// Block rows per parallelFor job
+		static const int s_parallelBlockRows = 8;
+
+		// BC7 interpolation weights for 4-bit indices, out of 64
+		static const int s_bc7Weights4[] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64, };
+
+		static void LoadBlock(
+			const byte4 * pPixels,
+			int2_arg dims,
+			int xBlock,
+			int yBlock,
+			float4 * pTexelsOut)
+		{
+			for (int y = 0; y < 4; ++y)
+			{
+				int ySrc = min(yBlock * 4 + y, dims.y - 1);
+				for (int x = 0; x < 4; ++x)
+				{
+					int xSrc = min(xBlock * 4 + x, dims.x - 1);
+					pTexelsOut[y*4 + x] = makefloat4(pPixels[ySrc * dims.x + xSrc]);
+				}
+			}
+		}
+
+		static void StoreBlock(
+			const byte4 * pTexels,
+			int2_arg dims,
+			int xBlock,
+			int yBlock,
+			byte4 * pPixelsOut)
+		{
+			for (int y = 0; y < 4 && yBlock * 4 + y < dims.y; ++y)
+			{
+				for (int x = 0; x < 4 && xBlock * 4 + x < dims.x; ++x)
+					pPixelsOut[(yBlock * 4 + y) * dims.x + xBlock * 4 + x] = pTexels[y*4 + x];
+			}
+		}
+
+		// Direction of greatest variance of a set of points, by power iteration on the
+		// covariance matrix.  Returns zero if the points are all the same.
+		static float4 PrincipalAxis(const float4 * pPoints, int count, float4_arg mean)
+		{
+			float cov[4][4] = {};
+			for (int i = 0; i < count; ++i)
+			{
+				float4 d = pPoints[i] - mean;
+				for (int r = 0; r < 4; ++r)
+				{
+					for (int c = 0; c < 4; ++c)
+						cov[r][c] += d[r] * d[c];
+				}
+			}
+
+			// Start from the row with the largest variance, which can't be orthogonal to the axis
+			int rowMax = 0;
+			for (int r = 1; r < 4; ++r)
+			{
+				if (cov[r][r] > cov[rowMax][rowMax])
+					rowMax = r;
+			}
+			if (cov[rowMax][rowMax] <= 0.0f)
+				return makefloat4(0.0f);
+
+			float4 axis = normalize(makefloat4(cov[rowMax][0], cov[rowMax][1], cov[rowMax][2], cov[rowMax][3]));
+			for (int iter = 0; iter < 8; ++iter)
+			{
+				float4 next = makefloat4(0.0f);
+				for (int r = 0; r < 4; ++r)
+				{
+					for (int c = 0; c < 4; ++c)
+						next[r] += cov[r][c] * axis[c];
+				}
+				float len = length(next);
+				if (len < 1e-6f)
+					break;
+				axis = next / len;
+			}
+			return axis;
+		}
+
+		// Initial endpoints for a set of points: the extremes of their principal axis, or at
+		// BCQ_Fast, the corners of their bounding box on the diagonal they lie along.  Inset by
+		// insetFraction of the span, since the extreme texels are better served by the
+		// interpolated colors than the endpoints landing past them.
+		static void FitEndpoints(
+			const float4 * pPoints,
+			int count,
+			BCQ bcq,
+			float insetFraction,
+			float4 * pE0Out,
+			float4 * pE1Out)
+		{
+			ASSERT_ERR(count > 0);
+
+			float4 e0, e1;
+			if (bcq == BCQ_Fast)
+			{
+				e0 = pPoints[0];
+				e1 = pPoints[0];
+				for (int i = 1; i < count; ++i)
+				{
+					e0 = min(e0, pPoints[i]);
+					e1 = max(e1, pPoints[i]);
+				}
+
+				// The box's main diagonal only suits points whose channels rise together, so
+				// flip each channel that falls as the widest one rises onto the other diagonal
+				float4 center = (e0 + e1) * 0.5f;
+				float4 span = e1 - e0;
+				int cWidest = 0;
+				for (int c = 1; c < 4; ++c)
+				{
+					if (span[c] > span[cWidest])
+						cWidest = c;
+				}
+				float4 covariance = makefloat4(0.0f);
+				for (int i = 0; i < count; ++i)
+				{
+					float4 d = pPoints[i] - center;
+					covariance += d[cWidest] * d;
+				}
+				for (int c = 0; c < 4; ++c)
+				{
+					if (covariance[c] < 0.0f)
+						swap(e0[c], e1[c]);
+				}
+			}
+			else
+			{
+				float4 mean = makefloat4(0.0f);
+				for (int i = 0; i < count; ++i)
+					mean += pPoints[i];
+				mean /= float(count);
+
+				float4 axis = PrincipalAxis(pPoints, count, mean);
+				float tMin = 0.0f, tMax = 0.0f;
+				for (int i = 0; i < count; ++i)
+				{
+					float t = dot(pPoints[i] - mean, axis);
+					tMin = min(tMin, t);
+					tMax = max(tMax, t);
+				}
+				e0 = mean + tMin * axis;
+				e1 = mean + tMax * axis;
+			}
+
+			float4 inset = (e1 - e0) * insetFraction;
+			*pE0Out = clamp(e0 + inset, makefloat4(0.0f), makefloat4(255.0f));
+			*pE1Out = clamp(e1 - inset, makefloat4(0.0f), makefloat4(255.0f));
+		}
+
+		// Best endpoints in the least-squares sense, given each point's interpolation weight
+		// (0 at e0, 1 at e1).  Returns false if the weights don't determine them.
+		static bool RefineEndpoints(
+			const float4 * pPoints,
+			const float * pWeights,
+			int count,
+			float4 * pE0Out,
+			float4 * pE1Out)
+		{
+			float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+			float4 ax = makefloat4(0.0f), bx = makefloat4(0.0f);
+			for (int i = 0; i < count; ++i)
+			{
+				float b = pWeights[i];
+				float a = 1.0f - b;
+				aa += a * a;
+				ab += a * b;
+				bb += b * b;
+				ax += a * pPoints[i];
+				bx += b * pPoints[i];
+			}
+
+			float det = aa * bb - ab * ab;
+			if (abs(det) < 1e-6f)
+				return false;
+
+			*pE0Out = clamp((bb * ax - ab * bx) / det, makefloat4(0.0f), makefloat4(255.0f));
+			*pE1Out = clamp((aa * bx - ab * ax) / det, makefloat4(0.0f), makefloat4(255.0f));
+			return true;
+		}
+
+
+
+		// BC1 (and the color half of BC3)
+
+		static u16 PackRGB565(float4_arg color)
+		{
+			int r = clamp(round(color.x * (31.0f / 255.0f)), 0, 31);
+			int g = clamp(round(color.y * (63.0f / 255.0f)), 0, 63);
+			int b = clamp(round(color.z * (31.0f / 255.0f)), 0, 31);
+			return u16((r << 11) | (g << 5) | b);
+		}
+
+		static float4 UnpackRGB565(u16 c)
+		{
+			int r = (c >> 11) & 31;
+			int g = (c >> 5) & 63;
+			int b = c & 31;
+			return makefloat4(float((r << 3) | (r >> 2)), float((g << 2) | (g >> 4)), float((b << 3) | (b >> 2)), 255.0f);
+		}
+
+		// Palette as the hardware decodes it.  BC3 color blocks are always in 4-color mode;
+		// BC1 blocks are in 3-color mode (with index 3 transparent black) when c0 <= c1.
+		// Returns the number of opaque entries.
+		static int DecodeColorPalette(u16 c0, u16 c1, bool isBC1, float4 * pPaletteOut)
+		{
+			pPaletteOut[0] = UnpackRGB565(c0);
+			pPaletteOut[1] = UnpackRGB565(c1);
+			if (!isBC1 || c0 > c1)
+			{
+				pPaletteOut[2] = (2.0f * pPaletteOut[0] + pPaletteOut[1]) / 3.0f;
+				pPaletteOut[3] = (pPaletteOut[0] + 2.0f * pPaletteOut[1]) / 3.0f;
+				return 4;
+			}
+			pPaletteOut[2] = (pPaletteOut[0] + pPaletteOut[1]) * 0.5f;
+			pPaletteOut[3] = makefloat4(0.0f);
+			return 3;
+		}
+
+		static float DistanceSquaredRGB(float4_arg a, float4_arg b)
+		{
+			float3 d = a.xyz - b.xyz;
+			return dot(d, d);
+		}
+
+		// Choose each texel's index for a pair of endpoints; returns the total error
+		static float ChooseColorIndices(
+			const float4 * pTexels,
+			const bool * pTransparent,
+			u16 c0, u16 c1,
+			bool isBC1,
+			int * pIndicesOut)
+		{
+			float4 palette[4];
+			int cOpaque = DecodeColorPalette(c0, c1, isBC1, palette);
+
+			float errTotal = 0.0f;
+			for (int i = 0; i < 16; ++i)
+			{
+				if (pTransparent[i])
+				{
+					pIndicesOut[i] = 3;
+					continue;
+				}
+
+				int iBest = 0;
+				float errBest = DistanceSquaredRGB(pTexels[i], palette[0]);
+				for (int j = 1; j < cOpaque; ++j)
+				{
+					float err = DistanceSquaredRGB(pTexels[i], palette[j]);
+					if (err < errBest)
+					{
+						errBest = err;
+						iBest = j;
+					}
+				}
+				pIndicesOut[i] = iBest;
+				errTotal += errBest;
+			}
+			return errTotal;
+		}
+
+		static void EncodeColorBlock(const float4 * pTexels, bool isBC1, BCQ bcq, byte * pOut)
+		{
+			// Transparent texels force BC1's 3-color mode, and are left out of the endpoint fit.
+			// Alpha is zeroed in the fit so it can't pull the principal axis away from RGB.
+			bool transparent[16] = {};
+			float4 opaque[16];
+			int cOpaque = 0;
+			for (int i = 0; i < 16; ++i)
+			{
+				transparent[i] = isBC1 && pTexels[i].w < 128.0f;
+				if (!transparent[i])
+					opaque[cOpaque++] = makefloat4(pTexels[i].xyz, 0.0f);
+			}
+			bool threeColor = (cOpaque < 16);
+
+			u16 c0Best = 0, c1Best = 0;
+			int indicesBest[16];
+			for (int i = 0; i < 16; ++i)
+				indicesBest[i] = 3;
+
+			if (cOpaque > 0)
+			{
+				float4 e0, e1;
+				FitEndpoints(opaque, cOpaque, bcq, threeColor ? 1.0f / 32.0f : 1.0f / 16.0f, &e0, &e1);
+
+				float errBest = FLT_MAX;
+				for (int pass = 0; pass <= s_refinePasses[bcq]; ++pass)
+				{
+					// Order the endpoints for the mode we want: c0 > c1 for 4 colors, else c0 <= c1
+					u16 c0 = PackRGB565(e0);
+					u16 c1 = PackRGB565(e1);
+					if ((c0 < c1) != threeColor)
+						swap(c0, c1);
+
+					int indices[16];
+					float err = ChooseColorIndices(pTexels, transparent, c0, c1, isBC1, indices);
+					if (err < errBest)
+					{
+						errBest = err;
+						c0Best = c0;
+						c1Best = c1;
+						memcpy(indicesBest, indices, sizeof(indices));
+					}
+
+					if (pass == s_refinePasses[bcq] || errBest == 0.0f)
+						break;
+
+					// Refit the endpoints to the indices just chosen
+					static const float s_weights4[] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f, };
+					static const float s_weights3[] = { 0.0f, 1.0f, 0.5f, 0.0f, };
+					const float * pWeightTable = (isBC1 && c0 <= c1) ? s_weights3 : s_weights4;
+					float weights[16];
+					int cFit = 0;
+					for (int i = 0; i < 16; ++i)
+					{
+						if (!transparent[i])
+							weights[cFit++] = pWeightTable[indices[i]];
+					}
+					if (!RefineEndpoints(opaque, weights, cFit, &e0, &e1))
+						break;
+				}
+			}
+
+			u32 indexBits = 0;
+			for (int i = 0; i < 16; ++i)
+				indexBits |= u32(indicesBest[i]) << (i * 2);
+
+			memcpy(pOut, &c0Best, sizeof(u16));
+			memcpy(pOut + 2, &c1Best, sizeof(u16));
+			memcpy(pOut + 4, &indexBits, sizeof(u32));
+		}
+
+		static void DecodeColorBlock(const byte * pIn, bool isBC1, byte4 * pTexelsOut)
+		{
+			u16 c0, c1;
+			u32 indexBits;
+			memcpy(&c0, pIn, sizeof(u16));
+			memcpy(&c1, pIn + 2, sizeof(u16));
+			memcpy(&indexBits, pIn + 4, sizeof(u32));
+
+			float4 palette[4];
+			DecodeColorPalette(c0, c1, isBC1, palette);
+			for (int i = 0; i < 16; ++i)
+			{
+				float4 color = palette[(indexBits >> (i * 2)) & 3];
+				pTexelsOut[i] = makebyte4(byte(round(color.x)), byte(round(color.y)), byte(round(color.z)), byte(round(color.w)));
+			}
+		}
+
+
+
+		// BC4 (also the alpha half of BC3, and both halves of BC5)
+
+		// Palette as the hardware decodes it: 8-value mode when a0 > a1, else 6 values plus 0 and 255
+		static void DecodeChannelPalette(int a0, int a1, float * pPaletteOut)
+		{
+			pPaletteOut[0] = float(a0);
+			pPaletteOut[1] = float(a1);
+			if (a0 > a1)
+			{
+				for (int i = 1; i < 7; ++i)
+					pPaletteOut[i + 1] = float((7 - i) * a0 + i * a1) / 7.0f;
+			}
+			else
+			{
+				for (int i = 1; i < 5; ++i)
+					pPaletteOut[i + 1] = float((5 - i) * a0 + i * a1) / 5.0f;
+				pPaletteOut[6] = 0.0f;
+				pPaletteOut[7] = 255.0f;
+			}
+		}
+
+		static float ChooseChannelIndices(const float * pValues, int a0, int a1, int * pIndicesOut)
+		{
+			float palette[8];
+			DecodeChannelPalette(a0, a1, palette);
+
+			float errTotal = 0.0f;
+			for (int i = 0; i < 16; ++i)
+			{
+				int iBest = 0;
+				float errBest = square(pValues[i] - palette[0]);
+				for (int j = 1; j < 8; ++j)
+				{
+					float err = square(pValues[i] - palette[j]);
+					if (err < errBest)
+					{
+						errBest = err;
+						iBest = j;
+					}
+				}
+				pIndicesOut[i] = iBest;
+				errTotal += errBest;
+			}
+			return errTotal;
+		}
+
+		static void EncodeChannelBlock(const float * pValues, BCQ bcq, byte * pOut)
+		{
+			float valueMin = 255.0f, valueMax = 0.0f;
+			float innerMin = 255.0f, innerMax = 0.0f;		// Excluding exact 0 and 255
+			for (int i = 0; i < 16; ++i)
+			{
+				valueMin = min(valueMin, pValues[i]);
+				valueMax = max(valueMax, pValues[i]);
+				if (pValues[i] > 0.0f && pValues[i] < 255.0f)
+				{
+					innerMin = min(innerMin, pValues[i]);
+					innerMax = max(innerMax, pValues[i]);
+				}
+			}
+
+			// Candidate endpoint pairs, as (a0, a1)
+			int2 candidates[32];
+			int cCandidate = 0;
+			int aMax = round(valueMax), aMin = round(valueMin);
+			candidates[cCandidate++] = makeint2(aMax, aMin);
+			if (bcq != BCQ_Fast)
+			{
+				if (innerMin <= innerMax)
+					candidates[cCandidate++] = makeint2(round(innerMin), round(innerMax));
+				else
+					candidates[cCandidate++] = makeint2(aMin, aMin);
+			}
+			if (bcq == BCQ_High)
+			{
+				// Nudge the 8-value endpoints inward, since the extremes are often better
+				// served by the interpolated values
+				for (int d0 = 0; d0 <= 4; d0 += 2)
+				{
+					for (int d1 = 0; d1 <= 4; d1 += 2)
+					{
+						if ((d0 || d1) && aMax - d0 > aMin + d1)
+							candidates[cCandidate++] = makeint2(aMax - d0, aMin + d1);
+					}
+				}
+			}
+			ASSERT_ERR(cCandidate <= int(dim(candidates)));
+
+			int2 best = candidates[0];
+			int indicesBest[16];
+			float errBest = FLT_MAX;
+			for (int iCandidate = 0; iCandidate < cCandidate; ++iCandidate)
+			{
+				int2 a = candidates[iCandidate];
+				int indices[16];
+				float err = ChooseChannelIndices(pValues, a.x, a.y, indices);
+				if (err < errBest)
+				{
+					errBest = err;
+					best = a;
+					memcpy(indicesBest, indices, sizeof(indices));
+				}
+			}
+
+			u64 bits = u64(best.x) | (u64(best.y) << 8);
+			for (int i = 0; i < 16; ++i)
+				bits |= u64(indicesBest[i]) << (16 + i * 3);
+			memcpy(pOut, &bits, sizeof(u64));
+		}
+
+		static void DecodeChannelBlock(const byte * pIn, int channel, byte4 * pTexelsOut)
+		{
+			u64 bits;
+			memcpy(&bits, pIn, sizeof(u64));
+
+			float palette[8];
+			DecodeChannelPalette(int(bits & 0xff), int((bits >> 8) & 0xff), palette);
+			for (int i = 0; i < 16; ++i)
+				pTexelsOut[i][channel] = byte(round(palette[(bits >> (16 + i * 3)) & 7]));
+		}
+
+
+
+		// BC7, mode 6 only
+
+		struct BitWriter
+		{
+			byte *	m_pOut;
+			int		m_iBit;
+
+			void Write(uint value, int bits)
+			{
+				for (int i = 0; i < bits; ++i, ++m_iBit)
+				{
+					if (value & (1U << i))
+						m_pOut[m_iBit >> 3] |= byte(1 << (m_iBit & 7));
+				}
+			}
+		};
+
+		struct BitReader
+		{
+			const byte *	m_pIn;
+			int				m_iBit;
+
+			uint Read(int bits)
+			{
+				uint value = 0;
+				for (int i = 0; i < bits; ++i, ++m_iBit)
+					value |= uint((m_pIn[m_iBit >> 3] >> (m_iBit & 7)) & 1) << i;
+				return value;
+			}
+		};
+
+		// Quantize an endpoint to 7 bits per channel plus a shared p-bit
+		static int4 QuantizeBC7Endpoint(float4_arg e, int pBit)
+		{
+			int4 q;
+			for (int c = 0; c < 4; ++c)
+				q[c] = clamp(round((e[c] - float(pBit)) * 0.5f), 0, 127);
+			return q;
+		}
+
+		static float4 UnquantizeBC7Endpoint(int4_arg q, int pBit)
+		{
+			return makefloat4(float(q.x * 2 + pBit), float(q.y * 2 + pBit), float(q.z * 2 + pBit), float(q.w * 2 + pBit));
+		}
+
+		static void DecodeBC7Palette(float4_arg e0, float4_arg e1, float4 * pPaletteOut)
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				int w = s_bc7Weights4[i];
+				for (int c = 0; c < 4; ++c)
+					pPaletteOut[i][c] = float(((64 - w) * int(e0[c]) + w * int(e1[c]) + 32) >> 6);
+			}
+		}
+
+		static float ChooseBC7Indices(const float4 * pTexels, float4_arg e0, float4_arg e1, int * pIndicesOut)
+		{
+			float4 palette[16];
+			DecodeBC7Palette(e0, e1, palette);
+
+			float errTotal = 0.0f;
+			for (int i = 0; i < 16; ++i)
+			{
+				int iBest = 0;
+				float errBest = lengthSquared(pTexels[i] - palette[0]);
+				for (int j = 1; j < 16; ++j)
+				{
+					float err = lengthSquared(pTexels[i] - palette[j]);
+					if (err < errBest)
+					{
+						errBest = err;
+						iBest = j;
+					}
+				}
+				pIndicesOut[i] = iBest;
+				errTotal += errBest;
+			}
+			return errTotal;
+		}
+
+		static void EncodeBC7Block(const float4 * pTexels, BCQ bcq, byte * pOut)
+		{
+			float4 e0, e1;
+			FitEndpoints(pTexels, 16, bcq, 0.0f, &e0, &e1);
+
+			int4 q0Best = {}, q1Best = {};
+			int p0Best = 0, p1Best = 0;
+			int indicesBest[16] = {};
+			float errBest = FLT_MAX;
+			for (int pass = 0; pass <= s_refinePasses[bcq]; ++pass)
+			{
+				// Pick each endpoint's p-bit by its own quantization error, or at BCQ_High,
+				// try all four combinations against the whole block
+				int pBitCombos[4][2] = { { 0, 0 }, { 0, 1 }, { 1, 0 }, { 1, 1 }, };
+				int cCombo = 4;
+				if (bcq != BCQ_High)
+				{
+					for (int iEnd = 0; iEnd < 2; ++iEnd)
+					{
+						float4 e = (iEnd == 0) ? e0 : e1;
+						float err0 = lengthSquared(UnquantizeBC7Endpoint(QuantizeBC7Endpoint(e, 0), 0) - e);
+						float err1 = lengthSquared(UnquantizeBC7Endpoint(QuantizeBC7Endpoint(e, 1), 1) - e);
+						pBitCombos[0][iEnd] = (err1 < err0) ? 1 : 0;
+					}
+					cCombo = 1;
+				}
+
+				int indices[16];
+				for (int iCombo = 0; iCombo < cCombo; ++iCombo)
+				{
+					int p0 = pBitCombos[iCombo][0], p1 = pBitCombos[iCombo][1];
+					int4 q0 = QuantizeBC7Endpoint(e0, p0);
+					int4 q1 = QuantizeBC7Endpoint(e1, p1);
+					float err = ChooseBC7Indices(pTexels, UnquantizeBC7Endpoint(q0, p0), UnquantizeBC7Endpoint(q1, p1), indices);
+					if (err < errBest)
+					{
+						errBest = err;
+						q0Best = q0;
+						q1Best = q1;
+						p0Best = p0;
+						p1Best = p1;
+						memcpy(indicesBest, indices, sizeof(indices));
+					}
+				}
+
+				if (pass == s_refinePasses[bcq] || errBest == 0.0f)
+					break;
+
+				// Refit the endpoints to the best indices so far
+				float weights[16];
+				for (int i = 0; i < 16; ++i)
+					weights[i] = float(s_bc7Weights4[indicesBest[i]]) / 64.0f;
+				if (!RefineEndpoints(pTexels, weights, 16, &e0, &e1))
+					break;
+			}
+
+			// The anchor (first) index is stored with its top bit implied zero, so flip the
+			// endpoints if necessary to make it so
+			if (indicesBest[0] >= 8)
+			{
+				swap(q0Best, q1Best);
+				swap(p0Best, p1Best);
+				for (int i = 0; i < 16; ++i)
+					indicesBest[i] = 15 - indicesBest[i];
+			}
+
+			memset(pOut, 0, 16);
+			BitWriter writer = { pOut, 0 };
+			writer.Write(1 << 6, 7);						// Mode 6
+			for (int c = 0; c < 4; ++c)
+			{
+				writer.Write(q0Best[c], 7);
+				writer.Write(q1Best[c], 7);
+			}
+			writer.Write(p0Best, 1);
+			writer.Write(p1Best, 1);
+			writer.Write(indicesBest[0], 3);
+			for (int i = 1; i < 16; ++i)
+				writer.Write(indicesBest[i], 4);
+			ASSERT_ERR(writer.m_iBit == 128);
+		}
+
+		static void DecodeBC7Block(const byte * pIn, byte4 * pTexelsOut)
+		{
+			BitReader reader = { pIn, 0 };
+			if (reader.Read(7) != (1 << 6))
+			{
+				// Not mode 6; mark it magenta
+				for (int i = 0; i < 16; ++i)
+					pTexelsOut[i] = makebyte4(byte(255), byte(0), byte(255), byte(255));
+				return;
+			}
+
+			int4 q0, q1;
+			for (int c = 0; c < 4; ++c)
+			{
+				q0[c] = int(reader.Read(7));
+				q1[c] = int(reader.Read(7));
+			}
+			int p0 = int(reader.Read(1));
+			int p1 = int(reader.Read(1));
+
+			float4 palette[16];
+			DecodeBC7Palette(UnquantizeBC7Endpoint(q0, p0), UnquantizeBC7Endpoint(q1, p1), palette);
+			for (int i = 0; i < 16; ++i)
+			{
+				float4 color = palette[reader.Read(i == 0 ? 3 : 4)];
+				pTexelsOut[i] = makebyte4(byte(color.x), byte(color.y), byte(color.z), byte(color.w));
+			}
+		}
+	}
+
+
+
+	namespace AssetCompiler
+	{
+		void EncodeBCnImage(
+			const byte4 * pPixels,
+			int2_arg dims,
+			DXGI_FORMAT format,
+			BCQ bcq,
+			std::vector<byte> * pDataOut)
+		{
+			ASSERT_ERR(pPixels);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(bcq >= 0 && bcq < BCQ_Count);
+			ASSERT_ERR(pDataOut);
+
+			using namespace BCnEncoder;
+
+			int blockBytes = BitsPerPixel(format) * 2;
+			int2 dimsBlocks = makeint2((dims.x + 3) / 4, (dims.y + 3) / 4);
+			pDataOut->assign(CalculateImageSizeInBytes(dims, format), 0);
+
+			// Block rows are independent, so encode bands of them in parallel
+			parallelFor(dimsBlocks.y, s_parallelBlockRows, [&](int yBlockStart, int yBlockEnd)
+			{
+				for (int yBlock = yBlockStart; yBlock < yBlockEnd; ++yBlock)
+				{
+					for (int xBlock = 0; xBlock < dimsBlocks.x; ++xBlock)
+					{
+						float4 texels[16];
+						LoadBlock(pPixels, dims, xBlock, yBlock, texels);
+						byte * pOut = &(*pDataOut)[(yBlock * dimsBlocks.x + xBlock) * blockBytes];
+
+						float values[16];
+						switch (format)
+						{
+						case DXGI_FORMAT_BC1_UNORM:
+						case DXGI_FORMAT_BC1_UNORM_SRGB:
+							EncodeColorBlock(texels, true, bcq, pOut);
+							break;
+
+						case DXGI_FORMAT_BC3_UNORM:
+						case DXGI_FORMAT_BC3_UNORM_SRGB:
+							for (int i = 0; i < 16; ++i)
+								values[i] = texels[i].w;
+							EncodeChannelBlock(values, bcq, pOut);
+							EncodeColorBlock(texels, false, bcq, pOut + 8);
+							break;
+
+						case DXGI_FORMAT_BC4_UNORM:
+							for (int i = 0; i < 16; ++i)
+								values[i] = texels[i].x;
+							EncodeChannelBlock(values, bcq, pOut);
+							break;
+
+						case DXGI_FORMAT_BC5_UNORM:
+							for (int i = 0; i < 16; ++i)
+								values[i] = texels[i].x;
+							EncodeChannelBlock(values, bcq, pOut);
+							for (int i = 0; i < 16; ++i)
+								values[i] = texels[i].y;
+							EncodeChannelBlock(values, bcq, pOut + 8);
+							break;
+
+						case DXGI_FORMAT_BC7_UNORM:
+						case DXGI_FORMAT_BC7_UNORM_SRGB:
+							EncodeBC7Block(texels, bcq, pOut);
+							break;
+
+						default:
+							ERR("Unsupported format for BCn encoding: %s", NameOfFormat(format));
+							return;
+						}
+					}
+				}
+			});
+		}
+
+		void DecodeBCnImage(
+			const byte * pData,
+			int2_arg dims,
+			DXGI_FORMAT format,
+			std::vector<byte4> * pPixelsOut)
+		{
+			ASSERT_ERR(pData);
+			ASSERT_ERR(all(dims > 0));
+			ASSERT_ERR(pPixelsOut);
+
+			using namespace BCnEncoder;
+
+			int blockBytes = BitsPerPixel(format) * 2;
+			int2 dimsBlocks = makeint2((dims.x + 3) / 4, (dims.y + 3) / 4);
+			pPixelsOut->resize(dims.x * dims.y);
+
+			for (int yBlock = 0; yBlock < dimsBlocks.y; ++yBlock)
+			{
+				for (int xBlock = 0; xBlock < dimsBlocks.x; ++xBlock)
+				{
+					const byte * pIn = &pData[(yBlock * dimsBlocks.x + xBlock) * blockBytes];
+					byte4 texels[16];
+					for (int i = 0; i < 16; ++i)
+						texels[i] = makebyte4(byte(0), byte(0), byte(0), byte(255));
+
+					switch (format)
+					{
+					case DXGI_FORMAT_BC1_UNORM:
+					case DXGI_FORMAT_BC1_UNORM_SRGB:
+						DecodeColorBlock(pIn, true, texels);
+						break;
+
+					case DXGI_FORMAT_BC3_UNORM:
+					case DXGI_FORMAT_BC3_UNORM_SRGB:
+						DecodeColorBlock(pIn + 8, false, texels);
+						DecodeChannelBlock(pIn, 3, texels);
+						break;
+
+					case DXGI_FORMAT_BC4_UNORM:
+						DecodeChannelBlock(pIn, 0, texels);
+						break;
+
+					case DXGI_FORMAT_BC5_UNORM:
+						DecodeChannelBlock(pIn, 0, texels);
+						DecodeChannelBlock(pIn + 8, 1, texels);
+						break;
+
+					case DXGI_FORMAT_BC7_UNORM:
+					case DXGI_FORMAT_BC7_UNORM_SRGB:
+						DecodeBC7Block(pIn, texels);
+						break;
+
+					default:
+						ERR("Unsupported format for BCn decoding: %s", NameOfFormat(format));
+						return;
+					}
+
+					StoreBlock(texels, dims, xBlock, yBlock, &(*pPixelsOut)[0]);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,325 @@
+#include "framework.h"
+#include "asset-internal.h"
+
+namespace Framework
+{
+	// Mip chain builder for the texture compiler.
+	//  * Each level is filtered from the one above it, not from the base level, so a whole
+	//      chain costs about 4/3 of one pass over the base.  The chain is carried between
+	//      levels in float, so the 8-bit output of one level isn't requantized into the next.
+	//  * Filtering is separable and done in linear space: sRGB textures are decoded with
+	//      toLinearSpan, filtered with alpha weighting (premultiplied, like stb_image_resize
+	//      does), then unpremultiplied and re-encoded with toSRGBSpan.
+	//  * Filter weights are built per output texel, so odd (NPOT) dimensions just get
+	//      3-tap (box) or wider, asymmetric (Kaiser) footprints; nothing assumes a factor of 2.
+	//  * Texels are float4s, processed one __m128 at a time; SSE2 only, as it's the x64
+	//      baseline and the filters are bound by loads rather than math.
+	//  * Edges are clamped, like stb_image_resize's default.
+	//  * Both passes are split into fixed bands of rows that run in parallel; the bands don't
+	//      depend on the thread count, and each writes only its own rows, so output is deterministic.
+
+	namespace MipBuilder
+	{
+		// Kaiser-windowed sinc, in destination texels: half-width 3 and alpha 4 are the usual
+		// choices for mipmapping (as in NVTT), trading a little ringing for sharpness.
+		static const float s_kaiserWidth = 3.0f;
+		static const float s_kaiserAlpha = 4.0f;
+
+		// Weights below this are dropped from a footprint
+		static const float s_weightEpsilon = 1e-5f;
+
+		// Rows per parallelFor job
+		static const int s_parallelBlockRows = 32;
+
+		// Texels unpremultiplied at a time before encoding, in a buffer on the stack
+		static const int s_encodeChunk = 64;
+
+		// Filter footprints along one axis: for each destination texel, m_tapsMax source
+		// indices (already clamped to the image) and weights summing to 1.  Short footprints
+		// are padded with zero weights.
+		struct AxisWeights
+		{
+			int					m_tapsMax;
+			std::vector<int>	m_indices;
+			std::vector<float>	m_weights;
+		};
+
+		static float BesselI0(float x)
+		{
+			// Power series; converges quickly for the small arguments used here
+			float sum = 1.0f, term = 1.0f;
+			float halfX = 0.5f * x;
+			for (int k = 1; k < 20; ++k)
+			{
+				term *= square(halfX / float(k));
+				sum += term;
+				if (term < sum * 1e-7f)
+					break;
+			}
+			return sum;
+		}
+
+		static float KaiserSinc(float x)
+		{
+			float t = x / s_kaiserWidth;
+			if (t * t >= 1.0f)
+				return 0.0f;
+			float sinc = (abs(x) < 1e-6f) ? 1.0f : sinf(pi * x) / (pi * x);
+			return sinc * BesselI0(s_kaiserAlpha * sqrtf(1.0f - t * t)) / BesselI0(s_kaiserAlpha);
+		}
+
+		static void BuildAxisWeights(int sizeSrc, int sizeDst, MIPF mipf, AxisWeights * pWeightsOut)
+		{
+			ASSERT_ERR(sizeSrc > 0 && sizeDst > 0 && sizeDst <= sizeSrc);
+			ASSERT_ERR(pWeightsOut);
+
+			// An axis that isn't shrinking (the 1-texel side of a long, thin mip) is copied through
+			if (sizeDst == sizeSrc)
+			{
+				pWeightsOut->m_tapsMax = 1;
+				pWeightsOut->m_indices.resize(sizeDst);
+				pWeightsOut->m_weights.assign(sizeDst, 1.0f);
+				for (int i = 0; i < sizeDst; ++i)
+					pWeightsOut->m_indices[i] = i;
+				return;
+			}
+
+			// Source texels per destination texel, and the footprint radius in source texels
+			float scale = float(sizeSrc) / float(sizeDst);
+			float radius = (mipf == MIPF_Kaiser) ? s_kaiserWidth * scale : 0.5f * scale;
+			int tapsAlloc = int(ceilf(2.0f * radius)) + 2;
+
+			// Evaluate every footprint, then trim the zero-weight taps from both ends
+			std::vector<int> firsts(sizeDst), counts(sizeDst);
+			std::vector<float> weights(sizeDst * tapsAlloc);
+			int tapsMax = 1;
+			for (int iDst = 0; iDst < sizeDst; ++iDst)
+			{
+				float center = (float(iDst) + 0.5f) * scale;
+				int iFirst = int(floorf(center - radius));
+				float * pWeights = &weights[iDst * tapsAlloc];
+
+				float weightSum = 0.0f;
+				for (int tap = 0; tap < tapsAlloc; ++tap)
+				{
+					float iSrc = float(iFirst + tap);
+					float weight;
+					if (mipf == MIPF_Kaiser)
+						weight = KaiserSinc((iSrc + 0.5f - center) / scale);
+					else
+						weight = max(0.0f, min(iSrc + 1.0f, center + radius) - max(iSrc, center - radius));
+					pWeights[tap] = weight;
+					weightSum += weight;
+				}
+
+				int tapStart = 0, tapEnd = tapsAlloc;
+				for (int tap = 0; tap < tapsAlloc; ++tap)
+					pWeights[tap] /= weightSum;
+				while (tapStart < tapEnd - 1 && abs(pWeights[tapStart]) < s_weightEpsilon)
+					++tapStart;
+				while (tapEnd > tapStart + 1 && abs(pWeights[tapEnd - 1]) < s_weightEpsilon)
+					--tapEnd;
+
+				// Shift the kept taps to the front of the footprint
+				for (int tap = tapStart; tap < tapEnd; ++tap)
+					pWeights[tap - tapStart] = pWeights[tap];
+				firsts[iDst] = iFirst + tapStart;
+				counts[iDst] = tapEnd - tapStart;
+				tapsMax = max(tapsMax, counts[iDst]);
+			}
+
+			pWeightsOut->m_tapsMax = tapsMax;
+			pWeightsOut->m_indices.resize(sizeDst * tapsMax);
+			pWeightsOut->m_weights.resize(sizeDst * tapsMax);
+			for (int iDst = 0; iDst < sizeDst; ++iDst)
+			{
+				for (int tap = 0; tap < tapsMax; ++tap)
+				{
+					int iOut = iDst * tapsMax + tap;
+					bool used = (tap < counts[iDst]);
+					pWeightsOut->m_indices[iOut] = clamp(firsts[iDst] + tap, 0, sizeSrc - 1);
+					pWeightsOut->m_weights[iOut] = used ? weights[iDst * tapsAlloc + tap] : 0.0f;
+				}
+			}
+		}
+
+		// Decode one row of the base level to linear float, premultiplying for sRGB
+		static void DecodeRow(const byte4 * pPixels, int count, bool sRGB, float4 * pTexelsOut)
+		{
+			if (sRGB)
+			{
+				toLinearSpan(pPixels, count, pTexelsOut);
+				for (int i = 0; i < count; ++i)
+					pTexelsOut[i].xyz *= pTexelsOut[i].w;
+			}
+			else
+			{
+				for (int i = 0; i < count; ++i)
+					pTexelsOut[i] = makefloat4(pPixels[i]) * (1.0f / 255.0f);
+			}
+		}
+
+		// Apply a set of footprints to a row of texels
+		static void FilterRow(
+			const float4 * pTexelsSrc,
+			const AxisWeights & weights,
+			int countDst,
+			float4 * pTexelsDst)
+		{
+			int tapsMax = weights.m_tapsMax;
+			const int * pIndices = &weights.m_indices[0];
+			const float * pWeights = &weights.m_weights[0];
+			for (int iDst = 0; iDst < countDst; ++iDst)
+			{
+				__m128 accum = _mm_setzero_ps();
+				for (int tap = 0; tap < tapsMax; ++tap)
+				{
+					__m128 texel = _mm_loadu_ps(&pTexelsSrc[pIndices[tap]].x);
+					accum = _mm_add_ps(accum, _mm_mul_ps(texel, _mm_set1_ps(pWeights[tap])));
+				}
+				_mm_storeu_ps(&pTexelsDst[iDst].x, accum);
+				pIndices += tapsMax;
+				pWeights += tapsMax;
+			}
+		}
+
+		// Combine whole rows for one destination row of the vertical pass
+		static void FilterColumns(
+			const float4 * pRowsSrc,
+			int width,
+			const int * pIndices,
+			const float * pWeights,
+			int taps,
+			float4 * pRowDst)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				__m128 accum = _mm_setzero_ps();
+				for (int tap = 0; tap < taps; ++tap)
+				{
+					__m128 texel = _mm_loadu_ps(&pRowsSrc[pIndices[tap] * width + x].x);
+					accum = _mm_add_ps(accum, _mm_mul_ps(texel, _mm_set1_ps(pWeights[tap])));
+				}
+				_mm_storeu_ps(&pRowDst[x].x, accum);
+			}
+		}
+
+		// Convert a level back to 8 bits, unpremultiplying and re-encoding for sRGB
+		static void EncodeLevel(const float4 * pTexels, int count, bool sRGB, byte4 * pPixelsOut)
+		{
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 maskAlpha = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+
+			if (sRGB)
+			{
+				rgba chunk[s_encodeChunk];
+				for (int iStart = 0; iStart < count; iStart += s_encodeChunk)
+				{
+					int chunkCount = min(s_encodeChunk, count - iStart);
+					for (int i = 0; i < chunkCount; ++i)
+					{
+						__m128 texel = _mm_loadu_ps(&pTexels[iStart + i].x);
+						texel = _mm_min_ps(_mm_max_ps(texel, zero), one);
+
+						// Unpremultiply, leaving fully transparent texels black
+						__m128 alpha = _mm_shuffle_ps(texel, texel, _MM_SHUFFLE(3, 3, 3, 3));
+						__m128 rcpAlpha = _mm_and_ps(_mm_div_ps(one, alpha), _mm_cmpgt_ps(alpha, zero));
+						__m128 color = _mm_mul_ps(texel, rcpAlpha);
+						color = _mm_or_ps(_mm_andnot_ps(maskAlpha, color), _mm_and_ps(maskAlpha, texel));
+						_mm_storeu_ps(&chunk[i].x, color);
+					}
+					toSRGBSpan(chunk, chunkCount, &pPixelsOut[iStart]);
+				}
+				return;
+			}
+
+			for (int i = 0; i < count; ++i)
+			{
+				__m128 texel = _mm_loadu_ps(&pTexels[i].x);
+				texel = _mm_min_ps(_mm_max_ps(texel, zero), one);
+				__m128i iTexel = _mm_cvtps_epi32(_mm_mul_ps(texel, _mm_set1_ps(255.0f)));
+				iTexel = _mm_packs_epi32(iTexel, iTexel);
+				iTexel = _mm_packus_epi16(iTexel, iTexel);
+				u32 packed = u32(_mm_cvtsi128_si32(iTexel));
+				memcpy(&pPixelsOut[i], &packed, sizeof(packed));
+			}
+		}
+	}
+
+	namespace AssetCompiler
+	{
+		void GenerateMips(
+			const byte4 * pPixelsBase,
+			int2_arg dimsBase,
+			int mipLevels,
+			bool sRGB,
+			MIPF mipf,
+			std::vector<std::vector<byte4>> * pMipsOut)
+		{
+			ASSERT_ERR(pPixelsBase);
+			ASSERT_ERR(all(dimsBase > 0));
+			ASSERT_ERR(mipLevels >= 1);
+			ASSERT_ERR(mipf == MIPF_Box || mipf == MIPF_Kaiser);
+			ASSERT_ERR(pMipsOut);
+
+			using namespace MipBuilder;
+
+			pMipsOut->resize(mipLevels - 1);
+
+			std::vector<float4> texelsSrc, texelsDst, rowsFiltered;
+			AxisWeights weightsX, weightsY;
+			int2 dimsSrc = dimsBase;
+			for (int level = 1; level < mipLevels; ++level)
+			{
+				int2 dimsDst = CalculateMipDims(dimsBase, level);
+				BuildAxisWeights(dimsSrc.x, dimsDst.x, mipf, &weightsX);
+				BuildAxisWeights(dimsSrc.y, dimsDst.y, mipf, &weightsY);
+
+				// Horizontal pass over every source row, decoding the base level as we go.
+				// Each row is independent, so bands of them are done in parallel.
+				rowsFiltered.resize(dimsSrc.y * dimsDst.x);
+				parallelFor(dimsSrc.y, s_parallelBlockRows, [&](int yStart, int yEnd)
+				{
+					std::vector<float4> rowDecoded((level == 1) ? dimsSrc.x : 0);
+					for (int y = yStart; y < yEnd; ++y)
+					{
+						const float4 * pRowSrc;
+						if (level == 1)
+						{
+							DecodeRow(&pPixelsBase[y * dimsSrc.x], dimsSrc.x, sRGB, &rowDecoded[0]);
+							pRowSrc = &rowDecoded[0];
+						}
+						else
+						{
+							pRowSrc = &texelsSrc[y * dimsSrc.x];
+						}
+						FilterRow(pRowSrc, weightsX, dimsDst.x, &rowsFiltered[y * dimsDst.x]);
+					}
+				});
+
+				// Vertical pass, and conversion back to 8 bits, in bands of destination rows
+				std::vector<byte4> & pixelsOut = (*pMipsOut)[level - 1];
+				texelsDst.resize(dimsDst.x * dimsDst.y);
+				pixelsOut.resize(dimsDst.x * dimsDst.y);
+				parallelFor(dimsDst.y, s_parallelBlockRows, [&](int yStart, int yEnd)
+				{
+					for (int y = yStart; y < yEnd; ++y)
+					{
+						int iWeights = y * weightsY.m_tapsMax;
+						FilterColumns(
+							&rowsFiltered[0], dimsDst.x,
+							&weightsY.m_indices[iWeights], &weightsY.m_weights[iWeights], weightsY.m_tapsMax,
+							&texelsDst[y * dimsDst.x]);
+					}
+					EncodeLevel(
+						&texelsDst[yStart * dimsDst.x], (yEnd - yStart) * dimsDst.x, sRGB,
+						&pixelsOut[yStart * dimsDst.x]);
+				});
+
+				texelsSrc.swap(texelsDst);
+				dimsSrc = dimsDst;
+			}
+		}
+	}
+}
@@ -13,13 +13,21 @@
 namespace Framework
 {
 	// Infrastructure for compiling textures.
-	//  * All textures are currently in RGBA8 sRGB format, top-down.
-	//  * Textures are either stored raw, or with mips.  Textures with mips are also
-	//      resampled up to the next pow2 size if necessary.
+	//  * Textures are stored top-down, in RGBA8 (sRGB for color, linear for normal maps), or
+	//      block-compressed by the BCn ACKs at the quality set in the AssetCompileInfo.
+	//  * Textures are either stored raw, or with mips.  Uncompressed textures with mips are
+	//      also resampled up to the next pow2 size if necessary; block-compressed ones keep
+	//      their native size, but are stretched up to whole blocks in the top level if needed.
+	//  * The quality tier and max dim in the AssetCompileInfo drop top mips at compile time.
+	//      The trimmed chain is stored as if it were the whole texture, so loading is unchanged;
+	//      the number dropped is recorded in the metadata.
+	//  * The compile settings that apply to a texture's ACK are recorded in its metadata, and
+	//      asking for different ones triggers a recompile.
+	//  * Mips are generated with the filter set in the AssetCompileInfo; see
+	//      asset-texture-mips.cpp for the box and Kaiser filters.
 	//  * Enable the WRITE_BMP define to additionally write out all images as .bmps
 	//      in the archive, for debugging.
 	//  * !!!UNDONE: Premultiplied alpha
-	//  * !!!UNDONE: BCn compression
 	//  * !!!UNDONE: Other pixel formats: HDR textures, normal maps, etc.
 	//  * !!!UNDONE: Cubemaps, volume textures, sparse tiled textures, etc.
 
@@ -34,9 +42,61 @@ namespace Framework
 			int2			m_dims;
 			int				m_mipLevels;
 			DXGI_FORMAT		m_format;
+
+			// Settings the texture was compiled with, and the top mips they dropped
+			BCQ				m_bcq;
+			MIPF			m_mipf;
+			TEXTIER			m_textier;
+			int				m_maxDim;
+			int				m_mipsDropped;
+		};
+
+		enum TEXCAT				// TEXture CATegory, for the quality tiers
+		{
+			TEXCAT_Color,
+			TEXCAT_NormalMap,
+			TEXCAT_Mask,
+
+			TEXCAT_Count
 		};
 
+		// Top mips dropped from each category of texture, for each tier
+		static const int s_tierMipsDropped[][TEXCAT_Count] =
+		{
+			{ 0, 0, 0, },		// TEXTIER_Full
+			{ 1, 1, 0, },		// TEXTIER_Medium
+			{ 2, 2, 1, },		// TEXTIER_Low
+		};
+		cassert(dim(s_tierMipsDropped) == TEXTIER_Count);
+
 		// Prototype various helper functions
+		static bool CompileMippedTexture(
+			const AssetCompileInfo * pACI,
+			bool sRGB,
+			DXGI_FORMAT format,
+			mz_zip_archive * pZipOut);
+
+		static int CalculateMipsDropped(
+			const AssetCompileInfo * pACI,
+			int2_arg dims,
+			int minTopDim);
+
+		static void ResampleMips(
+			const byte4 * pPixelsSrc,
+			int2_arg dimsSrc,
+			int2_arg dimsBase,
+			int mipLevels,
+			bool sRGB,
+			std::vector<std::vector<byte4>> * pMipsOut);
+
+		static bool WriteMipToZip(
+			const AssetCompileInfo * pACI,
+			int mipLevel,
+			const byte4 * pPixels,
+			int2_arg dims,
+			DXGI_FORMAT format,
+			mz_zip_archive * pZipOut);
+
 		static bool WriteImageToZip(
 			const char * assetPath,
 			int mipLevel,
@@ -86,6 +146,11 @@ namespace Framework
 			dims,
 			1,		// mipLevels
 			DXGI_FORMAT_R8G8B8A8_UNORM_SRGB,
+			pACI->m_bcq,
+			pACI->m_mipf,
+			pACI->m_textier,
+			pACI->m_maxDim,
+			0,		// mipsDropped
 		};
 
 		// Write the data out to the archive
@@ -109,171 +174,256 @@ namespace Framework
 		ASSERT_ERR(pACI->m_ack == ACK_TextureWithMips);
 		ASSERT_ERR(pZipOut);
 
-		using namespace AssetCompiler;
+		return TextureCompiler::CompileMippedTexture(pACI, true, DXGI_FORMAT_R8G8B8A8_UNORM_SRGB, pZipOut);
+	}
+
+	bool CompileNormalMapWithMipsAsset(
+		const AssetCompileInfo * pACI,
+		mz_zip_archive * pZipOut)
+	{
+		ASSERT_ERR(pACI);
+		ASSERT_ERR(pACI->m_pathSrc);
+		ASSERT_ERR(pACI->m_ack == ACK_NormalMapWithMips);
+		ASSERT_ERR(pZipOut);
+
+		return TextureCompiler::CompileMippedTexture(pACI, false, DXGI_FORMAT_R8G8B8A8_UNORM, pZipOut);
+	}
+
+	bool CompileTextureBCnAsset(
+		const AssetCompileInfo * pACI,
+		mz_zip_archive * pZipOut)
+	{
+		ASSERT_ERR(pACI);
+		ASSERT_ERR(pACI->m_pathSrc);
+		ASSERT_ERR(pZipOut);
+
 		using namespace TextureCompiler;
 
-		// Load the image
-		int2 dims;
-		int numComponents;
-		byte4 * pPixels = (byte4 *)stbi_load(pACI->m_pathSrc, &dims.x, &dims.y, &numComponents, 4);
-		if (!pPixels)
+		switch (pACI->m_ack)
 		{
-			WARN("Couldn't load file %s: %s", pACI->m_pathSrc, stbi_failure_reason());
+		case ACK_TextureBC1:		return CompileMippedTexture(pACI, true, DXGI_FORMAT_BC1_UNORM_SRGB, pZipOut);
+		case ACK_TextureBC3:		return CompileMippedTexture(pACI, true, DXGI_FORMAT_BC3_UNORM_SRGB, pZipOut);
+		case ACK_TextureBC7:		return CompileMippedTexture(pACI, true, DXGI_FORMAT_BC7_UNORM_SRGB, pZipOut);
+		case ACK_MaskBC4:			return CompileMippedTexture(pACI, false, DXGI_FORMAT_BC4_UNORM, pZipOut);
+		case ACK_NormalMapBC5:		return CompileMippedTexture(pACI, false, DXGI_FORMAT_BC5_UNORM, pZipOut);
+
+		default:
+			ERR("Unexpected ACK %d for BCn texture %s", pACI->m_ack, pACI->m_pathSrc);
 			return false;
 		}
+	}
 
-		// Resample the base mip up to pow2 if necessary
-		int2 dimsBase;
-		std::vector<byte4> pixelsBase;
-		byte4 * pPixelsBase;
-		if (!ispow2(dims.x) || !ispow2(dims.y))
-		{
-			dimsBase = makeint2(pow2_ceil(dims.x), pow2_ceil(dims.y));
-			pixelsBase.resize(dimsBase.x * dimsBase.y);
-			pPixelsBase = &pixelsBase[0];
-
-			CHECK_ERR(stbir_resize_uint8_srgb(
-						(const byte *)pPixels, dims.x, dims.y, 0,
-						(byte *)pPixelsBase, dimsBase.x, dimsBase.y, 0,
-						4, 3, 0));
-		}
-		else
-		{
-			dimsBase = dims;
-			pPixelsBase = pPixels;
-		}
 
-		// Fill out the metadata struct
-		int mipLevels = log2_floor(maxComponent(dimsBase)) + 1;
-		Meta meta =
-		{
-			dimsBase,
-			mipLevels,
-			DXGI_FORMAT_R8G8B8A8_UNORM_SRGB,
-		};
 
-		// Store the metadata and the base level pixels
-		if (!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pZipOut) ||
-			!WriteImageToZip(pACI->m_pathSrc, 0, pPixelsBase, dimsBase, pZipOut))
+	namespace TextureCompiler
+	{
+		static void ResizeImage(
+			const byte4 * pPixelsSrc,
+			int2_arg dimsSrc,
+			byte4 * pPixelsDst,
+			int2_arg dimsDst,
+			bool sRGB)
 		{
-			stbi_image_free(pPixels);
-			return false;
+			if (sRGB)
+			{
+				CHECK_ERR(stbir_resize_uint8_srgb(
+							(const byte *)pPixelsSrc, dimsSrc.x, dimsSrc.y, 0,
+							(byte *)pPixelsDst, dimsDst.x, dimsDst.y, 0,
+							4, 3, 0));
+			}
+			else
+			{
+				CHECK_ERR(stbir_resize_uint8(
+							(const byte *)pPixelsSrc, dimsSrc.x, dimsSrc.y, 0,
+							(byte *)pPixelsDst, dimsDst.x, dimsDst.y, 0,
+							4));
+			}
 		}
 
-		// Generate mip levels
-		std::vector<byte4> pixelsMip;
-		for (int level = 1; level < mipLevels; ++level)
+		static bool CompileMippedTexture(
+			const AssetCompileInfo * pACI,
+			bool sRGB,
+			DXGI_FORMAT format,
+			mz_zip_archive * pZipOut)
 		{
-			int2 dimsMip = CalculateMipDims(dimsBase, level);
-			pixelsMip.resize(dimsMip.x * dimsMip.y);
-			byte4 * pPixelsMip = &pixelsMip[0];
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pACI->m_pathSrc);
+			ASSERT_ERR(pZipOut);
 
-			CHECK_ERR(stbir_resize_uint8_srgb(
-						(const byte *)pPixels, dims.x, dims.y, 0,
-						(byte *)pPixelsMip, dimsMip.x, dimsMip.y, 0,
-						4, 3, 0));
+			using namespace AssetCompiler;
 
-			if (!WriteImageToZip(pACI->m_pathSrc, level, pPixelsMip, dimsMip, pZipOut))
+			// Load the image
+			int2 dims;
+			int numComponents;
+			byte4 * pPixels = (byte4 *)stbi_load(pACI->m_pathSrc, &dims.x, &dims.y, &numComponents, 4);
+			if (!pPixels)
 			{
-				stbi_image_free(pPixels);
+				WARN("Couldn't load file %s: %s", pACI->m_pathSrc, stbi_failure_reason());
 				return false;
 			}
-		}
 
-		stbi_image_free(pPixels);
-		return true;
-	}
+			// Resample the base mip up to pow2 if necessary.  Block-compressed textures keep
+			// their native size, since the hardware doesn't need pow2 for them; but the top
+			// level that's stored, after dropping mips, has to be made of whole blocks, so the
+			// base is resampled (stretched) up to a multiple of the block size times 2^mipsDropped.
+			int2 dimsBase = dims;
+			int mipsDropped;
+			if (IsBlockCompressed(format))
+			{
+				mipsDropped = CalculateMipsDropped(pACI, dims, 4);
+				int align = 4 << mipsDropped;
+				dimsBase = makeint2(
+							(dims.x + align - 1) & ~(align - 1),
+							(dims.y + align - 1) & ~(align - 1));
+			}
+			else
+			{
+				if (!ispow2(dims.x) || !ispow2(dims.y))
+					dimsBase = makeint2(pow2_ceil(dims.x), pow2_ceil(dims.y));
+				mipsDropped = CalculateMipsDropped(pACI, dimsBase, 1);
+			}
 
+			std::vector<byte4> pixelsBase;
+			byte4 * pPixelsBase = pPixels;
+			if (any(dimsBase != dims))
+			{
+				pixelsBase.resize(dimsBase.x * dimsBase.y);
+				pPixelsBase = &pixelsBase[0];
+				ResizeImage(pPixels, dims, pPixelsBase, dimsBase, sRGB);
+			}
 
+			// Fill out the metadata struct, for the chain that's left after dropping mips
+			int mipLevels = log2_floor(maxComponent(dimsBase)) + 1;
+			ASSERT_ERR(mipsDropped < mipLevels);
+			Meta meta =
+			{
+				CalculateMipDims(dimsBase, mipsDropped),
+				mipLevels - mipsDropped,
+				format,
+				pACI->m_bcq,
+				pACI->m_mipf,
+				pACI->m_textier,
+				pACI->m_maxDim,
+				mipsDropped,
+			};
+
+			if (!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pZipOut))
+			{
+				stbi_image_free(pPixels);
+				return false;
+			}
 
-	bool CompileNormalMapWithMipsAsset(
-		const AssetCompileInfo * pACI,
-		mz_zip_archive * pZipOut)
-	{
-		ASSERT_ERR(pACI);
-		ASSERT_ERR(pACI->m_pathSrc);
-		ASSERT_ERR(pACI->m_ack == ACK_NormalMapWithMips);
-		ASSERT_ERR(pZipOut);
+			// Generate the mip levels
+			ASSERT_ERR(pACI->m_mipf >= 0 && pACI->m_mipf < MIPF_Count);
+			std::vector<std::vector<byte4>> mips;
+			if (pACI->m_mipf == MIPF_Resample)
+				ResampleMips(pPixels, dims, dimsBase, mipLevels, sRGB, &mips);
+			else
+				GenerateMips(pPixelsBase, dimsBase, mipLevels, sRGB, pACI->m_mipf, &mips);
 
-		using namespace AssetCompiler;
-		using namespace TextureCompiler;
+			// Store the levels that weren't dropped, renumbered from zero
+			for (int level = mipsDropped; level < mipLevels; ++level)
+			{
+				int2 dimsMip = CalculateMipDims(dimsBase, level);
+				const byte4 * pPixelsMip = (level > 0) ? &mips[level - 1][0] : pPixelsBase;
+				if (!WriteMipToZip(pACI, level - mipsDropped, pPixelsMip, dimsMip, format, pZipOut))
+				{
+					stbi_image_free(pPixels);
+					return false;
+				}
+			}
 
-		// Load the image
-		int2 dims;
-		int numComponents;
-		byte4 * pPixels = (byte4 *)stbi_load(pACI->m_pathSrc, &dims.x, &dims.y, &numComponents, 4);
-		if (!pPixels)
-		{
-			WARN("Couldn't load file %s: %s", pACI->m_pathSrc, stbi_failure_reason());
-			return false;
+			stbi_image_free(pPixels);
+			return true;
 		}
 
-		// Resample the base mip up to pow2 if necessary
-		int2 dimsBase;
-		std::vector<byte4> pixelsBase;
-		byte4 * pPixelsBase;
-		if (!ispow2(dims.x) || !ispow2(dims.y))
-		{
-			dimsBase = makeint2(pow2_ceil(dims.x), pow2_ceil(dims.y));
-			pixelsBase.resize(dimsBase.x * dimsBase.y);
-			pPixelsBase = &pixelsBase[0];
-
-			CHECK_ERR(stbir_resize_uint8(
-						(const byte *)pPixels, dims.x, dims.y, 0,
-						(byte *)pPixelsBase, dimsBase.x, dimsBase.y, 0,
-						4));
-		}
-		else
+		// Work out how many top mips to drop: the tier's count for the texture's category, or
+		// more to fit the max dim.  The smaller side of the top level that's left is kept at
+		// least minTopDim, even if that means exceeding the max dim.
+		static int CalculateMipsDropped(
+			const AssetCompileInfo * pACI,
+			int2_arg dims,
+			int minTopDim)
 		{
-			dimsBase = dims;
-			pPixelsBase = pPixels;
-		}
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pACI->m_textier >= 0 && pACI->m_textier < TEXTIER_Count);
+			ASSERT_ERR(pACI->m_maxDim >= 0);
 
-		// Fill out the metadata struct
-		int mipLevels = log2_floor(maxComponent(dimsBase)) + 1;
-		Meta meta =
-		{
-			dimsBase,
-			mipLevels,
-			DXGI_FORMAT_R8G8B8A8_UNORM,
-		};
+			TEXCAT texcat;
+			switch (pACI->m_ack)
+			{
+			case ACK_NormalMapWithMips:
+			case ACK_NormalMapBC5:		texcat = TEXCAT_NormalMap;	break;
+			case ACK_MaskBC4:			texcat = TEXCAT_Mask;		break;
+			default:					texcat = TEXCAT_Color;		break;
+			}
 
-		// Store the metadata and the base level pixels
-		if (!WriteAssetDataToZip(pACI->m_pathSrc, s_suffixMeta, &meta, sizeof(meta), pZipOut) ||
-			!WriteImageToZip(pACI->m_pathSrc, 0, pPixelsBase, dimsBase, pZipOut))
-		{
-			stbi_image_free(pPixels);
-			return false;
+			int mipsDropped = s_tierMipsDropped[pACI->m_textier][texcat];
+			if (pACI->m_maxDim > 0)
+			{
+				while ((maxComponent(dims) >> mipsDropped) > pACI->m_maxDim)
+					++mipsDropped;
+			}
+
+			int mipsDroppedMax = max(0, log2_floor(minComponent(dims)) - log2_floor(minTopDim));
+			return min(mipsDropped, mipsDroppedMax);
 		}
 
-		// Generate mip levels
-		std::vector<byte4> pixelsMip;
-		for (int level = 1; level < mipLevels; ++level)
+		// Generate mip levels the original way: resampling each one from the source image
+		static void ResampleMips(
+			const byte4 * pPixelsSrc,
+			int2_arg dimsSrc,
+			int2_arg dimsBase,
+			int mipLevels,
+			bool sRGB,
+			std::vector<std::vector<byte4>> * pMipsOut)
 		{
-			int2 dimsMip = CalculateMipDims(dimsBase, level);
-			pixelsMip.resize(dimsMip.x * dimsMip.y);
-			byte4 * pPixelsMip = &pixelsMip[0];
+			ASSERT_ERR(pPixelsSrc);
+			ASSERT_ERR(pMipsOut);
 
-			CHECK_ERR(stbir_resize_uint8(
-						(const byte *)pPixels, dims.x, dims.y, 0,
-						(byte *)pPixelsMip, dimsMip.x, dimsMip.y, 0,
-						4));
-
-			if (!WriteImageToZip(pACI->m_pathSrc, level, pPixelsMip, dimsMip, pZipOut))
+			pMipsOut->resize(mipLevels - 1);
+			for (int level = 1; level < mipLevels; ++level)
 			{
-				stbi_image_free(pPixels);
-				return false;
+				int2 dimsMip = CalculateMipDims(dimsBase, level);
+				std::vector<byte4> & pixelsMip = (*pMipsOut)[level - 1];
+				pixelsMip.resize(dimsMip.x * dimsMip.y);
+				ResizeImage(pPixelsSrc, dimsSrc, &pixelsMip[0], dimsMip, sRGB);
 			}
 		}
 
-		stbi_image_free(pPixels);
-		return true;
-	}
+		static bool WriteMipToZip(
+			const AssetCompileInfo * pACI,
+			int mipLevel,
+			const byte4 * pPixels,
+			int2_arg dims,
+			DXGI_FORMAT format,
+			mz_zip_archive * pZipOut)
+		{
+			ASSERT_ERR(pACI);
 
+			if (!IsBlockCompressed(format))
+				return WriteImageToZip(pACI->m_pathSrc, mipLevel, pPixels, dims, pZipOut);
 
+			using namespace AssetCompiler;
+
+			std::vector<byte> encoded;
+			EncodeBCnImage(pPixels, dims, format, pACI->m_bcq, &encoded);
+
+			// Compose the suffix
+			char suffix[16] = {};
+			sprintf_s(suffix, "/%d", mipLevel);
+
+#if WRITE_BMP
+			// Write a .bmp of the decoded image, too, if we're doing that
+			std::vector<byte4> decoded;
+			DecodeBCnImage(&encoded[0], dims, format, &decoded);
+			if (!WriteBMPToZip(pACI->m_pathSrc, mipLevel, &decoded[0], dims, pZipOut))
+				return false;
+#endif
+
+			return WriteAssetDataToZip(pACI->m_pathSrc, suffix, &encoded[0], encoded.size(), pZipOut);
+		}
 
-	namespace TextureCompiler
-	{
 		static bool WriteImageToZip(
 			const char * assetPath,
 			int mipLevel,
@@ -331,6 +481,44 @@ namespace Framework
 
 
 
+	namespace AssetCompiler
+	{
+		bool TextureMatchesCompileInfo(
+			mz_zip_archive * pZip,
+			const AssetCompileInfo * pACI)
+		{
+			ASSERT_ERR(pZip);
+			ASSERT_ERR(pACI);
+
+			using namespace TextureCompiler;
+
+			char zipPath[MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE + 1] = {};
+			if (_snprintf_s(zipPath, _TRUNCATE, "%s%s", pACI->m_pathSrc, s_suffixMeta) < 0)
+				return false;
+
+			Meta meta;
+			int fileIndex = mz_zip_reader_locate_file(pZip, zipPath, nullptr, 0);
+			if (fileIndex < 0 ||
+				!mz_zip_reader_extract_to_mem(pZip, fileIndex, &meta, sizeof(meta), 0))
+			{
+				return false;
+			}
+
+			// Only compare the settings this ACK uses; the rest are ignored by its compiler
+			if (pACI->m_ack == ACK_TextureRaw)
+				return true;
+			if (meta.m_mipf != pACI->m_mipf ||
+				meta.m_textier != pACI->m_textier ||
+				meta.m_maxDim != pACI->m_maxDim)
+			{
+				return false;
+			}
+			return !IsBlockCompressed(meta.m_format) || meta.m_bcq == pACI->m_bcq;
+		}
+	}
+
+
+
 	// Load compiled data into a runtime game object
 
 	bool LoadTexture2DFromAssetPack(
@@ -378,8 +566,7 @@ namespace Framework
 				WARN("Couldn't find mip level %d of texture %s in asset pack %s", i, path, pPack->m_path.c_str());
 				return false;
 			}
-			int2 mipDims = CalculateMipDims(pMeta->m_dims, i);
-			int expectedPixelsSize = mipDims.x * mipDims.y * BitsPerPixel(pMeta->m_format) / 8;
+			int expectedPixelsSize = CalculateMipSizeInBytes(pMeta->m_dims, i, pMeta->m_format);
 			if (pixelsSize != expectedPixelsSize)
 			{
 				WARN("Mip level %d of texture %s in asset pack %s is wrong size, %d bytes (expected %d)",
@@ -417,7 +604,12 @@ namespace Framework
 			const AssetCompileInfo * pACI = &assets[i];
 			if (pACI->m_ack != ACK_TextureRaw &&
 				pACI->m_ack != ACK_TextureWithMips &&
-				pACI->m_ack != ACK_NormalMapWithMips)
+				pACI->m_ack != ACK_NormalMapWithMips &&
+				pACI->m_ack != ACK_TextureBC1 &&
+				pACI->m_ack != ACK_TextureBC3 &&
+				pACI->m_ack != ACK_TextureBC7 &&
+				pACI->m_ack != ACK_MaskBC4 &&
+				pACI->m_ack != ACK_NormalMapBC5)
 			{
 				continue;
 			}
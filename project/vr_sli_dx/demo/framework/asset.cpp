@@ -75,6 +75,9 @@ namespace Framework
 	bool CompileNormalMapWithMipsAsset(
 		const AssetCompileInfo * pACI,
 		mz_zip_archive * pZipOut);
+	bool CompileTextureBCnAsset(
+		const AssetCompileInfo * pACI,
+		mz_zip_archive * pZipOut);
 
 	typedef bool (*AssetCompileFunc)(const AssetCompileInfo *, mz_zip_archive *);
 	static const AssetCompileFunc s_assetCompileFuncs[] =
@@ -84,6 +87,11 @@ namespace Framework
 		&CompileTextureRawAsset,			// ACK_TextureRaw
 		&CompileTextureWithMipsAsset,		// ACK_TextureWithMips
 		&CompileNormalMapWithMipsAsset,		// ACK_NormalMapWithMips
+		&CompileTextureBCnAsset,			// ACK_TextureBC1
+		&CompileTextureBCnAsset,			// ACK_TextureBC3
+		&CompileTextureBCnAsset,			// ACK_TextureBC7
+		&CompileTextureBCnAsset,			// ACK_MaskBC4
+		&CompileTextureBCnAsset,			// ACK_NormalMapBC5
 	};
 	cassert(dim(s_assetCompileFuncs) == ACK_Count);
 
@@ -94,6 +102,11 @@ namespace Framework
 		"raw texture",						// ACK_TextureRaw
 		"mipmapped texture",				// ACK_TextureWithMips
 		"mipmapped normal map",				// ACK_NormalMapWithMips
+		"BC1 texture",						// ACK_TextureBC1
+		"BC3 texture",						// ACK_TextureBC3
+		"BC7 texture",						// ACK_TextureBC7
+		"BC4 mask",							// ACK_MaskBC4
+		"BC5 normal map",					// ACK_NormalMapBC5
 	};
 	cassert(dim(s_ackNames) == ACK_Count);
 
@@ -383,6 +396,162 @@ namespace Framework
 			}
 		}
 
+		// Texture assets are compiled ahead of the main compile loop, a batch at a time, in
+		// parallel.  Each goes to its own in-memory .zip, which the main loop copies into the
+		// pack when it reaches that asset, so the pack comes out in the same order as if
+		// everything had been compiled serially.  Batches are bounded to keep memory in check.
+		static const int s_textureBatchPerThread = 2;
+
+		struct StagedAsset
+		{
+			bool		m_staged;
+			bool		m_success;
+			void *		m_pZipData;			// Finalized in-memory .zip; free with mz_free
+			size_t		m_zipSize;
+		};
+
+		static bool IsTextureACK(ACK ack)
+		{
+			switch (ack)
+			{
+			case ACK_TextureRaw:
+			case ACK_TextureWithMips:
+			case ACK_NormalMapWithMips:
+			case ACK_TextureBC1:
+			case ACK_TextureBC3:
+			case ACK_TextureBC7:
+			case ACK_MaskBC4:
+			case ACK_NormalMapBC5:
+				return true;
+
+			default:
+				return false;
+			}
+		}
+
+		// Compile the next batch of texture assets in the list, from iToCompileStart onward
+		static void StageTextureAssets(
+			const AssetCompileInfo * assets,
+			const std::vector<int> & assetsToCompile,
+			int iToCompileStart,
+			std::vector<StagedAsset> * pStaged)
+		{
+			ASSERT_ERR(assets);
+			ASSERT_ERR(pStaged);
+
+			int cBatchMax = numHardwareThreads() * s_textureBatchPerThread;
+			std::vector<int> batch;
+			for (int i = iToCompileStart, c = int(assetsToCompile.size()); i < c && int(batch.size()) < cBatchMax; ++i)
+			{
+				int iAsset = assetsToCompile[i];
+				if (IsTextureACK(assets[iAsset].m_ack))
+					batch.push_back(iAsset);
+			}
+
+			LOG("Compiling a batch of %d textures in parallel...", int(batch.size()));
+
+			// One texture per job; their row bands share the same threads, picking up the slack
+			// once there are fewer textures left than threads
+			parallelFor(int(batch.size()), 1, [&](int iStart, int iEnd)
+			{
+				for (int i = iStart; i < iEnd; ++i)
+				{
+					const AssetCompileInfo * pACI = &assets[batch[i]];
+					StagedAsset * pStagedAsset = &(*pStaged)[batch[i]];
+					pStagedAsset->m_staged = true;
+
+					mz_zip_archive zip = {};
+					if (!mz_zip_writer_init_heap(&zip, 0, 0))
+					{
+						WARN("Couldn't create in-memory archive for asset %s", pACI->m_pathSrc);
+						continue;
+					}
+
+					pStagedAsset->m_success = s_assetCompileFuncs[pACI->m_ack](pACI, &zip);
+					if (!mz_zip_writer_finalize_heap_archive(&zip, &pStagedAsset->m_pZipData, &pStagedAsset->m_zipSize))
+					{
+						WARN("Couldn't finalize in-memory archive for asset %s", pACI->m_pathSrc);
+						pStagedAsset->m_success = false;
+					}
+					mz_zip_writer_end(&zip);
+				}
+			});
+		}
+
+		// Copy a staged asset's files into the pack, and free them
+		static bool WriteStagedAssetToZip(
+			const AssetCompileInfo * pACI,
+			StagedAsset * pStaged,
+			mz_zip_archive * pZipOut)
+		{
+			ASSERT_ERR(pACI);
+			ASSERT_ERR(pStaged);
+			ASSERT_ERR(pStaged->m_staged);
+			ASSERT_ERR(pZipOut);
+
+			bool success = pStaged->m_success;
+			if (success)
+			{
+				mz_zip_archive zipStaged = {};
+				if (!mz_zip_reader_init_mem(&zipStaged, pStaged->m_pZipData, pStaged->m_zipSize, 0))
+				{
+					WARN("Couldn't read in-memory archive for asset %s", pACI->m_pathSrc);
+					success = false;
+				}
+				else
+				{
+					for (int i = 0, c = int(mz_zip_reader_get_num_files(&zipStaged)); i < c; ++i)
+					{
+						if (!mz_zip_writer_add_from_zip_reader(pZipOut, &zipStaged, i))
+						{
+							WARN("Couldn't copy compiled data for asset %s to archive", pACI->m_pathSrc);
+							success = false;
+							break;
+						}
+					}
+					mz_zip_reader_end(&zipStaged);
+				}
+			}
+
+			mz_free(pStaged->m_pZipData);
+			pStaged->m_pZipData = nullptr;
+			return success;
+		}
+
+		static void FreeStagedAssets(std::vector<StagedAsset> * pStaged)
+		{
+			ASSERT_ERR(pStaged);
+
+			for (int i = 0, c = int(pStaged->size()); i < c; ++i)
+			{
+				mz_free((*pStaged)[i].m_pZipData);
+				(*pStaged)[i].m_pZipData = nullptr;
+			}
+		}
+
+		// Compile one asset from the list into the pack, staging the next batch of textures
+		// if this is a texture that hasn't been staged yet
+		static bool CompileAssetToZip(
+			const AssetCompileInfo * assets,
+			const std::vector<int> & assetsToCompile,
+			int iToCompile,
+			std::vector<StagedAsset> * pStaged,
+			mz_zip_archive * pZipOut)
+		{
+			ASSERT_ERR(assets);
+			ASSERT_ERR(pStaged);
+			ASSERT_ERR(pZipOut);
+
+			int iAsset = assetsToCompile[iToCompile];
+			const AssetCompileInfo * pACI = &assets[iAsset];
+			if (!IsTextureACK(pACI->m_ack))
+				return s_assetCompileFuncs[pACI->m_ack](pACI, pZipOut);
+
+			if (!(*pStaged)[iAsset].m_staged)
+				StageTextureAssets(assets, assetsToCompile, iToCompile, pStaged);
+			return WriteStagedAssetToZip(pACI, &(*pStaged)[iAsset], pZipOut);
+		}
+
 		// Compile an entire asset pack from scratch, to a .zip file on disk.
 		bool CompileFullAssetPackToFile(
 			const char * packPath,
@@ -427,6 +596,11 @@ namespace Framework
 
 			std::string manifest;
 
+			std::vector<int> assetsToCompile(numAssets);
+			for (int i = 0; i < numAssets; ++i)
+				assetsToCompile[i] = i;
+			std::vector<StagedAsset> staged(numAssets);
+
 			int numErrors = 0;
 			for (int iAsset = 0; iAsset < numAssets; ++iAsset)
 			{
@@ -437,7 +611,7 @@ namespace Framework
 				LOG("[%d/%d] Compiling %s asset %s...", iAsset+1, numAssets, s_ackNames[ack], pACI->m_pathSrc);
 
 				// Compile the asset
-				if (s_assetCompileFuncs[ack](pACI, pZipOut))
+				if (CompileAssetToZip(assets, assetsToCompile, iAsset, &staged, pZipOut))
 				{
 					// Write asset name to the manifest
 					manifest += pACI->m_pathSrc;
@@ -540,8 +714,6 @@ namespace Framework
 			ParseManifest(pManifest, int(manifestSize), packPath, &manifest);
 			mz_free(pManifest);
 
-			mz_zip_reader_end(&zip);
-
 			// Get the mod date of the asset pack
 			struct _stat packStat;
 			CHECK_ERR(_stat(packPath, &packStat) == 0);
@@ -572,6 +744,11 @@ namespace Framework
 				case ACK_TextureRaw:
 				case ACK_TextureWithMips:
 				case ACK_NormalMapWithMips:
+				case ACK_TextureBC1:
+				case ACK_TextureBC3:
+				case ACK_TextureBC7:
+				case ACK_MaskBC4:
+				case ACK_NormalMapBC5:
 					if (ver.m_texver != TEXVER_Current)
 					{
 						pAssetsToUpdateOut->push_back(i);
@@ -591,6 +768,13 @@ namespace Framework
 					continue;
 				}
 
+				// Textures also need recompiling if they were built with different settings
+				if (IsTextureACK(pACI->m_ack) && !TextureMatchesCompileInfo(&zip, pACI))
+				{
+					pAssetsToUpdateOut->push_back(i);
+					continue;
+				}
+
 				// Check mod time of the source file against that of the pack
 				// If the source file doesn't exist, that's OK!  Asset packs can be
 				// distributed in lieu of source files.
@@ -603,6 +787,7 @@ namespace Framework
 				}
 			}
 
+			mz_zip_reader_end(&zip);
 			return true;
 		}
 
@@ -654,6 +839,7 @@ namespace Framework
 			std::string manifest;
 			int numErrors = 0;
 			int numAssetsToUpdate = int(assetsToUpdate.size());
+			std::vector<StagedAsset> staged(numAssets);
 
 			// Iterate over assets, tracking position in both original asset list and
 			// list of assets that need updates (a sorted subset of the original ones)
@@ -674,7 +860,7 @@ namespace Framework
 						iAssetToUpdate+1, numAssetsToUpdate, s_ackNames[ack], pACI->m_pathSrc);
 
 					// Compile the asset
-					if (s_assetCompileFuncs[ack](pACI, &zipDest))
+					if (CompileAssetToZip(assets, assetsToUpdate, iAssetToUpdate, &staged, &zipDest))
 					{
 						// Write asset name to the manifest
 						manifest += pACI->m_pathSrc;
@@ -703,6 +889,7 @@ namespace Framework
 								mz_zip_reader_end(&zipSrc);
 								mz_zip_writer_end(&zipDest);
 								DeleteFile(tempPath);
+								FreeStagedAssets(&staged);
 								return false;
 							}
 						}
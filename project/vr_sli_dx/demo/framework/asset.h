@@ -31,14 +31,50 @@ namespace Framework
 		ACK_TextureRaw,			// Single RGBA8 image
 		ACK_TextureWithMips,	// RGBA8 image, resampled up to pow2 and mips generated
 		ACK_NormalMapWithMips,	// RGB8 image (non-sRGB), resampled up to pow2 and mips generated
+		ACK_TextureBC1,			// Like ACK_TextureWithMips, but BC1 (sRGB, 1-bit alpha), and NPOT kept native
+		ACK_TextureBC3,			// Like ACK_TextureBC1, but BC3 (sRGB, smooth alpha)
+		ACK_TextureBC7,			// Like ACK_TextureBC1, but BC7 (sRGB, with alpha)
+		ACK_MaskBC4,			// Single-channel mask from the red channel, BC4 (non-sRGB), with mips
+		ACK_NormalMapBC5,		// Like ACK_NormalMapWithMips, but BC5 (XY only; Z must be reconstructed), and NPOT kept native
 
 		ACK_Count
 	};
 
+	enum BCQ					// Block Compression Quality, for the BCn texture ACKs
+	{
+		BCQ_Normal,				// Principal-axis endpoints, refined once
+		BCQ_Fast,				// Bounding-box endpoints, no refinement
+		BCQ_High,				// Several refinement passes, more modes and endpoints tried
+
+		BCQ_Count
+	};
+
+	enum MIPF					// MIP Filter, for the texture ACKs with mips
+	{
+		MIPF_Box,				// Box filter, each level from the one above (3 taps on odd dims)
+		MIPF_Kaiser,			// Kaiser-windowed sinc, each level from the one above; sharper
+		MIPF_Resample,			// stb_image_resize's default (Mitchell), each level from the base; slowest
+
+		MIPF_Count
+	};
+
+	enum TEXTIER				// TEXture quality TIER: top mips dropped at compile time, for the ACKs with mips
+	{
+		TEXTIER_Full,			// Whole mip chain
+		TEXTIER_Medium,			// Top mip dropped from color textures and normal maps
+		TEXTIER_Low,			// Top two mips dropped from color textures and normal maps, top one from masks
+
+		TEXTIER_Count
+	};
+
 	struct AssetCompileInfo
 	{
 		const char *	m_pathSrc;
 		ACK				m_ack;
+		BCQ				m_bcq;					// Ignored by non-BCn ACKs
+		MIPF			m_mipf;					// Ignored by non-mipped ACKs
+		TEXTIER			m_textier;				// Ignored by non-mipped ACKs
+		int				m_maxDim;				// Ignored by non-mipped ACKs; if nonzero, more top mips are dropped to fit
 	};
 
 	// Load an asset pack file, checking that all its assets are present and up to date,
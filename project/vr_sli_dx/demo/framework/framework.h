@@ -2,7 +2,11 @@
 
 #include <util.h>
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -40,6 +44,9 @@ namespace Framework
 #include "material.h"
 #include "mesh.h"
 #include "rendertarget.h"
+#include "screenshot.h"
+#include "texarray.h"
+#include "texstreamer.h"
 #include "texture.h"
 #include "timer.h"
 
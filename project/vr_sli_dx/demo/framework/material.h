@@ -12,6 +12,9 @@ namespace Framework
 		Texture2D *		m_pTexDiffuseColor;
 		Texture2D *		m_pTexSpecColor;
 		Texture2D *		m_pTexHeight;
+		int2			m_sliceDiffuseColor;	// (array index, slice) of each texture in a TextureArrayLib,
+		int2			m_sliceSpecColor;		// or (-1, -1) if none
+		int2			m_sliceHeight;
 		rgb				m_rgbDiffuseColor;
 		rgb				m_rgbSpecColor;
 		float			m_specPower;
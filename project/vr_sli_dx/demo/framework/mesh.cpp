@@ -7,6 +7,11 @@ namespace Framework
 		m_pIndices(nullptr),
 		m_vertCount(0),
 		m_indexCount(0),
+		m_pPositions(nullptr),
+		m_pPosIndices(nullptr),
+		m_positionCount(0),
+		m_pInstanceTransforms(nullptr),
+		m_instanceTransformCount(0),
 		m_vtxStrideBytes(0),
 		m_primtopo(D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED),
 		m_bounds(makebox3Empty())
@@ -17,11 +22,9 @@ namespace Framework
 	{
 		ASSERT_ERR(pCtx);
 
-		UINT zero = 0;
-		pCtx->IASetVertexBuffers(0, 1, &m_pVtxBuffer, (UINT *)&m_vtxStrideBytes, &zero);
-		pCtx->IASetIndexBuffer(m_pIdxBuffer, DXGI_FORMAT_R32_UINT, 0);
-		pCtx->IASetPrimitiveTopology(m_primtopo);
-		pCtx->DrawIndexed(m_indexCount, 0, 0);
+		// Ranges may be instanced differently, so they can't all go in one draw
+		for (int i = 0, c = int(m_mtlRanges.size()); i < c; ++i)
+			DrawMtlRange(pCtx, i);
 	}
 
 	void Mesh::DrawMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange)
@@ -31,11 +34,37 @@ namespace Framework
 
 		const MtlRange * pRange = &m_mtlRanges[iMtlRange];
 
-		UINT zero = 0;
-		pCtx->IASetVertexBuffers(0, 1, &m_pVtxBuffer, (UINT *)&m_vtxStrideBytes, &zero);
+		ID3D11Buffer * apBuffers[] = { m_pVtxBuffer, m_pInstBuffer };
+		UINT aStrides[] = { UINT(m_vtxStrideBytes), sizeof(affine3) };
+		UINT aOffsets[] = { 0, 0 };
+		pCtx->IASetVertexBuffers(0, dim(apBuffers), apBuffers, aStrides, aOffsets);
 		pCtx->IASetIndexBuffer(m_pIdxBuffer, DXGI_FORMAT_R32_UINT, 0);
 		pCtx->IASetPrimitiveTopology(m_primtopo);
-		pCtx->DrawIndexed(pRange->m_indexCount, pRange->m_indexStart, 0);
+		pCtx->DrawIndexedInstanced(pRange->m_indexCount, pRange->m_instanceCount, pRange->m_indexStart, 0, pRange->m_instanceStart);
+	}
+
+	void Mesh::DrawDepthOnly(ID3D11DeviceContext * pCtx)
+	{
+		ASSERT_ERR(pCtx);
+
+		for (int i = 0, c = int(m_mtlRanges.size()); i < c; ++i)
+			DrawDepthOnlyMtlRange(pCtx, i);
+	}
+
+	void Mesh::DrawDepthOnlyMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(iMtlRange >= 0 && iMtlRange < int(m_mtlRanges.size()));
+
+		const MtlRange * pRange = &m_mtlRanges[iMtlRange];
+
+		ID3D11Buffer * apBuffers[] = { m_pPosVtxBuffer, m_pInstBuffer };
+		UINT aStrides[] = { sizeof(point3), sizeof(affine3) };
+		UINT aOffsets[] = { 0, 0 };
+		pCtx->IASetVertexBuffers(0, dim(apBuffers), apBuffers, aStrides, aOffsets);
+		pCtx->IASetIndexBuffer(m_pPosIdxBuffer, DXGI_FORMAT_R32_UINT, 0);
+		pCtx->IASetPrimitiveTopology(m_primtopo);
+		pCtx->DrawIndexedInstanced(pRange->m_indexCount, pRange->m_instanceCount, pRange->m_indexStart, 0, pRange->m_instanceStart);
 	}
 
 	void Mesh::Reset()
@@ -45,8 +74,16 @@ namespace Framework
 		m_pIndices = nullptr;
 		m_vertCount = 0;
 		m_indexCount = 0;
+		m_pPositions = nullptr;
+		m_pPosIndices = nullptr;
+		m_positionCount = 0;
+		m_pInstanceTransforms = nullptr;
+		m_instanceTransformCount = 0;
 		m_pVtxBuffer.release();
 		m_pIdxBuffer.release();
+		m_pPosVtxBuffer.release();
+		m_pPosIdxBuffer.release();
+		m_pInstBuffer.release();
 		m_vtxStrideBytes = 0;
 		m_primtopo = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
 		m_bounds = makebox3Empty();
@@ -58,6 +95,9 @@ namespace Framework
 
 		m_pVtxBuffer.release();
 		m_pIdxBuffer.release();
+		m_pPosVtxBuffer.release();
+		m_pPosIdxBuffer.release();
+		m_pInstBuffer.release();
 
 		D3D11_BUFFER_DESC vtxBufferDesc =
 		{
@@ -83,6 +123,45 @@ namespace Framework
 		D3D11_SUBRESOURCE_DATA idxBufferData = { m_pIndices, 0, 0 };
 		CHECK_D3D(pDevice->CreateBuffer(&idxBufferDesc, &idxBufferData, &m_pIdxBuffer));
 
+		if (m_pPositions && m_pPosIndices)
+		{
+			D3D11_BUFFER_DESC posVtxBufferDesc =
+			{
+				sizeof(point3) * m_positionCount,
+				D3D11_USAGE_IMMUTABLE,
+				D3D11_BIND_VERTEX_BUFFER,
+				0,	// no cpu access
+				0,	// no misc flags
+				0,	// structured buffer stride
+			};
+			D3D11_SUBRESOURCE_DATA posVtxBufferData = { m_pPositions, 0, 0 };
+			CHECK_D3D(pDevice->CreateBuffer(&posVtxBufferDesc, &posVtxBufferData, &m_pPosVtxBuffer));
+
+			D3D11_BUFFER_DESC posIdxBufferDesc =
+			{
+				sizeof(int) * m_indexCount,
+				D3D11_USAGE_IMMUTABLE,
+				D3D11_BIND_INDEX_BUFFER,
+				0,	// no cpu access
+				0,	// no misc flags
+				0,	// structured buffer stride
+			};
+			D3D11_SUBRESOURCE_DATA posIdxBufferData = { m_pPosIndices, 0, 0 };
+			CHECK_D3D(pDevice->CreateBuffer(&posIdxBufferDesc, &posIdxBufferData, &m_pPosIdxBuffer));
+		}
+
+		D3D11_BUFFER_DESC instBufferDesc =
+		{
+			sizeof(affine3) * m_instanceTransformCount,
+			D3D11_USAGE_IMMUTABLE,
+			D3D11_BIND_VERTEX_BUFFER,
+			0,	// no cpu access
+			0,	// no misc flags
+			0,	// structured buffer stride
+		};
+		D3D11_SUBRESOURCE_DATA instBufferData = { m_pInstanceTransforms, 0, 0 };
+		CHECK_D3D(pDevice->CreateBuffer(&instBufferDesc, &instBufferData, &m_pInstBuffer));
+
 		m_vtxStrideBytes = sizeof(Vertex);
 		m_primtopo = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 	}
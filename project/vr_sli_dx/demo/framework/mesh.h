@@ -31,17 +31,35 @@ namespace Framework
 		int							m_vertCount;
 		int							m_indexCount;
 
+		// Position-only stream for depth-only passes, with its own index buffer.
+		// Verts that differ only in normal/UV are welded, so m_positionCount <= m_vertCount.
+		// m_pPosIndices parallels m_pIndices, so material ranges apply to it as well.
+		point3 *					m_pPositions;
+		int *						m_pPosIndices;
+		int							m_positionCount;
+
+		// Per-instance transforms.  Entry 0 is identity, used by all the non-instanced ranges;
+		// ranges compiled from repeated geometry use their own span of transforms.
+		affine3 *					m_pInstanceTransforms;
+		int							m_instanceTransformCount;
+
 		// Material map
 		struct MtlRange
 		{
 			Material *	m_pMtl;
 			int			m_indexStart, m_indexCount;
+			int			m_instanceStart, m_instanceCount;
+			box3		m_bounds;		// Local space, covering all the range's instances
+			float		m_uvDensity;	// UV units per local-space unit, from the 95th-percentile triangle
 		};
 		std::vector<MtlRange>		m_mtlRanges;
 
 		// GPU resources
 		comptr<ID3D11Buffer>		m_pVtxBuffer;
 		comptr<ID3D11Buffer>		m_pIdxBuffer;
+		comptr<ID3D11Buffer>		m_pPosVtxBuffer;
+		comptr<ID3D11Buffer>		m_pPosIdxBuffer;
+		comptr<ID3D11Buffer>		m_pInstBuffer;		// Bound to vertex buffer slot 1
 
 		// Rendering info
 		int							m_vtxStrideBytes;
@@ -51,9 +69,13 @@ namespace Framework
 				Mesh();
 		void	Draw(ID3D11DeviceContext * pCtx);
 		void	DrawMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange);
+		void	DrawDepthOnly(ID3D11DeviceContext * pCtx);
+		void	DrawDepthOnlyMtlRange(ID3D11DeviceContext * pCtx, int iMtlRange);
 		void	Reset();
 
-		// Creates the vertex and index buffers on the GPU from m_pVerts and m_pIndices
+		// Creates the vertex and index buffers on the GPU from m_pVerts and m_pIndices,
+		// the depth-only ones from m_pPositions and m_pPosIndices, and the instance
+		// buffer from m_pInstanceTransforms
 		void	UploadToGPU(ID3D11Device * pDevice);
 	};
 
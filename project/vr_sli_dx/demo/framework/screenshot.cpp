@@ -0,0 +1,353 @@
+#include "framework.h"
+
+#define MINIZ_HEADER_FILE_ONLY
+#include "miniz.c"
+
+namespace Framework
+{
+	// Deflate level for PNGs: screenshots are big, and the encode has to keep up with capture
+	static const int s_pngLevel = 1;
+
+	IMGFMT ImageFormatFromPath(const char * path)
+	{
+		ASSERT_ERR(path);
+
+		const char * pExt = strrchr(path, '.');
+		if (pExt && _stricmp(pExt, ".png") == 0)
+			return IMGFMT_PNG;
+
+		return IMGFMT_BMP;
+	}
+
+	bool EncodeImage(
+		const byte4 * pPixels,
+		int2_arg dims,
+		IMGFMT imgfmt,
+		std::vector<byte> * pDataOut)
+	{
+		ASSERT_ERR(pPixels);
+		ASSERT_ERR(all(dims > 0));
+		ASSERT_ERR(pDataOut);
+
+		switch (imgfmt)
+		{
+		case IMGFMT_BMP:
+			WriteBMPToMemory(pPixels, dims, pDataOut);
+			return true;
+
+		case IMGFMT_PNG:
+			{
+				size_t sizeBytes = 0;
+				void * pData = tdefl_write_image_to_png_file_in_memory_ex(
+									pPixels, dims.x, dims.y, 4, &sizeBytes, s_pngLevel, MZ_FALSE);
+				if (!pData)
+					return false;
+				pDataOut->assign((const byte *)pData, (const byte *)pData + sizeBytes);
+				mz_free(pData);
+				return true;
+			}
+
+		default:
+			ERR("Unknown image format %d", imgfmt);
+			return false;
+		}
+	}
+
+	static bool WriteDataToFile(const std::vector<byte> & data, const char * path)
+	{
+		FILE * pFile = nullptr;
+		if (fopen_s(&pFile, path, "wb") != 0)
+			return false;
+
+		bool result = (fwrite(&data[0], data.size(), 1, pFile) == 1);
+		fclose(pFile);
+		return result;
+	}
+
+
+
+	// ImageEncodeQueue implementation
+
+	ImageEncodeQueue::ImageEncodeQueue()
+	:	m_maxQueued(0),
+		m_jobsInProgress(0),
+		m_quit(false)
+	{
+		memset(&m_stats, 0, sizeof(m_stats));
+	}
+
+	ImageEncodeQueue::~ImageEncodeQueue()
+	{
+		Reset();
+	}
+
+	void ImageEncodeQueue::Init(int maxQueued /* = 8 */, int threadCount /* = 1 */)
+	{
+		ASSERT_ERR(maxQueued > 0);
+		ASSERT_ERR(threadCount > 0);
+
+		Reset();
+
+		m_maxQueued = maxQueued;
+		m_quit = false;
+		for (int i = 0; i < threadCount; ++i)
+			m_threads.push_back(std::thread([this]() { WorkerMain(); }));
+	}
+
+	void ImageEncodeQueue::Reset()
+	{
+		// Workers drain the queue before they notice the quit flag
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_cvJobs.notify_all();
+		for (int i = 0, c = int(m_threads.size()); i < c; ++i)
+			m_threads[i].join();
+		m_threads.clear();
+
+		ASSERT_WARN(m_jobs.empty() && m_jobsInProgress == 0);
+		m_jobs.clear();
+		m_maxQueued = 0;
+		m_jobsInProgress = 0;
+		memset(&m_stats, 0, sizeof(m_stats));
+	}
+
+	bool ImageEncodeQueue::Push(
+		std::vector<byte4> * pPixels,
+		int2_arg dims,
+		IMGFMT imgfmt,
+		const char * path,
+		bool wait)
+	{
+		ASSERT_ERR(pPixels);
+		ASSERT_ERR(int(pPixels->size()) == dims.x * dims.y);
+		ASSERT_ERR(path);
+		ASSERT_ERR_MSG(!m_threads.empty(), "ImageEncodeQueue used before Init");
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (wait)
+			{
+				m_cvSpace.wait(lock, [this]() { return int(m_jobs.size()) < m_maxQueued; });
+			}
+			else if (int(m_jobs.size()) >= m_maxQueued)
+			{
+				++m_stats.m_imagesDropped;
+				return false;
+			}
+
+			// Swap the pixels in rather than copying them (no implicit moves in VS2013)
+			m_jobs.push_back(Job());
+			Job * pJob = &m_jobs.back();
+			pJob->m_pixels.swap(*pPixels);
+			pJob->m_dims = dims;
+			pJob->m_imgfmt = imgfmt;
+			pJob->m_path = path;
+		}
+		m_cvJobs.notify_one();
+
+		pPixels->clear();
+		return true;
+	}
+
+	bool ImageEncodeQueue::IsFull()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return int(m_jobs.size()) >= m_maxQueued;
+	}
+
+	void ImageEncodeQueue::Flush()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cvSpace.wait(lock, [this]() { return m_jobs.empty() && m_jobsInProgress == 0; });
+	}
+
+	ImageEncodeStats ImageEncodeQueue::GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_stats;
+	}
+
+	void ImageEncodeQueue::WorkerMain()
+	{
+		std::vector<byte> data;
+		for (;;)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cvJobs.wait(lock, [this]() { return m_quit || !m_jobs.empty(); });
+				if (m_jobs.empty())
+					return;
+
+				Job * pJobFront = &m_jobs.front();
+				job.m_pixels.swap(pJobFront->m_pixels);
+				job.m_dims = pJobFront->m_dims;
+				job.m_imgfmt = pJobFront->m_imgfmt;
+				job.m_path.swap(pJobFront->m_path);
+				m_jobs.pop_front();
+				++m_jobsInProgress;
+			}
+
+			bool result = EncodeImage(&job.m_pixels[0], job.m_dims, job.m_imgfmt, &data) &&
+							WriteDataToFile(data, job.m_path.c_str());
+			if (!result)
+				WARN("Couldn't write image %s", job.m_path.c_str());
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (result)
+					++m_stats.m_imagesWritten;
+				else
+					++m_stats.m_imagesFailed;
+				--m_jobsInProgress;
+			}
+			m_cvSpace.notify_all();
+		}
+	}
+
+
+
+	// ScreenshotCapture implementation
+
+	ScreenshotCapture::ScreenshotCapture()
+	:	m_iSlotOldest(0),
+		m_slotsPending(0),
+		m_capturesDropped(0),
+		m_pQueue(nullptr)
+	{
+	}
+
+	void ScreenshotCapture::Init(ImageEncodeQueue * pQueue, int ringSize /* = 3 */)
+	{
+		ASSERT_ERR(pQueue);
+		ASSERT_ERR(ringSize > 0);
+
+		Reset();
+		m_pQueue = pQueue;
+		m_slots.resize(ringSize);
+	}
+
+	void ScreenshotCapture::Reset()
+	{
+		ASSERT_WARN_MSG(m_slotsPending == 0, "ScreenshotCapture reset with %d captures still pending", m_slotsPending);
+
+		m_slots.clear();
+		m_iSlotOldest = 0;
+		m_slotsPending = 0;
+		m_capturesDropped = 0;
+		m_pQueue = nullptr;
+	}
+
+	bool ScreenshotCapture::Capture(
+		ID3D11DeviceContext * pCtx,
+		RenderTarget * pRt,
+		const char * path)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(pRt);
+		ASSERT_ERR(all(pRt->m_dims > 0));
+		ASSERT_ERR(path);
+		ASSERT_ERR_MSG(m_pQueue, "ScreenshotCapture used before Init");
+
+		// Currently the texture must be in RGBA8 format and can't be multisampled
+		ASSERT_ERR(pRt->m_format == DXGI_FORMAT_R8G8B8A8_UNORM || pRt->m_format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB);
+		ASSERT_ERR(pRt->m_sampleCount == 1);
+
+		int cSlot = int(m_slots.size());
+		if (m_slotsPending == cSlot)
+		{
+			++m_capturesDropped;
+			return false;
+		}
+
+		Slot * pSlot = &m_slots[(m_iSlotOldest + m_slotsPending) % cSlot];
+
+		// (Re-)create the staging texture if needed
+		if (!pSlot->m_pTexStaging || any(pSlot->m_dims != pRt->m_dims) || pSlot->m_format != pRt->m_format)
+		{
+			comptr<ID3D11Device> pDevice;
+			pCtx->GetDevice(&pDevice);
+
+			D3D11_TEXTURE2D_DESC texDesc =
+			{
+				pRt->m_dims.x, pRt->m_dims.y, 1, 1,
+				pRt->m_format,
+				{ 1, 0 },
+				D3D11_USAGE_STAGING,
+				0,
+				D3D11_CPU_ACCESS_READ,
+				0,
+			};
+			pSlot->m_pTexStaging.release();
+			CHECK_D3D(pDevice->CreateTexture2D(&texDesc, nullptr, &pSlot->m_pTexStaging));
+			pSlot->m_dims = pRt->m_dims;
+			pSlot->m_format = pRt->m_format;
+		}
+
+		pCtx->CopyResource(pSlot->m_pTexStaging, pRt->m_pTex);
+		pSlot->m_path = path;
+		++m_slotsPending;
+		return true;
+	}
+
+	void ScreenshotCapture::Poll(ID3D11DeviceContext * pCtx)
+	{
+		while (m_slotsPending > 0 && ReadbackOldest(pCtx, false))
+		{
+		}
+	}
+
+	void ScreenshotCapture::Flush(ID3D11DeviceContext * pCtx)
+	{
+		while (m_slotsPending > 0)
+			ReadbackOldest(pCtx, true);
+	}
+
+	bool ScreenshotCapture::ReadbackOldest(ID3D11DeviceContext * pCtx, bool wait)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(m_pQueue);
+
+		if (m_slotsPending == 0)
+			return false;
+
+		// Leave the copy pending rather than read it back only to drop it
+		if (!wait && m_pQueue->IsFull())
+			return false;
+
+		Slot * pSlot = &m_slots[m_iSlotOldest];
+
+		D3D11_MAPPED_SUBRESOURCE mapped = {};
+		HRESULT hr = pCtx->Map(pSlot->m_pTexStaging, 0, D3D11_MAP_READ, wait ? 0 : D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+		if (hr == DXGI_ERROR_WAS_STILL_DRAWING)
+			return false;
+
+		if (SUCCEEDED(hr))
+		{
+			// Copy the data out row by row, in case the pitch is different
+			std::vector<byte4> pixels(pSlot->m_dims.x * pSlot->m_dims.y);
+			int rowSize = pSlot->m_dims.x * sizeof(byte4);
+			ASSERT_ERR(mapped.RowPitch >= UINT(rowSize));
+			for (int y = 0; y < pSlot->m_dims.y; ++y)
+			{
+				memcpy(
+					&pixels[y * pSlot->m_dims.x],
+					advanceBytes(mapped.pData, y * mapped.RowPitch),
+					rowSize);
+			}
+			pCtx->Unmap(pSlot->m_pTexStaging, 0);
+
+			m_pQueue->Push(&pixels, pSlot->m_dims, ImageFormatFromPath(pSlot->m_path.c_str()), pSlot->m_path.c_str(), wait);
+		}
+		else
+		{
+			WARN("Couldn't map staging texture for screenshot %s: error 0x%08x", pSlot->m_path.c_str(), hr);
+		}
+
+		m_iSlotOldest = (m_iSlotOldest + 1) % int(m_slots.size());
+		--m_slotsPending;
+		return true;
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+namespace Framework
+{
+	class RenderTarget;
+
+	// Asynchronous screenshots: a render target is copied into one of a ring of staging
+	// textures, which are polled on later frames and only mapped once the GPU is done with
+	// them, so the render thread never stalls on a readback.  The pixels then go through a
+	// bounded queue to worker threads that encode them and write the files.
+
+	enum IMGFMT					// IMaGe ForMaT for encoding screenshots
+	{
+		IMGFMT_BMP,				// 32-bit uncompressed; cheap to encode, so best for frame sequences
+		IMGFMT_PNG,				// Deflate-compressed (miniz), at its fastest level
+
+		IMGFMT_Count
+	};
+
+	// Picks the format from a path's extension: .png, or BMP for anything else
+	IMGFMT ImageFormatFromPath(const char * path);
+
+	// Encode RGBA8 pixels to an image file in memory
+	bool EncodeImage(
+			const byte4 * pPixels,
+			int2_arg dims,
+			IMGFMT imgfmt,
+			std::vector<byte> * pDataOut);
+
+	struct ImageEncodeStats
+	{
+		int		m_imagesWritten;
+		int		m_imagesFailed;			// Couldn't be encoded or written
+		int		m_imagesDropped;		// Pushed while the queue was full, without waiting
+	};
+
+	// Encodes and writes images on worker threads.  Works on plain CPU buffers, so it can be
+	// driven without a GPU.
+	class ImageEncodeQueue
+	{
+	public:
+				ImageEncodeQueue();
+				~ImageEncodeQueue();
+
+		void	Init(int maxQueued = 8, int threadCount = 1);
+
+		// Finishes everything queued, then stops the workers
+		void	Reset();
+
+		// Takes the pixels (leaving *pPixels empty) and queues them to be written to path.
+		// If the queue is full, either waits for room or drops the image and returns false.
+		bool	Push(
+					std::vector<byte4> * pPixels,
+					int2_arg dims,
+					IMGFMT imgfmt,
+					const char * path,
+					bool wait);
+		bool	IsFull();
+
+		// Waits until everything queued so far has been written
+		void	Flush();
+
+		ImageEncodeStats	GetStats();
+
+	protected:
+		struct Job
+		{
+			std::vector<byte4>	m_pixels;
+			int2				m_dims;
+			IMGFMT				m_imgfmt;
+			std::string			m_path;
+		};
+
+		void	WorkerMain();
+
+		std::deque<Job>				m_jobs;
+		int							m_maxQueued;
+		int							m_jobsInProgress;
+		bool						m_quit;
+		std::mutex					m_mutex;
+		std::condition_variable		m_cvJobs;		// Signaled when a job is queued, or on quit
+		std::condition_variable		m_cvSpace;		// Signaled when a job finishes
+		std::vector<std::thread>	m_threads;
+		ImageEncodeStats			m_stats;
+	};
+
+	// Ring of staging textures for reading back render targets without stalling
+	class ScreenshotCapture
+	{
+	public:
+				ScreenshotCapture();
+
+		void	Init(ImageEncodeQueue * pQueue, int ringSize = 3);
+		void	Reset();
+
+		// Copies the render target to a free staging texture, to be written to path once
+		// it's been read back.  Returns false, dropping the capture, if the ring is full.
+		bool	Capture(
+					ID3D11DeviceContext * pCtx,
+					RenderTarget * pRt,
+					const char * path);
+
+		// Call once per frame: hands the copies the GPU has finished to the encode queue,
+		// oldest first, without waiting.  Stops early if the queue is full.
+		void	Poll(ID3D11DeviceContext * pCtx);
+
+		// Waits for every pending copy to be read back and queued
+		void	Flush(ID3D11DeviceContext * pCtx);
+
+		// Reads back the oldest pending copy and queues it; returns false if it isn't ready
+		bool	ReadbackOldest(ID3D11DeviceContext * pCtx, bool wait);
+
+		struct Slot
+		{
+			comptr<ID3D11Texture2D>		m_pTexStaging;
+			int2						m_dims;
+			DXGI_FORMAT					m_format;
+			std::string					m_path;
+		};
+
+		std::vector<Slot>		m_slots;
+		int						m_iSlotOldest;		// Oldest pending copy
+		int						m_slotsPending;
+		int						m_capturesDropped;
+		ImageEncodeQueue *		m_pQueue;
+	};
+}
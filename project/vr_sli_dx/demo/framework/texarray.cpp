@@ -0,0 +1,268 @@
+#include "framework.h"
+#include <algorithm>
+
+namespace Framework
+{
+	// Resources are allocated in pages, so each small texture wastes the rest of its last one;
+	// this is only an estimate, since the driver doesn't report its actual placement.
+	static const int s_resourceAlignment = 64 * 1024;
+
+	static i64 RoundUpToResourceAlignment(i64 bytes)
+	{
+		return (bytes + s_resourceAlignment - 1) / s_resourceAlignment * s_resourceAlignment;
+	}
+
+	static void CreateArraySrv(
+		ID3D11Device * pDevice,
+		ID3D11Texture2D * pTex,
+		DXGI_FORMAT format,
+		int mipLevels,
+		int arraySize,
+		ID3D11ShaderResourceView ** ppSrvOut)
+	{
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = { format, D3D11_SRV_DIMENSION_TEXTURE2DARRAY, };
+		srvDesc.Texture2DArray.MostDetailedMip = 0;
+		srvDesc.Texture2DArray.MipLevels = mipLevels;
+		srvDesc.Texture2DArray.FirstArraySlice = 0;
+		srvDesc.Texture2DArray.ArraySize = arraySize;
+		CHECK_D3D(pDevice->CreateShaderResourceView(pTex, &srvDesc, ppSrvOut));
+	}
+
+
+
+	// TextureArrayLib implementation
+
+	TextureArrayLib::TextureArrayLib()
+	{
+		Reset();
+	}
+
+	void TextureArrayLib::Init(
+		ID3D11Device * pDevice,
+		TextureLib * pTexLib,
+		Texture2D * const * apTexExtra,
+		int texExtraCount,
+		bool group,
+		const TextureStreamer * pStreamer /* = nullptr */)
+	{
+		ASSERT_ERR(pDevice);
+		ASSERT_ERR(pTexLib);
+		ASSERT_ERR(apTexExtra || texExtraCount == 0);
+
+		Reset();
+
+		// Gather the textures in a stable order, so the slice assignment doesn't depend on
+		// the hash table's iteration order
+		std::vector<std::pair<std::string, Texture2D *>> aTexNamed;
+		aTexNamed.reserve(pTexLib->m_texs.size());
+		for (auto iter = pTexLib->m_texs.begin(), end = pTexLib->m_texs.end(); iter != end; ++iter)
+			aTexNamed.push_back(std::make_pair(iter->first, &iter->second));
+		std::sort(aTexNamed.begin(), aTexNamed.end());
+
+		std::vector<Texture2D *> apTex;
+		apTex.reserve(aTexNamed.size() + texExtraCount);
+		for (int i = 0, c = int(aTexNamed.size()); i < c; ++i)
+			apTex.push_back(aTexNamed[i].second);
+		for (int i = 0; i < texExtraCount; ++i)
+			apTex.push_back(apTexExtra[i]);
+
+		// Sort the textures into groups by layout.  Arrays started by a texture that can't be
+		// grouped stay closed to the rest.
+		std::vector<bool> arraysOpen;
+		for (int i = 0, c = int(apTex.size()); i < c; ++i)
+		{
+			Texture2D * pTex = apTex[i];
+			ASSERT_ERR(pTex);
+			if (m_slices.find(pTex) != m_slices.end())
+				continue;
+
+			// A texture can only be grouped if its whole chain can be put in the array, from its
+			// pixel data or its own resource
+			bool groupable = (int(pTex->m_apPixels.size()) == pTex->m_mipLevels || pTex->m_pTex) &&
+								!(pStreamer && pStreamer->IsStreaming(pTex));
+
+			int iArray = -1;
+			if (group && groupable)
+			{
+				for (int j = 0, cArrays = int(m_arrays.size()); j < cArrays; ++j)
+				{
+					const Array * pArray = &m_arrays[j];
+					if (arraysOpen[j] &&
+						all(pArray->m_dims == pTex->m_dims) &&
+						pArray->m_mipLevels == pTex->m_mipLevels &&
+						pArray->m_format == pTex->m_format)
+					{
+						iArray = j;
+						break;
+					}
+				}
+			}
+			if (iArray < 0)
+			{
+				iArray = int(m_arrays.size());
+				m_arrays.push_back(Array());
+				Array * pArray = &m_arrays.back();
+				pArray->m_dims = pTex->m_dims;
+				pArray->m_mipLevels = pTex->m_mipLevels;
+				pArray->m_format = pTex->m_format;
+				pArray->m_pTexViewed = nullptr;
+				arraysOpen.push_back(groupable);
+			}
+
+			Array * pArray = &m_arrays[iArray];
+			m_slices[pTex] = makeint2(iArray, int(pArray->m_apTex.size()));
+			pArray->m_apTex.push_back(pTex);
+		}
+
+		m_stats.m_textures = int(m_slices.size());
+
+		// Create the arrays on the GPU
+		i64 bytesPaddedSeparate = 0;
+		i64 bytesPaddedArrays = 0;
+		for (int i = 0, c = int(m_arrays.size()); i < c; ++i)
+		{
+			Array * pArray = &m_arrays[i];
+			int sliceCount = int(pArray->m_apTex.size());
+
+			if (sliceCount == 1)
+			{
+				// View the texture's own resource, uploading it if nobody has yet
+				Texture2D * pTex = pArray->m_apTex[0];
+				if (!pTex->m_pTex)
+					pTex->UploadToGPU(pDevice);
+				GetSrv(pDevice, i);
+				continue;
+			}
+
+			DXGI_FORMAT formatTex = FindTypelessFormat(pArray->m_format);
+			if (formatTex == DXGI_FORMAT_UNKNOWN)
+				formatTex = pArray->m_format;
+
+			D3D11_TEXTURE2D_DESC texDesc =
+			{
+				pArray->m_dims.x, pArray->m_dims.y,
+				pArray->m_mipLevels, sliceCount,
+				formatTex,
+				{ 1, 0 },
+				D3D11_USAGE_DEFAULT,
+				D3D11_BIND_SHADER_RESOURCE,
+				0, 0,
+			};
+
+			// Subresources are ordered by slice, then mip level.  Textures that only exist on the
+			// GPU (e.g. the fallback 1x1s) have no pixel data, so they're copied in afterward.
+			std::vector<D3D11_SUBRESOURCE_DATA> aInitialData(sliceCount * pArray->m_mipLevels);
+			int slicesWithPixels = 0;
+			for (int iSlice = 0; iSlice < sliceCount; ++iSlice)
+			{
+				const Texture2D * pTex = pArray->m_apTex[iSlice];
+				if (int(pTex->m_apPixels.size()) != pArray->m_mipLevels)
+				{
+					ASSERT_ERR(pTex->m_pTex);
+					continue;
+				}
+				++slicesWithPixels;
+				for (int iMip = 0; iMip < pArray->m_mipLevels; ++iMip)
+				{
+					D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[iSlice * pArray->m_mipLevels + iMip];
+					pInitialData->pSysMem = pTex->m_apPixels[iMip];
+					pInitialData->SysMemPitch = CalculateRowPitch(CalculateMipDims(pArray->m_dims.x, iMip), pArray->m_format);
+					pInitialData->SysMemSlicePitch = 0;
+				}
+			}
+
+			if (slicesWithPixels == sliceCount)
+			{
+				CHECK_D3D(pDevice->CreateTexture2D(&texDesc, &aInitialData[0], &pArray->m_pTex));
+			}
+			else
+			{
+				CHECK_D3D(pDevice->CreateTexture2D(&texDesc, nullptr, &pArray->m_pTex));
+
+				comptr<ID3D11DeviceContext> pCtx;
+				pDevice->GetImmediateContext(&pCtx);
+				for (int iSlice = 0; iSlice < sliceCount; ++iSlice)
+				{
+					const Texture2D * pTex = pArray->m_apTex[iSlice];
+					for (int iMip = 0; iMip < pArray->m_mipLevels; ++iMip)
+					{
+						int iSubresource = iSlice * pArray->m_mipLevels + iMip;
+						const D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[iSubresource];
+						if (pInitialData->pSysMem)
+							pCtx->UpdateSubresource(pArray->m_pTex, iSubresource, nullptr, pInitialData->pSysMem, pInitialData->SysMemPitch, 0);
+						else
+							pCtx->CopySubresourceRegion(pArray->m_pTex, iSubresource, 0, 0, 0, pTex->m_pTex, iMip, nullptr);
+					}
+				}
+			}
+
+			CreateArraySrv(pDevice, pArray->m_pTex, pArray->m_format, pArray->m_mipLevels, sliceCount, &pArray->m_pSrv);
+
+			i64 bytesSlice = CalculateMipPyramidSizeInBytes(pArray->m_dims, pArray->m_format, pArray->m_mipLevels);
+			bytesPaddedSeparate += RoundUpToResourceAlignment(bytesSlice) * sliceCount;
+			bytesPaddedArrays += RoundUpToResourceAlignment(bytesSlice * sliceCount);
+
+			++m_stats.m_arrays;
+			m_stats.m_texturesGrouped += sliceCount;
+			m_stats.m_resourcesSaved += slicesWithPixels - 1;		// The rest keep their own
+			m_stats.m_bytesGrouped += bytesSlice * sliceCount;
+		}
+		m_stats.m_bytesPaddingSaved = bytesPaddedSeparate - bytesPaddedArrays;
+
+		LOG("Texture arrays: %d of %d textures packed into %d arrays, %d fewer resources; %0.1f MB grouped, ~%0.1f MB padding saved",
+			m_stats.m_texturesGrouped, m_stats.m_textures, m_stats.m_arrays, m_stats.m_resourcesSaved,
+			float(m_stats.m_bytesGrouped) / 1048576.0f, float(m_stats.m_bytesPaddingSaved) / 1048576.0f);
+	}
+
+	void TextureArrayLib::Reset()
+	{
+		m_arrays.clear();
+		m_slices.clear();
+		memset(&m_stats, 0, sizeof(m_stats));
+	}
+
+	int2 TextureArrayLib::Lookup(const Texture2D * pTex) const
+	{
+		auto iter = m_slices.find(pTex);
+		if (iter == m_slices.end())
+			return makeint2(-1);
+
+		return iter->second;
+	}
+
+	ID3D11ShaderResourceView * TextureArrayLib::GetSrv(ID3D11Device * pDevice, int iArray)
+	{
+		ASSERT_ERR(iArray >= 0 && iArray < int(m_arrays.size()));
+
+		Array * pArray = &m_arrays[iArray];
+		if (pArray->m_pTex)
+			return pArray->m_pSrv;
+
+		// The view holds a reference to the resource it was made from, so a re-created
+		// resource can never come back at the same address while we still hold the old view
+		Texture2D * pTex = pArray->m_apTex[0];
+		if (pArray->m_pTexViewed != pTex->m_pTex)
+		{
+			ASSERT_ERR(pDevice);
+			pArray->m_pSrv.release();
+			if (pTex->m_pTex)
+				CreateArraySrv(pDevice, pTex->m_pTex, pTex->m_format, -1, 1, &pArray->m_pSrv);
+			pArray->m_pTexViewed = pTex->m_pTex;
+		}
+
+		return pArray->m_pSrv;
+	}
+
+	void TextureArrayLib::AssignMaterialSlices(MaterialLib * pMtlLib) const
+	{
+		ASSERT_ERR(pMtlLib);
+
+		for (auto iter = pMtlLib->m_mtls.begin(), end = pMtlLib->m_mtls.end(); iter != end; ++iter)
+		{
+			Material * pMtl = &iter->second;
+			pMtl->m_sliceDiffuseColor = pMtl->m_pTexDiffuseColor ? Lookup(pMtl->m_pTexDiffuseColor) : makeint2(-1);
+			pMtl->m_sliceSpecColor = pMtl->m_pTexSpecColor ? Lookup(pMtl->m_pTexSpecColor) : makeint2(-1);
+			pMtl->m_sliceHeight = pMtl->m_pTexHeight ? Lookup(pMtl->m_pTexHeight) : makeint2(-1);
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+namespace Framework
+{
+	class MaterialLib;
+	class Texture2D;
+	class TextureLib;
+	class TextureStreamer;
+
+	// Texture arrays: textures that share a format, size and mip count are packed into one
+	// Texture2DArray per group, so a run of materials can keep the same SRVs bound and pick
+	// their textures by slice index in the shader.  A texture that shares its layout with no
+	// other is viewed as a one-slice array of its own resource, so shaders only ever see arrays.
+
+	struct TextureArrayStats
+	{
+		int		m_textures;				// Textures in the library, plus any extras
+		int		m_texturesGrouped;		// ...of which were packed into a multi-slice array
+		int		m_arrays;				// Multi-slice arrays created
+		int		m_resourcesSaved;		// Texture resources no longer created
+		i64		m_bytesGrouped;			// Texel data in the multi-slice arrays
+		i64		m_bytesPaddingSaved;	// Estimated allocation rounding no longer paid
+	};
+
+	class TextureArrayLib
+	{
+	public:
+		struct Array
+		{
+			int2								m_dims;
+			int									m_mipLevels;
+			DXGI_FORMAT							m_format;
+			std::vector<Texture2D *>			m_apTex;		// Source texture for each slice
+
+			// Multi-slice arrays own m_pTex; one-slice arrays view the texture's own resource,
+			// and remember which one so the view can follow it if it's re-created (e.g. streamed)
+			comptr<ID3D11Texture2D>				m_pTex;
+			comptr<ID3D11ShaderResourceView>	m_pSrv;
+			ID3D11Texture2D *					m_pTexViewed;
+		};
+
+		std::vector<Array>								m_arrays;
+		std::unordered_map<const Texture2D *, int2>		m_slices;	// Texture -> (array index, slice)
+		TextureArrayStats								m_stats;
+
+				TextureArrayLib();
+
+		// Sorts every texture in the library, plus the extras (e.g. fallback 1x1 textures),
+		// into arrays, and creates them on the GPU straight from the textures' pixel data;
+		// grouped textures don't get resources of their own, except ones with no pixel data
+		// (e.g. the 1x1s), which are copied in from the resources they already have.  If
+		// group is false, each texture is a one-slice array.  Textures pStreamer streams are
+		// always one-slice arrays, as they have no fixed mip chain; the rest are still grouped.
+		void	Init(
+					ID3D11Device * pDevice,
+					TextureLib * pTexLib,
+					Texture2D * const * apTexExtra,
+					int texExtraCount,
+					bool group,
+					const TextureStreamer * pStreamer = nullptr);
+		void	Reset();
+
+		// Returns (array index, slice), or (-1, -1) if the texture isn't in the library
+		int2	Lookup(const Texture2D * pTex) const;
+
+		// Re-creates a one-slice array's view first, if its texture's resource has changed
+		ID3D11ShaderResourceView * GetSrv(ID3D11Device * pDevice, int iArray);
+
+		// Rewrites each material's texture references to array indices and slices
+		void	AssignMaterialSlices(MaterialLib * pMtlLib) const;
+	};
+}
@@ -0,0 +1,253 @@
+#include "framework.h"
+
+namespace Framework
+{
+	int EstimateMipForUVDensity(
+		float uvDensity,
+		int2_arg texDims,
+		float distance,
+		float pixelsPerRadian)
+	{
+		// A texture with no UV variation looks the same at any level
+		int mipCoarsest = CalculateMipCount(texDims) - 1;
+		if (uvDensity <= 0.0f)
+			return mipCoarsest;
+
+		// Texels and pixels per world unit; the ratio is the footprint of a pixel in texels
+		float texelsPerUnit = uvDensity * float(maxComponent(texDims));
+		float pixelsPerUnit = pixelsPerRadian / max(distance, 1e-6f);
+		float texelsPerPixel = texelsPerUnit / pixelsPerUnit;
+		if (texelsPerPixel <= 1.0f)
+			return 0;
+
+		return min(int(floor(log2(texelsPerPixel))), mipCoarsest);
+	}
+
+	static i64 ChainSizeInBytes(const Texture2D * pTex, int mipMostDetailed)
+	{
+		return CalculateMipPyramidSizeInBytes(
+					CalculateMipDims(pTex->m_dims, mipMostDetailed),
+					pTex->m_format,
+					pTex->m_mipLevels - mipMostDetailed);
+	}
+
+
+
+	// TextureStreamer implementation
+
+	TextureStreamer::TextureStreamer()
+	:	m_budgetBytes(0),
+		m_frameCount(0),
+		m_stats()
+	{
+	}
+
+	void TextureStreamer::Init(
+		ID3D11DeviceContext * pCtx,
+		TextureLib * pTexLib,
+		i64 budgetBytes,
+		int tailDim /* = 64 */)
+	{
+		ASSERT_ERR(pTexLib);
+		ASSERT_ERR(budgetBytes > 0);
+		ASSERT_ERR(tailDim > 0);
+
+		Reset();
+		m_budgetBytes = budgetBytes;
+
+		for (auto iter = pTexLib->m_texs.begin(), end = pTexLib->m_texs.end(); iter != end; ++iter)
+		{
+			Texture2D * pTex = &iter->second;
+			if (pTex->m_mipLevels <= 0 || int(pTex->m_apPixels.size()) != pTex->m_mipLevels)
+				continue;
+
+			Entry entry = {};
+			entry.m_pTex = pTex;
+			entry.m_mipTail = max(0, log2_floor(maxComponent(pTex->m_dims)) - log2_floor(tailDim));
+			entry.m_mipTail = CalculateValidTopMip(pTex->m_dims, min(entry.m_mipTail, pTex->m_mipLevels - 1), pTex->m_format);
+			entry.m_mipWanted = entry.m_mipTail;
+			entry.m_frameLastWanted = -1;
+
+			// Upload the tail
+			i64 bytes;
+			if (pCtx)
+			{
+				bytes = pTex->SetResidentMips(pCtx, entry.m_mipTail);
+				entry.m_mipResident = pTex->m_mipResident;
+			}
+			else
+			{
+				bytes = ChainSizeInBytes(pTex, entry.m_mipTail);
+				entry.m_mipResident = entry.m_mipTail;
+			}
+			m_stats.m_bytesUploaded += bytes;
+			m_stats.m_bytesUploadedTail += bytes;
+			m_stats.m_bytesResident += ChainSizeInBytes(pTex, entry.m_mipResident);
+
+			m_entryIndices[pTex] = int(m_entries.size());
+			m_entries.push_back(entry);
+		}
+
+		m_stats.m_bytesResidentPeak = m_stats.m_bytesResident;
+
+		LOG("Texture streamer: %d textures, %0.1f MB of tails, budget %0.1f MB",
+			int(m_entries.size()), float(m_stats.m_bytesUploadedTail) / 1048576.0f, float(m_budgetBytes) / 1048576.0f);
+	}
+
+	void TextureStreamer::Reset()
+	{
+		m_entries.clear();
+		m_entryIndices.clear();
+		m_budgetBytes = 0;
+		m_frameCount = 0;
+		TextureStreamerStats statsZero = {};
+		m_stats = statsZero;
+	}
+
+	void TextureStreamer::BeginFrame()
+	{
+		++m_frameCount;
+	}
+
+	void TextureStreamer::RequestMip(const Texture2D * pTex, int mip)
+	{
+		if (!pTex)
+			return;
+
+		auto iter = m_entryIndices.find(pTex);
+		if (iter == m_entryIndices.end())
+			return;
+
+		Entry * pEntry = &m_entries[iter->second];
+		if (pEntry->m_frameLastWanted == m_frameCount)
+		{
+			pEntry->m_mipWanted = min(pEntry->m_mipWanted, mip);
+		}
+		else
+		{
+			pEntry->m_mipWanted = mip;
+			pEntry->m_frameLastWanted = m_frameCount;
+		}
+	}
+
+	void TextureStreamer::RequestMeshMips(
+		const Mesh * pMesh,
+		point3_arg posCamera,
+		float pixelsPerRadian)
+	{
+		ASSERT_ERR(pMesh);
+
+		for (int i = 0, c = int(pMesh->m_mtlRanges.size()); i < c; ++i)
+		{
+			const Mesh::MtlRange * pRange = &pMesh->m_mtlRanges[i];
+			const Material * pMtl = pRange->m_pMtl;
+			if (!pMtl)
+				continue;
+
+			// The nearest point of the range is where its textures need the most detail
+			float dist = distance(pRange->m_bounds, posCamera);
+
+			const Texture2D * apTex[] = { pMtl->m_pTexDiffuseColor, pMtl->m_pTexSpecColor, pMtl->m_pTexHeight, };
+			for (int j = 0; j < dim(apTex); ++j)
+			{
+				if (apTex[j])
+					RequestMip(apTex[j], EstimateMipForUVDensity(pRange->m_uvDensity, apTex[j]->m_dims, dist, pixelsPerRadian));
+			}
+		}
+	}
+
+	void TextureStreamer::Update(ID3D11DeviceContext * pCtx)
+	{
+		// Each texture's target is whatever's resident, plus any more detailed levels wanted this frame
+		i64 bytesTarget = 0;
+		for (int i = 0, c = int(m_entries.size()); i < c; ++i)
+		{
+			Entry * pEntry = &m_entries[i];
+			const Texture2D * pTex = pEntry->m_pTex;
+
+			int mipTarget = pEntry->m_mipResident;
+			if (pEntry->m_frameLastWanted == m_frameCount)
+				mipTarget = min(mipTarget, pEntry->m_mipWanted);
+
+			pEntry->m_mipTarget = CalculateValidTopMip(pTex->m_dims, max(mipTarget, 0), pTex->m_format);
+			bytesTarget += ChainSizeInBytes(pTex, pEntry->m_mipTarget);
+		}
+
+		// Enforce the budget by dropping high mips, one level at a time.  Levels not wanted this
+		// frame go first, from the texture wanted least recently; after that, the largest levels.
+		while (bytesTarget > m_budgetBytes)
+		{
+			Entry * pVictim = nullptr;
+			bool victimNeeded = false;
+			i64 bytesVictimTop = 0;
+			for (int i = 0, c = int(m_entries.size()); i < c; ++i)
+			{
+				Entry * pEntry = &m_entries[i];
+				if (pEntry->m_mipTarget >= pEntry->m_mipTail)
+					continue;
+
+				bool needed = (pEntry->m_frameLastWanted == m_frameCount && pEntry->m_mipTarget >= pEntry->m_mipWanted);
+				i64 bytesTop = CalculateMipSizeInBytes(pEntry->m_pTex->m_dims, pEntry->m_mipTarget, pEntry->m_pTex->m_format);
+				if (!pVictim ||
+					(!needed && victimNeeded) ||
+					(needed == victimNeeded &&
+						(pEntry->m_frameLastWanted < pVictim->m_frameLastWanted ||
+						 (pEntry->m_frameLastWanted == pVictim->m_frameLastWanted && bytesTop > bytesVictimTop))))
+				{
+					pVictim = pEntry;
+					victimNeeded = needed;
+					bytesVictimTop = bytesTop;
+				}
+			}
+			if (!pVictim)
+				break;
+
+			const Texture2D * pTex = pVictim->m_pTex;
+			int mipNew = pVictim->m_mipTarget + 1;
+			while (mipNew < pVictim->m_mipTail && CalculateValidTopMip(pTex->m_dims, mipNew, pTex->m_format) != mipNew)
+				++mipNew;
+
+			bytesTarget -= ChainSizeInBytes(pTex, pVictim->m_mipTarget) - ChainSizeInBytes(pTex, mipNew);
+			pVictim->m_mipTarget = mipNew;
+		}
+
+		// Apply the changes
+		m_stats.m_texturesWanted = 0;
+		m_stats.m_texturesSatisfied = 0;
+		for (int i = 0, c = int(m_entries.size()); i < c; ++i)
+		{
+			Entry * pEntry = &m_entries[i];
+			Texture2D * pTex = pEntry->m_pTex;
+
+			if (pEntry->m_mipTarget != pEntry->m_mipResident)
+			{
+				m_stats.m_bytesResident -= ChainSizeInBytes(pTex, pEntry->m_mipResident);
+
+				if (pCtx)
+				{
+					m_stats.m_bytesUploaded += pTex->SetResidentMips(pCtx, pEntry->m_mipTarget);
+					pEntry->m_mipResident = pTex->m_mipResident;
+				}
+				else
+				{
+					// Levels already resident get copied on the GPU; only the new ones are uploaded
+					for (int level = pEntry->m_mipTarget; level < pEntry->m_mipResident; ++level)
+						m_stats.m_bytesUploaded += CalculateMipSizeInBytes(pTex->m_dims, level, pTex->m_format);
+					pEntry->m_mipResident = pEntry->m_mipTarget;
+				}
+
+				m_stats.m_bytesResident += ChainSizeInBytes(pTex, pEntry->m_mipResident);
+				++m_stats.m_uploads;
+			}
+
+			if (pEntry->m_frameLastWanted == m_frameCount)
+			{
+				++m_stats.m_texturesWanted;
+				if (pEntry->m_mipResident <= pEntry->m_mipWanted)
+					++m_stats.m_texturesSatisfied;
+			}
+		}
+
+		m_stats.m_bytesResidentPeak = max(m_stats.m_bytesResidentPeak, m_stats.m_bytesResident);
+	}
+}
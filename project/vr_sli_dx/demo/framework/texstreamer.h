@@ -0,0 +1,78 @@
+#pragma once
+
+namespace Framework
+{
+	class Mesh;
+	class Texture2D;
+	class TextureLib;
+
+	// Texture streaming: each texture keeps a small mip tail resident on the GPU, and its more
+	// detailed levels are uploaded from the asset pack on demand.  Demand is a CPU-side estimate
+	// of the finest mip each material's textures can be sampled at, from the UV density of each
+	// material range and the camera's distance to its bounds.  Levels
+	// stay resident until a global budget on the total resident bytes is exceeded; then levels
+	// nobody currently wants are evicted first, from the textures wanted least recently.
+
+	// Estimate the finest mip level that can be sampled for a texture mapped at a given UV
+	// density (UV units per world unit, as in Mesh::MtlRange), seen face-on from a distance.
+	// Anything more detailed would be minified past one texel per pixel.
+	int EstimateMipForUVDensity(
+			float uvDensity,
+			int2_arg texDims,
+			float distance,
+			float pixelsPerRadian);
+
+	struct TextureStreamerStats
+	{
+		i64		m_bytesUploaded;		// Total since Init, including the tails
+		i64		m_bytesUploadedTail;	// Portion of the above spent on the initial tails
+		int		m_uploads;				// Number of times a texture's resident chain changed
+		i64		m_bytesResident;
+		i64		m_bytesResidentPeak;
+		int		m_texturesWanted;		// Textures requested in the last update
+		int		m_texturesSatisfied;	// ...of which had their wanted level resident
+	};
+
+	class TextureStreamer
+	{
+	public:
+				TextureStreamer();
+
+		// Makes every texture in the library streamable and uploads its tail.  If pCtx is null,
+		// nothing touches the GPU; residency is only simulated, with identical accounting.
+		void	Init(
+					ID3D11DeviceContext * pCtx,
+					TextureLib * pTexLib,
+					i64 budgetBytes,
+					int tailDim = 64);
+		void	Reset();
+
+		// Per-frame usage: BeginFrame, any number of requests, then Update
+		void	BeginFrame();
+		void	RequestMip(const Texture2D * pTex, int mip);
+		void	RequestMeshMips(
+					const Mesh * pMesh,
+					point3_arg posCamera,		// In the mesh's local space
+					float pixelsPerRadian);
+		void	Update(ID3D11DeviceContext * pCtx);
+
+		bool	IsStreaming(const Texture2D * pTex) const
+					{ return m_entryIndices.find(pTex) != m_entryIndices.end(); }
+
+		struct Entry
+		{
+			Texture2D *		m_pTex;
+			int				m_mipTail;			// Coarsest level at which the chain is always resident
+			int				m_mipResident;
+			int				m_mipWanted;		// Valid if m_frameLastWanted is the current frame
+			int				m_mipTarget;		// Scratch for Update
+			int				m_frameLastWanted;
+		};
+
+		std::vector<Entry>								m_entries;
+		std::unordered_map<const Texture2D *, int>		m_entryIndices;
+		i64												m_budgetBytes;
+		int												m_frameCount;
+		TextureStreamerStats							m_stats;
+	};
+}
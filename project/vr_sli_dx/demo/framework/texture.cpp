@@ -7,7 +7,8 @@ namespace Framework
 	Texture2D::Texture2D()
 	:	m_dims(makeint2(0)),
 		m_mipLevels(0),
-		m_format(DXGI_FORMAT_UNKNOWN)
+		m_format(DXGI_FORMAT_UNKNOWN),
+		m_mipResident(0)
 	{
 	}
 
@@ -21,6 +22,7 @@ namespace Framework
 		m_pTex.release();
 		m_pSrv.release();
 		m_pUav.release();
+		m_mipResident = 0;
 	}
 
 	void Texture2D::Init(
@@ -67,6 +69,7 @@ namespace Framework
 		m_dims = dims;
 		m_mipLevels = texDesc.MipLevels;
 		m_format = format;
+		m_mipResident = 0;
 	}
 
 	void Texture2D::UploadToGPU(
@@ -102,7 +105,7 @@ namespace Framework
 		{
 			D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[i];
 			pInitialData->pSysMem = m_apPixels[i];
-			pInitialData->SysMemPitch = CalculateMipDims(m_dims.x, i) * BitsPerPixel(m_format) / 8;
+			pInitialData->SysMemPitch = CalculateRowPitch(CalculateMipDims(m_dims.x, i), m_format);
 			pInitialData->SysMemSlicePitch = 0;
 		}
 
@@ -117,6 +120,86 @@ namespace Framework
 			D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = { m_format, D3D11_UAV_DIMENSION_TEXTURE2D, };
 			CHECK_D3D(pDevice->CreateUnorderedAccessView(m_pTex, &uavDesc, &m_pUav));
 		}
+
+		m_mipResident = 0;
+	}
+
+	int Texture2D::SetResidentMips(
+		ID3D11DeviceContext * pCtx,
+		int mipMostDetailed,
+		int flags /* = TEXFLAG_Default */)
+	{
+		ASSERT_ERR(pCtx);
+		ASSERT_ERR(int(m_apPixels.size()) == m_mipLevels);
+		ASSERT_ERR(mipMostDetailed >= 0 && mipMostDetailed < m_mipLevels);
+
+		mipMostDetailed = CalculateValidTopMip(m_dims, mipMostDetailed, m_format);
+		if (m_pTex && mipMostDetailed == m_mipResident)
+			return 0;
+
+		comptr<ID3D11Device> pDevice;
+		pCtx->GetDevice(&pDevice);
+
+		// Always map the format to its typeless version, if possible;
+		// enables views of other formats to be created if desired
+		DXGI_FORMAT formatTex = FindTypelessFormat(m_format);
+		if (formatTex == DXGI_FORMAT_UNKNOWN)
+			formatTex = m_format;
+
+		int2 dimsResident = CalculateMipDims(m_dims, mipMostDetailed);
+		int mipLevelsResident = m_mipLevels - mipMostDetailed;
+		D3D11_TEXTURE2D_DESC texDesc =
+		{
+			dimsResident.x, dimsResident.y,
+			mipLevelsResident, 1,
+			formatTex,
+			{ 1, 0 },
+			D3D11_USAGE_DEFAULT,
+			D3D11_BIND_SHADER_RESOURCE,
+			0, 0,
+		};
+		if (flags & TEXFLAG_EnableUAV)
+		{
+			texDesc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
+		}
+
+		comptr<ID3D11Texture2D> pTexNew;
+		CHECK_D3D(pDevice->CreateTexture2D(&texDesc, nullptr, &pTexNew));
+
+		// Fill in each level, from the old texture if it has it, else from the asset pack
+		int bytesUploaded = 0;
+		for (int i = 0; i < mipLevelsResident; ++i)
+		{
+			int level = mipMostDetailed + i;
+			if (m_pTex && level >= m_mipResident)
+			{
+				pCtx->CopySubresourceRegion(pTexNew, i, 0, 0, 0, m_pTex, level - m_mipResident, nullptr);
+			}
+			else
+			{
+				pCtx->UpdateSubresource(
+						pTexNew, i, nullptr, m_apPixels[level],
+						CalculateRowPitch(CalculateMipDims(m_dims.x, level), m_format), 0);
+				bytesUploaded += CalculateMipSizeInBytes(m_dims, level, m_format);
+			}
+		}
+
+		m_pTex = pTexNew;
+		m_pSrv.release();
+		m_pUav.release();
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = { m_format, D3D11_SRV_DIMENSION_TEXTURE2D, };
+		srvDesc.Texture2D.MipLevels = mipLevelsResident;
+		CHECK_D3D(pDevice->CreateShaderResourceView(m_pTex, &srvDesc, &m_pSrv));
+
+		if (flags & TEXFLAG_EnableUAV)
+		{
+			D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = { m_format, D3D11_UAV_DIMENSION_TEXTURE2D, };
+			CHECK_D3D(pDevice->CreateUnorderedAccessView(m_pTex, &uavDesc, &m_pUav));
+		}
+
+		m_mipResident = mipMostDetailed;
+		return bytesUploaded;
 	}
 
 	void Texture2D::Readback(
@@ -126,7 +209,7 @@ namespace Framework
 	{
 		ASSERT_ERR(m_pTex);
 		ASSERT_ERR(pCtx);
-		ASSERT_ERR(level >= 0 && level < m_mipLevels);
+		ASSERT_ERR(level >= m_mipResident && level < m_mipLevels);
 		ASSERT_ERR(pDataOut);
 
 		comptr<ID3D11Device> pDevice;
@@ -149,16 +232,17 @@ namespace Framework
 		pDevice->CreateTexture2D(&texDesc, nullptr, &pTexStaging);
 
 		// Copy the data to the staging resource
-		pCtx->CopySubresourceRegion(pTexStaging, 0, 0, 0, 0, m_pTex, level, nullptr);
+		pCtx->CopySubresourceRegion(pTexStaging, 0, 0, 0, 0, m_pTex, level - m_mipResident, nullptr);
 
 		// Map the staging resource
 		D3D11_MAPPED_SUBRESOURCE mapped = {};
 		CHECK_D3D(pCtx->Map(pTexStaging, 0, D3D11_MAP_READ, 0, &mapped));
 
 		// Copy the data out row by row, in case the pitch is different
-		int rowSize = mipDims.x * BitsPerPixel(m_format) / 8;
+		int rowSize = CalculateRowPitch(mipDims.x, m_format);
+		int rows = IsBlockCompressed(m_format) ? (mipDims.y + 3) / 4 : mipDims.y;
 		ASSERT_ERR(mapped.RowPitch >= UINT(rowSize));
-		for (int y = 0; y < mipDims.y; ++y)
+		for (int y = 0; y < rows; ++y)
 		{
 			memcpy(
 				advanceBytes(pDataOut, y * rowSize),
@@ -276,7 +360,7 @@ namespace Framework
 			{
 				D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[face * m_mipLevels + level];
 				pInitialData->pSysMem = m_apPixels[face * m_mipLevels + level];
-				pInitialData->SysMemPitch = CalculateMipDims(m_cubeSize, level) * BitsPerPixel(m_format) / 8;
+				pInitialData->SysMemPitch = CalculateRowPitch(CalculateMipDims(m_cubeSize, level), m_format);
 				pInitialData->SysMemSlicePitch = 0;
 			}
 		}
@@ -448,8 +532,8 @@ namespace Framework
 			int3 mipDims = CalculateMipDims(m_dims, i);
 			D3D11_SUBRESOURCE_DATA * pInitialData = &aInitialData[i];
 			pInitialData->pSysMem = m_apPixels[i];
-			pInitialData->SysMemPitch = mipDims.x * BitsPerPixel(m_format) / 8;
-			pInitialData->SysMemSlicePitch = pInitialData->SysMemPitch * mipDims.y;
+			pInitialData->SysMemPitch = CalculateRowPitch(mipDims.x, m_format);
+			pInitialData->SysMemSlicePitch = CalculateImageSizeInBytes(mipDims.xy, m_format);
 		}
 
 		CHECK_D3D(pDevice->CreateTexture3D(&texDesc, &aInitialData[0], &m_pTex));
@@ -652,7 +736,7 @@ namespace Framework
 			0, 0,
 		};
 
-		D3D11_SUBRESOURCE_DATA initialData = { pPixels, dims.x * BitsPerPixel(format) / 8 };
+		D3D11_SUBRESOURCE_DATA initialData = { pPixels, UINT(CalculateRowPitch(dims.x, format)) };
 		comptr<ID3D11Texture2D> pTex;
 		CHECK_D3D(pDevice->CreateTexture2D(&texDesc, &initialData, &pTex));
 
@@ -1105,6 +1189,27 @@ namespace Framework
 		return s_typelessFormat[format];
 	}
 
+	bool IsBlockCompressed(DXGI_FORMAT format)
+	{
+		return (format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM) ||
+			   (format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB);
+	}
+
+	int CalculateRowPitch(int width, DXGI_FORMAT format)
+	{
+		// A 4x4 block holds 16 texels' worth of bits
+		if (IsBlockCompressed(format))
+			return ((width + 3) / 4) * BitsPerPixel(format) * 2;
+
+		return width * BitsPerPixel(format) / 8;
+	}
+
+	int CalculateImageSizeInBytes(int2_arg dims, DXGI_FORMAT format)
+	{
+		int rows = IsBlockCompressed(format) ? (dims.y + 3) / 4 : dims.y;
+		return rows * CalculateRowPitch(dims.x, format);
+	}
+
 
 
 	// Helper functions for saving out screenshots of textures
@@ -6,9 +6,15 @@ namespace Framework
 	const char * NameOfFormat(DXGI_FORMAT format);
 	int BitsPerPixel(DXGI_FORMAT format);
 	DXGI_FORMAT FindTypelessFormat(DXGI_FORMAT format);
+	bool IsBlockCompressed(DXGI_FORMAT format);
+
+	// Bytes per row of texels, or per row of 4x4 blocks for block-compressed formats
+	int CalculateRowPitch(int width, DXGI_FORMAT format);
+	int CalculateImageSizeInBytes(int2_arg dims, DXGI_FORMAT format);
 
 	// Utility functions for counting mips
-	// Note: these don't take into account minimum block sizes for compressed formats.
+	// Note: the mip counts and dims don't take into account minimum block sizes for compressed
+	// formats, but the sizes in bytes do.
 
 	inline int CalculateMipCount(int size)
 		{ return log2_floor(size) + 1; }
@@ -25,11 +31,27 @@ namespace Framework
 		{ return max(makeint3(baseDims.x >> level, baseDims.y >> level, baseDims.z >> level), makeint3(1)); }
 
 	inline int CalculateMipSizeInBytes(int baseDim, int level, DXGI_FORMAT format)
-		{ return square(CalculateMipDims(baseDim, level)) * BitsPerPixel(format); }
+		{ return CalculateImageSizeInBytes(makeint2(CalculateMipDims(baseDim, level)), format); }
 	inline int CalculateMipSizeInBytes(int2_arg baseDims, int level, DXGI_FORMAT format)
-		{ int2 mipDims = CalculateMipDims(baseDims, level); return mipDims.x * mipDims.y * BitsPerPixel(format); }
+		{ return CalculateImageSizeInBytes(CalculateMipDims(baseDims, level), format); }
 	inline int CalculateMipSizeInBytes(int3_arg baseDims, int level, DXGI_FORMAT format)
-		{ int3 mipDims = CalculateMipDims(baseDims, level); return mipDims.x * mipDims.y * mipDims.z * BitsPerPixel(format); }
+		{ int3 mipDims = CalculateMipDims(baseDims, level); return CalculateImageSizeInBytes(mipDims.xy, format) * mipDims.z; }
+
+	// Level that can serve as the top of a partial mip chain: block-compressed textures need
+	// whole blocks there, so step toward more detailed levels until the dims are multiples of 4
+	inline int CalculateValidTopMip(int2_arg baseDims, int level, DXGI_FORMAT format)
+	{
+		if (IsBlockCompressed(format))
+		{
+			for (; level > 0; --level)
+			{
+				int2 mipDims = CalculateMipDims(baseDims, level);
+				if (((mipDims.x | mipDims.y) & 3) == 0)
+					break;
+			}
+		}
+		return level;
+	}
 
 	inline int CalculateMipPyramidSizeInBytes(int baseDim, DXGI_FORMAT format, int mipLevels = -1)
 	{
@@ -86,11 +108,17 @@ namespace Framework
 		comptr<ID3D11ShaderResourceView>	m_pSrv;
 		comptr<ID3D11UnorderedAccessView>	m_pUav;
 
+		// Most detailed mip level present on the GPU; level 0 of m_pTex is this level of
+		// the full chain.  Zero unless the texture is being streamed.
+		int							m_mipResident;
+
 				Texture2D();
 		void	Reset();
 
 		int		SizeInBytes() const
 					{ return CalculateMipPyramidSizeInBytes(m_dims, m_format, m_mipLevels); }
+		int		ResidentSizeInBytes() const
+					{ return m_pTex ? CalculateMipPyramidSizeInBytes(CalculateMipDims(m_dims, m_mipResident), m_format, m_mipLevels - m_mipResident) : 0; }
 
 		// Creates a texture that exists only on the GPU, not backed by asset data
 		void	Init(
@@ -104,6 +132,15 @@ namespace Framework
 					ID3D11Device * pDevice,
 					int flags = TEXFLAG_Default);
 
+		// Re-creates the texture on the GPU with only levels mipMostDetailed and below.
+		// Levels already resident are copied on the GPU; the rest come from m_apPixels.
+		// Block-compressed textures may keep a more detailed level than requested, since
+		// their top level must be a whole number of blocks.  Returns bytes uploaded.
+		int		SetResidentMips(
+					ID3D11DeviceContext * pCtx,
+					int mipMostDetailed,
+					int flags = TEXFLAG_Default);
+
 		// Read back the data to main memory - you're responsible for allocing enough
 		void	Readback(
 					ID3D11DeviceContext * pCtx,
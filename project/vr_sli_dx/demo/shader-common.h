@@ -80,6 +80,15 @@ struct Vertex
 	float4		m_tangent	: TANGENT;
 };
 
+// Per-instance transform, matching affine3 in C++ (row-vector math)
+struct Instance
+{
+	float3		m_linear0		: INSTANCE_LINEAR0;
+	float3		m_linear1		: INSTANCE_LINEAR1;
+	float3		m_linear2		: INSTANCE_LINEAR2;
+	float3		m_translation	: INSTANCE_TRANSLATION;
+};
+
 cbuffer CBFrame : CB_FRAME					// matches struct CBFrame in warping_testbed.cpp
 {
 	float4x4	g_matWorldToClip;
@@ -96,6 +105,12 @@ cbuffer CBFrame : CB_FRAME					// matches struct CBFrame in warping_testbed.cpp
 	float		g_exposure;					// Exposure multiplier
 }
 
+cbuffer CBMaterial : CB_MATERIAL			// matches struct CBMaterial in vr_sli_demo.cpp
+{
+	float		g_sliceDiffuse;				// Slices of the material's textures in the bound texture arrays
+	float		g_sliceNormal;				// ...
+}
+
 cbuffer CBDebug : CB_DEBUG			// matches struct CBDebug in warping_testbed.cpp
 {
 	float		g_debugKey;			// Mapped to spacebar - 0 if up, 1 if down
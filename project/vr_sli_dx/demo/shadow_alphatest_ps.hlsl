@@ -34,13 +34,13 @@
 
 #include "shader-common.h"
 
-Texture2D<float4> g_texDiffuse : TEX_DIFFUSE;
+Texture2DArray<float4> g_texDiffuse : TEX_DIFFUSE;
 SamplerState g_ss : SAMP_DEFAULT;
 
 void main(in Vertex i_vtx)
 {
 	float2 uv = i_vtx.m_uv;
-	float4 diffuseTex = g_texDiffuse.Sample(g_ss, uv);
+	float4 diffuseTex = g_texDiffuse.Sample(g_ss, float3(uv, g_sliceDiffuse));
 	if (diffuseTex.a < 0.5)
 		discard;
 }
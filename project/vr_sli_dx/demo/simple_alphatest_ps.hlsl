@@ -34,8 +34,8 @@
 
 #include "shader-common.h"
 
-Texture2D<float4> g_texDiffuse : TEX_DIFFUSE;
-Texture2D<float3> g_texDDN : TEX_NORMAL;
+Texture2DArray<float4> g_texDiffuse : TEX_DIFFUSE;
+Texture2DArray<float3> g_texDDN : TEX_NORMAL;
 SamplerState g_ss : SAMP_DEFAULT;
 
 Texture2D<float> g_texShadowMap : TEX_SHADOW;
@@ -109,7 +109,7 @@ void main(
 
 	float3 vecNormal_worldSpace = normalGeom;
 	
-	float3 vecNormal_tangentSpace = g_texDDN.Sample(g_ss, uv).xyz;
+	float3 vecNormal_tangentSpace = g_texDDN.Sample(g_ss, float3(uv, g_sliceNormal)).xyz;
 	vecNormal_tangentSpace = vecNormal_tangentSpace * 2.0 - 1.0;
 
 	float3x3 matTangentToWorld = float3x3(
@@ -120,7 +120,7 @@ void main(
 
 	vecNormal_worldSpace = normalize(mul(vecNormal_tangentSpace, matTangentToWorld));
 
-	float4 diffuseTex = g_texDiffuse.Sample(g_ss, uv);
+	float4 diffuseTex = g_texDiffuse.Sample(g_ss, float3(uv, g_sliceDiffuse));
 	if (diffuseTex.a < 0.5)
 		discard;
 
@@ -34,8 +34,8 @@
 
 #include "shader-common.h"
 
-Texture2D<float3> g_texDiffuse : TEX_DIFFUSE;
-Texture2D<float3> g_texDDN : TEX_NORMAL;
+Texture2DArray<float3> g_texDiffuse : TEX_DIFFUSE;
+Texture2DArray<float3> g_texDDN : TEX_NORMAL;
 SamplerState g_ss : SAMP_DEFAULT;
 
 Texture2D<float> g_texShadowMap : TEX_SHADOW;
@@ -109,7 +109,7 @@ void main(
 
 	float3 vecNormal_worldSpace = normalGeom;
 	
-	float3 vecNormal_tangentSpace = g_texDDN.Sample(g_ss, uv).xyz;
+	float3 vecNormal_tangentSpace = g_texDDN.Sample(g_ss, float3(uv, g_sliceNormal)).xyz;
 	vecNormal_tangentSpace = vecNormal_tangentSpace * 2.0 - 1.0;
 
 	float3x3 matTangentToWorld = float3x3(
@@ -124,7 +124,7 @@ void main(
 	float shadow = EvaluateShadowPCF8(i_uvzwShadow, vecNormal_worldSpace);
 
 	// Evaluate diffuse lighting
-	float3 diffuseColor = g_texDiffuse.Sample(g_ss, uv);
+	float3 diffuseColor = g_texDiffuse.Sample(g_ss, float3(uv, g_sliceDiffuse));
 	float3 diffuseLight = shadow * g_rgbDirectionalLight * saturate(dot(vecNormal_worldSpace, g_vecDirectionalLight));
 
 	// Simple ramp ambient
@@ -0,0 +1,1156 @@
+#include <framework.h>
+#include <asset-internal.h>
+#include <stb_image.h>
+#include <stb_image_resize.h>
+#include <cstdio>
+#include <limits>
+
+// Tests and benchmarks for the framework and util libraries, using only their public API.
+// Run with no arguments to run them all, or name the ones to run on the command line.
+// Each one logs its measurements, and fails if anything is outside its tolerance; the exit
+// code is the number of failures.
+
+using namespace Framework;
+
+namespace
+{
+	int s_errorCount = 0;
+
+	void LogToStdout(const char * message)
+	{
+		fputs(message, stdout);
+	}
+
+	void CountError(const char * message)
+	{
+		fprintf(stderr, "%s\n", message);
+		++s_errorCount;
+	}
+
+	// Milliseconds between two QueryPerformanceCounter timestamps
+	float ElapsedMs(i64 timestampStart, i64 timestampEnd)
+	{
+		i64 frequency;
+		QueryPerformanceFrequency((LARGE_INTEGER *)&frequency);
+		return 1000.0f * float(timestampEnd - timestampStart) / float(frequency);
+	}
+
+	i64 Timestamp()
+	{
+		i64 timestamp;
+		QueryPerformanceCounter((LARGE_INTEGER *)&timestamp);
+		return timestamp;
+	}
+
+
+
+	// Tangent frames: compares AssetCompiler::GenerateTangentFrames, which works on four
+	// triangles at a time with SSE and gathers onto verts, against a straightforward scalar
+	// version that scatters each triangle's frame onto its verts in turn, and times both.
+
+	// Builds a bumpy grid with a mirrored UV seam down the middle (so both handednesses occur)
+	// and a band of triangles with degenerate UVs (so the fallback tangents get used)
+	void BuildTangentTestMesh(
+		int cellsPerSide,
+		std::vector<Vertex> * pVertsOut,
+		std::vector<int> * pIndicesOut)
+	{
+		RNG rng(47);
+		int vertsPerSide = cellsPerSide + 1;
+
+		pVertsOut->resize(vertsPerSide * vertsPerSide);
+		for (int z = 0; z < vertsPerSide; ++z)
+		{
+			for (int x = 0; x < vertsPerSide; ++x)
+			{
+				Vertex * pVert = &(*pVertsOut)[z * vertsPerSide + x];
+				float fx = float(x) / float(cellsPerSide);
+				float fz = float(z) / float(cellsPerSide);
+				pVert->m_pos = makepoint3(fx, 0.05f * sinf(40.0f * fx) * cosf(30.0f * fz) + rng.randFloat(0.0f, 0.002f), fz);
+				pVert->m_normal = makefloat3(0.0f);
+				pVert->m_uv = makefloat2(4.0f * abs(fx - 0.5f), 4.0f * fz);
+				if (z == vertsPerSide / 3)
+					pVert->m_uv.y = 4.0f * float(vertsPerSide / 3 + 1) / float(cellsPerSide);
+#if VERTEX_TANGENT
+				pVert->m_tangent = makefloat4(0.0f);
+#endif
+			}
+		}
+
+		pIndicesOut->clear();
+		pIndicesOut->reserve(cellsPerSide * cellsPerSide * 6);
+		for (int z = 0; z < cellsPerSide; ++z)
+		{
+			for (int x = 0; x < cellsPerSide; ++x)
+			{
+				int i00 = z * vertsPerSide + x;
+				int i10 = i00 + 1;
+				int i01 = i00 + vertsPerSide;
+				int i11 = i01 + 1;
+				int aIdx[] = { i00, i01, i10, i10, i01, i11 };
+				pIndicesOut->insert(pIndicesOut->end(), aIdx, aIdx + dim(aIdx));
+			}
+		}
+	}
+
+	void GenerateTangentFramesScalar(std::vector<Vertex> * pVerts, const std::vector<int> & indices)
+	{
+		std::vector<Vertex> & verts = *pVerts;
+
+		for (int i = 0, c = int(indices.size()); i < c; i += 3)
+		{
+			const int * pIdx = &indices[i];
+			float3 normal = normalize(cross(verts[pIdx[1]].m_pos - verts[pIdx[0]].m_pos, verts[pIdx[2]].m_pos - verts[pIdx[0]].m_pos));
+			for (int j = 0; j < 3; ++j)
+				verts[pIdx[j]].m_normal += normal;
+		}
+
+		for (int i = 0, c = int(verts.size()); i < c; ++i)
+			verts[i].m_normal = normalize(verts[i].m_normal);
+
+#if VERTEX_TANGENT
+		std::vector<float3> tangents(verts.size(), makefloat3(0.0f));
+		std::vector<float3> bitangents(verts.size(), makefloat3(0.0f));
+		for (int i = 0, c = int(indices.size()); i < c; i += 3)
+		{
+			const int * pIdx = &indices[i];
+			float3 edge0 = verts[pIdx[1]].m_pos - verts[pIdx[0]].m_pos;
+			float3 edge1 = verts[pIdx[2]].m_pos - verts[pIdx[0]].m_pos;
+			float3 normal = cross(edge0, edge1);
+			float3x3 matUnitToPosition = makefloat3x3(edge0, edge1, normal);
+
+			float3x3 matUnitToUV = float3x3::identity();
+			matUnitToUV[0].xy = verts[pIdx[1]].m_uv - verts[pIdx[0]].m_uv;
+			matUnitToUV[1].xy = verts[pIdx[2]].m_uv - verts[pIdx[0]].m_uv;
+
+			float3 tangent, bitangent;
+			if (determinant(matUnitToUV) != 0.0f)
+			{
+				float3x3 matUVToPosition = inverse(matUnitToUV) * matUnitToPosition;
+				tangent = normalize(matUVToPosition[0]);
+				bitangent = normalize(matUVToPosition[1]);
+			}
+			else
+			{
+				tangent = normalize(edge0);
+				bitangent = normalize(cross(normal, tangent));
+			}
+
+			for (int j = 0; j < 3; ++j)
+			{
+				if (length(tangents[pIdx[j]]) == 0.0f || dot(tangents[pIdx[j]], tangent) > 0.0f)
+					tangents[pIdx[j]] += tangent;
+				if (length(bitangents[pIdx[j]]) == 0.0f || dot(bitangents[pIdx[j]], bitangent) > 0.0f)
+					bitangents[pIdx[j]] += bitangent;
+			}
+		}
+
+		for (int i = 0, c = int(verts.size()); i < c; ++i)
+		{
+			float3 normal = verts[i].m_normal;
+			float3 tangent = normalize(tangents[i]);
+			tangent = normalize(tangent - normal * dot(normal, tangent));
+			float handedness = (dot(cross(normal, tangent), normalize(bitangents[i])) < 0.0f) ? -1.0f : 1.0f;
+			verts[i].m_tangent = makefloat4(tangent, handedness);
+		}
+#endif
+	}
+
+	bool TestTangentFrames()
+	{
+		// Reordering the sums and the closed-form UV inverse only move the results by a few ulps
+		static const float s_tolerance = 1e-4f;
+
+		std::vector<Vertex> vertsRef;
+		std::vector<int> indices;
+		BuildTangentTestMesh(700, &vertsRef, &indices);
+		std::vector<Vertex> verts = vertsRef;
+
+		i64 timestampStart = Timestamp();
+		GenerateTangentFramesScalar(&vertsRef, indices);
+		i64 timestampScalar = Timestamp();
+		AssetCompiler::GenerateTangentFrames(&verts, &indices, false);
+		i64 timestampSIMD = Timestamp();
+
+		float maxErrNormal = 0.0f;
+		float maxErrTangent = 0.0f;
+		int handednessMismatches = 0;
+		for (int i = 0, c = int(verts.size()); i < c; ++i)
+		{
+			maxErrNormal = max(maxErrNormal, maxComponent(abs(verts[i].m_normal - vertsRef[i].m_normal)));
+#if VERTEX_TANGENT
+			maxErrTangent = max(maxErrTangent, maxComponent(abs(verts[i].m_tangent.xyz - vertsRef[i].m_tangent.xyz)));
+			if (verts[i].m_tangent.w != vertsRef[i].m_tangent.w)
+				++handednessMismatches;
+#endif
+		}
+
+		LOG("Tangent frames: %d verts, %d tris; scalar %0.1f ms, SIMD on %d threads %0.1f ms",
+			int(verts.size()), int(indices.size()) / 3,
+			ElapsedMs(timestampStart, timestampScalar), numHardwareThreads(), ElapsedMs(timestampScalar, timestampSIMD));
+		LOG("Tangent frames: max error %g in normals, %g in tangents; %d handedness mismatches",
+			maxErrNormal, maxErrTangent, handednessMismatches);
+
+		return maxErrNormal <= s_tolerance && maxErrTangent <= s_tolerance && handednessMismatches == 0;
+	}
+
+
+
+	// sRGB spans: checks the span conversions exhaustively against the scalar ones and a
+	// double-precision reference, and times both.
+
+	bool TestSRGBSpans()
+	{
+		// Encoding is documented to be within this many codes of the exact value
+		static const double s_encodeErrMax = 0.6;
+
+		// Decoding must match the scalar conversion exactly, and every code must round-trip
+		byte codes[256];
+		byte4 pixels[256];
+		for (int i = 0; i < 256; ++i)
+		{
+			codes[i] = byte(i);
+			pixels[i] = makebyte4(byte(i), byte(255 - i), byte(i ^ 0x5a), byte(i));
+		}
+
+		float linear[256];
+		rgba texels[256];
+		toLinearSpan(codes, 256, linear);
+		toLinearSpan(pixels, 256, texels);
+
+		int decodeMismatches = 0;
+		for (int i = 0; i < 256; ++i)
+		{
+			if (linear[i] != toLinear(float(i) / 255.0f))
+				++decodeMismatches;
+		}
+
+		byte codesOut[256];
+		byte4 pixelsOut[256];
+		toSRGBSpan(linear, 256, codesOut);
+		toSRGBSpan(texels, 256, pixelsOut);
+
+		int roundTripMismatches = 0;
+		for (int i = 0; i < 256; ++i)
+		{
+			if (codesOut[i] != codes[i] || any(pixelsOut[i] != pixels[i]))
+				++roundTripMismatches;
+		}
+		LOG("sRGB spans: %d decode mismatches, %d round-trip mismatches of 256 codes",
+			decodeMismatches, roundTripMismatches);
+
+		// Encode accuracy against a double-precision reference, over a sweep of every 64th
+		// float in [0, 1], including the odd lengths that end in the leftover path
+		std::vector<float> sweep;
+		for (uint bits = 0; bits <= 0x3f800000; bits += 64)
+		{
+			float f;
+			memcpy(&f, &bits, sizeof(f));
+			sweep.push_back(f);
+		}
+		std::vector<byte> sweepCodes(sweep.size());
+		toSRGBSpan(&sweep[0], int(sweep.size()), &sweepCodes[0]);
+
+		double errMax = 0.0;
+		int offByMoreThanOne = 0, differFromScalar = 0;
+		for (int i = 0, c = int(sweep.size()); i < c; ++i)
+		{
+			double x = sweep[i];
+			double exact = 255.0 * ((x <= 0.0031308) ? x * 12.92 : 1.055 * ::pow(x, 1.0 / 2.4) - 0.055);
+			errMax = max(errMax, abs(double(sweepCodes[i]) - exact));
+			if (abs(double(sweepCodes[i]) - exact) > 1.0)
+				++offByMoreThanOne;
+			if (sweepCodes[i] != byte(clamp(round(toSRGB(sweep[i]) * 255.0f), 0, 255)))
+				++differFromScalar;
+		}
+		LOG("sRGB spans: %d values encoded, max error %0.3f codes, %d off by more than 1, %d differ from scalar rounding",
+			int(sweep.size()), errMax, offByMoreThanOne, differFromScalar);
+
+		// Out-of-range values are clamped
+		float inf = std::numeric_limits<float>::infinity();
+		float edges[7] = { std::numeric_limits<float>::quiet_NaN(), -inf, -1.0f, 0.0f, 1.0f, 2.0f, inf };
+		byte edgesExpected[7] = { 0, 0, 0, 0, 255, 255, 255 };
+		byte edgesOut[7];
+		toSRGBSpan(edges, 7, edgesOut);
+		bool edgesMatch = (memcmp(edgesOut, edgesExpected, sizeof(edgesOut)) == 0);
+
+		// Throughput, against the scalar conversions
+		static const int s_benchCount = 1 << 20;
+		static const int s_benchPasses = 20;
+		std::vector<float> benchLinear(s_benchCount);
+		std::vector<byte> benchCodes(s_benchCount);
+		for (int i = 0; i < s_benchCount; ++i)
+			benchCodes[i] = byte((uint(i) * 7919) >> 3);
+
+		float msScalarDecode = 0.0f, msSpanDecode = 0.0f, msScalarEncode = 0.0f, msSpanEncode = 0.0f;
+		u32 checksum = 0;
+		for (int pass = 0; pass < s_benchPasses; ++pass)
+		{
+			i64 timestamp0 = Timestamp();
+			for (int i = 0; i < s_benchCount; ++i)
+				benchLinear[i] = toLinear(float(benchCodes[i]) / 255.0f);
+			i64 timestamp1 = Timestamp();
+			for (int i = 0; i < s_benchCount; ++i)
+				benchCodes[i] = byte(clamp(round(toSRGB(benchLinear[i]) * 255.0f), 0, 255));
+			i64 timestamp2 = Timestamp();
+			toLinearSpan(&benchCodes[0], s_benchCount, &benchLinear[0]);
+			i64 timestamp3 = Timestamp();
+			toSRGBSpan(&benchLinear[0], s_benchCount, &benchCodes[0]);
+			i64 timestamp4 = Timestamp();
+
+			checksum += benchCodes[pass];
+			msScalarDecode += ElapsedMs(timestamp0, timestamp1);
+			msScalarEncode += ElapsedMs(timestamp1, timestamp2);
+			msSpanDecode += ElapsedMs(timestamp2, timestamp3);
+			msSpanEncode += ElapsedMs(timestamp3, timestamp4);
+		}
+
+		float megaValues = float(s_benchCount) * s_benchPasses * 1e-6f;
+		LOG("sRGB spans: decode %0.0f Mvalues/s (scalar %0.0f), encode %0.0f Mvalues/s (scalar %0.0f) [checksum %u]",
+			megaValues / (msSpanDecode * 1e-3f), megaValues / (msScalarDecode * 1e-3f),
+			megaValues / (msSpanEncode * 1e-3f), megaValues / (msScalarEncode * 1e-3f),
+			checksum);
+
+		return decodeMismatches == 0 && roundTripMismatches == 0 &&
+				errMax <= s_encodeErrMax && offByMoreThanOne == 0 && edgesMatch;
+	}
+
+
+
+	// Mip filters: builds a few textures' chains with every MIPF, timing each, and measures
+	// how far the successive box and Kaiser chains stray from resampling each level from the
+	// source.  Paths are relative to the demo directory.
+
+	struct MipTestTexture
+	{
+		const char *	m_path;
+		bool			m_sRGB;
+	};
+
+	const MipTestTexture s_mipTestTextures[] =
+	{
+		{ "crytek-sponza/textures/sponza_arch_diff.tga",		true },
+		{ "crytek-sponza/textures/sponza_thorn_diff.tga",		true },
+		{ "crytek-sponza/textures/sponza_column_a_diff.tga",	true },
+		{ "crytek-sponza/textures/spnza_bricks_a_ddn.tga",		false },
+		{ "crytek-sponza/textures/chain_texture_mask.tga",		false },
+	};
+
+	// Same resampling as the texture compiler's, via stb_image_resize
+	void ResampleImage(
+		const byte4 * pPixelsSrc,
+		int2_arg dimsSrc,
+		byte4 * pPixelsDst,
+		int2_arg dimsDst,
+		bool sRGB)
+	{
+		if (sRGB)
+		{
+			CHECK_ERR(stbir_resize_uint8_srgb(
+						(const byte *)pPixelsSrc, dimsSrc.x, dimsSrc.y, 0,
+						(byte *)pPixelsDst, dimsDst.x, dimsDst.y, 0,
+						4, 3, 0));
+		}
+		else
+		{
+			CHECK_ERR(stbir_resize_uint8(
+						(const byte *)pPixelsSrc, dimsSrc.x, dimsSrc.y, 0,
+						(byte *)pPixelsDst, dimsDst.x, dimsDst.y, 0,
+						4));
+		}
+	}
+
+	bool TestMipFilters()
+	{
+		// Filtering each level from the one above shouldn't wander far from the resampled chain
+		static const double s_psnrMin = 30.0;
+
+		bool passed = true;
+		for (int iTex = 0; iTex < dim(s_mipTestTextures); ++iTex)
+		{
+			const MipTestTexture & test = s_mipTestTextures[iTex];
+
+			int2 dims;
+			int numComponents;
+			byte4 * pPixels = (byte4 *)stbi_load(test.m_path, &dims.x, &dims.y, &numComponents, 4);
+			if (!pPixels)
+			{
+				LOG("Couldn't load %s: %s", test.m_path, stbi_failure_reason());
+				passed = false;
+				continue;
+			}
+
+			// Resample the base up to pow2, as ACK_TextureWithMips does
+			int2 dimsBase = makeint2(pow2_ceil(dims.x), pow2_ceil(dims.y));
+			std::vector<byte4> pixelsBase(pPixels, pPixels + dims.x * dims.y);
+			if (!ispow2(dims.x) || !ispow2(dims.y))
+			{
+				pixelsBase.resize(dimsBase.x * dimsBase.y);
+				ResampleImage(pPixels, dims, &pixelsBase[0], dimsBase, test.m_sRGB);
+			}
+			int mipLevels = log2_floor(maxComponent(dimsBase)) + 1;
+
+			// Build the chain every way there is
+			std::vector<std::vector<byte4>> mips[MIPF_Count];
+			float msec[MIPF_Count];
+			for (int mipf = 0; mipf < MIPF_Count; ++mipf)
+			{
+				i64 timestampStart = Timestamp();
+				if (mipf == MIPF_Resample)
+				{
+					mips[mipf].resize(mipLevels - 1);
+					for (int level = 1; level < mipLevels; ++level)
+					{
+						int2 dimsMip = CalculateMipDims(dimsBase, level);
+						mips[mipf][level - 1].resize(dimsMip.x * dimsMip.y);
+						ResampleImage(pPixels, dims, &mips[mipf][level - 1][0], dimsMip, test.m_sRGB);
+					}
+				}
+				else
+				{
+					AssetCompiler::GenerateMips(&pixelsBase[0], dimsBase, mipLevels, test.m_sRGB, MIPF(mipf), &mips[mipf]);
+				}
+				msec[mipf] = ElapsedMs(timestampStart, Timestamp());
+			}
+			stbi_image_free(pPixels);
+
+			// Error of the successive chains against the resampled one, over all levels below the base
+			double psnr[MIPF_Count] = {};
+			for (int mipf = 0; mipf < MIPF_Resample; ++mipf)
+			{
+				double sqErrSum = 0.0;
+				i64 samples = 0;
+				for (int level = 1; level < mipLevels; ++level)
+				{
+					const std::vector<byte4> & pixels = mips[mipf][level - 1];
+					const std::vector<byte4> & pixelsRef = mips[MIPF_Resample][level - 1];
+					for (int i = 0, c = int(pixels.size()); i < c; ++i)
+					{
+						// Color is compared premultiplied, as it's arbitrary where alpha is zero
+						float alpha = float(pixels[i].w) / 255.0f;
+						float alphaRef = float(pixelsRef[i].w) / 255.0f;
+						for (int channel = 0; channel < 3; ++channel)
+							sqErrSum += double(square(float(pixels[i][channel]) * alpha - float(pixelsRef[i][channel]) * alphaRef));
+						sqErrSum += double(square(int(pixels[i].w) - int(pixelsRef[i].w)));
+					}
+					samples += i64(pixels.size()) * 4;
+				}
+				double mse = sqErrSum / double(max(samples, i64(1)));
+				psnr[mipf] = (mse > 0.0) ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+				if (psnr[mipf] < s_psnrMin)
+					passed = false;
+			}
+
+			LOG("Mips for %s (%dx%d): resample %0.1f ms; box %0.1f ms, PSNR %0.2f dB; Kaiser %0.1f ms, PSNR %0.2f dB",
+				test.m_path, dimsBase.x, dimsBase.y, msec[MIPF_Resample],
+				msec[MIPF_Box], psnr[MIPF_Box], msec[MIPF_Kaiser], psnr[MIPF_Kaiser]);
+		}
+
+		return passed;
+	}
+
+
+
+	// Texture compile: compiles all of Sponza's .tga textures from scratch to an in-memory
+	// pack, first as one list, so textures are batched across the threads with each one's
+	// row bands nested inside, then a texture at a time, so only the row bands run in
+	// parallel.  Times both, and checks they produce the same files.
+
+	// Compiles a list of assets to an in-memory pack, and returns each file's CRC and size
+	bool CompileToMemory(
+		const AssetCompileInfo * assets,
+		int numAssets,
+		std::unordered_map<std::string, std::pair<uint, i64>> * pFilesOut)
+	{
+		mz_zip_archive zipWrite = {};
+		CHECK_ERR(mz_zip_writer_init_heap(&zipWrite, 0, 0));
+
+		bool success = AssetCompiler::CompileFullAssetPackToZip(assets, numAssets, &zipWrite);
+
+		void * pData = nullptr;
+		size_t sizeBytes = 0;
+		if (!mz_zip_writer_finalize_heap_archive(&zipWrite, &pData, &sizeBytes))
+			success = false;
+		mz_zip_writer_end(&zipWrite);
+		if (!success)
+		{
+			mz_free(pData);
+			return false;
+		}
+
+		mz_zip_archive zipRead = {};
+		CHECK_ERR(mz_zip_reader_init_mem(&zipRead, pData, sizeBytes, 0));
+		for (int i = 0, c = int(mz_zip_reader_get_num_files(&zipRead)); i < c; ++i)
+		{
+			mz_zip_archive_file_stat fileStat;
+			CHECK_ERR(mz_zip_reader_file_stat(&zipRead, i, &fileStat));
+			(*pFilesOut)[fileStat.m_filename] = std::make_pair(uint(fileStat.m_crc32), i64(fileStat.m_uncomp_size));
+		}
+		mz_zip_reader_end(&zipRead);
+		mz_free(pData);
+		return true;
+	}
+
+	bool TestTextureCompile()
+	{
+		// Every .tga in Sponza's textures, as the demo compiles them
+		std::vector<std::string> paths;
+		WIN32_FIND_DATAA findData;
+		HANDLE hFind = FindFirstFileA("crytek-sponza/textures/*.tga", &findData);
+		if (hFind == INVALID_HANDLE_VALUE)
+		{
+			LOG("Couldn't find the Sponza textures");
+			return false;
+		}
+		do
+		{
+			paths.push_back(std::string("crytek-sponza/textures/") + findData.cFileName);
+		}
+		while (FindNextFileA(hFind, &findData));
+		FindClose(hFind);
+
+		std::vector<AssetCompileInfo> assets(paths.size());
+		for (int i = 0, c = int(paths.size()); i < c; ++i)
+		{
+			AssetCompileInfo aci = { paths[i].c_str(), ACK_TextureWithMips };
+			if (paths[i].find("_ddn.") != std::string::npos)
+				aci.m_ack = ACK_NormalMapWithMips;
+			assets[i] = aci;
+		}
+
+		std::unordered_map<std::string, std::pair<uint, i64>> filesBatched;
+		i64 timestampStart = Timestamp();
+		bool passed = CompileToMemory(&assets[0], int(assets.size()), &filesBatched);
+		i64 timestampBatched = Timestamp();
+
+		std::unordered_map<std::string, std::pair<uint, i64>> filesSingly;
+		for (int i = 0, c = int(assets.size()); i < c; ++i)
+		{
+			if (!CompileToMemory(&assets[i], 1, &filesSingly))
+				passed = false;
+		}
+		i64 timestampSingly = Timestamp();
+
+		// The per-pack bookkeeping files differ, but every asset's own files should match
+		int mismatches = 0;
+		for (auto it = filesSingly.begin(); it != filesSingly.end(); ++it)
+		{
+			if (it->first.compare(0, 14, "crytek-sponza/") != 0)
+				continue;
+			auto itBatched = filesBatched.find(it->first);
+			if (itBatched == filesBatched.end() || itBatched->second != it->second)
+				++mismatches;
+		}
+
+		LOG("Texture compile: %d textures on %d threads; as one list %0.0f ms, a texture at a time %0.0f ms; %d files differ",
+			int(assets.size()), numHardwareThreads(),
+			ElapsedMs(timestampStart, timestampBatched), ElapsedMs(timestampBatched, timestampSingly), mismatches);
+
+		return passed && mismatches == 0;
+	}
+
+
+
+	// BCn encode: block-compresses a few generated images to each BCn format at every
+	// quality, decodes them again, and checks the PSNR against the RGBA8 source, over the
+	// channels the format stores, is above the format's floor for that quality on every
+	// image.  BC1's alpha is 1-bit, so its transparent texels only have to come out
+	// transparent.  Logs the encoder's throughput.  The images have dims that aren't
+	// multiples of 4, so the padded edge blocks are exercised too.
+
+	struct BCnTestFormat
+	{
+		DXGI_FORMAT		m_format;
+		int				m_channels;		// Compared, starting from red
+		double			m_psnrMin[BCQ_Count];
+	};
+
+	const BCnTestFormat s_bcnTestFormats[] =
+	{
+		// Floors for BCQ_Normal, BCQ_Fast, BCQ_High, on the hardest image
+		{ DXGI_FORMAT_BC1_UNORM,	3,	{ 28.0, 25.0, 28.0 } },
+		{ DXGI_FORMAT_BC3_UNORM,	4,	{ 29.0, 26.0, 29.0 } },
+		{ DXGI_FORMAT_BC4_UNORM,	1,	{ 34.0, 34.0, 36.5 } },
+		{ DXGI_FORMAT_BC5_UNORM,	2,	{ 35.5, 34.0, 37.0 } },
+		{ DXGI_FORMAT_BC7_UNORM,	4,	{ 31.0, 28.0, 31.0 } },
+	};
+
+	const char * s_bcqTestNames[] = { "normal", "fast", "high" };
+	cassert(dim(s_bcqTestNames) == BCQ_Count);
+
+	// Smooth gradients and waves, with a little noise, and an alpha channel that fades in
+	// some places and is cut out in others.  If detailed, it's opaque, with hard-edged checks
+	// laid over it, which are much harder to compress.
+	void BuildBCnTestImage(
+		int2_arg dims,
+		bool detailed,
+		uint seed,
+		std::vector<byte4> * pPixelsOut)
+	{
+		RNG rng(seed);
+		pPixelsOut->resize(dims.x * dims.y);
+		for (int y = 0; y < dims.y; ++y)
+		{
+			for (int x = 0; x < dims.x; ++x)
+			{
+				float fx = float(x) / float(dims.x);
+				float fy = float(y) / float(dims.y);
+				float noise = rng.randFloat(-6.0f, 6.0f);
+				float3 color = makefloat3(
+									255.0f * fx,
+									128.0f + 100.0f * sinf(20.0f * fx) * cosf(13.0f * fy),
+									255.0f * (1.0f - fy));
+				float alpha = (((x * x + y * y) % 3000) < 1500) ? 255.0f : 255.0f * fy;
+				if (detailed)
+				{
+					if (((x / 7) + (y / 5)) & 1)
+						color = makefloat3(230.0f, 40.0f, 90.0f) - 0.5f * color;
+					alpha = 255.0f;
+				}
+
+				byte4 & pixel = (*pPixelsOut)[y * dims.x + x];
+				pixel = makebyte4(
+							byte(clamp(int(color.x + noise), 0, 255)),
+							byte(clamp(int(color.y + noise), 0, 255)),
+							byte(clamp(int(color.z + noise), 0, 255)),
+							byte(clamp(int(alpha), 0, 255)));
+			}
+		}
+	}
+
+	bool TestBCnEncode()
+	{
+		struct BCnTestImage
+		{
+			int2				m_dims;
+			bool				m_detailed;
+		};
+		static const BCnTestImage s_images[] =
+		{
+			{ makeint2(509, 256),	false },
+			{ makeint2(256, 254),	true },
+			{ makeint2(61, 37),		true },
+		};
+
+		std::vector<byte4> images[dim(s_images)];
+		for (int iImage = 0; iImage < dim(s_images); ++iImage)
+			BuildBCnTestImage(s_images[iImage].m_dims, s_images[iImage].m_detailed, 31 + iImage, &images[iImage]);
+
+		bool passed = true;
+		for (int iFormat = 0; iFormat < dim(s_bcnTestFormats); ++iFormat)
+		{
+			const BCnTestFormat & test = s_bcnTestFormats[iFormat];
+			for (int bcq = 0; bcq < BCQ_Count; ++bcq)
+			{
+				double sqErrSum = 0.0;
+				i64 samples = 0;
+				i64 pixels = 0;
+				float msec = 0.0f;
+				double psnrWorst = 99.0;
+				for (int iImage = 0; iImage < dim(s_images); ++iImage)
+				{
+					int2 dims = s_images[iImage].m_dims;
+					const std::vector<byte4> & source = images[iImage];
+
+					std::vector<byte> encoded;
+					i64 timestampStart = Timestamp();
+					AssetCompiler::EncodeBCnImage(&source[0], dims, test.m_format, BCQ(bcq), &encoded);
+					msec += ElapsedMs(timestampStart, Timestamp());
+					pixels += dims.x * dims.y;
+
+					if (encoded.size() != size_t(CalculateImageSizeInBytes(dims, test.m_format)))
+					{
+						LOG("%s (%s quality) encoded %dx%d to %d bytes, expected %d",
+							NameOfFormat(test.m_format), s_bcqTestNames[bcq], dims.x, dims.y,
+							int(encoded.size()), CalculateImageSizeInBytes(dims, test.m_format));
+						passed = false;
+						continue;
+					}
+
+					std::vector<byte4> decoded;
+					AssetCompiler::DecodeBCnImage(&encoded[0], dims, test.m_format, &decoded);
+
+					bool isBC1 = (test.m_format == DXGI_FORMAT_BC1_UNORM);
+					double sqErrImage = 0.0;
+					i64 samplesImage = 0;
+					int alphaMismatches = 0;
+					for (int i = 0, c = dims.x * dims.y; i < c; ++i)
+					{
+						if (isBC1)
+						{
+							bool transparent = (source[i].w < 128);
+							if (decoded[i].w != (transparent ? 0 : 255))
+								++alphaMismatches;
+							if (transparent)
+								continue;
+						}
+						for (int channel = 0; channel < test.m_channels; ++channel)
+							sqErrImage += double(square(int(source[i][channel]) - int(decoded[i][channel])));
+						samplesImage += test.m_channels;
+					}
+					if (alphaMismatches > 0)
+					{
+						LOG("%s (%s quality): %d texels of %dx%d came out with the wrong 1-bit alpha",
+							NameOfFormat(test.m_format), s_bcqTestNames[bcq], alphaMismatches, dims.x, dims.y);
+						passed = false;
+					}
+					double mse = sqErrImage / double(max(samplesImage, i64(1)));
+					psnrWorst = min(psnrWorst, (mse > 0.0) ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0);
+
+					sqErrSum += sqErrImage;
+					samples += samplesImage;
+				}
+
+				double mse = sqErrSum / double(max(samples, i64(1)));
+				double psnr = (mse > 0.0) ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+				LOG("BCn encode, %s (%s quality): PSNR %0.2f dB overall, %0.2f dB on the worst image; %0.1f Mpixels/s",
+					NameOfFormat(test.m_format), s_bcqTestNames[bcq], psnr, psnrWorst,
+					(msec > 0.0f) ? double(pixels) * 1e-3 / double(msec) : 0.0);
+
+				if (psnrWorst < test.m_psnrMin[bcq])
+				{
+					LOG("%s (%s quality) is under its floor of %0.1f dB", NameOfFormat(test.m_format), s_bcqTestNames[bcq], test.m_psnrMin[bcq]);
+					passed = false;
+				}
+			}
+		}
+
+		return passed;
+	}
+
+
+
+	// UV density: compiles quads whose UV density is known analytically as OBJ meshes, and
+	// checks the density stored for their material range.
+
+	struct UVDensityQuad
+	{
+		float2	m_dimsWorld;
+		float2	m_dimsUV;
+	};
+
+	struct UVDensityTestCase
+	{
+		const char *	m_name;
+		UVDensityQuad	m_quads[3];
+		int				m_quadRepeats[3];
+		float			m_uvDensityExpected;
+	};
+
+	const UVDensityTestCase s_uvDensityTestCases[] =
+	{
+		{ "unit",		{ { { 1, 1 }, { 1, 1 } }, },		{ 1, },			1.0f, },
+		{ "tiled",		{ { { 4, 4 }, { 2, 2 } }, },		{ 1, },			0.5f, },
+		{ "stretched",	{ { { 2, 1 }, { 1, 1 } }, },		{ 1, },			0.70710678f, },
+		{ "scaled",		{ { { 0.01f, 0.01f }, { 1, 1 } }, },{ 1, },			100.0f, },
+		// 1 of 40 quads with 16x the density of the rest: above the percentile, so ignored
+		{ "outlier",	{ { { 1, 1 }, { 1, 1 } }, { { 1, 1 }, { 16, 16 } }, },	{ 39, 1, },	1.0f, },
+		// 3 of 40 with 4x the density: reaches the percentile, so it counts
+		{ "cluster",	{ { { 1, 1 }, { 1, 1 } }, { { 1, 1 }, { 4, 4 } }, },	{ 37, 3, },	4.0f, },
+	};
+
+	// Lays the quads out side by side in the XZ plane, all in one material
+	bool WriteUVDensityTestOBJ(const UVDensityTestCase & test, const char * path)
+	{
+		FILE * pFile = nullptr;
+		if (fopen_s(&pFile, path, "wt") != 0)
+		{
+			LOG("Couldn't open %s for writing", path);
+			return false;
+		}
+
+		fprintf(pFile, "usemtl test\n");
+		float xOffset = 0.0f;
+		int iVertBase = 1;
+		for (int iQuad = 0; iQuad < dim(test.m_quads); ++iQuad)
+		{
+			const UVDensityQuad & quad = test.m_quads[iQuad];
+			for (int iRepeat = 0; iRepeat < test.m_quadRepeats[iQuad]; ++iRepeat)
+			{
+				for (int iCorner = 0; iCorner < 4; ++iCorner)
+				{
+					float2 corner = makefloat2(float(iCorner & 1), float(iCorner >> 1));
+					fprintf(pFile, "v %.9g 0 %.9g\n", xOffset + corner.x * quad.m_dimsWorld.x, corner.y * quad.m_dimsWorld.y);
+					fprintf(pFile, "vt %.9g %.9g\n", corner.x * quad.m_dimsUV.x, corner.y * quad.m_dimsUV.y);
+				}
+				fprintf(pFile, "f %d/%d %d/%d %d/%d\n", iVertBase, iVertBase, iVertBase + 1, iVertBase + 1, iVertBase + 3, iVertBase + 3);
+				fprintf(pFile, "f %d/%d %d/%d %d/%d\n", iVertBase, iVertBase, iVertBase + 3, iVertBase + 3, iVertBase + 2, iVertBase + 2);
+				iVertBase += 4;
+				xOffset += quad.m_dimsWorld.x;
+			}
+		}
+
+		fclose(pFile);
+		return true;
+	}
+
+	bool TestUVDensity()
+	{
+		// Asset paths must be relative and lowercase
+		static const char * s_path = "uv_density_test.obj";
+
+		bool passed = true;
+		for (int iCase = 0; iCase < dim(s_uvDensityTestCases); ++iCase)
+		{
+			const UVDensityTestCase & test = s_uvDensityTestCases[iCase];
+
+			Mesh mesh;
+			if (!WriteUVDensityTestOBJ(test, s_path) ||
+				!LoadOBJMesh(s_path, &mesh) ||
+				mesh.m_mtlRanges.size() != 1)
+			{
+				LOG("UV density test %s: couldn't compile the mesh", test.m_name);
+				passed = false;
+				continue;
+			}
+
+			float uvDensity = mesh.m_mtlRanges[0].m_uvDensity;
+			bool pass = isnear(uvDensity, test.m_uvDensityExpected, 1e-4f * test.m_uvDensityExpected);
+			LOG("UV density test %s: %s - got %g, expected %g",
+				test.m_name, pass ? "passed" : "FAILED", uvDensity, test.m_uvDensityExpected);
+			if (!pass)
+				passed = false;
+		}
+
+		remove(s_path);
+		return passed;
+	}
+
+
+
+	// Image encode: round-trips a test image through each encoder and stb_image, then pushes
+	// more images than fit through a small queue with several workers, and reads them all
+	// back.  Waiting pushes must never drop.
+
+	bool TestImageEncode()
+	{
+		// A gradient with a hard edge and varying alpha, in a non-pow2, non-square size
+		int2 dims = { 67, 29 };
+		std::vector<byte4> pixels(dims.x * dims.y);
+		for (int y = 0; y < dims.y; ++y)
+		{
+			for (int x = 0; x < dims.x; ++x)
+			{
+				byte4 pixel =
+				{
+					byte(x * 255 / (dims.x - 1)),
+					byte(y * 255 / (dims.y - 1)),
+					byte((x < dims.x / 2) ? 0 : 255),
+					byte(255 - (x + y) % 128),
+				};
+				pixels[y * dims.x + x] = pixel;
+			}
+		}
+
+		// Both encoders have to round-trip exactly, alpha included
+		bool passed = true;
+		for (int i = 0; i < IMGFMT_Count; ++i)
+		{
+			std::vector<byte> data;
+			int2 dimsDecoded = {};
+			int channels = 0;
+			byte * pDecoded = nullptr;
+			if (EncodeImage(&pixels[0], dims, IMGFMT(i), &data))
+				pDecoded = stbi_load_from_memory(&data[0], int(data.size()), &dimsDecoded.x, &dimsDecoded.y, &channels, 4);
+
+			bool match = pDecoded && all(dimsDecoded == dims) &&
+							memcmp(pDecoded, &pixels[0], pixels.size() * sizeof(byte4)) == 0;
+			LOG("Image encode: format %d, %d bytes: %s", i, int(data.size()), match ? "ok" : "MISMATCH");
+			stbi_image_free(pDecoded);
+			if (!match)
+				passed = false;
+		}
+
+		static const int s_imageCount = 12;
+		ImageEncodeQueue queue;
+		queue.Init(2, 3);
+
+		char paths[s_imageCount][32];
+		for (int i = 0; i < s_imageCount; ++i)
+		{
+			sprintf_s(paths[i], "test_image_encode_%02d.%s", i, (i & 1) ? "png" : "bmp");
+			std::vector<byte4> copy = pixels;
+			copy[0].r = byte(i);
+			queue.Push(&copy, dims, ImageFormatFromPath(paths[i]), paths[i], true);
+		}
+		queue.Flush();
+
+		int imagesOk = 0;
+		for (int i = 0; i < s_imageCount; ++i)
+		{
+			int2 dimsDecoded = {};
+			int channels = 0;
+			byte * pDecoded = stbi_load(paths[i], &dimsDecoded.x, &dimsDecoded.y, &channels, 4);
+			if (pDecoded && all(dimsDecoded == dims) && pDecoded[0] == byte(i))
+				++imagesOk;
+			stbi_image_free(pDecoded);
+			remove(paths[i]);
+		}
+
+		ImageEncodeStats stats = queue.GetStats();
+		LOG("Image encode: queue wrote %d of %d images, %d read back intact, %d failed, %d dropped",
+			stats.m_imagesWritten, s_imageCount, imagesOk, stats.m_imagesFailed, stats.m_imagesDropped);
+		queue.Reset();
+
+		return passed && imagesOk == s_imageCount && stats.m_imagesWritten == s_imageCount &&
+				stats.m_imagesFailed == 0 && stats.m_imagesDropped == 0;
+	}
+
+
+
+	// Texture streaming: streams a generated set of textures along two camera paths through a
+	// generated hall, one position per frame, without touching the GPU, and logs the residency
+	// and upload totals.  With a budget that fits everything, every request has to be met and
+	// no level uploaded twice; with a tight one, only the tails may go over it.  Either way the
+	// streamer's resident total has to match its textures' resident chains.
+
+	// A hall of 10-unit bays, four deep along z, each a material range with its own diffuse,
+	// specular and height textures, at a spread of sizes and formats.  The pixel data is generated into
+	// pPixelStore, which the textures point into as they'd point into an asset pack.
+	void BuildStreamingTestScene(
+		int rangeCount,
+		std::vector<std::vector<byte>> * pPixelStore,
+		TextureLib * pTexLibOut,
+		std::vector<Material> * pMtlsOut,
+		Mesh * pMeshOut)
+	{
+		static const int s_dims[] = { 128, 256, 512, 1024, };
+		static const DXGI_FORMAT s_formats[] =
+		{
+			DXGI_FORMAT_BC1_UNORM_SRGB,			// Diffuse
+			DXGI_FORMAT_BC1_UNORM_SRGB,			// Specular
+			DXGI_FORMAT_BC4_UNORM,				// Height
+		};
+		static const char * s_suffixes[] = { "diff", "spec", "height", };
+		cassert(dim(s_formats) == dim(s_suffixes));
+
+		RNG rng(34);
+		pMtlsOut->resize(rangeCount);
+		pMeshOut->m_mtlRanges.resize(rangeCount);
+		pMeshOut->m_bounds = makebox3Empty();
+		for (int iRange = 0; iRange < rangeCount; ++iRange)
+		{
+			Material * pMtl = &(*pMtlsOut)[iRange];
+			Texture2D * apTex[dim(s_formats)] = {};
+			for (int iTex = 0; iTex < dim(s_formats); ++iTex)
+			{
+				char name[32];
+				sprintf_s(name, "range%d_%s", iRange, s_suffixes[iTex]);
+				Texture2D * pTex = &pTexLibOut->m_texs[name];
+
+				// Every fourth diffuse map is uncompressed, and some are twice as wide as high
+				pTex->m_format = (iTex == 0 && iRange % 4 == 3) ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : s_formats[iTex];
+				int dimY = s_dims[rng.randInt(0, dim(s_dims))];
+				pTex->m_dims = makeint2((rng.randUint() & 1) ? dimY * 2 : dimY, dimY);
+				pTex->m_mipLevels = CalculateMipCount(pTex->m_dims);
+
+				pPixelStore->push_back(std::vector<byte>(CalculateMipPyramidSizeInBytes(pTex->m_dims, pTex->m_format, pTex->m_mipLevels)));
+				std::vector<byte> & pixels = pPixelStore->back();
+				for (int i = 0, c = int(pixels.size()); i < c; ++i)
+					pixels[i] = byte(i ^ (i >> 8) ^ iRange);
+
+				int offset = 0;
+				for (int level = 0; level < pTex->m_mipLevels; ++level)
+				{
+					pTex->m_apPixels.push_back(&pixels[offset]);
+					offset += CalculateMipSizeInBytes(pTex->m_dims, level, pTex->m_format);
+				}
+				apTex[iTex] = pTex;
+			}
+
+			*pMtl = Material();
+			pMtl->m_pTexDiffuseColor = apTex[0];
+			pMtl->m_pTexSpecColor = apTex[1];
+			pMtl->m_pTexHeight = apTex[2];
+
+			// Each texture spans 10 to 50 units, so the more distant bays still want some detail
+			Mesh::MtlRange * pRange = &pMeshOut->m_mtlRanges[iRange];
+			*pRange = Mesh::MtlRange();
+			pRange->m_pMtl = pMtl;
+			point3 posBay = makepoint3(float(iRange / 4) * 10.0f, 0.0f, float(iRange % 4) * 10.0f);
+			pRange->m_bounds = makebox3(posBay, posBay + makefloat3(10.0f, 8.0f, 10.0f));
+			pRange->m_uvDensity = rng.randFloat(0.02f, 0.1f);
+			pMeshOut->m_bounds = boxUnion(pMeshOut->m_bounds, pRange->m_bounds);
+		}
+	}
+
+	bool SimulateTextureStreaming(
+		const char * pathName,
+		const Mesh * pMesh,
+		TextureLib * pTexLib,
+		i64 budgetBytes,
+		const point3 * aPosCamera,
+		int frameCount,
+		float pixelsPerRadian)
+	{
+		TextureStreamer streamer;
+		streamer.Init(nullptr, pTexLib, budgetBytes);
+
+		i64 bytesFull = 0;
+		for (int i = 0, c = int(streamer.m_entries.size()); i < c; ++i)
+			bytesFull += streamer.m_entries[i].m_pTex->SizeInBytes();
+
+		bool passed = true;
+		i64 wantedTotal = 0, satisfiedTotal = 0;
+		for (int i = 0; i < frameCount; ++i)
+		{
+			streamer.BeginFrame();
+			streamer.RequestMeshMips(pMesh, aPosCamera[i], pixelsPerRadian);
+			streamer.Update(nullptr);
+			wantedTotal += streamer.m_stats.m_texturesWanted;
+			satisfiedTotal += streamer.m_stats.m_texturesSatisfied;
+
+			i64 bytesResident = 0;
+			for (int j = 0, c = int(streamer.m_entries.size()); j < c; ++j)
+			{
+				const TextureStreamer::Entry & entry = streamer.m_entries[j];
+				const Texture2D * pTex = entry.m_pTex;
+				bytesResident += CalculateMipPyramidSizeInBytes(
+									CalculateMipDims(pTex->m_dims, entry.m_mipResident),
+									pTex->m_format,
+									pTex->m_mipLevels - entry.m_mipResident);
+				if (entry.m_mipResident > entry.m_mipTail ||
+					CalculateValidTopMip(pTex->m_dims, entry.m_mipResident, pTex->m_format) != entry.m_mipResident)
+				{
+					LOG("Texture streaming, %s path, frame %d: a %dx%d %s texture has level %d resident, with its tail at %d",
+						pathName, i, pTex->m_dims.x, pTex->m_dims.y, NameOfFormat(pTex->m_format), entry.m_mipResident, entry.m_mipTail);
+					passed = false;
+				}
+			}
+			if (bytesResident != streamer.m_stats.m_bytesResident)
+			{
+				LOG("Texture streaming, %s path, frame %d: %lld bytes counted resident, but the textures' chains come to %lld",
+					pathName, i, streamer.m_stats.m_bytesResident, bytesResident);
+				passed = false;
+			}
+			if (!passed)
+				break;
+		}
+
+		const TextureStreamerStats & stats = streamer.m_stats;
+		LOG("Texture streaming, %s path: %d frames, budget %0.1f MB, %0.1f MB if fully resident",
+			pathName, frameCount, float(budgetBytes) / 1048576.0f, float(bytesFull) / 1048576.0f);
+		LOG("    uploaded %0.1f MB (%0.1f MB of tails) in %d uploads; resident %0.1f MB at end, %0.1f MB peak; %0.1f%% of requests satisfied",
+			float(stats.m_bytesUploaded) / 1048576.0f,
+			float(stats.m_bytesUploadedTail) / 1048576.0f,
+			stats.m_uploads,
+			float(stats.m_bytesResident) / 1048576.0f,
+			float(stats.m_bytesResidentPeak) / 1048576.0f,
+			wantedTotal > 0 ? 100.0f * float(satisfiedTotal) / float(wantedTotal) : 100.0f);
+
+		if (budgetBytes >= bytesFull)
+		{
+			// Nothing is ever evicted, so every request is met as it's made, and each level is
+			// uploaded once at most
+			if (satisfiedTotal != wantedTotal || stats.m_bytesUploaded > bytesFull)
+			{
+				LOG("With room for everything, %lld of %lld requests were met and %lld bytes uploaded",
+					satisfiedTotal, wantedTotal, stats.m_bytesUploaded);
+				passed = false;
+			}
+		}
+
+		// Only the tails may go over budget
+		if (stats.m_bytesResidentPeak > max(budgetBytes, stats.m_bytesUploadedTail))
+		{
+			LOG("Resident bytes peaked at %lld, over the budget of %lld", stats.m_bytesResidentPeak, budgetBytes);
+			passed = false;
+		}
+
+		return passed;
+	}
+
+	bool TestTextureStreaming()
+	{
+		static const int s_rangeCount = 24;
+		std::vector<std::vector<byte>> pixelStore;
+		TextureLib texLib;
+		std::vector<Material> mtls;
+		Mesh mesh;
+		BuildStreamingTestScene(s_rangeCount, &pixelStore, &texLib, &mtls, &mesh);
+
+		i64 bytesFull = 0;
+		for (auto it = texLib.m_texs.begin(); it != texLib.m_texs.end(); ++it)
+			bytesFull += it->second.SizeInBytes();
+
+		// Walk down the length of the hall at head height, then orbit it from outside
+		static const int s_frameCount = 600;
+		float pixelsPerRadian = 1080.0f / 1.5f;		// 1080-pixel-high view with the demo's FOV
+		box3 bounds = mesh.m_bounds;
+		float3 diagonal = bounds.diagonal();
+		std::vector<point3> aPosNave(s_frameCount), aPosOrbit(s_frameCount);
+
+		float radius = 0.75f * max(diagonal.x, diagonal.z);
+		for (int i = 0; i < s_frameCount; ++i)
+		{
+			float u = float(i) / float(s_frameCount - 1);
+			aPosNave[i] = makepoint3(
+								lerp(bounds.m_mins.x, bounds.m_maxs.x, u),
+								bounds.m_mins.y + 0.2f * diagonal.y,
+								bounds.center().z);
+
+			float theta = 2.0f * pi * float(i) / float(s_frameCount);
+			aPosOrbit[i] = bounds.center() + makefloat3(radius * cos(theta), 0.0f, radius * sin(theta));
+		}
+
+		// Room for everything, then for a quarter of it
+		bool passed = true;
+		const i64 budgets[] = { bytesFull, bytesFull / 4, };
+		for (int iBudget = 0; iBudget < dim(budgets); ++iBudget)
+		{
+			if (!SimulateTextureStreaming("nave", &mesh, &texLib, budgets[iBudget], &aPosNave[0], s_frameCount, pixelsPerRadian))
+				passed = false;
+			if (!SimulateTextureStreaming("orbit", &mesh, &texLib, budgets[iBudget], &aPosOrbit[0], s_frameCount, pixelsPerRadian))
+				passed = false;
+		}
+
+		return passed;
+	}
+
+
+
+
+	struct Test
+	{
+		const char *	m_name;
+		bool			(*m_func)();
+	};
+
+	const Test s_tests[] =
+	{
+		{ "tangent-frames",		&TestTangentFrames },
+		{ "srgb-spans",			&TestSRGBSpans },
+		{ "mip-filters",		&TestMipFilters },
+		{ "texture-compile",	&TestTextureCompile },
+		{ "bcn-encode",		&TestBCnEncode },
+		{ "uv-density",			&TestUVDensity },
+		{ "image-encode",		&TestImageEncode },
+		{ "texture-streaming",	&TestTextureStreaming },
+	};
+}
+
+int main(int argc, char ** argv)
+{
+	g_logCallback = &LogToStdout;
+	g_errorCallback = &CountError;
+	g_breakOnError = false;
+
+	int failures = 0;
+	for (int i = 0; i < dim(s_tests); ++i)
+	{
+		// Run the test if it's named on the command line, or if nothing is
+		bool run = (argc <= 1);
+		for (int j = 1; j < argc && !run; ++j)
+			run = (strcmp(argv[j], s_tests[i].m_name) == 0);
+		if (!run)
+			continue;
+
+		s_errorCount = 0;
+		bool passed = s_tests[i].m_func() && s_errorCount == 0;
+		printf("%s: %s\n", s_tests[i].m_name, passed ? "passed" : "FAILED");
+		if (!passed)
+			++failures;
+	}
+
+	return failures;
+}
@@ -2,6 +2,160 @@
 
 namespace util
 {
+	// SRGB span conversions
+
+	// The encode table covers [2^-13, 1): below that, everything rounds to code 0.  Each octave
+	// is split into 8 segments by the top 3 mantissa bits, and each segment is fit with a line
+	// in the next 8 mantissa bits.  Entries pack a 16-bit slope (in 1/65536 codes per step)
+	// and a 16-bit intercept (in 1/128 codes, +0.5 for rounding) for _mm_madd_epi16.
+	static const int s_toSRGBExpMin = -13;
+	static const int s_toSRGBSegmentBits = 3;
+	static const int s_toSRGBStepBits = 8;
+	static const int s_toSRGBTableSize = -s_toSRGBExpMin << s_toSRGBSegmentBits;
+	static const uint s_toSRGBBitsMin = uint(127 + s_toSRGBExpMin) << 23;
+	static const uint s_toSRGBBitsMax = 0x3f7fffff;		// Largest float below 1
+
+	// Built at startup, so they're safe to use from several threads without a lazy-init race
+	struct SRGBSpanTables
+	{
+		float	m_toLinear[256];
+		uint	m_toSRGB[s_toSRGBTableSize];
+
+		SRGBSpanTables()
+		{
+			for (int i = 0; i < 256; ++i)
+				m_toLinear[i] = toLinear(float(i) / 255.0f);
+
+			// Least-squares line through each segment, at the middle of each step
+			for (int iEntry = 0; iEntry < s_toSRGBTableSize; ++iEntry)
+			{
+				double sumT = 0.0, sumTT = 0.0, sumG = 0.0, sumTG = 0.0;
+				int steps = 1 << s_toSRGBStepBits;
+				for (int t = 0; t < steps; ++t)
+				{
+					double mantissa = (double((iEntry & ((1 << s_toSRGBSegmentBits) - 1)) << s_toSRGBStepBits) + t + 0.5) /
+										double(1 << (s_toSRGBSegmentBits + s_toSRGBStepBits));
+					double x = ldexp(1.0 + mantissa, s_toSRGBExpMin + (iEntry >> s_toSRGBSegmentBits));
+					double g = 255.0 * ((x <= 0.0031308) ? x * 12.92 : 1.055 * ::pow(x, 1.0 / 2.4) - 0.055) + 0.5;
+					sumT += t;
+					sumTT += double(t) * t;
+					sumG += g;
+					sumTG += t * g;
+				}
+				double slope = (steps * sumTG - sumT * sumG) / (steps * sumTT - sumT * sumT);
+				double intercept = (sumG - slope * sumT) / steps;
+				int slopeFixed = int(floor(slope * 65536.0 + 0.5));
+				int interceptFixed = int(floor(intercept * 128.0 + 0.5));
+				ASSERT_ERR(slopeFixed >= 0 && slopeFixed < 32768);
+				ASSERT_ERR(interceptFixed >= 0 && interceptFixed < 32768);
+				m_toSRGB[iEntry] = (uint(interceptFixed) << 16) | uint(slopeFixed);
+			}
+		}
+	};
+	static const SRGBSpanTables s_srgbSpanTables;
+
+	// Encode 4 linear values to sRGB codes, in the low bytes of each lane
+	static inline __m128i toSRGBx4(__m128 c)
+	{
+		// max/min return their second operand if either is NaN, so NaNs go to the bottom
+		c = _mm_max_ps(c, _mm_castsi128_ps(_mm_set1_epi32(s_toSRGBBitsMin)));
+		c = _mm_min_ps(c, _mm_castsi128_ps(_mm_set1_epi32(s_toSRGBBitsMax)));
+
+		__m128i bits = _mm_castps_si128(c);
+		__m128i indices = _mm_srli_epi32(
+							_mm_sub_epi32(bits, _mm_set1_epi32(s_toSRGBBitsMin)),
+							23 - s_toSRGBSegmentBits);
+		int aiEntry[4];
+		_mm_storeu_si128((__m128i *)aiEntry, indices);
+		const uint * pTable = s_srgbSpanTables.m_toSRGB;
+		__m128i entries = _mm_setr_epi32(
+							pTable[aiEntry[0]], pTable[aiEntry[1]],
+							pTable[aiEntry[2]], pTable[aiEntry[3]]);
+
+		// Step within the segment in the low half of each lane, and the intercept's scale
+		// in the high half, so one multiply-add evaluates the line
+		__m128i steps = _mm_and_si128(
+							_mm_srli_epi32(bits, 23 - s_toSRGBSegmentBits - s_toSRGBStepBits),
+							_mm_set1_epi32((1 << s_toSRGBStepBits) - 1));
+		steps = _mm_or_si128(steps, _mm_set1_epi32(512 << 16));
+		return _mm_srli_epi32(_mm_madd_epi16(entries, steps), 16);
+	}
+
+	void toLinearSpan(const byte * pSrc, int count, float * pDst)
+	{
+		ASSERT_ERR((pSrc && pDst) || count == 0);
+
+		const float * pTable = s_srgbSpanTables.m_toLinear;
+		for (int i = 0; i < count; ++i)
+			pDst[i] = pTable[pSrc[i]];
+	}
+
+	void toLinearSpan(const byte4 * pSrc, int count, rgba * pDst)
+	{
+		ASSERT_ERR((pSrc && pDst) || count == 0);
+
+		const float * pTable = s_srgbSpanTables.m_toLinear;
+		for (int i = 0; i < count; ++i)
+		{
+			byte4 p = pSrc[i];
+			pDst[i] = makergba(pTable[p.x], pTable[p.y], pTable[p.z], float(p.w) * (1.0f / 255.0f));
+		}
+	}
+
+	void toSRGBSpan(const float * pSrc, int count, byte * pDst)
+	{
+		ASSERT_ERR((pSrc && pDst) || count == 0);
+
+		int i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128i codes = toSRGBx4(_mm_loadu_ps(&pSrc[i]));
+			codes = _mm_packs_epi32(codes, codes);
+			codes = _mm_packus_epi16(codes, codes);
+			u32 packed = u32(_mm_cvtsi128_si32(codes));
+			memcpy(&pDst[i], &packed, sizeof(packed));
+		}
+
+		// Leftovers go through a padded vector
+		if (i < count)
+		{
+			float tail[4] = {};
+			for (int j = i; j < count; ++j)
+				tail[j - i] = pSrc[j];
+			__m128i codes = toSRGBx4(_mm_loadu_ps(tail));
+			int aiCode[4];
+			_mm_storeu_si128((__m128i *)aiCode, codes);
+			for (int j = i; j < count; ++j)
+				pDst[j] = byte(aiCode[j - i]);
+		}
+	}
+
+	void toSRGBSpan(const rgba * pSrc, int count, byte4 * pDst)
+	{
+		ASSERT_ERR((pSrc && pDst) || count == 0);
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128i maskAlpha = _mm_set_epi32(-1, 0, 0, 0);
+		for (int i = 0; i < count; ++i)
+		{
+			__m128 texel = _mm_loadu_ps(&pSrc[i].x);
+			__m128i codes = toSRGBx4(texel);
+
+			// Alpha is linear, so it's just clamped and rounded; NaNs go to 0 here too
+			__m128 alpha = _mm_mul_ps(_mm_min_ps(_mm_max_ps(texel, zero), one), _mm_set1_ps(255.0f));
+			__m128i alphaCode = _mm_cvtps_epi32(alpha);
+			codes = _mm_or_si128(_mm_andnot_si128(maskAlpha, codes), _mm_and_si128(maskAlpha, alphaCode));
+
+			codes = _mm_packs_epi32(codes, codes);
+			codes = _mm_packus_epi16(codes, codes);
+			u32 packed = u32(_mm_cvtsi128_si32(codes));
+			memcpy(&pDst[i], &packed, sizeof(packed));
+		}
+	}
+
+
+
 	// Color space conversions
 
 	hsv RGBtoHSV(rgb_arg c)
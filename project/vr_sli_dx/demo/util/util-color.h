@@ -71,6 +71,16 @@ namespace util
 	inline srgba toSRGB(rgba_arg c)
 		{ return makergba(toSRGB(c.rgb), c.a); }
 
+	// Batched SRGB/linear conversions over whole spans, with SSE2.  Decoding 8-bit sRGB is a
+	// table lookup, identical to toLinear(c / 255).  Encoding to 8 bits interpolates a small
+	// table indexed by the float's exponent and top mantissa bits; it's within 0.6 of a code
+	// of the exact value, and every 8-bit value round-trips.  Encoding clamps to [0, 1] and
+	// sends NaNs to 0.  Alpha is linear, so it's only rescaled.
+	void toLinearSpan(const byte * pSrc, int count, float * pDst);
+	void toLinearSpan(const byte4 * pSrc, int count, rgba * pDst);
+	void toSRGBSpan(const float * pSrc, int count, byte * pDst);
+	void toSRGBSpan(const rgba * pSrc, int count, byte4 * pDst);
+
 	// RGB/HSV conversions
 	hsv RGBtoHSV(rgb_arg c);
 	rgb HSVtoRGB(hsv_arg c);
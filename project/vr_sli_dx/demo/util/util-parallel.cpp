@@ -0,0 +1,142 @@
+#include "util.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace util
+{
+	// A parallelFor call in flight; lives on the calling thread's stack
+	struct ParallelJob
+	{
+		const std::function<void (int iStart, int iEnd)> *	m_pFunc;
+		int													m_count;
+		int													m_blockSize;
+		int													m_cBlock;
+		std::atomic<int>									m_iBlockNext;
+		int													m_cWorkers;		// Pool threads inside the job; guarded by the pool mutex
+
+		bool	HasBlocksLeft() const { return m_iBlockNext.load() < m_cBlock; }
+
+		// Pulls blocks off the shared counter until they run out
+		void	RunBlocks()
+		{
+			for (;;)
+			{
+				int iBlock = m_iBlockNext++;
+				if (iBlock >= m_cBlock)
+					break;
+				int iStart = iBlock * m_blockSize;
+				(*m_pFunc)(iStart, min(iStart + m_blockSize, m_count));
+			}
+		}
+	};
+
+	// Worker threads are started on the first parallelFor that needs them and then kept for
+	// the life of the process, sleeping while there's no work.  They're deliberately never
+	// joined: the pool is leaked, so no static destructor has to wait on them at exit.
+	// Nested calls queue their jobs on the same pool, and idle workers join the newest job
+	// that still has blocks left, so inner loops finish before more outer blocks are started.
+	// A thread only waits on a job after running out of its blocks, and then only on workers
+	// still inside it, which never wait on anything outside it; so nesting can't deadlock.
+	class ParallelPool
+	{
+	public:
+		explicit ParallelPool(int cThread)
+		{
+			for (int i = 0; i < cThread; ++i)
+				std::thread(&ParallelPool::WorkerMain, this).detach();
+		}
+
+		void Run(ParallelJob * pJob)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_jobs.push_back(pJob);
+			}
+			m_cvWork.notify_all();
+
+			// The calling thread pitches in too
+			pJob->RunBlocks();
+
+			// Every block has been claimed by now; stop any more workers from joining, and
+			// wait for the ones still finishing their last blocks
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), pJob));
+			m_cvDone.wait(lock, [pJob]() { return pJob->m_cWorkers == 0; });
+		}
+
+	private:
+		void WorkerMain()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			for (;;)
+			{
+				ParallelJob * pJob = nullptr;
+				m_cvWork.wait(lock, [this, &pJob]()
+				{
+					for (int i = int(m_jobs.size()) - 1; i >= 0; --i)
+					{
+						if (m_jobs[i]->HasBlocksLeft())
+						{
+							pJob = m_jobs[i];
+							return true;
+						}
+					}
+					return false;
+				});
+
+				++pJob->m_cWorkers;
+				lock.unlock();
+				pJob->RunBlocks();
+				lock.lock();
+				if (--pJob->m_cWorkers == 0)
+					m_cvDone.notify_all();
+			}
+		}
+
+		std::mutex					m_mutex;
+		std::condition_variable		m_cvWork;
+		std::condition_variable		m_cvDone;
+		std::vector<ParallelJob *>	m_jobs;
+	};
+
+	static ParallelPool * s_pPool = nullptr;
+	static std::once_flag s_poolOnce;
+
+	int numHardwareThreads()
+	{
+		return max(1, int(std::thread::hardware_concurrency()));
+	}
+
+	void parallelFor(
+			int count,
+			int blockSize,
+			const std::function<void (int iStart, int iEnd)> & func)
+	{
+		ASSERT_ERR(count >= 0);
+		ASSERT_ERR(blockSize > 0);
+
+		int cBlock = div_ceil(count, blockSize);
+
+		// Not worth waking threads for a single block
+		if (cBlock <= 1 || numHardwareThreads() <= 1)
+		{
+			for (int iStart = 0; iStart < count; iStart += blockSize)
+				func(iStart, min(iStart + blockSize, count));
+			return;
+		}
+
+		std::call_once(s_poolOnce, []() { s_pPool = new ParallelPool(numHardwareThreads() - 1); });
+
+		ParallelJob job;
+		job.m_pFunc = &func;
+		job.m_count = count;
+		job.m_blockSize = blockSize;
+		job.m_cBlock = cBlock;
+		job.m_iBlockNext = 0;
+		job.m_cWorkers = 0;
+		s_pPool->Run(&job);
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <functional>
+
+namespace util
+{
+	// Simple data-parallel loop helpers, run on a pool of worker threads that's started on
+	// first use and kept for the life of the process.
+
+	// Number of hardware threads available (at least 1)
+	int numHardwareThreads();
+
+	// Splits [0, count) into contiguous blocks of blockSize items (the last one may be
+	// shorter) and calls func(iStart, iEnd) once per block, spread across all hardware
+	// threads including the calling one.  Returns when all blocks are done.
+	// Block boundaries depend only on count and blockSize, never on the thread count,
+	// so as long as func writes disjoint outputs per block the results are deterministic.
+	// Calls may be nested: an inner call's blocks are shared out over the same pool, not
+	// new threads, so composing parallel loops never oversubscribes the machine.  Threads
+	// that run out of outer blocks help with inner ones, and the newest loop's blocks are
+	// taken first.  So it's fine, e.g., to parallelize over textures and also over the rows
+	// within each one; a lone large texture still gets every thread.
+	void parallelFor(
+			int count,
+			int blockSize,
+			const std::function<void (int iStart, int iEnd)> & func);
+}
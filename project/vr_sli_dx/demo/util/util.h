@@ -2,3 +2,4 @@
 #include "util-basics.h"
 #include "util-math.h"
 #include "util-rng.h"
+#include "util-parallel.h"
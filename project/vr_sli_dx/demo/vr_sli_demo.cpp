@@ -49,6 +49,7 @@
 #include "shadow_alphatest_ps.h"
 #include "tonemap_ps.h"
 #include "world_vs.h"
+#include "depth_vs.h"
 
 using namespace util;
 using namespace Framework;
@@ -115,6 +116,16 @@ int2 g_dimsPreWarp;						// Final pixel dims, including supersample factor, for
 bool g_vsync = true;
 int g_repeatRenderingCount = 1;
 
+// Texture streaming
+bool g_streamTextures = true;			// Read at init; otherwise all mips are uploaded up front
+int g_textureBudgetMB = 128;
+
+// Screenshots
+bool g_captureSequence = false;			// Capture every frame to capture/frame_NNNNN.bmp, asynchronously
+
+// Texture arrays
+bool g_textureArrays = true;			// Read at init; packs same-layout textures into arrays, except streamed ones
+
 float g_debugSlider0 = 0.0f;
 float g_debugSlider1 = 0.0f;
 float g_debugSlider2 = 0.0f;
@@ -146,6 +157,12 @@ struct CBFrame								// matches cbuffer CBFrame in shader-common.h
 	float		m_exposure;					// Exposure multiplier
 };
 
+struct CBMaterial							// matches cbuffer CBMaterial in shader-common.h
+{
+	float		m_sliceDiffuse;				// Slices of the material's textures in the bound texture arrays
+	float		m_sliceNormal;				// ...
+};
+
 struct CBDebug								// matches cbuffer CBDebug in shader-common.h
 {
 	float		m_debugKey;					// Mapped to spacebar and controller A button - 0 if up, 1 if down
@@ -197,7 +214,10 @@ public:
 	void							UpdateRenderTargetDims();
 	void							EnsureRenderTargetsAlloced();
 	affine3							GetEyeToCameraTransform(int eye);
+	void							SortMtlRangesForDrawing();
+	void							BindMaterialTextures(const Material * pMtl, bool bindNormal, int2 * pArraysBound, CBMaterial * pCbMaterialBound);
 	void							DrawMaterials(ID3D11PixelShader * pPs, ID3D11PixelShader * pPsAlphaTest);
+	void							DrawMaterialsDepthOnly(ID3D11PixelShader * pPsAlphaTest);
 	void							RenderScene();
 	void							RenderShadowMap();
 	RenderTarget					m_rtPreWarpMSAA;
@@ -207,12 +227,15 @@ public:
 	comptr<ID3D11RenderTargetView>	m_pRtvPreWarpRaw;	// Non-SRGB RTV
 	ShadowMap						m_shmp;
 	comptr<ID3D11VertexShader>		m_pVsWorld;
+	comptr<ID3D11VertexShader>		m_pVsDepth;
 	comptr<ID3D11PixelShader>		m_pPsSimple;
 	comptr<ID3D11PixelShader>		m_pPsSimpleAlphaTest;
 	comptr<ID3D11PixelShader>		m_pPsShadowAlphaTest;
 	comptr<ID3D11PixelShader>		m_pPsTonemap;
 	comptr<ID3D11InputLayout>		m_pInputLayout;
+	comptr<ID3D11InputLayout>		m_pInputLayoutDepth;
 	CB<CBFrame>						m_cbFrame[2];
+	CB<CBMaterial>					m_cbMaterial;
 	CB<CBDebug>						m_cbDebug;
 	Texture2D						m_tex1x1Black;
 	Texture2D						m_tex1x1White;
@@ -225,6 +248,9 @@ public:
 	Mesh							m_meshCrytekSponza;
 	MaterialLib						m_mtlLibCrytekSponza;
 	TextureLib						m_texLibCrytekSponza;
+	TextureStreamer					m_texStreamerCrytekSponza;
+	TextureArrayLib					m_texArraysCrytekSponza;
+	std::vector<int>				m_aiMtlRangeDrawOrder;
 	FPSCamera						m_camCrytekSponza;
 
 	// Oculus HMD support
@@ -249,6 +275,9 @@ public:
 
 	// Screenshots
 	void							SaveScreenshot(RenderTarget * pRt, const char * suggestedFilename);
+	ImageEncodeQueue				m_imageEncodeQueue;
+	ScreenshotCapture				m_screenshotCapture;
+	int								m_iFrameSequence;
 
 	// VR SLI
 	bool							m_vrSliMode;
@@ -266,6 +295,7 @@ VRSLIDemo::VRSLIDemo()
 	m_openVRHMDState(HMDSTATE_Unavailable),
 	m_pOpenVRHMD(nullptr),
 	m_pCompositorOpenVRHMD(nullptr),
+	m_iFrameSequence(0),
 	m_vrSliMode(false),
 	m_useBroadcastSLI(true),
 	m_pMultiGPUDevice(nullptr)
@@ -360,7 +390,7 @@ bool VRSLIDemo::Init(HINSTANCE hInstance)
 
 	// Create bar for rendering options
 	TwBar * pTwBarRendering = TwNewBar("Rendering");
-	TwDefine("Rendering position='15 160' size='330 140' valueswidth=120");
+	TwDefine("Rendering position='15 160' size='330 160' valueswidth=120");
 	TwAddVarCB(
 		pTwBarRendering, "Supersample Factor", TW_TYPE_FLOAT, 
 		[](const void * value, void * window) {
@@ -374,6 +404,8 @@ bool VRSLIDemo::Init(HINSTANCE hInstance)
 		"min=0.1 max=4.0 step=0.01 precision=2");
 	TwAddVarRW(pTwBarRendering, "Repeat Rendering", TW_TYPE_INT32, &g_repeatRenderingCount, "min=1 max=100");
 	TwAddVarRW(pTwBarRendering, "VSync", TW_TYPE_BOOLCPP, &g_vsync, nullptr);
+	if (g_streamTextures)
+		TwAddVarRW(pTwBarRendering, "Texture Budget (MB)", TW_TYPE_INT32, &g_textureBudgetMB, "min=1 max=4096");
 	if (m_multiGPUCaps.nSLIGPUs > 1)
 	{
 		TwAddVarRW(pTwBarRendering, "VR SLI Mode", TW_TYPE_BOOLCPP, &m_vrSliMode, nullptr);
@@ -382,7 +414,7 @@ bool VRSLIDemo::Init(HINSTANCE hInstance)
 
 	// Create bar for Oculus HMD connection
 	TwBar * pTwBarOculusHMD = TwNewBar("Oculus HMD");
-	TwDefine("'Oculus HMD' position='15 315' size='300 100' valueswidth=125 refresh=1.0");
+	TwDefine("'Oculus HMD' position='15 335' size='300 100' valueswidth=125 refresh=1.0");
 	TwAddButton(
 		pTwBarOculusHMD, "Activate Oculus HMD",
 		[](void * window) {
@@ -398,7 +430,7 @@ bool VRSLIDemo::Init(HINSTANCE hInstance)
 
 	// Create bar for OpenVR HMD connection
 	TwBar * pTwBarOpenVRHMD = TwNewBar("OpenVR HMD");
-	TwDefine("'OpenVR HMD' position='15 430' size='300 100' valueswidth=125 refresh=1.0");
+	TwDefine("'OpenVR HMD' position='15 450' size='300 100' valueswidth=125 refresh=1.0");
 	TwAddButton(
 		pTwBarOpenVRHMD, "Activate OpenVR HMD",
 		[](void * window) {
@@ -414,18 +446,19 @@ bool VRSLIDemo::Init(HINSTANCE hInstance)
 
 	// Create bar for screenshots
 	TwBar * pTwBarScreenshots = TwNewBar("Screenshots");
-	TwDefine("Screenshots position='15 545' size='300 100' valueswidth=15");
+	TwDefine("Screenshots position='15 565' size='300 100' valueswidth=15");
 	TwAddButton(
 			pTwBarScreenshots, "Screenshot Pre-Warp RT",
 			[](void * window) {
 				VRSLIDemo * pWindow = (VRSLIDemo *)window;
 				pWindow->SaveScreenshot(&pWindow->m_rtPreWarp, "prewarp.bmp");
 			}, this, nullptr);
+	TwAddVarRW(pTwBarScreenshots, "Capture Frame Sequence", TW_TYPE_BOOLCPP, &g_captureSequence, nullptr);
 
 #if 0
 	// Create bar for debug sliders
 	TwBar * pTwBarDebug = TwNewBar("Debug");
-	TwDefine("Debug position='15 660' size='225 115' valueswidth=75");
+	TwDefine("Debug position='15 680' size='225 115' valueswidth=75");
 	TwAddVarRW(pTwBarDebug, "g_debugSlider0", TW_TYPE_FLOAT, &g_debugSlider0, "min=0.0 step=0.01 precision=2");
 	TwAddVarRW(pTwBarDebug, "g_debugSlider1", TW_TYPE_FLOAT, &g_debugSlider1, "min=0.0 step=0.01 precision=2");
 	TwAddVarRW(pTwBarDebug, "g_debugSlider2", TW_TYPE_FLOAT, &g_debugSlider2, "min=0.0 step=0.01 precision=2");
@@ -437,6 +470,7 @@ bool VRSLIDemo::Init(HINSTANCE hInstance)
 
 	// Load shaders
 	CHECK_D3D(m_pDevice->CreateVertexShader(world_vs_bytecode, dim(world_vs_bytecode), nullptr, &m_pVsWorld));
+	CHECK_D3D(m_pDevice->CreateVertexShader(depth_vs_bytecode, dim(depth_vs_bytecode), nullptr, &m_pVsDepth));
 	CHECK_D3D(m_pDevice->CreatePixelShader(simple_ps_bytecode, dim(simple_ps_bytecode), nullptr, &m_pPsSimple));
 	CHECK_D3D(m_pDevice->CreatePixelShader(simple_alphatest_ps_bytecode, dim(simple_alphatest_ps_bytecode), nullptr, &m_pPsSimpleAlphaTest));
 	CHECK_D3D(m_pDevice->CreatePixelShader(shadow_alphatest_ps_bytecode, dim(shadow_alphatest_ps_bytecode), nullptr, &m_pPsShadowAlphaTest));
@@ -450,22 +484,47 @@ bool VRSLIDemo::Init(HINSTANCE hInstance)
 		{ "NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT,    0, UINT(offsetof(Vertex, m_normal)),  D3D11_INPUT_PER_VERTEX_DATA, 0 },
 		{ "UV",       0, DXGI_FORMAT_R32G32_FLOAT,       0, UINT(offsetof(Vertex, m_uv)),      D3D11_INPUT_PER_VERTEX_DATA, 0 },
 		{ "TANGENT",  0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, UINT(offsetof(Vertex, m_tangent)), D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "INSTANCE_LINEAR",      0, DXGI_FORMAT_R32G32B32_FLOAT, 1, UINT(offsetof(affine3, m_linear)),                     D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "INSTANCE_LINEAR",      1, DXGI_FORMAT_R32G32B32_FLOAT, 1, UINT(offsetof(affine3, m_linear) + sizeof(float3)),    D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "INSTANCE_LINEAR",      2, DXGI_FORMAT_R32G32B32_FLOAT, 1, UINT(offsetof(affine3, m_linear) + 2 * sizeof(float3)), D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "INSTANCE_TRANSLATION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 1, UINT(offsetof(affine3, m_translation)),                D3D11_INPUT_PER_INSTANCE_DATA, 1 },
 	};
 	CHECK_D3D(m_pDevice->CreateInputLayout(
 							aInputDescs, dim(aInputDescs),
 							world_vs_bytecode, dim(world_vs_bytecode),
 							&m_pInputLayout));
 
+	// Input layout for the mesh's position-only stream, used in depth-only passes
+	D3D11_INPUT_ELEMENT_DESC aInputDescsDepth[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT,    0, 0,                                 D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		{ "INSTANCE_LINEAR",      0, DXGI_FORMAT_R32G32B32_FLOAT, 1, UINT(offsetof(affine3, m_linear)),                     D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "INSTANCE_LINEAR",      1, DXGI_FORMAT_R32G32B32_FLOAT, 1, UINT(offsetof(affine3, m_linear) + sizeof(float3)),    D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "INSTANCE_LINEAR",      2, DXGI_FORMAT_R32G32B32_FLOAT, 1, UINT(offsetof(affine3, m_linear) + 2 * sizeof(float3)), D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "INSTANCE_TRANSLATION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 1, UINT(offsetof(affine3, m_translation)),                D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	};
+	CHECK_D3D(m_pDevice->CreateInputLayout(
+							aInputDescsDepth, dim(aInputDescsDepth),
+							depth_vs_bytecode, dim(depth_vs_bytecode),
+							&m_pInputLayoutDepth));
+
 	// Init constant buffers
 	for (int i = 0; i < dim(m_cbFrame); ++i)
 		m_cbFrame[i].Init(m_pDevice);
+	m_cbMaterial.Init(m_pDevice);
 	m_cbDebug.Init(m_pDevice);
 
-	// Init default textures
+	// Init default textures.  White and the flat normal share a format (white is the same in
+	// sRGB or not), so they can share a texture array even when every other texture is streamed.
 	CreateTexture1x1(m_pDevice, makergba(0.0f), &m_tex1x1Black);
-	CreateTexture1x1(m_pDevice, makergba(1.0f), &m_tex1x1White);
+	CreateTexture1x1(m_pDevice, makergba(1.0f), &m_tex1x1White, DXGI_FORMAT_R8G8B8A8_UNORM);
 	CreateTexture1x1(m_pDevice, makergba(0.5f, 0.5f, 1.0f, 0.0f), &m_tex1x1FlatNormal, DXGI_FORMAT_R8G8B8A8_UNORM);
 
+	// Init screenshots: readbacks are polled over the following frames, and encoded and
+	// written on worker threads, so capturing doesn't stall rendering
+	m_imageEncodeQueue.Init(8, 2);
+	m_screenshotCapture.Init(&m_imageEncodeQueue);
+
 	if (!InitCrytekSponza())
 		return false;
 
@@ -572,9 +631,20 @@ bool VRSLIDemo::InitCrytekSponza()
 			pMtl->m_alphaTest = true;
 	}
 
-	// Upload all assets to GPU
+	// Upload all assets to GPU; streamed textures just get their mip tails for now.  Texture
+	// arrays need every slice's whole chain, so streamed textures are uploaded on their own
+	// and viewed as one-slice arrays; the rest, including the fallback 1x1s, are grouped.
 	m_meshCrytekSponza.UploadToGPU(m_pDevice);
-	m_texLibCrytekSponza.UploadAllToGPU(m_pDevice);
+	if (g_streamTextures)
+		m_texStreamerCrytekSponza.Init(m_pCtx, &m_texLibCrytekSponza, i64(g_textureBudgetMB) << 20);
+	Texture2D * apTexFallback[] = { &m_tex1x1White, &m_tex1x1FlatNormal, };
+	m_texArraysCrytekSponza.Init(
+								m_pDevice, &m_texLibCrytekSponza,
+								apTexFallback, dim(apTexFallback),
+								g_textureArrays,
+								g_streamTextures ? &m_texStreamerCrytekSponza : nullptr);
+	m_texArraysCrytekSponza.AssignMaterialSlices(&m_mtlLibCrytekSponza);
+	SortMtlRangesForDrawing();
 
 	// Init the camera
 	m_camCrytekSponza.m_moveSpeed = 3.0f;
@@ -637,6 +707,18 @@ void VRSLIDemo::Shutdown()
 	DeactivateOculusHMD();
 	DeactivateOpenVRHMD();
 
+	// Finish writing any screenshots still in flight
+	if (m_pCtx && !m_screenshotCapture.m_slots.empty())
+	{
+		m_screenshotCapture.Flush(m_pCtx);
+		m_imageEncodeQueue.Flush();
+		ImageEncodeStats stats = m_imageEncodeQueue.GetStats();
+		LOG("Screenshots: %d written, %d failed, %d dropped at capture, %d dropped at encode",
+			stats.m_imagesWritten, stats.m_imagesFailed, m_screenshotCapture.m_capturesDropped, stats.m_imagesDropped);
+	}
+	m_screenshotCapture.Reset();
+	m_imageEncodeQueue.Reset();
+
 	m_rtPreWarpMSAA.Reset();
 	m_dstPreWarpMSAA.Reset();
 	m_rtPreWarp.Reset();
@@ -644,13 +726,16 @@ void VRSLIDemo::Shutdown()
 	m_pRtvPreWarpRaw.release();
 	m_shmp.Reset();
 	m_pVsWorld.release();
+	m_pVsDepth.release();
 	m_pPsSimple.release();
 	m_pPsSimpleAlphaTest.release();
 	m_pPsShadowAlphaTest.release();
 	m_pPsTonemap.release();
 	m_pInputLayout.release();
+	m_pInputLayoutDepth.release();
 	for (int i = 0; i < dim(m_cbFrame); ++i)
 		m_cbFrame[i].Reset();
+	m_cbMaterial.Reset();
 	m_cbDebug.Reset();
 	m_tex1x1Black.Reset();
 	m_tex1x1White.Reset();
@@ -659,6 +744,9 @@ void VRSLIDemo::Shutdown()
 
 	m_meshCrytekSponza.Reset();
 	m_mtlLibCrytekSponza.Reset();
+	m_texStreamerCrytekSponza.Reset();
+	m_texArraysCrytekSponza.Reset();
+	m_aiMtlRangeDrawOrder.clear();
 	m_texLibCrytekSponza.Reset();
 
 	if (m_pMultiGPUDevice)
@@ -754,6 +842,19 @@ void VRSLIDemo::OnRender()
 
 	EnsureRenderTargetsAlloced();
 
+	if (g_streamTextures)
+	{
+		// Request texture mips for the camera position in the mesh's local space
+		float sceneScale = 0.01f;
+		m_texStreamerCrytekSponza.m_budgetBytes = i64(g_textureBudgetMB) << 20;
+		m_texStreamerCrytekSponza.BeginFrame();
+		m_texStreamerCrytekSponza.RequestMeshMips(
+									&m_meshCrytekSponza,
+									m_camCrytekSponza.m_pos * scaling(makefloat3(1.0f / sceneScale)),
+									float(g_dimsPreWarp.y) / 1.5f);
+		m_texStreamerCrytekSponza.Update(m_pCtx);
+	}
+
 	m_gpup.OnFrameStart(m_pCtx);
 	m_pCtx->ClearState();
 	m_pCtx->RSSetState(m_pRsDefault);
@@ -851,6 +952,23 @@ void VRSLIDemo::OnRender()
 		CHECK_OPENVR_WARN(m_pCompositorOpenVRHMD->Submit(vr::Eye_Right, &tex, &bounds));
 	}
 
+	// Capture the frame if recording a sequence; frames are numbered even if dropped, so any
+	// gaps show.  Then hand off any earlier captures the GPU has finished copying.
+	if (g_captureSequence)
+	{
+		if (m_iFrameSequence == 0)
+			CreateDirectory("capture", nullptr);
+		char path[MAX_PATH];
+		sprintf_s(path, "capture/frame_%05d.bmp", m_iFrameSequence);
+		m_screenshotCapture.Capture(m_pCtx, &m_rtPreWarp, path);
+		++m_iFrameSequence;
+	}
+	else
+	{
+		m_iFrameSequence = 0;
+	}
+	m_screenshotCapture.Poll(m_pCtx);
+
 	// Render the main window
 	m_pCtx->ClearRenderTargetView(m_pRtvRaw, makergba(0.0f));
 	m_pCtx->OMSetDepthStencilState(m_pDssNoDepthTest, 0);
@@ -871,62 +989,172 @@ void VRSLIDemo::OnRender()
 		DeactivateOculusHMD();
 }
 
+void VRSLIDemo::SortMtlRangesForDrawing()
+{
+	// Draw ranges that share texture arrays back to back, so the arrays are bound once per run
+	const Mesh * pMesh = &m_meshCrytekSponza;
+	int2 sliceWhite = m_texArraysCrytekSponza.Lookup(&m_tex1x1White);
+	int2 sliceFlatNormal = m_texArraysCrytekSponza.Lookup(&m_tex1x1FlatNormal);
+	auto diffuseSlice = [&](const Material * pMtl) { return (pMtl->m_sliceDiffuseColor.x >= 0) ? pMtl->m_sliceDiffuseColor : sliceWhite; };
+	auto normalSlice = [&](const Material * pMtl) { return (pMtl->m_sliceHeight.x >= 0) ? pMtl->m_sliceHeight : sliceFlatNormal; };
+
+	m_aiMtlRangeDrawOrder.resize(pMesh->m_mtlRanges.size());
+	for (int i = 0, c = int(m_aiMtlRangeDrawOrder.size()); i < c; ++i)
+		m_aiMtlRangeDrawOrder[i] = i;
+	std::stable_sort(m_aiMtlRangeDrawOrder.begin(), m_aiMtlRangeDrawOrder.end(), [&](int a, int b)
+	{
+		const Material * pMtlA = pMesh->m_mtlRanges[a].m_pMtl;
+		const Material * pMtlB = pMesh->m_mtlRanges[b].m_pMtl;
+		if (pMtlA->m_alphaTest != pMtlB->m_alphaTest)
+			return pMtlB->m_alphaTest;
+		int2 diffuseA = diffuseSlice(pMtlA), diffuseB = diffuseSlice(pMtlB);
+		if (diffuseA.x != diffuseB.x)
+			return diffuseA.x < diffuseB.x;
+		return normalSlice(pMtlA).x < normalSlice(pMtlB).x;
+	});
+
+	// Count the SRV binds a color pass makes, before (two per range) and after
+	int bindsBefore = 0;
+	int bindsAfter = 0;
+	int2 arraysBound = makeint2(-1);
+	bool alphaTestBound = false;
+	for (int i = 0, c = int(m_aiMtlRangeDrawOrder.size()); i < c; ++i)
+	{
+		const Material * pMtl = pMesh->m_mtlRanges[m_aiMtlRangeDrawOrder[i]].m_pMtl;
+		if (pMtl->m_alphaTest != alphaTestBound)
+		{
+			arraysBound = makeint2(-1);
+			alphaTestBound = pMtl->m_alphaTest;
+		}
+		int2 arrays = makeint2(diffuseSlice(pMtl).x, normalSlice(pMtl).x);
+		bindsBefore += 2;
+		bindsAfter += int(arrays.x != arraysBound.x) + int(arrays.y != arraysBound.y);
+		arraysBound = arrays;
+	}
+	LOG("Material texture binds per color pass: %d ranges, %d SRV binds, down from %d",
+		int(m_aiMtlRangeDrawOrder.size()), bindsAfter, bindsBefore);
+}
+
+void VRSLIDemo::BindMaterialTextures(const Material * pMtl, bool bindNormal, int2 * pArraysBound, CBMaterial * pCbMaterialBound)
+{
+	ASSERT_ERR(pMtl);
+	ASSERT_ERR(pArraysBound);
+	ASSERT_ERR(pCbMaterialBound);
+
+	int2 sliceDiffuse = pMtl->m_sliceDiffuseColor;
+	if (sliceDiffuse.x < 0)
+		sliceDiffuse = m_texArraysCrytekSponza.Lookup(&m_tex1x1White);
+	int2 sliceNormal = pMtl->m_sliceHeight;
+	if (sliceNormal.x < 0)
+		sliceNormal = m_texArraysCrytekSponza.Lookup(&m_tex1x1FlatNormal);
+
+	// Only rebind the arrays when they change; ranges were sorted to make that rare
+	if (sliceDiffuse.x != pArraysBound->x)
+	{
+		ID3D11ShaderResourceView * pSrvDiffuse = m_texArraysCrytekSponza.GetSrv(m_pDevice, sliceDiffuse.x);
+		m_pCtx->PSSetShaderResources(TEX_DIFFUSE, 1, &pSrvDiffuse);
+		pArraysBound->x = sliceDiffuse.x;
+	}
+	if (bindNormal && sliceNormal.x != pArraysBound->y)
+	{
+		ID3D11ShaderResourceView * pSrvNormal = m_texArraysCrytekSponza.GetSrv(m_pDevice, sliceNormal.x);
+		m_pCtx->PSSetShaderResources(TEX_NORMAL, 1, &pSrvNormal);
+		pArraysBound->y = sliceNormal.x;
+	}
+
+	CBMaterial cbMaterial = { float(sliceDiffuse.y), float(sliceNormal.y), };
+	if (cbMaterial.m_sliceDiffuse != pCbMaterialBound->m_sliceDiffuse ||
+		cbMaterial.m_sliceNormal != pCbMaterialBound->m_sliceNormal)
+	{
+		m_cbMaterial.Update(m_pCtx, &cbMaterial);
+		*pCbMaterialBound = cbMaterial;
+	}
+}
+
 void VRSLIDemo::DrawMaterials(ID3D11PixelShader * pPs, ID3D11PixelShader * pPsAlphaTest)
 {
-	// Draw the individual material ranges of the mesh
+	// Draw the individual material ranges of the mesh, in the order that shares texture arrays
+	m_cbMaterial.Bind(m_pCtx, CB_MATERIAL);
+	CBMaterial cbMaterialBound = { -1.0f, -1.0f, };
 
 	// Non-alpha-tested materials
 	m_pCtx->PSSetShader(pPs, nullptr, 0);
 	m_pCtx->RSSetState(m_pRsDefault);
-	for (int i = 0, c = int(m_meshCrytekSponza.m_mtlRanges.size()); i < c; ++i)
+	int2 arraysBound = makeint2(-1);
+	for (int i = 0, c = int(m_aiMtlRangeDrawOrder.size()); i < c; ++i)
 	{
-		Material * pMtl = m_meshCrytekSponza.m_mtlRanges[i].m_pMtl;
+		int iMtlRange = m_aiMtlRangeDrawOrder[i];
+		Material * pMtl = m_meshCrytekSponza.m_mtlRanges[iMtlRange].m_pMtl;
 		ASSERT_ERR(pMtl);
 
 		if (pMtl->m_alphaTest)
 			continue;
 
 		if (pPs)
-		{
-			ID3D11ShaderResourceView * pSrvDiffuse = m_tex1x1White.m_pSrv;
-			if (Texture2D * pTex = pMtl->m_pTexDiffuseColor)
-				pSrvDiffuse = pTex->m_pSrv;
-			m_pCtx->PSSetShaderResources(TEX_DIFFUSE, 1, &pSrvDiffuse);
-
-			ID3D11ShaderResourceView * pSrvNormal = m_tex1x1FlatNormal.m_pSrv;
-			if (Texture2D * pTex = pMtl->m_pTexHeight)
-				pSrvNormal = pTex->m_pSrv;
-			m_pCtx->PSSetShaderResources(TEX_NORMAL, 1, &pSrvNormal);
-		}
+			BindMaterialTextures(pMtl, true, &arraysBound, &cbMaterialBound);
 
-		m_meshCrytekSponza.DrawMtlRange(m_pCtx, i);
+		m_meshCrytekSponza.DrawMtlRange(m_pCtx, iMtlRange);
 	}
 
 	// Alpha-tested materials
 	m_pCtx->PSSetShader(pPsAlphaTest, nullptr, 0);
 	m_pCtx->RSSetState(m_pRsDoubleSided);
+	arraysBound = makeint2(-1);
+	for (int i = 0, c = int(m_aiMtlRangeDrawOrder.size()); i < c; ++i)
+	{
+		int iMtlRange = m_aiMtlRangeDrawOrder[i];
+		Material * pMtl = m_meshCrytekSponza.m_mtlRanges[iMtlRange].m_pMtl;
+		ASSERT_ERR(pMtl);
+
+		if (!pMtl->m_alphaTest)
+			continue;
+
+		if (pPsAlphaTest)
+			BindMaterialTextures(pMtl, true, &arraysBound, &cbMaterialBound);
+
+		m_meshCrytekSponza.DrawMtlRange(m_pCtx, iMtlRange);
+	}
+}
+
+void VRSLIDemo::DrawMaterialsDepthOnly(ID3D11PixelShader * pPsAlphaTest)
+{
+	// Non-alpha-tested materials only need positions, so draw them from the
+	// mesh's position-only stream with no pixel shader
+	m_pCtx->IASetInputLayout(m_pInputLayoutDepth);
+	m_pCtx->VSSetShader(m_pVsDepth, nullptr, 0);
+	m_pCtx->PSSetShader(nullptr, nullptr, 0);
+	m_pCtx->RSSetState(m_pRsDefault);
 	for (int i = 0, c = int(m_meshCrytekSponza.m_mtlRanges.size()); i < c; ++i)
 	{
 		Material * pMtl = m_meshCrytekSponza.m_mtlRanges[i].m_pMtl;
 		ASSERT_ERR(pMtl);
 
+		if (pMtl->m_alphaTest)
+			continue;
+
+		m_meshCrytekSponza.DrawDepthOnlyMtlRange(m_pCtx, i);
+	}
+
+	// Alpha-tested materials still need UVs, so use the full vertex
+	m_pCtx->IASetInputLayout(m_pInputLayout);
+	m_pCtx->VSSetShader(m_pVsWorld, nullptr, 0);
+	m_pCtx->PSSetShader(pPsAlphaTest, nullptr, 0);
+	m_pCtx->RSSetState(m_pRsDoubleSided);
+	m_cbMaterial.Bind(m_pCtx, CB_MATERIAL);
+	CBMaterial cbMaterialBound = { -1.0f, -1.0f, };
+	int2 arraysBound = makeint2(-1);
+	for (int i = 0, c = int(m_aiMtlRangeDrawOrder.size()); i < c; ++i)
+	{
+		int iMtlRange = m_aiMtlRangeDrawOrder[i];
+		Material * pMtl = m_meshCrytekSponza.m_mtlRanges[iMtlRange].m_pMtl;
+		ASSERT_ERR(pMtl);
+
 		if (!pMtl->m_alphaTest)
 			continue;
 
-		if (pPsAlphaTest)
-		{
-			ID3D11ShaderResourceView * pSrvDiffuse = m_tex1x1White.m_pSrv;
-			if (Texture2D * pTex = pMtl->m_pTexDiffuseColor)
-				pSrvDiffuse = pTex->m_pSrv;
-			m_pCtx->PSSetShaderResources(TEX_DIFFUSE, 1, &pSrvDiffuse);
-
-			ID3D11ShaderResourceView * pSrvNormal = m_tex1x1FlatNormal.m_pSrv;
-			if (Texture2D * pTex = pMtl->m_pTexHeight)
-				pSrvNormal = pTex->m_pSrv;
-			m_pCtx->PSSetShaderResources(TEX_NORMAL, 1, &pSrvNormal);
-		}
+		BindMaterialTextures(pMtl, false, &arraysBound, &cbMaterialBound);
 
-		m_meshCrytekSponza.DrawMtlRange(m_pCtx, i);
+		m_meshCrytekSponza.DrawMtlRange(m_pCtx, iMtlRange);
 	}
 }
 
@@ -1110,7 +1338,6 @@ void VRSLIDemo::RenderShadowMap()
 	if (all(isnear(m_shmp.m_matWorldToClip, matWorldToClipPrev)))
 		return;
 
-	m_pCtx->IASetInputLayout(m_pInputLayout);
 	m_pCtx->OMSetDepthStencilState(m_pDssDepthTest, 0);
 
 	CBFrame cbFrame =
@@ -1123,10 +1350,9 @@ void VRSLIDemo::RenderShadowMap()
 	m_pCtx->ClearDepthStencilView(m_shmp.m_dst.m_pDsv, D3D11_CLEAR_DEPTH, 1.0f, 0);
 	m_shmp.Bind(m_pCtx);
 
-	m_pCtx->VSSetShader(m_pVsWorld, nullptr, 0);
 	m_pCtx->PSSetSamplers(SAMP_DEFAULT, 1, &m_pSsTrilinearRepeatAniso);
 
-	DrawMaterials(nullptr, m_pPsShadowAlphaTest);
+	DrawMaterialsDepthOnly(m_pPsShadowAlphaTest);
 }
 
 void VRSLIDemo::ResetCameras()
@@ -1322,7 +1548,7 @@ void VRSLIDemo::SaveScreenshot(RenderTarget * pRt, const char * suggestedFilenam
 	ofn.lStructSize = sizeof(ofn);
 	ofn.hwndOwner = m_hWnd;
 	ofn.hInstance = m_hInstance;
-	ofn.lpstrFilter = "Bitmap Files (*.bmp)\0*.bmp\0";
+	ofn.lpstrFilter = "Bitmap Files (*.bmp)\0*.bmp\0PNG Files (*.png)\0*.png\0";
 	ofn.nFilterIndex = 1;
 	ofn.lpstrFile = path;
 	ofn.nMaxFile = dim(path);
@@ -1335,7 +1561,9 @@ void VRSLIDemo::SaveScreenshot(RenderTarget * pRt, const char * suggestedFilenam
 		return;
 	}
 
-	CHECK_WARN(WriteRenderTargetToBMP(m_pCtx, pRt, path));
+	// Copy it now; it's read back and written over the next few frames
+	if (!m_screenshotCapture.Capture(m_pCtx, pRt, path))
+		WARN("Couldn't capture screenshot %s: all staging textures are busy", path);
 }
 
 
@@ -36,6 +36,7 @@
 
 void main(
 	in Vertex i_vtx,
+	in Instance i_inst,
 	out Vertex o_vtx,
 	out float3 o_vecCamera : CAMERA,
 	out float4 o_uvzwShadow : UVZW_SHADOW,
@@ -45,10 +46,16 @@ void main(
 #endif
 	)
 {
+	// Instance transforms are rigid, so they can be applied to normals and tangents as-is
+	float3x3 matInstLinear = float3x3(i_inst.m_linear0, i_inst.m_linear1, i_inst.m_linear2);
 	o_vtx = i_vtx;
-	o_vecCamera = g_posCamera - i_vtx.m_pos;
-	o_uvzwShadow = mul(float4(i_vtx.m_pos, 1.0), g_matWorldToUvzwShadow);
-	o_posClip = mul(float4(i_vtx.m_pos, 1.0), g_matWorldToClip);
+	o_vtx.m_pos = mul(i_vtx.m_pos, matInstLinear) + i_inst.m_translation;
+	o_vtx.m_normal = mul(i_vtx.m_normal, matInstLinear);
+	o_vtx.m_tangent.xyz = mul(i_vtx.m_tangent.xyz, matInstLinear);
+
+	o_vecCamera = g_posCamera - o_vtx.m_pos;
+	o_uvzwShadow = mul(float4(o_vtx.m_pos, 1.0), g_matWorldToUvzwShadow);
+	o_posClip = mul(float4(o_vtx.m_pos, 1.0), g_matWorldToClip);
 
 #if DEBUG_COLOR
 	o_rgbDebug = 0.0.xxx;